@@ -0,0 +1,201 @@
+#ifndef RPACK_H
+#define RPACK_H
+
+/* Rectangle packing without Python
+
+Sizes and positions are plain arrays of `2 * length` longs holding
+(width, height) and (x, y) pairs in input order. A negative
+`max_width` or `max_height` means unbounded. The result is the same
+as from rpack.pack() for the same input and any number of threads.
+The functions return RPACK_OK or one of the other RPACK_* status
+codes. On RPACK_IMPOSSIBLE the rectangles that did not fit are at
+position (-1, -1).
+
+Example:
+
+    long sizes[] = { 58, 206, 231, 176, 35, 113, 46, 109 };
+    long positions[8];
+    int status = rpack_pack(sizes, 4, -1, -1, 1, positions);
+    if (status != RPACK_OK) {
+        fprintf(stderr, "%s\n", rpack_strerror(status));
+    }
+
+Link with librpack and -pthread, see the librpack target of the
+Makefile. Sizes beyond long can be packed with the _i128 functions
+below.
+*/
+
+#include <stddef.h>
+
+#define RPACK_OK 0
+#define RPACK_WIDTH_NOT_POSITIVE 1
+#define RPACK_HEIGHT_NOT_POSITIVE 2
+#define RPACK_SUM_WIDTH_OVERFLOW 3
+#define RPACK_SUM_HEIGHT_OVERFLOW 4
+#define RPACK_AREA_OVERFLOW 5
+#define RPACK_SUM_AREA_OVERFLOW 6
+#define RPACK_SIDE_OVERFLOW 7
+#define RPACK_MAX_WIDTH_ZERO 8
+#define RPACK_MAX_WIDTH_TOO_SMALL 9
+#define RPACK_MAX_HEIGHT_ZERO 10
+#define RPACK_MAX_HEIGHT_TOO_SMALL 11
+#define RPACK_IMPOSSIBLE 12
+#define RPACK_NO_MEMORY 13
+#define RPACK_TIME_LIMIT 14
+#define RPACK_POSITION_OVERFLOW 15
+
+/* A packer keeps its grids and buffers between calls. It must not be
+   used by more than one thread at a time. */
+typedef struct packer RpackPacker;
+
+RpackPacker *rpack_packer_new(void);
+void rpack_packer_free(RpackPacker *packer);
+int rpack_packer_pack(RpackPacker *packer, const long *sizes, size_t length,
+                      long max_width, long max_height, size_t threads,
+                      long *positions);
+
+/* With a time limit of `seconds` (negative for none) a packer returns
+   the best packing found when the time is up, and
+   rpack_packer_stopped() returns 1 after such a call. If no packing
+   was found at all, RPACK_TIME_LIMIT is returned. */
+void rpack_packer_set_time_limit(RpackPacker *packer, double seconds);
+int rpack_packer_stopped(const RpackPacker *packer);
+
+/* Counters of the work done by a packer, see rpack_packer_stats() */
+struct rpack_counters {
+    unsigned long long try_packs;     /* packing attempts at a bbox size */
+    unsigned long long placed;        /* rectangles placed by them */
+    unsigned long long resumed;       /* rectangles kept from the last */
+    unsigned long long columns;       /* column cells visited */
+    unsigned long long rows;          /* row cells visited */
+    unsigned long long jumps;         /* jump matrix jumps taken */
+    unsigned long long cuts;          /* row and column cuts */
+    unsigned long long copied;        /* jump matrix elements copied */
+    unsigned long long coarse_steps;  /* coarse height step escalations */
+    unsigned long long refine_probes; /* heights probed by refinement */
+};
+typedef struct rpack_counters RpackCounters;
+
+struct rpack_stats {
+    RpackCounters counters;
+    /* Wall time spent searching each of the four strategies */
+    double strategy_seconds[4];
+};
+typedef struct rpack_stats RpackStats;
+
+/* Counting is off by default. When it is on, the statistics of the
+   last call are returned by rpack_packer_stats(). */
+void rpack_packer_set_stats(RpackPacker *packer, int enable);
+const RpackStats *rpack_packer_stats(const RpackPacker *packer);
+
+/* A packer stops searching once it finds a packing whose area is at
+   most `1 + tolerance` times a lower bound on the area. The default
+   tolerance is 0, stopping only at packings that are provably
+   optimal, which does not change the result. */
+void rpack_packer_set_tolerance(RpackPacker *packer, double tolerance);
+
+/* With `threads` above 1 (the default is 1) a packer searches the four
+   strategies one after another and splits the heights of each search
+   into chunks searched by `threads` threads, which share the best area
+   found. The threads argument of rpack_packer_pack() is then not used.
+   The area found is usually no larger, but the packing differs from
+   the default search and may differ from run to run. */
+void rpack_packer_set_sweep_threads(RpackPacker *packer, size_t threads);
+
+int rpack_pack(const long *sizes, size_t length, long max_width,
+               long max_height, size_t threads, long *positions);
+
+/* rpack_overlapping sets `*first` < `*second` to the first pair of
+   rectangles whose interiors intersect, in the order of a double loop
+   over all pairs, or both to `length` if none do. Rectangles that
+   only touch do not overlap. Takes O(n log n) time, or O(n log^2 n)
+   if some rectangles overlap. */
+int rpack_overlapping(const long *sizes, const long *positions,
+                      size_t length, size_t *first, size_t *second);
+
+/* rpack_bbox_size sets `*width` and `*height` to the size of the box at
+   the origin that encloses the rectangles. rpack_total_area sets
+   `*area` to the sum of the rectangle areas. The packing density is
+   the total area divided by width * height. */
+int rpack_bbox_size(const long *sizes, const long *positions, size_t length,
+                    long *width, long *height);
+int rpack_total_area(const long *sizes, size_t length, long *area);
+
+/* An atlas places rectangles one at a time into a `width` x `height`
+   page, first fit, without moving the ones already placed. An insert
+   costs about one region search of rpack_pack(). rpack_atlas_insert()
+   returns RPACK_IMPOSSIBLE if the rectangle does not fit the page any
+   more, which is left as it was. rpack_atlas_reset() empties the page.
+   rpack_atlas_new() returns NULL if out of memory or if `width` or
+   `height` is not positive. An atlas must not be used by more than one
+   thread at a time. */
+typedef struct atlas RpackAtlas;
+
+RpackAtlas *rpack_atlas_new(long width, long height);
+void rpack_atlas_free(RpackAtlas *atlas);
+int rpack_atlas_insert(RpackAtlas *atlas, long width, long height, long *x,
+                       long *y);
+void rpack_atlas_reset(RpackAtlas *atlas);
+
+/* rpack_pack_bins packs the rectangles into as few `bin_width` x
+   `bin_height` bins as it can in one call. Rectangle `i` is put in bin
+   `bins[i]`, counted from 0, at the position in `positions`, and the
+   number of bins used is stored in `*n_bins`. A rectangle larger than
+   a bin gives RPACK_MAX_WIDTH_TOO_SMALL or RPACK_MAX_HEIGHT_TOO_SMALL. */
+int rpack_pack_bins(const long *sizes, size_t length, long bin_width,
+                    long bin_height, size_t *bins, long *positions,
+                    size_t *n_bins);
+
+const char *rpack_strerror(int status);
+
+/* With GCC and Clang on 64-bit targets the same functions exist for
+   128-bit sizes and positions, with the suffix _i128. They pack inputs
+   whose sides, sums or areas overflow long, exactly and with the same
+   result the long functions would give if long were wide enough. */
+#if defined(__SIZEOF_INT128__)
+#define RPACK_HAVE_INT128 1
+__extension__ typedef __int128 rpack_int128;
+typedef struct packer_i128 RpackPackerI128;
+
+RpackPackerI128 *rpack_packer_new_i128(void);
+void rpack_packer_free_i128(RpackPackerI128 *packer);
+int rpack_packer_pack_i128(RpackPackerI128 *packer,
+                           const rpack_int128 *sizes, size_t length,
+                           rpack_int128 max_width, rpack_int128 max_height,
+                           size_t threads, rpack_int128 *positions);
+void rpack_packer_set_time_limit_i128(RpackPackerI128 *packer,
+                                      double seconds);
+int rpack_packer_stopped_i128(const RpackPackerI128 *packer);
+void rpack_packer_set_stats_i128(RpackPackerI128 *packer, int enable);
+const RpackStats *rpack_packer_stats_i128(const RpackPackerI128 *packer);
+void rpack_packer_set_tolerance_i128(RpackPackerI128 *packer,
+                                     double tolerance);
+void rpack_packer_set_sweep_threads_i128(RpackPackerI128 *packer,
+                                         size_t threads);
+int rpack_pack_i128(const rpack_int128 *sizes, size_t length,
+                    rpack_int128 max_width, rpack_int128 max_height,
+                    size_t threads, rpack_int128 *positions);
+int rpack_overlapping_i128(const rpack_int128 *sizes,
+                           const rpack_int128 *positions, size_t length,
+                           size_t *first, size_t *second);
+int rpack_bbox_size_i128(const rpack_int128 *sizes,
+                         const rpack_int128 *positions, size_t length,
+                         rpack_int128 *width, rpack_int128 *height);
+int rpack_total_area_i128(const rpack_int128 *sizes, size_t length,
+                          rpack_int128 *area);
+typedef struct atlas_i128 RpackAtlasI128;
+
+RpackAtlasI128 *rpack_atlas_new_i128(rpack_int128 width,
+                                     rpack_int128 height);
+void rpack_atlas_free_i128(RpackAtlasI128 *atlas);
+int rpack_atlas_insert_i128(RpackAtlasI128 *atlas, rpack_int128 width,
+                            rpack_int128 height, rpack_int128 *x,
+                            rpack_int128 *y);
+void rpack_atlas_reset_i128(RpackAtlasI128 *atlas);
+int rpack_pack_bins_i128(const rpack_int128 *sizes, size_t length,
+                         rpack_int128 bin_width, rpack_int128 bin_height,
+                         size_t *bins, rpack_int128 *positions,
+                         size_t *n_bins);
+#endif
+
+#endif
@@ -2,85 +2,512 @@
 #define RPACKCORE_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "rpack.h"
+
+// Coord
+/* Sizes, positions and areas are of type Coord, a C long by default.
+   Compiled with RPACK_COORD_I128 or RPACK_COORD_I32, see
+   src/rpackcore_i128.c and src/rpackcore_i32.c, they are 128-bit or
+   32-bit and every external name gets the suffix _i128 or _i32, so
+   that the variants link into the same program. rpack.h declares the
+   public functions of the long and 128-bit variants. The int32
+   variant is internal, packer_pack hands it the inputs that fit. */
+#if defined(RPACK_COORD_I128)
+__extension__ typedef __int128 Coord;
+__extension__ typedef unsigned __int128 UCoord;
+#define COORD_MAX ((Coord) (~(UCoord) 0 >> 1))
+#define COORD_MIN (-COORD_MAX - 1)
+#define RPACK_NAME(name) name##_i128
+#define RpackPacker RpackPackerI128
+#define RpackAtlas RpackAtlasI128
+#elif defined(RPACK_COORD_I32)
+typedef int32_t Coord;
+typedef uint32_t UCoord;
+#define COORD_MAX INT32_MAX
+#define COORD_MIN INT32_MIN
+#define RPACK_NAME(name) name##_i32
+#define RpackPacker RpackPackerI32
+#define RpackAtlas RpackAtlasI32
+#else
+typedef long Coord;
+typedef unsigned long UCoord;
+#define COORD_MAX LONG_MAX
+#define COORD_MIN LONG_MIN
+#endif
+
+#ifdef RPACK_NAME
+#define packer RPACK_NAME(packer)
+#define rectangle RPACK_NAME(rectangle)
+#define start_pos RPACK_NAME(start_pos)
+#define search_shared_init RPACK_NAME(search_shared_init)
+#define search_shared_limit RPACK_NAME(search_shared_limit)
+#define search_shared_offer RPACK_NAME(search_shared_offer)
+#define deadline_now RPACK_NAME(deadline_now)
+#define deadline_init RPACK_NAME(deadline_init)
+#define deadline_expired RPACK_NAME(deadline_expired)
+#define task_run RPACK_NAME(task_run)
+#define task_run_workers RPACK_NAME(task_run_workers)
+#define grid_alloc RPACK_NAME(grid_alloc)
+#define grid_free RPACK_NAME(grid_free)
+#define grid_reserve RPACK_NAME(grid_reserve)
+#define grid_clear RPACK_NAME(grid_clear)
+#define grid_find_region RPACK_NAME(grid_find_region)
+#define grid_split RPACK_NAME(grid_split)
+#define grid_search_bbox RPACK_NAME(grid_search_bbox)
+#define grid_search_bbox_shared RPACK_NAME(grid_search_bbox_shared)
+#define grid_search_bbox_pool RPACK_NAME(grid_search_bbox_pool)
+#define grid_search_bbox_sweep RPACK_NAME(grid_search_bbox_sweep)
+#define rectangle_stats_init RPACK_NAME(rectangle_stats_init)
+#define rectangle_init RPACK_NAME(rectangle_init)
+#define rectangle_bounds RPACK_NAME(rectangle_bounds)
+#define rectangle_bbox RPACK_NAME(rectangle_bbox)
+#define rectangle_order RPACK_NAME(rectangle_order)
+#define rectangle_sort_index RPACK_NAME(rectangle_sort_index)
+#define rectangle_sides_fill RPACK_NAME(rectangle_sides_fill)
+#define rectangle_index_cmp RPACK_NAME(rectangle_index_cmp)
+#define rectangle_width_cmp RPACK_NAME(rectangle_width_cmp)
+#define rectangle_height_cmp RPACK_NAME(rectangle_height_cmp)
+#define rectangle_area_cmp RPACK_NAME(rectangle_area_cmp)
+#define packer_init RPACK_NAME(packer_init)
+#define packer_destroy RPACK_NAME(packer_destroy)
+#define packer_capacity RPACK_NAME(packer_capacity)
+#define packer_pack RPACK_NAME(packer_pack)
+#define rpack_packer_new RPACK_NAME(rpack_packer_new)
+#define rpack_packer_free RPACK_NAME(rpack_packer_free)
+#define rpack_packer_pack RPACK_NAME(rpack_packer_pack)
+#define rpack_packer_set_time_limit RPACK_NAME(rpack_packer_set_time_limit)
+#define rpack_packer_stopped RPACK_NAME(rpack_packer_stopped)
+#define rpack_packer_set_stats RPACK_NAME(rpack_packer_set_stats)
+#define rpack_packer_stats RPACK_NAME(rpack_packer_stats)
+#define rpack_packer_set_tolerance RPACK_NAME(rpack_packer_set_tolerance)
+#define rpack_packer_set_sweep_threads \
+    RPACK_NAME(rpack_packer_set_sweep_threads)
+#define rpack_pack RPACK_NAME(rpack_pack)
+#define rpack_overlapping RPACK_NAME(rpack_overlapping)
+#define rpack_bbox_size RPACK_NAME(rpack_bbox_size)
+#define rpack_total_area RPACK_NAME(rpack_total_area)
+#define atlas RPACK_NAME(atlas)
+#define atlas_init RPACK_NAME(atlas_init)
+#define atlas_destroy RPACK_NAME(atlas_destroy)
+#define atlas_reset RPACK_NAME(atlas_reset)
+#define atlas_insert RPACK_NAME(atlas_insert)
+#define atlas_resize RPACK_NAME(atlas_resize)
+#define bins_init RPACK_NAME(bins_init)
+#define bins_destroy RPACK_NAME(bins_destroy)
+#define bins_pack RPACK_NAME(bins_pack)
+#define rpack_atlas_new RPACK_NAME(rpack_atlas_new)
+#define rpack_atlas_free RPACK_NAME(rpack_atlas_free)
+#define rpack_atlas_insert RPACK_NAME(rpack_atlas_insert)
+#define rpack_atlas_reset RPACK_NAME(rpack_atlas_reset)
+#define rpack_pack_bins RPACK_NAME(rpack_pack_bins)
+#endif
 
 // Cell
+#ifdef RPACK_CELL_SOA
+/* Cells are positions in the CellLink arrays */
+typedef size_t CellRef;
+#define CELL_NONE SIZE_MAX
+#else
 struct cell {
-    long end_pos;
+    Coord end_pos;
     size_t jump_index;
   
     struct cell *prev;
     struct cell *next;
 };
 typedef struct cell Cell;
+typedef Cell *CellRef;
+#define CELL_NONE NULL
 
-long start_pos(const Cell *cell);
+Coord start_pos(const Cell *cell);
+#endif
 
 // CellLink
 struct cell_link {
     size_t size;
-    long end_pos;
+    Coord end_pos;
     size_t jump_index;
+#ifdef RPACK_CELL_SOA
+    Coord *ends;
+    size_t *jumps;
+    size_t *positions;
+#else
     Cell *cells;
     Cell *head;
+#endif
 };
 typedef struct cell_link CellLink;
 
 // JumpMatrix
-typedef Cell ***JumpMatrix;
+typedef uint32_t JumpIndex;
+#define JUMP_FREE ((JumpIndex) 0)
+#define JUMP_COL_FULL ((JumpIndex) UINT32_MAX)
+
+/* Index of the first bit in [from, end) set in both bitsets, or
+   `end` */
+typedef size_t (*BitsScanFunc)(const uint64_t *bits, const uint64_t *mask,
+                               size_t from, size_t end);
+
+struct jump_matrix {
+    size_t size;
+    int wide;
+    size_t elem_size;
+    size_t n_tiles;
+    size_t tiles_allocated;
+    void **tiles;
+    void *data;
+    /* A bit per element, set if it is not JUMP_FREE. One bitset of
+       `n_words` words per column, over slots in spatial order: slot k
+       of the `n_slots` holds row `row_at[k]` if bit k of `live` is
+       set and is a gap otherwise, and `row_pos` maps a row to its
+       slot. */
+    size_t n_words;
+    uint64_t **occupied;
+    uint64_t *occupied_data;
+    size_t n_slots;
+    size_t max_slots;
+    uint64_t *live;
+    size_t *row_at;
+    size_t *row_pos;
+    /* The fastest scan of the CPU, see jump_scan */
+    BitsScanFunc scan;
+};
+typedef struct jump_matrix JumpMatrix;
 
 // Region
 struct region {
-    Cell *row_cell_start;
-    Cell *row_cell;
-    long row_end_pos;
-    Cell *col_cell_start;
-    Cell *col_cell;
-    long col_end_pos;
+    CellRef row_cell_start;
+    CellRef row_cell;
+    Coord row_start_pos;
+    Coord row_end_pos;
+    CellRef col_cell_start;
+    CellRef col_cell;
+    Coord col_start_pos;
+    Coord col_end_pos;
+    int found;
+    /* Row range ends that decided the search, see GridJournal */
+    Coord row_fit_end;
+    Coord row_reject_end;
 };
 typedef struct region Region;
 
 // Rectangle
 struct rectangle {
-    long width;
-    long height;
-    long x;
-    long y;
+    Coord width;
+    Coord height;
+    Coord x;
+    Coord y;
     size_t index;
-    long area;
+    Coord area;
     int wide;
     int rotated;
 };
 typedef struct rectangle Rectangle;
 
+/* The sides of rectangles in separate arrays, read in the order of
+   `order`, see rectangle_order. Positions are stored in `x` and `y`.
+   Swapping `width` with `height` and `x` with `y` rotates them. */
+struct rectangle_sides {
+    const Coord *width;
+    const Coord *height;
+    Coord *x;
+    Coord *y;
+    const size_t *order;
+    size_t length;
+};
+typedef struct rectangle_sides RectangleSides;
+
+#ifndef RPACK_NAME
+/* The Rectangle of the int32 variant */
+struct rectangle_i32 {
+    int32_t width;
+    int32_t height;
+    int32_t x;
+    int32_t y;
+    size_t index;
+    int32_t area;
+    int wide;
+    int rotated;
+};
+#endif
+
+/* Totals and extremes of a set of rectangles, see rectangle_init */
+struct rectangle_stats {
+    Coord sum_width;
+    Coord sum_height;
+    Coord min_width;
+    Coord min_height;
+    Coord max_width;
+    Coord max_height;
+    Coord area;
+};
+typedef struct rectangle_stats RectangleStats;
+
+void rectangle_stats_init(RectangleStats *self);
+int rectangle_init(Rectangle *self, RectangleStats *stats, size_t index,
+                   Coord width, Coord height);
+int rectangle_bounds(const RectangleStats *stats, Coord *max_width,
+                     Coord *max_height);
+int rectangle_bbox(const Rectangle *rectangles, size_t length, Coord *width,
+                   Coord *height);
+void rectangle_order(const Rectangle *rectangles, size_t length,
+                     int by_width, size_t *order, size_t *tmp);
+void rectangle_sort_index(Rectangle *rectangles, size_t length);
+void rectangle_sides_fill(RectangleSides *self, Coord *sides,
+                         const size_t *order, const Rectangle *rectangles,
+                         size_t length);
+int rectangle_index_cmp(const void *a, const void *b);
+int rectangle_width_cmp(const void *a, const void *b);
+int rectangle_height_cmp(const void *a, const void *b);
+int rectangle_area_cmp(const void *a, const void *b);
+
 // BBoxRestrictions
 struct bbox_restrictions {
-    long min_width;
-    long max_width;
-    long min_height;
-    long max_height;
-    long max_area;
+    Coord min_width;
+    Coord max_width;
+    Coord min_height;
+    Coord max_height;
+    Coord max_area;
+    /* A search may stop at a bbox with an area this small */
+    Coord happy_area;
 };
 typedef struct bbox_restrictions BBoxRestrictions;
 
+// SearchShared
+struct search_shared {
+    Coord area;
+    Coord slack;
+    struct search_shared *next;
+#ifdef RPACK_COORD_I128
+    char lock;
+#endif
+};
+typedef struct search_shared SearchShared;
+
+void search_shared_init(SearchShared *self, Coord slack);
+Coord search_shared_limit(SearchShared *self);
+void search_shared_offer(SearchShared *self, Coord area);
+
+// Deadline
+struct deadline {
+    double at;
+    long expired;
+};
+typedef struct deadline Deadline;
+
+double deadline_now(void);
+void deadline_init(Deadline *self, double seconds);
+int deadline_expired(Deadline *self);
+
+// Task
+typedef void (*TaskFunc)(void *arg, size_t index);
+typedef void (*TaskWorkerFunc)(void *arg, size_t worker, size_t index);
+
+void task_run(TaskFunc func, void *arg, size_t n_tasks, size_t n_threads);
+void task_run_workers(TaskWorkerFunc func, void *arg, size_t n_tasks,
+                      size_t n_threads);
+
+// GridJournal
+struct jump_undo {
+    JumpIndex row;
+    JumpIndex col;
+    JumpIndex value;
+};
+typedef struct jump_undo JumpUndo;
+
+struct grid_mark {
+    size_t undo_len;
+    size_t rows;
+    size_t cols;
+    Coord row_fit_end;
+    Coord row_reject_end;
+    Coord bottom;
+    Coord right;
+};
+typedef struct grid_mark GridMark;
+
+struct grid_journal {
+    int recording;
+    Coord width;
+    Coord height;
+    size_t placed;
+    GridMark *marks;
+    JumpUndo *undo;
+    size_t undo_len;
+    size_t undo_size;
+};
+typedef struct grid_journal GridJournal;
+
 // Grid
+typedef RpackCounters GridCounters;
+
 struct grid {
     size_t size;
-    long width;
-    long height;
+    size_t capacity;
+    Coord width;
+    Coord height;
 
     CellLink *cols;
     CellLink *rows;
 
-    JumpMatrix jump_matrix;
+    JumpMatrix *jump_matrix;
+    GridJournal *journal;
+    /* Searches on the grid stop when it passes, may be NULL */
+    Deadline *deadline;
+    /* Work done on the grid, counted if `counting` is set */
+    int counting;
+    GridCounters counters;
 };
 typedef struct grid Grid;
 
-Grid *grid_alloc(size_t size, long width, long height);
+Grid *grid_alloc(size_t size, Coord width, Coord height);
 void grid_free(Grid *grid);
+Grid *grid_reserve(Grid *grid, size_t size);
 void grid_clear(Grid *self);
-long grid_find_region(Grid *grid, const Rectangle *rectangle, Region *reg);
+Coord grid_find_region(Grid *grid, const Rectangle *rectangle, Region *reg);
 int grid_split(Grid *self, Region *reg);
-long grid_search_bbox(Grid *grid, const Rectangle *sizes,
+Coord grid_search_bbox(Grid *grid, const RectangleSides *sizes,
                       const BBoxRestrictions *bbr);
+Coord grid_search_bbox_shared(Grid *grid, const RectangleSides *sizes,
+                             const BBoxRestrictions *bbr,
+                             SearchShared *shared);
+Coord grid_search_bbox_pool(Grid **grids, size_t n_grids,
+                           const RectangleSides *sizes,
+                           const BBoxRestrictions *bbr,
+                           SearchShared *shared);
+Coord grid_search_bbox_sweep(Grid **grids, size_t n_grids,
+                            const RectangleSides *sizes,
+                            const BBoxRestrictions *bbr,
+                            SearchShared *shared);
+
+// Packer
+struct packer {
+    Grid **grids;
+    size_t n_grids;
+    /* The sides and positions of the input, see packer_pack */
+    Coord *sides;
+    size_t sides_size;
+    size_t *orders;
+    size_t orders_size;
+    Rectangle *rectangles;
+    size_t rectangles_size;
+    double time_limit;
+    double tolerance;
+    /* Threads per strategy search, see packer_pack */
+    size_t sweep_threads;
+    int stopped;
+    Deadline deadline;
+    int counting;
+    RpackStats stats;
+#ifndef RPACK_NAME
+    /* The int32 variant and its rectangles, see packer_pack */
+    struct packer_i32 *narrow;
+    struct rectangle_i32 *narrow_rectangles;
+    size_t narrow_size;
+#endif
+};
+typedef struct packer Packer;
+
+void packer_init(Packer *self);
+void packer_destroy(Packer *self);
+size_t packer_capacity(const Packer *self);
+int packer_pack(Packer *self, Rectangle *rectangles, size_t length,
+                Coord max_width, Coord max_height, size_t threads);
+
+// Atlas
+struct atlas {
+    Grid *grid;
+    Coord width;
+    Coord height;
+    /* The rectangles placed since the last reset, in insert order */
+    Rectangle *placed;
+    size_t length;
+    size_t size;
+    /* Set if the grid must be rebuilt from `placed` */
+    int stale;
+};
+typedef struct atlas Atlas;
+
+void atlas_init(Atlas *self, Coord width, Coord height);
+void atlas_destroy(Atlas *self);
+void atlas_reset(Atlas *self);
+int atlas_insert(Atlas *self, Coord width, Coord height, Coord *x,
+                 Coord *y);
+void atlas_resize(Atlas *self, Coord width, Coord height);
+
+// Bins
+struct bin {
+    Atlas atlas;
+    /* Area not covered yet, -1 if the bin area overflows Coord */
+    Coord free_area;
+    /* Set if a `fail_width` x `fail_height` rectangle did not fit */
+    int failed;
+    Coord fail_width;
+    Coord fail_height;
+};
+typedef struct bin Bin;
+
+struct bins {
+    /* `size` bins, kept with their grids between calls */
+    Bin *bins;
+    size_t size;
+    Rectangle *rectangles;
+    size_t rectangles_size;
+    /* Two orders, and the bins and positions of a second pass, of
+       `scratch_size` rectangles */
+    size_t *orders;
+    Coord *positions;
+    size_t *indices;
+    size_t scratch_size;
+};
+typedef struct bins Bins;
+
+void bins_init(Bins *self);
+void bins_destroy(Bins *self);
+int bins_pack(Bins *self, const Coord *sizes, size_t length, Coord width,
+              Coord height, size_t *bins, Coord *positions, size_t *n_bins);
+
+#if !defined(RPACK_NAME) || defined(RPACK_COORD_I32)
+// The int32 variant
+typedef struct packer_i32 RpackPackerI32;
+
+size_t packer_capacity_i32(const RpackPackerI32 *self);
+int packer_pack_i32(RpackPackerI32 *self, struct rectangle_i32 *rectangles,
+                    size_t length, int32_t max_width, int32_t max_height,
+                    size_t threads);
+RpackPackerI32 *rpack_packer_new_i32(void);
+void rpack_packer_free_i32(RpackPackerI32 *packer);
+int rpack_packer_pack_i32(RpackPackerI32 *packer, const int32_t *sizes,
+                          size_t length, int32_t max_width,
+                          int32_t max_height, size_t threads,
+                          int32_t *positions);
+void rpack_packer_set_time_limit_i32(RpackPackerI32 *packer, double seconds);
+int rpack_packer_stopped_i32(const RpackPackerI32 *packer);
+void rpack_packer_set_stats_i32(RpackPackerI32 *packer, int enable);
+const RpackStats *rpack_packer_stats_i32(const RpackPackerI32 *packer);
+void rpack_packer_set_tolerance_i32(RpackPackerI32 *packer, double tolerance);
+void rpack_packer_set_sweep_threads_i32(RpackPackerI32 *packer,
+                                        size_t threads);
+int rpack_pack_i32(const int32_t *sizes, size_t length, int32_t max_width,
+                   int32_t max_height, size_t threads, int32_t *positions);
+int rpack_overlapping_i32(const int32_t *sizes, const int32_t *positions,
+                          size_t length, size_t *first, size_t *second);
+int rpack_bbox_size_i32(const int32_t *sizes, const int32_t *positions,
+                        size_t length, int32_t *width, int32_t *height);
+int rpack_total_area_i32(const int32_t *sizes, size_t length, int32_t *area);
+typedef struct atlas_i32 RpackAtlasI32;
+
+RpackAtlasI32 *rpack_atlas_new_i32(int32_t width, int32_t height);
+void rpack_atlas_free_i32(RpackAtlasI32 *atlas);
+int rpack_atlas_insert_i32(RpackAtlasI32 *atlas, int32_t width,
+                           int32_t height, int32_t *x, int32_t *y);
+void rpack_atlas_reset_i32(RpackAtlasI32 *atlas);
+int rpack_pack_bins_i32(const int32_t *sizes, size_t length,
+                       int32_t bin_width, int32_t bin_height, size_t *bins,
+                       int32_t *positions, size_t *n_bins);
+#endif
 
 #endif
@@ -0,0 +1,320 @@
+/* Benchmark of the complete packing, without Python
+
+Packs rectangles from the distributions of misc/crunch.py and the
+thin-rectangle pathology with fixed seeds, calling packer_pack()
+directly. Each input is packed once to count the work done and then
+REPEAT times to measure the best wall time. For every case the time
+per rectangle, packing attempts per search and mean packing density
+are written as JSON, to stdout or to OUTPUT. Compare two such files
+with misc/benchcmp.py (see the bench target in the Makefile).
+
+Usage: bench [-j THREADS] [-r REPEAT] [-o OUTPUT]
+
+*/
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rpackcore.h"
+
+#ifdef RPACK_CELL_SOA
+#define STORAGE "soa"
+#else
+#define STORAGE "list"
+#endif
+
+/* Random seed fixed - make benchmark repeatable */
+#define SEED 81611
+#define REPEAT 3
+
+/* Width of the thin rectangle of the pathology, its height is 1 */
+#define THIN_WIDTH 936469
+
+enum source { UNIF_SIDE, UNIF_AREA, SQUARE, CIRCUM, THIN };
+
+struct bench_case {
+    const char *name;
+    enum source source;
+    size_t n;
+    long m;
+    size_t samples;
+};
+
+struct bench_result {
+    double seconds;
+    double ns_per_rect;
+    double probes;
+    double density;
+};
+
+static const struct bench_case cases[] = {
+    { "unif_side", UNIF_SIDE, 25, 1000, 20 },
+    { "unif_side", UNIF_SIDE, 50, 1000, 10 },
+    { "unif_side", UNIF_SIDE, 100, 100, 5 },
+    { "unif_area", UNIF_AREA, 50, 1000, 10 },
+    { "unif_area", UNIF_AREA, 100, 1000, 5 },
+    { "square", SQUARE, 100, 100, 1 },
+    { "circum", CIRCUM, 100, 100, 1 },
+    { "thin", THIN, 10, 1000000, 20 },
+};
+
+static double now(void)
+{
+#if defined(_WIN32)
+    return (double) clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#endif
+}
+
+/* Random numbers
+   ==============
+
+   The generator is part of the benchmark so that every platform packs
+   the same rectangles.
+*/
+
+static uint64_t random_state;
+
+static long random_range(long low, long high)
+{
+    uint64_t z = (random_state += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    z ^= z >> 31;
+    return low + (long) (z % (uint64_t) (high - low + 1));
+}
+
+/* Rectangle sources
+   =================
+*/
+
+/* generate writes `bc->n` random (width, height) pairs to `sizes` */
+static void generate(const struct bench_case *bc, long *sizes)
+{
+    size_t i, n = bc->n;
+    long area, width;
+
+    for (i = 0; i < n; i++) {
+        switch (bc->source) {
+        case UNIF_SIDE:
+            sizes[2 * i] = random_range(1, bc->m);
+            sizes[2 * i + 1] = random_range(1, bc->m);
+            break;
+        case UNIF_AREA:
+            area = random_range(1, bc->m);
+            width = random_range(1, area);
+            sizes[2 * i] = width;
+            sizes[2 * i + 1] = area / width;
+            if (random_range(0, 1)) {
+                sizes[2 * i] = area / width;
+                sizes[2 * i + 1] = width;
+            }
+            break;
+        case SQUARE:
+            sizes[2 * i] = (long) (n - i);
+            sizes[2 * i + 1] = (long) (n - i);
+            break;
+        case CIRCUM:
+            sizes[2 * i] = (long) (i + 1);
+            sizes[2 * i + 1] = (long) (n - i);
+            break;
+        case THIN:
+            sizes[2 * i] = i == 0 ? THIN_WIDTH : random_range(1, bc->m);
+            sizes[2 * i + 1] = i == 0 ? 1 : random_range(1, bc->m);
+            break;
+        }
+    }
+}
+
+/* Benchmark
+   =========
+*/
+
+/* pack_sizes packs the `n` pairs of `sizes` into `rectangles`. Return
+   an RPACK_* status. */
+static int
+pack_sizes(Packer * packer, const long *sizes, size_t n,
+           Rectangle * rectangles, RectangleStats * stats, size_t threads)
+{
+    long max_width = -1, max_height = -1;
+    size_t i;
+    int status;
+
+    rectangle_stats_init(stats);
+    for (i = 0; i < n; i++) {
+        status = rectangle_init(&rectangles[i], stats, i, sizes[2 * i],
+                                sizes[2 * i + 1]);
+        if (status != RPACK_OK) {
+            return status;
+        }
+    }
+    status = rectangle_bounds(stats, &max_width, &max_height);
+    if (status != RPACK_OK) {
+        return status;
+    }
+    return packer_pack(packer, rectangles, n, max_width, max_height,
+                       threads);
+}
+
+static double density(const Rectangle * rectangles, size_t n, long area)
+{
+    long width, height;
+    rectangle_bbox(rectangles, n, &width, &height);
+    return (double) area / ((double) width * (double) height);
+}
+
+static int
+bench(Packer * packer, const struct bench_case *bc, size_t threads,
+      int repeat, struct bench_result *result)
+{
+    RectangleStats stats;
+    Rectangle *rectangles;
+    long *sizes;
+    double start, elapsed, best;
+    size_t s;
+    int k, status = RPACK_OK;
+
+    memset(result, 0, sizeof(*result));
+    sizes = malloc(2 * bc->n * sizeof(long));
+    rectangles = malloc(bc->n * sizeof(Rectangle));
+    if (sizes == NULL || rectangles == NULL) {
+        free(sizes);
+        free(rectangles);
+        return RPACK_NO_MEMORY;
+    }
+    for (s = 0; s < bc->samples; s++) {
+        generate(bc, sizes);
+
+        /* Warm up the packer's buffers and count the work */
+        packer->counting = 1;
+        status = pack_sizes(packer, sizes, bc->n, rectangles, &stats,
+                            threads);
+        packer->counting = 0;
+        if (status != RPACK_OK) {
+            break;
+        }
+        result->probes += (double) packer->stats.counters.try_packs;
+        result->density += density(rectangles, bc->n, stats.area);
+
+        best = -1;
+        for (k = 0; k < repeat && status == RPACK_OK; k++) {
+            start = now();
+            status = pack_sizes(packer, sizes, bc->n, rectangles, &stats,
+                                threads);
+            elapsed = now() - start;
+            if (best < 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+        result->seconds += best;
+    }
+    if (status == RPACK_OK) {
+        result->ns_per_rect =
+            result->seconds * 1e9 / (double) (bc->n * bc->samples);
+        result->probes /= (double) bc->samples;
+        result->density /= (double) bc->samples;
+    }
+    free(sizes);
+    free(rectangles);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_cases = sizeof(cases) / sizeof(cases[0]);
+    struct bench_result result;
+    const char *output = NULL;
+    FILE *out = stdout;
+    Packer packer;
+    size_t threads = 1;
+    size_t i;
+    long value;
+    int repeat = REPEAT;
+    int k, status;
+    char *end;
+
+    for (k = 1; k < argc; k++) {
+        if (k + 1 >= argc || argv[k][0] != '-' || argv[k][1] == '\0'
+            || argv[k][2] != '\0') {
+            goto usage;
+        }
+        value = strtol(argv[k + 1], &end, 10);
+        switch (argv[k][1]) {
+        case 'j':
+            if (*end != '\0' || value < 1) {
+                goto usage;
+            }
+            threads = (size_t) value;
+            break;
+        case 'r':
+            if (*end != '\0' || value < 1 || value > 1000) {
+                goto usage;
+            }
+            repeat = (int) value;
+            break;
+        case 'o':
+            output = argv[k + 1];
+            break;
+        default:
+            goto usage;
+        }
+        k++;
+    }
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        perror(output);
+        return 1;
+    }
+
+    packer_init(&packer);
+    fprintf(out, "{\n  \"storage\": \"%s\",\n  \"threads\": %zu,\n"
+            "  \"repeat\": %d,\n  \"seed\": %d,\n  \"cases\": [\n",
+            STORAGE, threads, repeat, SEED);
+    for (i = 0; i < n_cases; i++) {
+        /* Every case has its own seed, adding cases changes no other */
+        random_state = SEED + i;
+        status = bench(&packer, &cases[i], threads, repeat, &result);
+        if (status != RPACK_OK) {
+            fprintf(stderr, "bench: %s n=%zu: %s\n", cases[i].name,
+                    cases[i].n, rpack_strerror(status));
+            packer_destroy(&packer);
+            if (out != stdout) {
+                fclose(out);
+            }
+            return 1;
+        }
+        fprintf(out, "    {\"name\": \"%s\", \"n\": %zu, \"m\": %ld, "
+                "\"samples\": %zu, \"seconds\": %.6f, "
+                "\"ns_per_rect\": %.1f, \"probes\": %.1f, "
+                "\"density\": %.6f}%s\n", cases[i].name, cases[i].n,
+                cases[i].m, cases[i].samples, result.seconds,
+                result.ns_per_rect, result.probes, result.density,
+                i + 1 < n_cases ? "," : "");
+        fflush(out);
+        if (out != stdout) {
+            fprintf(stderr, "%-9s n=%-4zu m=%-7ld %10.1f ns/rect\n",
+                    cases[i].name, cases[i].n, cases[i].m,
+                    result.ns_per_rect);
+        }
+    }
+    fprintf(out, "  ]\n}\n");
+    packer_destroy(&packer);
+    if (out != stdout && fclose(out) != 0) {
+        perror(output);
+        return 1;
+    }
+    return 0;
+
+  usage:
+    fprintf(stderr, "Usage: bench [-j THREADS] [-r REPEAT] [-o OUTPUT]\n");
+    return 2;
+}
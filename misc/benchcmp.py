@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Compare two benchmark results of misc/bench.c
+
+Prints the time per rectangle, packing attempts and density of every
+case of the new result relative to the old one. Exits with status 1 if
+a case got slower than the threshold allows or its density changed.
+
+Example:
+
+    make bench BENCH_OUT=artifacts/bench-old.json
+    (change and rebuild)
+    make bench BENCH_OUT=artifacts/bench-new.json
+    python3 misc/benchcmp.py artifacts/bench-old.json artifacts/bench-new.json
+
+"""
+
+# Built-in
+import argparse
+import json
+import sys
+
+
+def load_cases(path: str):
+    """Return the cases of a benchmark result keyed by (name, n, m)"""
+    with open(path) as fh:
+        result = json.load(fh)
+    return {(c["name"], c["n"], c["m"]): c for c in result["cases"]}
+
+
+def main(args):
+    old = load_cases(args.old)
+    new = load_cases(args.new)
+    failed = False
+    print(f"{'case':<24} {'time':>10} {'probes':>10} {'density':>10}")
+    for key, n in new.items():
+        o = old.get(key)
+        name = "{} n={} m={}".format(*key)
+        if o is None:
+            print(f"{name:<24} {'new':>10}")
+            continue
+        time_ratio = n["ns_per_rect"] / max(o["ns_per_rect"], 1e-9)
+        probe_ratio = n["probes"] / max(o["probes"], 1e-9)
+        flags = []
+        if time_ratio > 1 + args.threshold:
+            flags.append("SLOWER")
+        if abs(n["density"] - o["density"]) > 1e-6:
+            flags.append("DENSITY")
+        failed = failed or bool(flags)
+        print(
+            f"{name:<24} {time_ratio:>10.3f} {probe_ratio:>10.3f} "
+            f"{n['density'] - o['density']:>+10.6f} {' '.join(flags)}"
+        )
+    return 1 if failed else 0
+
+
+PARSER = argparse.ArgumentParser()
+PARSER.add_argument("old", help="Result of the baseline build.")
+PARSER.add_argument("new", help="Result of the build to check.")
+PARSER.add_argument(
+    "--threshold",
+    "-t",
+    type=float,
+    default=0.1,
+    help="Allowed relative slowdown per case (default: %(default)s).",
+)
+
+if __name__ == "__main__":
+    sys.exit(main(PARSER.parse_args()))
@@ -0,0 +1,127 @@
+/* Micro benchmark of the grid cell storage
+
+Packs a set of random rectangles at a single, fixed bounding box
+height and reports the CPU time spent. Build it once with the default
+linked list cells and once with -DRPACK_CELL_SOA to compare the two
+storage layouts (see the cellbench target in the Makefile).
+
+Usage: cellbench [N ...]
+
+*/
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rpackcore.h"
+
+#ifdef RPACK_CELL_SOA
+#define STORAGE "soa"
+#else
+#define STORAGE "list"
+#endif
+
+/* Random seed fixed - make benchmark repeatable */
+#define SEED 81611
+#define SIDE_MAX 100
+#define REPEAT 3
+
+static double bench(size_t n)
+{
+    Rectangle *sizes = NULL;
+    RectangleSides sides;
+    long *buffer = NULL;
+    size_t *order = NULL;
+    Grid *grid = NULL;
+    BBoxRestrictions bbr;
+    double total_area = 0;
+    double best = -1;
+    long max_width = 0;
+    long height;
+    size_t i;
+    int k;
+
+    sizes = calloc(n, sizeof(Rectangle));
+    buffer = malloc(4 * n * sizeof(long));
+    order = malloc(2 * n * sizeof(size_t));
+    if (sizes == NULL || buffer == NULL || order == NULL) {
+        free(sizes);
+        free(buffer);
+        free(order);
+        return -1;
+    }
+    srand(SEED);
+    for (i = 0; i < n; i++) {
+        sizes[i].width = 1 + rand() % SIDE_MAX;
+        sizes[i].height = 1 + rand() % SIDE_MAX;
+        sizes[i].area = sizes[i].width * sizes[i].height;
+        total_area += sizes[i].area;
+        if (sizes[i].width > max_width) {
+            max_width = sizes[i].width;
+        }
+    }
+    /* By decreasing height */
+    rectangle_order(sizes, n, 0, order, &order[n]);
+    rectangle_sides_fill(&sides, buffer, order, sizes, n);
+
+    /* One probe at a slightly loose square-ish height */
+    height = (long)(sqrt(total_area) * 1.2);
+    if (height < sizes[order[0]].height) {
+        height = sizes[order[0]].height;
+    }
+    bbr.min_width = max_width;
+    bbr.max_width = 2 * height;
+    bbr.min_height = height;
+    bbr.max_height = height;
+    bbr.max_area = LONG_MAX;
+    bbr.happy_area = 0;
+
+    grid = grid_alloc(n + 1, 0, 0);
+    if (grid == NULL) {
+        free(sizes);
+        free(buffer);
+        free(order);
+        return -1;
+    }
+    for (k = 0; k < REPEAT; k++) {
+        clock_t start = clock();
+        if (grid_search_bbox(grid, &sides, &bbr) < 0) {
+            best = -1;
+            break;
+        }
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    grid_free(grid);
+    free(sizes);
+    free(buffer);
+    free(order);
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t default_sizes[] = { 1000, 2000, 5000, 10000 };
+    size_t n_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    size_t i, n;
+    double t;
+
+    if (argc > 1) {
+        n_sizes = (size_t)argc - 1;
+    }
+    for (i = 0; i < n_sizes; i++) {
+        n = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : default_sizes[i];
+        t = bench(n);
+        if (t < 0) {
+            fprintf(stderr, "%s: n=%zu failed\n", STORAGE, n);
+            return 1;
+        }
+        printf("%-4s n=%-6zu %8.3f s\n", STORAGE, n, t);
+        fflush(stdout);
+    }
+    return 0;
+}
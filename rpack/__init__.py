@@ -6,6 +6,11 @@ The result is a list of ``(x, y)`` lower-left coordinates in input order.
 Public API:
 
 * :func:`pack`: Compute non-overlapping positions with small enclosing area.
+* :func:`pack_many`: Pack many independent sets of rectangles in one call.
+* :class:`Packer`: Pack repeatedly, reusing the internal storage.
+* :class:`PackStats`: Counters of the work done by :func:`pack`.
+* :class:`PackCache`: Cache of packing results, shared by calls of
+  :func:`pack` that pack the same sizes in any order.
 * :exc:`PackingImpossibleError`: Raised when given size constraints are
   impossible to satisfy.
 * :func:`bbox_size` / :data:`enclosing_size`: Compute enclosing box dimensions
@@ -31,7 +36,7 @@ __url__ = "https://github.com/Penlect/rectangle-packer"
 __version__ = "2.0.6"
 
 # Built-in
-from typing import Iterable, List, Tuple
+from typing import Iterable, List, Optional, Tuple
 
 # Local modules
 from rpack._bigint_fallback import (
@@ -46,11 +51,17 @@ from rpack._bigint_fallback import (
 from rpack._bigint_fallback import (
     packing_density_with_bigint_fallback as _packing_density_with_bigint_fallback,
 )
+from rpack._cache import CacheStats, PackCache
 
 # Extension modules
 from rpack._core import (
-    pack as _pack,
+    Atlas as _Atlas,
+    pack_many as _pack_many,
+    pack_bins as _pack_bins,
+    Packer as _Packer,
+    PackStats,
     PackingImpossibleError,
+    PositionOverflowError as _PositionOverflowError,
     bbox_size as _core_bbox_size,
     packing_density as _core_packing_density,
     overlapping as _core_overlapping,
@@ -58,7 +69,14 @@ from rpack._core import (
 
 __all__ = [
     "pack",
+    "pack_many",
+    "pack_bins",
+    "Packer",
+    "Atlas",
+    "PackStats",
     "PackingImpossibleError",
+    "PackCache",
+    "CacheStats",
     "bbox_size",
     "enclosing_size",
     "packing_density",
@@ -90,8 +108,40 @@ def overlapping(sizes, positions):
 enclosing_size = bbox_size
 
 
+def _is_buffer(obj) -> bool:
+    try:
+        memoryview(obj)
+    except TypeError:
+        return False
+    return True
+
+
+def _store_positions(positions, sizes, out):
+    """Write fallback positions to `out`, or a new buffer like `sizes`."""
+    if out is None:
+        view = memoryview(sizes)
+        fmt = "i" if view.itemsize == 4 else "q"
+        data = bytearray(len(positions) * 2 * view.itemsize)
+        out = memoryview(data).cast(fmt, (len(positions), 2))
+    if memoryview(out).itemsize == 4:
+        limit = (1 << 31) - 1
+        if any(x > limit or y > limit for x, y in positions):
+            raise _PositionOverflowError("Position does not fit the int32 out buffer")
+    for i, (x, y) in enumerate(positions):
+        out[i, 0] = x
+        out[i, 1] = y
+    return out
+
+
 def pack(
-    sizes: Iterable[Tuple[int, int]], max_width=None, max_height=None
+    sizes: Iterable[Tuple[int, int]],
+    max_width=None,
+    max_height=None,
+    threads=1,
+    out=None,
+    time_limit=None,
+    tolerance=0.0,
+    cache=None,
 ) -> List[Tuple[int, int]]:
     """Pack rectangles into a bounding box with minimal area.
 
@@ -102,7 +152,9 @@ def pack(
     The helper function :py:func:`bbox_size` can be used to compute
     the width and height of the resulting bounding box.  And
     :py:func:`packing_density` can be used to evaluate the packing
-    quality.
+    quality.  A :py:class:`Packer` also tells both, computed from the
+    packed rectangles without reading the positions back, and whether
+    the ``time_limit`` ran out and how much work the search did.
 
     The algorithm will sort the input in different ways internally so
     there is no need to sort ``sizes`` in advance.
@@ -112,12 +164,16 @@ def pack(
     this becomes a problem, you might need to implement your own
     `divide-and-conquer algorithm`_.
 
-    Very large Python integers are supported through a fallback path:
-    first exact axis-wise ``gcd`` reduction is attempted, and if the
-    instance still does not fit C ``long`` bookkeeping, a conservative
-    power-of-two scaling approximation is used.  This approximation is
-    safe (no overlaps when scaled back) but can produce false negatives
-    under strict ``max_width``/``max_height`` constraints.
+    Very large Python integers are supported.  If the sizes, their
+    sums or areas do not fit C ``long``, they are packed with 128-bit
+    integers, exactly and with the same result as if ``long`` were wide
+    enough, on platforms whose compiler has them (GCC and Clang).
+    Beyond 128 bits, or without them, a fallback path is taken: first
+    exact axis-wise ``gcd`` reduction is attempted, and if the instance
+    still does not fit, a conservative power-of-two scaling
+    approximation is used.  This approximation is safe (no overlaps
+    when scaled back) but can produce false negatives under strict
+    ``max_width``/``max_height`` constraints.
 
     **Example**::
 
@@ -150,21 +206,518 @@ def pack(
         :py:exc:`rpack.PackingImpossibleError` will be raised.
     :type max_height: Union[None, int]
 
-    :return: List of positions (x, y) of the input rectangles.
-    :rtype: List[Tuple[int, int]]
+    :param threads: Number of threads used to search the packing
+        strategies concurrently.  Each thread works on its own copy of
+        the internal grid, so memory use grows with the number of
+        threads.  The result is the same for any thread count.
+    :type threads: int
+
+    :param out: Buffer of shape (n, 2) and type int32 or int64, e.g. a
+        NumPy array, to write the positions to.  It is returned instead
+        of a list.  :py:exc:`OverflowError` is raised if a position
+        does not fit an int32 buffer.
+    :type out: Union[None, Buffer]
+
+    :param time_limit: Seconds the search may take.  When they run
+        out, the remaining probes and strategies are skipped and the
+        best packing found so far is returned, which may be less dense
+        than without a limit, see :py:attr:`Packer.stopped_early`.  If
+        no packing at all was found in time, :py:exc:`TimeoutError` is
+        raised.  The fallback path beyond 128-bit integers ignores the
+        limit.
+    :type time_limit: Union[None, float]
+
+    :param tolerance: Accept a packing whose area is at most ``1 +
+        tolerance`` times a lower bound on the area, e.g. 0.02 for 2%.
+        The search and the remaining strategies then stop, trading
+        density for speed.  The bound combines the total area of the
+        rectangles, the widest and highest rectangle, the rectangles
+        that must be stacked because they are wider than half of
+        ``max_width`` (or placed side by side because they are taller
+        than half of ``max_height``) and the area spread over
+        ``max_width`` or ``max_height``.  With the default 0 the
+        search only stops early at a provably optimal area, which
+        doesn't change the result.
+    :type tolerance: float
+
+    :param cache: Results of earlier calls, see :py:class:`PackCache`.
+        If the same sizes, in any order, were packed with the same
+        ``max_width``, ``max_height`` and ``tolerance``, the search is
+        skipped and the stored positions are returned in the order of
+        ``sizes``.  The result is the same as without the cache.
+    :type cache: Union[None, PackCache]
+
+    :return: List of positions (x, y) of the input rectangles.  If
+        ``sizes`` is an (n, 2) int32 or int64 buffer, such as a NumPy
+        array, the sizes are read from it directly and the positions
+        are returned in ``out``, or in a new :py:class:`memoryview` of
+        the same integer type, which ``numpy.asarray`` wraps without
+        copying.
+    :rtype: Union[List[Tuple[int, int]], Buffer]
     """
+    positions, _ = _pack_checked(
+        _Packer(),
+        sizes,
+        max_width,
+        max_height,
+        threads,
+        out,
+        time_limit,
+        tolerance,
+        False,
+        cache,
+    )
+    return positions
+
+
+def _check_arguments(max_width, max_height, threads, time_limit=None, tolerance=0.0):
     if max_width is not None and not isinstance(max_width, int):
         raise TypeError("max_width must be an integer")
     if max_height is not None and not isinstance(max_height, int):
         raise TypeError("max_height must be an integer")
-    if not isinstance(sizes, list):
+    if not isinstance(threads, int):
+        raise TypeError("threads must be an integer")
+    if threads < 1:
+        raise ValueError("threads must be at least 1")
+    if time_limit is not None:
+        if isinstance(time_limit, bool) or not isinstance(time_limit, (int, float)):
+            raise TypeError("time_limit must be a number")
+        if not time_limit >= 0:
+            raise ValueError("time_limit must not be negative")
+    if isinstance(tolerance, bool) or not isinstance(tolerance, (int, float)):
+        raise TypeError("tolerance must be a number")
+    if not tolerance >= 0:
+        raise ValueError("tolerance must not be negative")
+
+
+def _pack_checked(
+    core_packer,
+    sizes,
+    max_width,
+    max_height,
+    threads,
+    out,
+    time_limit=None,
+    tolerance=0.0,
+    count=False,
+    cache=None,
+):
+    """Check the arguments and pack `sizes` with `core_packer`.
+
+    Return the positions and whether they were taken from `cache`.
+    """
+    _check_arguments(max_width, max_height, threads, time_limit, tolerance)
+    if cache is not None and not isinstance(cache, PackCache):
+        raise TypeError("cache must be a PackCache")
+    is_buffer = _is_buffer(sizes)
+    if cache is not None and not is_buffer and not isinstance(sizes, list):
+        sizes = list(sizes)
+    key = order = cached = None
+    if cache is not None:
+        key, order = _cache_key(cache, sizes, max_width, max_height, tolerance)
+    if key is not None:
+        cached = cache.get(key)
+    if cached is not None:
+        # Skip the search, the result is that of a complete one
+        positions = [None] * len(order)
+        for k, i in enumerate(order):
+            positions[i] = cached[k]
+        if is_buffer or out is not None:
+            positions = _store_positions(
+                positions, sizes if is_buffer else None, out
+            )
+    else:
+        positions = _pack_core(
+            core_packer,
+            sizes,
+            max_width,
+            max_height,
+            threads,
+            out,
+            -1 if time_limit is None else time_limit,
+            tolerance,
+            count,
+        )
+        complete = time_limit is None or not core_packer.stopped_early
+        if key is not None and complete:
+            rows = positions
+            if _is_buffer(positions):
+                rows = memoryview(positions).tolist()
+            cache.put(key, [tuple(rows[i]) for i in order])
+    return positions, cached is not None
+
+
+def _cache_key(cache, sizes, max_width, max_height, tolerance):
+    """Return the key and canonical order of `sizes`, see PackCache."""
+    rows = memoryview(sizes).tolist() if _is_buffer(sizes) else sizes
+    mw = -1 if max_width is None or max_width < 0 else max_width
+    mh = -1 if max_height is None or max_height < 0 else max_height
+    try:
+        return cache.key(rows, mw, mh, tolerance)
+    except TypeError:
+        # Sizes that can't be sorted are reported by the packing
+        return None, None
+
+
+def _metrics(sizes, positions):
+    """Return the bounding box size and density of a packing."""
+    if len(positions) == 0:
+        return (0, 0), 0.0
+    # Packed with 128-bit coordinates, the fallback or taken from a cache
+    return bbox_size(sizes, positions), packing_density(sizes, positions)
+
+
+def _pack_core(
+    core_packer,
+    sizes,
+    max_width,
+    max_height,
+    threads,
+    out,
+    time_limit,
+    tolerance,
+    count,
+):
+    is_buffer = _is_buffer(sizes)
+    if not is_buffer and not isinstance(sizes, list):
         sizes = list(sizes)
     mw = -1 if max_width is None else max_width
     mh = -1 if max_height is None else max_height
     try:
-        return _pack(sizes, mw, mh)
+        return core_packer.pack(
+            sizes, mw, mh, threads, out, time_limit, tolerance, count
+        )
+    except _PositionOverflowError:
+        # The sizes were packed, only the out buffer is too narrow
+        raise
     except OverflowError:
-        # For instances that overflow C long bookkeeping, retry by first
-        # applying exact axis-wise gcd reduction, and then (if still needed)
-        # a conservative ceil-based power-of-two approximation.
-        return _pack_with_bigint_fallback(sizes, max_width, max_height)
+        pass
+    # Instances that overflow C long bookkeeping are packed natively
+    # with 128-bit coordinates.  If they overflow those too, retry by
+    # first applying exact axis-wise gcd reduction, and then (if still
+    # needed) a conservative ceil-based power-of-two approximation.
+    sizes_list = memoryview(sizes).tolist() if is_buffer else sizes
+    try:
+        positions = core_packer.pack_wide(
+            sizes_list, mw, mh, threads, time_limit, tolerance, count
+        )
+    except OverflowError:
+        positions = _pack_with_bigint_fallback(
+            sizes_list, max_width, max_height, threads
+        )
+    if not is_buffer and out is None:
+        return positions
+    return _store_positions(positions, sizes if is_buffer else None, out)
+
+
+def _as_sizes(sizes):
+    if _is_buffer(sizes) or isinstance(sizes, list):
+        return sizes
+    try:
+        return list(sizes)
+    except TypeError:
+        # Reported for this set by the native code
+        return sizes
+
+
+def pack_many(
+    sets: Iterable[Iterable[Tuple[int, int]]],
+    max_width=None,
+    max_height=None,
+    threads=1,
+) -> List[object]:
+    """Pack many independent sets of rectangles.
+
+    Each set is packed exactly as :py:func:`pack` would pack it, but
+    all sets are validated up front and then packed in a single call
+    that releases the GIL.  This removes the per-call overhead when
+    there are thousands of small sets, e.g. one per texture atlas page
+    or per document.
+
+    **Example**::
+
+        >>> import rpack
+        >>> rpack.pack_many([[(2, 1), (1, 1)], [(3, 3)], [(0, 1)]])
+        [[(0, 0), (2, 0)], [(0, 0)], ValueError('Rectangle width must be positive integer')]
+
+    :param sets: Sets of "(width, height)" to pack.  A set may also be
+        an (n, 2) int32 or int64 buffer, its positions are then
+        returned in a buffer of the same type, see :py:func:`pack`.
+    :type sets: Iterable[Iterable[Tuple[int, int]]]
+
+    :param max_width: Maximum width of every enclosing rectangle, see
+        :py:func:`pack`.
+    :type max_width: Union[None, int]
+
+    :param max_height: Maximum height of every enclosing rectangle,
+        see :py:func:`pack`.
+    :type max_height: Union[None, int]
+
+    :param threads: Number of threads packing the sets.  Each thread
+        packs whole sets and reuses its internal grid between them.
+        The results are the same for any thread count.
+    :type threads: int
+
+    :return: One entry per set, in input order: the positions of the
+        set, or the exception :py:func:`pack` would have raised for it,
+        e.g. :py:exc:`rpack.PackingImpossibleError`.  Errors are
+        returned, not raised, so one bad set doesn't discard the rest.
+    :rtype: List[Union[List[Tuple[int, int]], Buffer, Exception]]
+    """
+    _check_arguments(max_width, max_height, threads)
+    sets = [_as_sizes(sizes) for sizes in sets]
+    mw = -1 if max_width is None else max_width
+    mh = -1 if max_height is None else max_height
+    try:
+        results = _pack_many(sets, mw, mh, threads)
+    except OverflowError as error:
+        results = [error] * len(sets)
+    for k, result in enumerate(results):
+        if isinstance(result, OverflowError):
+            # Sets that overflow C long take the 128-bit path of pack()
+            try:
+                results[k] = pack(sets[k], max_width, max_height)
+            except Exception as error:
+                results[k] = error
+    return results
+
+
+def pack_bins(
+    sizes: Iterable[Tuple[int, int]], bin_width: int, bin_height: int
+) -> List[Tuple[int, int, int]]:
+    """Pack rectangles into as few bins of a fixed size as possible.
+
+    Where :py:func:`pack` raises :py:class:`PackingImpossibleError` if
+    the rectangles don't fit ``max_width`` and ``max_height``, this
+    opens as many ``bin_width`` x ``bin_height`` bins as needed, e.g.
+    the pages of a texture atlas.  The rectangles are placed in one
+    call, without the GIL, in order of decreasing height, each into the
+    first bin with room for it.  Unless that reaches a lower bound on
+    the number of bins, they are placed once more in order of
+    decreasing width and the result with fewer bins is returned.
+
+    **Example**::
+
+        >>> import rpack
+        >>> rpack.pack_bins([(6, 4), (6, 4), (4, 4)], 10, 4)
+        [(0, 0, 0), (1, 0, 0), (0, 6, 0)]
+
+    :param sizes: List of rectangle sizes (width, height), or an
+        (n, 2) int32 or int64 buffer.
+    :type sizes: List[Tuple[int, int]]
+
+    :param bin_width: Width of each bin.
+    :type bin_width: int
+
+    :param bin_height: Height of each bin.
+    :type bin_height: int
+
+    :return: ``(bin, x, y)`` of each rectangle, bins counted from 0.
+    :rtype: List[Tuple[int, int, int]]
+
+    :raises PackingImpossibleError: If a rectangle is wider or higher
+        than a bin.
+    """
+    if not isinstance(bin_width, int) or not isinstance(bin_height, int):
+        raise TypeError("bin_width and bin_height must be integers")
+    if bin_width <= 0 or bin_height <= 0:
+        raise ValueError("bin_width and bin_height must be positive")
+    return _pack_bins(sizes, bin_width, bin_height)
+
+
+class Packer:
+    """Pack rectangles repeatedly, reusing the internal storage.
+
+    Each call to :py:func:`pack` allocates an internal grid, whose size
+    grows quadratically with the number of rectangles, and a buffer
+    for the rectangles.  A :py:class:`Packer` keeps both between calls
+    and only grows them, geometrically, when an input has more
+    rectangles than any before it.  This helps when packing again and
+    again, e.g. once per frame.
+
+    A packer also tells more about its last packing than the positions
+    :py:func:`pack` returns, see :py:attr:`stopped_early`,
+    :py:attr:`stats` and :py:attr:`metrics`.
+
+    A packer must not be used from several threads at the same time.
+    Use one packer per thread instead.
+
+    With ``sweep_threads`` above 1 the four strategies are searched one
+    after another, and the heights of each search are split into that
+    many chunks, searched concurrently with a shared best area.  The
+    ``threads`` argument of :py:meth:`pack` is then not used.  The area
+    is usually no larger than that of :py:func:`pack`, but the packing
+    is not the same and may differ from call to call, so a ``cache``
+    can't be used with it.
+
+    **Example**::
+
+        >>> import rpack
+        >>> packer = rpack.Packer()
+        >>> packer.pack([(58, 206), (231, 176), (35, 113), (46, 109)])
+        [(0, 0), (58, 0), (289, 0), (289, 113)]
+        >>> packer.metrics
+        ((335, 222), 0.8279279279279279)
+    """
+
+    def __init__(self, sweep_threads=1):
+        if not isinstance(sweep_threads, int):
+            raise TypeError("sweep_threads must be an integer")
+        if sweep_threads < 1:
+            raise ValueError("sweep_threads must be at least 1")
+        self._packer = _Packer()
+        self._packer.sweep_threads = sweep_threads
+        # Sizes, positions and whether they came from a cache
+        self._last = None
+
+    @property
+    def capacity(self) -> int:
+        """Number of rectangles that can be packed without allocating."""
+        return self._packer.capacity
+
+    def pack(
+        self,
+        sizes: Iterable[Tuple[int, int]],
+        max_width=None,
+        max_height=None,
+        threads=1,
+        out=None,
+        time_limit=None,
+        tolerance=0.0,
+        stats=False,
+        cache=None,
+    ) -> List[Tuple[int, int]]:
+        """Pack rectangles, same arguments and result as :py:func:`pack`.
+
+        :param stats: Count the work done by the search, e.g. the
+            packing attempts and grid cells visited, and time each
+            strategy, see :py:attr:`stats`.  Counting costs little but
+            is off by default.
+        :type stats: bool
+        """
+        self._last = None
+        if cache is not None and self._packer.sweep_threads > 1:
+            raise ValueError("cache can't be used with sweep_threads")
+        sizes = _as_sizes(sizes)
+        positions, cached = _pack_checked(
+            self._packer,
+            sizes,
+            max_width,
+            max_height,
+            threads,
+            out,
+            time_limit,
+            tolerance,
+            bool(stats),
+            cache,
+        )
+        self._last = (sizes, positions, cached)
+        return positions
+
+    @property
+    def stopped_early(self) -> bool:
+        """True if the ``time_limit`` of the last packing ran out.
+
+        The positions are then the best packing found in time, which
+        may be less dense than without a limit.
+        """
+        if self._last is None or self._last[2]:
+            return False
+        return self._packer.stopped_early
+
+    @property
+    def stats(self) -> Optional[PackStats]:
+        """:py:class:`PackStats` of the last packing, with ``stats=True``.
+
+        None without ``stats``, if ``sizes`` was empty, was taken from
+        a cache or took the fallback path beyond 128-bit integers.
+        """
+        if self._last is None or self._last[2]:
+            return None
+        return self._packer.stats
+
+    @property
+    def metrics(self) -> Optional[Tuple[Tuple[int, int], float]]:
+        """Bounding box and density of the last packing.
+
+        ``((width, height), density)``, see :py:func:`bbox_size` and
+        :py:func:`packing_density`.  Computed in C from the packed
+        rectangles, whose total area is already known, when possible.
+        The density of an empty input is 0.0.  None before the first
+        packing.
+        """
+        if self._last is None:
+            return None
+        sizes, positions, cached = self._last
+        packed = None if cached else self._packer.metrics
+        return packed or _metrics(sizes, positions)
+
+
+class Atlas:
+    """Insert rectangles one at a time into a page of fixed size.
+
+    Where :py:func:`pack` searches for the smallest bounding box of a
+    whole set, an atlas places each rectangle when it is inserted, at
+    the first free region of a ``width`` x ``height`` page, and never
+    moves it again.  This suits a texture or glyph atlas that is
+    filled at runtime.  The page is kept between inserts, so an insert
+    costs about one region search of :py:func:`pack`.
+
+    An atlas must not be used from several threads at the same time.
+
+    **Example**::
+
+        >>> import rpack
+        >>> atlas = rpack.Atlas(64, 32)
+        >>> atlas.insert(32, 32)
+        (0, 0)
+        >>> atlas.insert(32, 16)
+        (32, 0)
+        >>> atlas.insert(48, 8) is None
+        True
+
+    :param width: Width of the page.
+    :type width: int
+
+    :param height: Height of the page.
+    :type height: int
+
+    :raises ValueError: If `width` or `height` is not positive.
+    """
+
+    def __init__(self, width: int, height: int):
+        if not isinstance(width, int) or not isinstance(height, int):
+            raise TypeError("width and height must be integers")
+        self._atlas = _Atlas(width, height)
+
+    def __len__(self) -> int:
+        return len(self._atlas)
+
+    @property
+    def width(self) -> int:
+        """Width of the page."""
+        return self._atlas.width
+
+    @property
+    def height(self) -> int:
+        """Height of the page."""
+        return self._atlas.height
+
+    def insert(self, width: int, height: int) -> Optional[Tuple[int, int]]:
+        """Place a rectangle and return its position.
+
+        :return: Position (x, y) of the rectangle, or None if the page
+            has no free region left that can contain it.  The page is
+            then left as it was, so smaller rectangles may still fit.
+
+        :raises ValueError: If `width` or `height` is not positive.
+        """
+        if not isinstance(width, int) or not isinstance(height, int):
+            raise TypeError("width and height must be integers")
+        if width > 0 and height > 0 and (width > self.width or height > self.height):
+            return None
+        return self._atlas.insert(width, height)
+
+    def reset(self):
+        """Remove all rectangles from the page, keeping the storage."""
+        self._atlas.reset()
@@ -20,6 +20,7 @@ import ctypes
 import math
 from typing import Iterable, List, Optional, Sequence, Tuple
 
+from rpack._core import overlapping as _overlapping
 from rpack._core import pack as _pack
 from rpack._core import PackingImpossibleError
 
@@ -323,6 +324,7 @@ def pack_with_bigint_fallback(
     sizes: Sizes,
     max_width: Optional[int],
     max_height: Optional[int],
+    threads: int = 1,
 ) -> Positions:
     """Pack rectangles through the bigint fallback pipeline."""
     normalized_sizes = _validate_sizes_for_bigint_fallback(sizes)
@@ -385,6 +387,7 @@ def pack_with_bigint_fallback(
                 scaled_sizes,
                 _bound_arg(scaled_max_width),
                 _bound_arg(scaled_max_height),
+                threads,
             )
         except OverflowError:
             # Defensive retry: if the C core reports overflow, increase the
@@ -439,20 +442,28 @@ def overlapping_with_bigint_fallback(
     sizes: Sequence[Size],
     positions: Sequence[Position],
 ) -> Optional[Tuple[int, int]]:
-    """Python-int fallback for :func:`rpack.overlapping`."""
+    """Python-int fallback for :func:`rpack.overlapping`.
+
+    Whether rectangles overlap depends only on the order of their edges.
+    The edges are replaced by their ranks, which fit in C ``long``, and
+    the native sweep finds the same pair as for the original values.
+    """
     validated_sizes, validated_positions = _validate_and_materialize_helper_inputs(
         sizes,
         positions,
     )
-    n = len(validated_sizes)
-    for i in range(n):
-        width_1, height_1 = validated_sizes[i]
-        x_1, y_1 = validated_positions[i]
-        for j in range(i + 1, n):
-            width_2, height_2 = validated_sizes[j]
-            x_2, y_2 = validated_positions[j]
-            disjoint_in_x = (x_1 + width_1 <= x_2 or x_2 + width_2 <= x_1)
-            disjoint_in_y = (y_1 + height_1 <= y_2 or y_2 + height_2 <= y_1)
-            if not (disjoint_in_x or disjoint_in_y):
-                return (i, j)
-    return None
+    edges_x = set()
+    edges_y = set()
+    for (width, height), (x, y) in zip(validated_sizes, validated_positions):
+        edges_x.update((x, x + width))
+        edges_y.update((y, y + height))
+    rank_x = {edge: rank for rank, edge in enumerate(sorted(edges_x))}
+    rank_y = {edge: rank for rank, edge in enumerate(sorted(edges_y))}
+    ranked_sizes = []
+    ranked_positions = []
+    for (width, height), (x, y) in zip(validated_sizes, validated_positions):
+        ranked_sizes.append(
+            (rank_x[x + width] - rank_x[x], rank_y[y + height] - rank_y[y])
+        )
+        ranked_positions.append((rank_x[x], rank_y[y]))
+    return _overlapping(ranked_sizes, ranked_positions)
@@ -0,0 +1,283 @@
+"""Cache of packing results for :func:`rpack.pack`.
+
+The packing of a set of rectangles does not depend on their order:
+rectangles are sorted internally and identical ones are interchangeable.
+A result is therefore stored once per multiset of sizes, with the
+positions in canonical order, sizes sorted and ties broken by input
+index, and mapped back to the order of each input that hits it.
+
+The key is a hash of the sorted sizes and the arguments that change
+the result, ``max_width``, ``max_height`` and ``tolerance``.  Results of
+searches that ran out of time are not cached.
+
+The optional cache file is a header followed by records, appended by
+any number of processes and read through a memory map::
+
+    header: b"RPACKC01"
+    record: b"RPCK" | key (16 bytes) | n (u64) | crc32 (u32)
+            | pad (u32) | 2 * n int64 positions
+
+Integers are little-endian.  A record that is torn or fails its
+checksum, e.g. after a crash, is skipped up to the next record magic.
+"""
+
+# Built-in
+import array
+import collections
+import hashlib
+import mmap
+import os
+import struct
+import sys
+import threading
+import zlib
+from typing import List, Optional, Sequence, Tuple
+
+CacheStats = collections.namedtuple(
+    "CacheStats", "hits misses evictions size disk_entries"
+)
+CacheStats.__doc__ = """Counters of a :py:class:`PackCache`.
+
+- ``hits``: results found in memory or in the cache file.
+- ``misses``: results that had to be packed.
+- ``evictions``: results dropped from memory to stay within
+  ``maxsize``.
+- ``size``: results held in memory.
+- ``disk_entries``: results in the cache file, 0 without one.
+"""
+
+_FILE_MAGIC = b"RPACKC01"
+_RECORD = struct.Struct("<4s16sQII")
+_RECORD_MAGIC = b"RPCK"
+_INT64_MIN = -(1 << 63)
+_INT64_MAX = (1 << 63) - 1
+
+
+def _int64_array(values) -> array.array:
+    """Return `values` as little-endian int64."""
+    data = array.array("q", values)
+    if sys.byteorder != "little":
+        data.byteswap()
+    return data
+
+
+class _CacheFile:
+    """Append-only record file, indexed by key and read through mmap."""
+
+    def __init__(self, path):
+        self._file = open(path, "a+b")
+        try:
+            self._file.seek(0, os.SEEK_END)
+            if self._file.tell() == 0:
+                self._file.write(_FILE_MAGIC)
+                self._file.flush()
+            self._file.seek(0)
+            if self._file.read(len(_FILE_MAGIC)) != _FILE_MAGIC:
+                raise ValueError(f"{path} is not an rpack cache file")
+        except BaseException:
+            self._file.close()
+            raise
+        self._map = None
+        self._index = {}
+        self._scanned = len(_FILE_MAGIC)
+        self._refresh()
+
+    def __len__(self):
+        return len(self._index)
+
+    def close(self):
+        if self._map is not None:
+            self._map.close()
+            self._map = None
+        self._file.close()
+
+    def _refresh(self):
+        """Index the records appended since the last call."""
+        size = os.fstat(self._file.fileno()).st_size
+        if size <= self._scanned:
+            return
+        if self._map is not None:
+            self._map.close()
+        self._map = mmap.mmap(self._file.fileno(), size, access=mmap.ACCESS_READ)
+        offset = self._scanned
+        while offset + _RECORD.size <= size:
+            magic, key, n, crc, _ = _RECORD.unpack_from(self._map, offset)
+            end = offset + _RECORD.size + 16 * n
+            if (
+                magic == _RECORD_MAGIC
+                and end <= size
+                and zlib.crc32(self._map[offset + _RECORD.size : end]) == crc
+            ):
+                self._index[key] = offset
+                offset = end
+                continue
+            # Torn, or still being written if nothing follows, then it
+            # is scanned again by the next call
+            following = self._map.find(_RECORD_MAGIC, offset + 1)
+            if following < 0:
+                break
+            offset = following
+        self._scanned = offset
+
+    def get(self, key: bytes) -> Optional[List[Tuple[int, int]]]:
+        offset = self._index.get(key)
+        if offset is None:
+            self._refresh()
+            offset = self._index.get(key)
+            if offset is None:
+                return None
+        n = _RECORD.unpack_from(self._map, offset)[2]
+        start = offset + _RECORD.size
+        data = array.array("q")
+        data.frombytes(self._map[start : start + 16 * n])
+        if sys.byteorder != "little":
+            data.byteswap()
+        return list(zip(data[0::2], data[1::2]))
+
+    def put(self, key: bytes, positions: Sequence[Tuple[int, int]]):
+        flat = [v for position in positions for v in position]
+        if any(v < _INT64_MIN or v > _INT64_MAX for v in flat):
+            # Held in memory only
+            return
+        payload = _int64_array(flat).tobytes()
+        header = _RECORD.pack(
+            _RECORD_MAGIC, key, len(positions), zlib.crc32(payload), 0
+        )
+        # One write per record, so that appends of other processes
+        # don't interleave with it
+        self._file.seek(0, os.SEEK_END)
+        self._file.write(header + payload)
+        self._file.flush()
+        self._refresh()
+
+
+class PackCache:
+    """Cache of packing results, keyed by the multiset of sizes.
+
+    Pass it to :py:func:`rpack.pack` or :py:meth:`rpack.Packer.pack` as
+    ``cache``.  An input whose sizes, in any order, and arguments were
+    packed before is not searched again: the stored positions are
+    mapped back to the input order, giving exactly the result a search
+    would.
+
+    The most recently used results are kept in memory.  With ``path``,
+    results are also appended to a cache file, which is shared by
+    every process on the host that opens it, and outlives them.  On a
+    network file system appends from different machines are not
+    atomic, so records written concurrently can be lost, but the
+    checksums keep them from giving wrong results.  A cache may be
+    used by several threads.
+
+    **Example**::
+
+        >>> import rpack
+        >>> cache = rpack.PackCache()
+        >>> rpack.pack([(2, 1), (1, 1)], cache=cache)
+        [(0, 0), (2, 0)]
+        >>> rpack.pack([(1, 1), (2, 1)], cache=cache)
+        [(2, 0), (0, 0)]
+        >>> cache.stats
+        CacheStats(hits=1, misses=1, evictions=0, size=1, disk_entries=0)
+
+    :param maxsize: Number of results kept in memory.  The least
+        recently used result is evicted when a new one doesn't fit.
+    :type maxsize: int
+
+    :param path: Cache file to read results from and append new results
+        to, created if missing.  Positions beyond 64-bit integers are
+        not written to it.
+    :type path: Union[None, str, os.PathLike]
+    """
+
+    def __init__(self, maxsize=1024, path=None):
+        if not isinstance(maxsize, int):
+            raise TypeError("maxsize must be an integer")
+        if maxsize < 0:
+            raise ValueError("maxsize must not be negative")
+        self._maxsize = maxsize
+        self._entries = collections.OrderedDict()
+        self._lock = threading.Lock()
+        self._hits = 0
+        self._misses = 0
+        self._evictions = 0
+        self._file = None if path is None else _CacheFile(path)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+    def close(self):
+        """Close the cache file, the results in memory are kept."""
+        with self._lock:
+            if self._file is not None:
+                self._file.close()
+                self._file = None
+
+    @property
+    def stats(self) -> CacheStats:
+        """:py:class:`CacheStats` since the cache was created."""
+        with self._lock:
+            return CacheStats(
+                self._hits,
+                self._misses,
+                self._evictions,
+                len(self._entries),
+                0 if self._file is None else len(self._file),
+            )
+
+    def clear(self):
+        """Drop the results in memory and reset the counters."""
+        with self._lock:
+            self._entries.clear()
+            self._hits = self._misses = self._evictions = 0
+
+    @staticmethod
+    def key(sizes, max_width, max_height, tolerance):
+        """Return the key of an input and its canonical order.
+
+        The order lists the input indices sorted by size, ties by
+        index, which is the order the positions are stored in.
+        """
+        order = sorted(range(len(sizes)), key=sizes.__getitem__)
+        canonical = (
+            max_width,
+            max_height,
+            float(tolerance),
+            [tuple(sizes[i]) for i in order],
+        )
+        digest = hashlib.blake2b(repr(canonical).encode(), digest_size=16)
+        return digest.digest(), order
+
+    def get(self, key: bytes) -> Optional[List[Tuple[int, int]]]:
+        """Return the positions of `key` in canonical order, or None."""
+        with self._lock:
+            positions = self._entries.get(key)
+            if positions is not None:
+                self._entries.move_to_end(key)
+            elif self._file is not None:
+                positions = self._file.get(key)
+                if positions is not None:
+                    self._remember(key, positions)
+            if positions is None:
+                self._misses += 1
+            else:
+                self._hits += 1
+            return positions
+
+    def put(self, key: bytes, positions: Sequence[Tuple[int, int]]):
+        """Store the positions of `key` in canonical order."""
+        with self._lock:
+            self._remember(key, list(positions))
+            if self._file is not None:
+                self._file.put(key, positions)
+
+    def _remember(self, key, positions):
+        if self._maxsize == 0:
+            return
+        self._entries[key] = positions
+        self._entries.move_to_end(key)
+        while len(self._entries) > self._maxsize:
+            self._entries.popitem(last=False)
+            self._evictions += 1
@@ -1,5 +1,99 @@
 
 
+cdef extern from "rpack.h":
+
+    enum:
+        RPACK_OK
+        RPACK_WIDTH_NOT_POSITIVE
+        RPACK_HEIGHT_NOT_POSITIVE
+        RPACK_SIDE_OVERFLOW
+        RPACK_MAX_WIDTH_ZERO
+        RPACK_IMPOSSIBLE
+        RPACK_NO_MEMORY
+        RPACK_TIME_LIMIT
+
+    const char *rpack_strerror(int status) nogil
+    int rpack_overlapping(const long *sizes, const long *positions,
+                          size_t length, size_t *first, size_t *second) nogil
+    int rpack_bbox_size(const long *sizes, const long *positions,
+                        size_t length, long *width, long *height) nogil
+    int rpack_total_area(const long *sizes, size_t length, long *area) nogil
+
+    ctypedef struct RpackAtlas:
+        pass
+
+    RpackAtlas *rpack_atlas_new(long width, long height) nogil
+    void rpack_atlas_free(RpackAtlas *atlas) nogil
+    int rpack_atlas_insert(RpackAtlas *atlas, long width, long height,
+                           long *x, long *y) nogil
+    void rpack_atlas_reset(RpackAtlas *atlas) nogil
+    int rpack_pack_bins(const long *sizes, size_t length, long bin_width,
+                        long bin_height, size_t *bins, long *positions,
+                        size_t *n_bins) nogil
+
+    ctypedef struct RpackCounters:
+        unsigned long long try_packs
+        unsigned long long placed
+        unsigned long long resumed
+        unsigned long long columns
+        unsigned long long rows
+        unsigned long long jumps
+        unsigned long long cuts
+        unsigned long long copied
+        unsigned long long coarse_steps
+        unsigned long long refine_probes
+
+    ctypedef struct RpackStats:
+        RpackCounters counters
+        double strategy_seconds[4]
+
+
+# The packer with 128-bit coordinates, see rpack.h. Without 128-bit
+# integers RPACK_HAVE_INT128 is 0 and the names stand for the long
+# functions, only so that the module compiles. They must not be called.
+cdef extern from "rpack.h":
+    """
+    #ifndef RPACK_HAVE_INT128
+    #define RPACK_HAVE_INT128 0
+    typedef long rpack_int128;
+    typedef RpackPacker RpackPackerI128;
+    #define rpack_packer_new_i128 rpack_packer_new
+    #define rpack_packer_free_i128 rpack_packer_free
+    #define rpack_packer_pack_i128 rpack_packer_pack
+    #define rpack_packer_set_time_limit_i128 rpack_packer_set_time_limit
+    #define rpack_packer_stopped_i128 rpack_packer_stopped
+    #define rpack_packer_set_stats_i128 rpack_packer_set_stats
+    #define rpack_packer_stats_i128 rpack_packer_stats
+    #define rpack_packer_set_tolerance_i128 rpack_packer_set_tolerance
+    #define rpack_packer_set_sweep_threads_i128 rpack_packer_set_sweep_threads
+    #endif
+    """
+
+    enum:
+        RPACK_HAVE_INT128
+
+    ctypedef long long rpack_int128
+
+    ctypedef struct RpackPackerI128:
+        pass
+
+    RpackPackerI128 *rpack_packer_new_i128() nogil
+    void rpack_packer_free_i128(RpackPackerI128 *packer) nogil
+    int rpack_packer_pack_i128(RpackPackerI128 *packer,
+                               const rpack_int128 *sizes, size_t length,
+                               rpack_int128 max_width, rpack_int128 max_height,
+                               size_t threads, rpack_int128 *positions) nogil
+    void rpack_packer_set_time_limit_i128(RpackPackerI128 *packer,
+                                          double seconds) nogil
+    int rpack_packer_stopped_i128(const RpackPackerI128 *packer) nogil
+    void rpack_packer_set_stats_i128(RpackPackerI128 *packer, int enable) nogil
+    const RpackStats *rpack_packer_stats_i128(const RpackPackerI128 *packer) nogil
+    void rpack_packer_set_tolerance_i128(RpackPackerI128 *packer,
+                                         double tolerance) nogil
+    void rpack_packer_set_sweep_threads_i128(RpackPackerI128 *packer,
+                                             size_t threads) nogil
+
+
 cdef extern from "rpackcore.h":
 
     ctypedef struct Rectangle:
@@ -12,14 +106,22 @@ cdef extern from "rpackcore.h":
         bint wide
         bint rotated
 
-    ctypedef struct Cell
+    ctypedef struct RectangleSides:
+        size_t length
 
-    cdef long start_pos(const Cell *cell) nogil
+    ctypedef struct RectangleStats:
+        long sum_width
+        long sum_height
+        long min_width
+        long min_height
+        long max_width
+        long max_height
+        long area
 
     ctypedef struct Region:
-        Cell *row_cell_start
-        Cell *col_cell_start
-        Cell *col_cell
+        long row_start_pos
+        long col_start_pos
+        bint found
 
     ctypedef struct BBoxRestrictions:
         long min_width
@@ -27,17 +129,64 @@ cdef extern from "rpackcore.h":
         long min_height
         long max_height
         long max_area
+        long happy_area
+
+    ctypedef struct SearchShared:
+        long area
+        long slack
+
+    ctypedef void (*TaskFunc)(void *arg, size_t index) noexcept nogil
+    ctypedef void (*TaskWorkerFunc)(void *arg, size_t worker,
+                                    size_t index) noexcept nogil
 
     ctypedef struct CGrid "Grid":
         size_t size
+        size_t capacity
         long width
         long height
 
+    ctypedef struct CPacker "Packer":
+        double time_limit
+        double tolerance
+        size_t sweep_threads
+        bint stopped
+        bint counting
+        RpackStats stats
+
     cdef:
+        void rectangle_stats_init(RectangleStats *self) nogil
+        int rectangle_init(Rectangle *self, RectangleStats *stats, size_t index,
+                           long width, long height) nogil
+        int rectangle_bounds(const RectangleStats *stats, long *max_width,
+                             long *max_height) nogil
+        int rectangle_bbox(const Rectangle *rectangles, size_t length,
+                           long *width, long *height) nogil
+        int rectangle_index_cmp(const void *a, const void *b) noexcept nogil
+        int rectangle_width_cmp(const void *a, const void *b) noexcept nogil
+        int rectangle_height_cmp(const void *a, const void *b) noexcept nogil
+        int rectangle_area_cmp(const void *a, const void *b) noexcept nogil
+        void packer_init(CPacker *self) nogil
+        void packer_destroy(CPacker *self) nogil
+        size_t packer_capacity(const CPacker *self) nogil
+        int packer_pack(CPacker *self, Rectangle *rectangles, size_t length,
+                        long max_width, long max_height, size_t threads) nogil
         CGrid *grid_alloc(size_t size, long width, long height) nogil
         void grid_free(CGrid *grid) nogil
+        CGrid *grid_reserve(CGrid *grid, size_t size) nogil
         void grid_clear(CGrid *self) nogil
         long grid_find_region(CGrid *grid, const Rectangle *rectangle, Region *reg) nogil
         int grid_split(CGrid *self, Region *reg) nogil
-        long grid_search_bbox(CGrid *grid, const Rectangle *sizes,
+        long grid_search_bbox(CGrid *grid, const RectangleSides *sizes,
                               const BBoxRestrictions *bbr) nogil
+        long grid_search_bbox_shared(CGrid *grid, const RectangleSides *sizes,
+                                     const BBoxRestrictions *bbr,
+                                     SearchShared *shared) nogil
+        long grid_search_bbox_pool(CGrid **grids, size_t n_grids,
+                                   const RectangleSides *sizes,
+                                   const BBoxRestrictions *bbr,
+                                   SearchShared *shared) nogil
+        void search_shared_init(SearchShared *self, long slack) nogil
+        void task_run(TaskFunc func, void *arg, size_t n_tasks,
+                      size_t n_threads) nogil
+        void task_run_workers(TaskWorkerFunc func, void *arg, size_t n_tasks,
+                              size_t n_threads) nogil
@@ -7,18 +7,25 @@ from typing import Tuple
 
 # Cython
 import cython
-from libc.stdlib cimport malloc, free, qsort
+from libc.stdlib cimport malloc, free
 from libc.limits cimport LONG_MAX, LONG_MIN
-from libc.stdint cimport SIZE_MAX
-from cpython.mem cimport PyMem_Malloc, PyMem_Free
+from libc.stdint cimport SIZE_MAX, INT32_MAX, int32_t, int64_t
+from cpython.buffer cimport PyObject_CheckBuffer
+from cpython.mem cimport PyMem_Malloc, PyMem_Realloc, PyMem_Free
 
 
 DEF NO_POSITION = -1
-DEF CASE_0 = 0
-DEF CASE_1 = 1
-DEF CASE_2 = 2
-DEF CASE_3 = 3
-DEF CASE_4 = 4
+
+# Sizes and positions can also be exchanged through (n, 2) buffers of
+# 32-bit or 64-bit integers, e.g. NumPy arrays, without creating a
+# Python object per rectangle.
+ctypedef fused buffer_int:
+    int32_t
+    int64_t
+
+# Inputs that overflow C long are packed with 128-bit coordinates, see
+# Packer.pack_wide, if the compiler has them.
+HAVE_INT128 = bool(RPACK_HAVE_INT128)
 
 
 class PackingImpossibleError(Exception):
@@ -32,55 +39,47 @@ class PackingImpossibleError(Exception):
     point of failure.
     """
 
-# The following four functions are used as compare-functions for
-# sorting `Rectangle` structs by index, width, height and area.
 
-cdef int rectangle_index_cmp(const void *a, const void *b) noexcept nogil:
-    cdef int index_a, index_b
-    index_a = (<Rectangle*>a)[0].index
-    index_b = (<Rectangle*>b)[0].index
-    if index_a < index_b:
-        return -1
-    elif index_a == index_b:
-        return 0
-    else:
-        return 1
-
-
-cdef int rectangle_width_cmp(const void *a, const void *b) noexcept nogil:
-    cdef long width_a, width_b
-    width_a = (<Rectangle*>a)[0].width
-    width_b = (<Rectangle*>b)[0].width
-    if width_a < width_b:
-        return 1
-    elif width_a == width_b:
-        return rectangle_area_cmp(a, b)
-    else:
-        return -1
-
-
-cdef int rectangle_height_cmp(const void *a, const void *b) noexcept nogil:
-    cdef long height_a, height_b
-    height_a = (<Rectangle*>a)[0].height
-    height_b = (<Rectangle*>b)[0].height
-    if height_a < height_b:
-        return 1
-    elif height_a == height_b:
-        return rectangle_area_cmp(a, b)
-    else:
-        return -1
-
-
-cdef int rectangle_area_cmp(const void *a, const void *b) noexcept nogil:
-    cdef long area_a, area_b
-    area_a = (<Rectangle*>a)[0].area
-    area_b = (<Rectangle*>b)[0].area
-    if area_a < area_b:
-        return 1
-    elif area_a == area_b:
-        return 0
-    else:
-        return -1
+class PositionOverflowError(OverflowError):
+    """A position does not fit the integer type of the out buffer.
+
+    Unlike other overflows, packing with wider coordinates doesn't
+    help, so rpack.pack raises it without falling back.
+    """
+
+PackStats = collections.namedtuple(
+    "PackStats",
+    [
+        "try_packs",
+        "placed",
+        "resumed",
+        "columns",
+        "rows",
+        "jumps",
+        "cuts",
+        "copied",
+        "coarse_steps",
+        "refine_probes",
+        "strategy_seconds",
+    ],
+)
+PackStats.__doc__ = """Work done by one call of :func:`pack`.
+
+    The counters add up all threads:
+
+    - ``try_packs``: attempts to pack all rectangles at a bounding box
+      size, and ``placed``/``resumed`` the rectangles they placed or
+      kept from the previous attempt.
+    - ``columns``/``rows``: cells visited while searching for a free
+      region, and ``jumps`` the jump matrix skips taken.
+    - ``cuts``: rows and columns cut in two, and ``copied`` the jump
+      matrix elements copied by the cuts.
+    - ``coarse_steps``: escalations of the coarse height step, and
+      ``refine_probes`` the heights probed around the best one after
+      coarse stepping.
+    - ``strategy_seconds``: wall time spent on each of the four
+      strategies, zero for the strategies skipped.
+    """
 
 
 cdef inline bint positive_area_overflows_long(long width, long height) noexcept nogil:
@@ -95,12 +94,37 @@ cdef inline bint long_add_overflows(long a, long b) noexcept nogil:
     return False
 
 
-cdef inline long safe_bbox_area(long width, long height) noexcept nogil:
-    if width <= 0 or height <= 0:
-        return -1
-    if positive_area_overflows_long(width, height):
-        return LONG_MAX
-    return width * height
+cdef int check_status(int status) except -1:
+    """Raise the exception for an RPACK_* status code."""
+    if status == RPACK_OK:
+        return 0
+    message = rpack_strerror(status).decode()
+    if status == RPACK_WIDTH_NOT_POSITIVE or status == RPACK_HEIGHT_NOT_POSITIVE:
+        raise ValueError(message)
+    elif status == RPACK_NO_MEMORY:
+        raise MemoryError(message)
+    elif status == RPACK_TIME_LIMIT:
+        raise TimeoutError(message)
+    elif RPACK_MAX_WIDTH_ZERO <= status <= RPACK_IMPOSSIBLE:
+        raise PackingImpossibleError(message, list())
+    raise OverflowError(message)
+
+
+cdef Py_ssize_t buffer_int_itemsize(obj, str name) except -1:
+    """Return the item size of an (n, 2) int32 or int64 buffer."""
+    view = memoryview(obj)
+    if view.format.lstrip("@=") not in ("i", "l", "q") \
+            or view.itemsize not in (4, 8):
+        raise TypeError(f"{name} buffer must hold int32 or int64 integers")
+    if view.ndim != 2 or view.shape[1] != 2:
+        raise ValueError(f"{name} buffer must have shape (n, 2)")
+    return view.itemsize
+
+
+cdef object new_positions_buffer(size_t length, Py_ssize_t itemsize):
+    """Return a writable (length, 2) memoryview of int32 or int64."""
+    fmt = "i" if itemsize == 4 else "q"
+    return memoryview(bytearray(length * 2 * itemsize)).cast(fmt, (length, 2))
 
 
 cdef class RectangleSet:
@@ -109,36 +133,38 @@ cdef class RectangleSet:
     cdef:
         Rectangle *rectangles
         size_t length
-        long sum_width
-        long sum_height
-
-        long min_width
-        long min_height
-
-        long max_width
-        long max_height
-
-        long area
+        size_t capacity
+        RectangleStats stats
 
+    def __cinit__(self, sizes=None):
+        self.rectangles = NULL
+        self.length = 0
+        self.capacity = 0
+        if sizes is not None:
+            self.fill(sizes)
 
-    def __cinit__(self, sizes):
+    cdef int fill(self, sizes) except -1:
+        """Replace the rectangles with `sizes`, reusing the buffer."""
         cdef:
             size_t i
-            long w, h, rect_area
+            long w, h
+            Py_ssize_t itemsize = 0
 
+        if PyObject_CheckBuffer(sizes):
+            itemsize = buffer_int_itemsize(sizes, "sizes")
         if len(sizes) == 0:
             raise ValueError("sizes must not be empty")
+        self.reserve(len(sizes))
         self.length = len(sizes)
-        self.min_height = LONG_MAX
-        self.min_width = LONG_MAX
+        rectangle_stats_init(&self.stats)
 
         # Prepare input
-        self.rectangles = NULL
-        if self.length > SIZE_MAX // sizeof(Rectangle):
-            raise MemoryError("RectangleSet allocation size overflow")
-        self.rectangles = <Rectangle *> PyMem_Malloc(<size_t>self.length * sizeof(Rectangle))
-        if not self.rectangles:
-            raise MemoryError("Failed to allocate rectangle buffer")
+        if itemsize == 4:
+            self.read_buffer[int32_t](sizes)
+            return 0
+        elif itemsize == 8:
+            self.read_buffer[int64_t](sizes)
+            return 0
         i = 0
         for width, height in sizes:
             if not isinstance(width, int):
@@ -147,44 +173,52 @@ cdef class RectangleSet:
                 raise TypeError("Rectangle height must be an integer")
             w = <long>width
             h = <long>height
-            if w <= 0:
-                raise ValueError("Rectangle width must be positive integer")
-            elif h <= 0:
-                raise ValueError("Rectangle height must be positive integer")
-
-            if self.sum_width > LONG_MAX - w:
-                raise OverflowError("Total rectangle width too large")
-            if self.sum_height > LONG_MAX - h:
-                raise OverflowError("Total rectangle height too large")
-            self.sum_width += w
-            self.sum_height += h
-
-            if self.max_width < w:
-                self.max_width = w
-            if self.max_height < h:
-                self.max_height = h
-
-            if w < self.min_width:
-                self.min_width = w
-            if h < self.min_height:
-                self.min_height = h
-
-            if positive_area_overflows_long(w, h):
-                raise OverflowError("Rectangle area too large")
-            rect_area = w*h
-            if self.area > LONG_MAX - rect_area:
-                raise OverflowError("Total rectangle area too large")
-            self.area += rect_area
-
-            self.rectangles[i].width = w
-            self.rectangles[i].height = h
-            self.rectangles[i].x = NO_POSITION
-            self.rectangles[i].y = NO_POSITION
-            self.rectangles[i].index = i
-            self.rectangles[i].area = rect_area
-            self.rectangles[i].wide = (w >= h)
-            self.rectangles[i].rotated = False
+            check_status(rectangle_init(&self.rectangles[i], &self.stats, i, w, h))
             i += 1
+        return 0
+
+    cdef int reserve(self, size_t length) except -1:
+        """Make room for `length` rectangles, growing geometrically."""
+        cdef:
+            size_t capacity = length
+            Rectangle *rectangles
+        if length <= self.capacity:
+            return 0
+        if length > SIZE_MAX // sizeof(Rectangle):
+            raise MemoryError("RectangleSet allocation size overflow")
+        if self.capacity <= SIZE_MAX // sizeof(Rectangle) // 2 \
+                and 2 * self.capacity > capacity:
+            capacity = 2 * self.capacity
+        rectangles = <Rectangle *> PyMem_Realloc(
+            self.rectangles, capacity * sizeof(Rectangle))
+        if not rectangles and capacity > length:
+            capacity = length
+            rectangles = <Rectangle *> PyMem_Realloc(
+                self.rectangles, capacity * sizeof(Rectangle))
+        if not rectangles:
+            raise MemoryError("Failed to allocate rectangle buffer")
+        self.rectangles = rectangles
+        self.capacity = capacity
+        return 0
+
+    @cython.boundscheck(False)
+    @cython.wraparound(False)
+    cdef int read_buffer(self, const buffer_int[:, :] sizes) except -1:
+        """Add the rectangles of an (n, 2) buffer without the GIL."""
+        cdef:
+            size_t i
+            int status = RPACK_OK
+        with nogil:
+            for i in range(self.length):
+                if sizes[i, 0] > LONG_MAX or sizes[i, 1] > LONG_MAX:
+                    status = RPACK_SIDE_OVERFLOW
+                else:
+                    status = rectangle_init(
+                        &self.rectangles[i], &self.stats, i,
+                        <long>sizes[i, 0], <long>sizes[i, 1])
+                if status != RPACK_OK:
+                    break
+        return check_status(status)
 
     def __dealloc__(self):
         # Note: this is called if Exceptions are raised in __cinit__
@@ -197,63 +231,73 @@ cdef class RectangleSet:
             yield self.rectangles[i]
 
     cdef list positions(self):
+        """Return the positions as a list in input order."""
         cdef size_t i = 0, end_i = 0
+        cdef Rectangle *r
         for i in range(self.length):
             if self.rectangles[i].x == NO_POSITION or \
                    self.rectangles[i].y == NO_POSITION:
                 break
             end_i = i + 1
-        self.sort_by_index(end_i)
-        output = [(self.rectangles[i].x, self.rectangles[i].y)
-                  for i in range(end_i)]
+        output = [None] * <Py_ssize_t>self.length
+        for i in range(end_i):
+            r = &self.rectangles[i]
+            output[r.index] = (r.x, r.y)
         if end_i != self.length:
-            raise PackingImpossibleError(f"Partial result", output)
+            raise PackingImpossibleError(
+                f"Partial result", [p for p in output if p is not None])
         return output
 
-    cdef bbox_size(self):
-        cdef:
-            long max_width = 0, max_height = 0, width_end, height_end
-            Rectangle *r
-            size_t i
-        for i in range(self.length):
-            r = &self.rectangles[i]
-            if r.x == NO_POSITION or r.y == NO_POSITION:
-                break
-            if long_add_overflows(r.width, r.x):
-                raise OverflowError("Rectangle x + width overflows C long")
-            if long_add_overflows(r.height, r.y):
-                raise OverflowError("Rectangle y + height overflows C long")
-            width_end = r.width + r.x
-            height_end = r.height + r.y
-            if width_end > max_width:
-                max_width = width_end
-            if height_end > max_height:
-                max_height = height_end
-        return max_width, max_height
-
-    cdef void rotate_all(self) nogil:
+    cdef object store_positions(self, out):
+        """Write the positions to the (n, 2) buffer `out` and return it.
+
+        Rectangles carry their input index, so no sorting is needed.
+        """
         cdef size_t i
-        cdef Rectangle *r
         for i in range(self.length):
-            r = &self.rectangles[i]
-            r.width, r.height = r.height, r.width
-            r.rotated = not r.rotated
-            r.wide = r.width >= r.height
-        self.sum_width, self.sum_height = self.sum_height, self.sum_width
-        self.min_width, self.min_height = self.min_height, self.min_width
-        self.max_width, self.max_height = self.max_height, self.max_width
-
-    cdef void sort_by_index(self, size_t length) nogil:
-        qsort(<void*>(self.rectangles), length, sizeof(Rectangle), rectangle_index_cmp)
-
-    cdef void sort_by_width(self) nogil:
-        qsort(<void*>(self.rectangles), self.length, sizeof(Rectangle), rectangle_width_cmp)
-
-    cdef void sort_by_height(self) nogil:
-        qsort(<void*>(self.rectangles), self.length, sizeof(Rectangle), rectangle_height_cmp)
+            if self.rectangles[i].x == NO_POSITION or \
+                   self.rectangles[i].y == NO_POSITION:
+                self.positions()
+        if buffer_int_itemsize(out, "out") == 4:
+            self.write_buffer[int32_t](out)
+        else:
+            self.write_buffer[int64_t](out)
+        return out
+
+    @cython.boundscheck(False)
+    @cython.wraparound(False)
+    cdef int write_buffer(self, buffer_int[:, :] out) except -1:
+        cdef:
+            size_t i
+            bint overflow = False
+            Rectangle *r
+        if <size_t>out.shape[0] != self.length:
+            raise ValueError(
+                f"out buffer must have {self.length} rows, not {out.shape[0]}")
+        with nogil:
+            for i in range(self.length):
+                r = &self.rectangles[i]
+                if buffer_int is int32_t:
+                    if r.x > INT32_MAX or r.y > INT32_MAX:
+                        overflow = True
+                        break
+                out[r.index, 0] = <buffer_int>r.x
+                out[r.index, 1] = <buffer_int>r.y
+        if overflow:
+            raise PositionOverflowError(
+                "Position does not fit the int32 out buffer")
+        return 0
 
-    cdef void sort_by_area(self) nogil:
-        qsort(<void*>(self.rectangles), self.length, sizeof(Rectangle), rectangle_area_cmp)
+    cdef bbox_size(self):
+        """Return the bounding box size of the placed rectangles."""
+        cdef:
+            long width, height
+            int status
+        with nogil:
+            status = rectangle_bbox(self.rectangles, self.length, &width,
+                                    &height)
+        check_status(status)
+        return width, height
 
     cdef void translate(self, long x, long y) nogil:
         cdef size_t i
@@ -268,82 +312,9 @@ cdef class RectangleSet:
             r.x += x
             r.y += y
 
-    cdef void transpose(self) nogil:
-        cdef size_t i
-        cdef Rectangle *r
-        for i in range(self.length):
-            r = &self.rectangles[i]
-            r.x, r.y = r.y, r.x
-
-
-cdef class Grid:
 
-    cdef:
-        Py_ssize_t length
-        CGrid *cgrid
-
-    def __cinit__(self, size_t size, long width=0, long height=0):
-        self.cgrid = grid_alloc(size, width, height)
-        if not self.cgrid:
-            raise MemoryError("Failed to allocate grid")
-
-    def __dealloc__(self):
-        if self.cgrid != NULL:
-            grid_free(self.cgrid)
-
-    cdef (long, long) search_bbox(
-            self, RectangleSet rset, BBoxRestrictions *bbr):
-        cdef long status
-        if self.cgrid.size + 1 < rset.length:
-            raise PackingImpossibleError(
-                (
-                    "Too many rectangles for allocated grid size "
-                    f"(grid={self.cgrid.size}, rectangles={rset.length})"
-                ),
-                [],
-            )
-        assert bbr.min_width == rset.max_width
-        assert bbr.min_height == rset.max_height
-        with nogil:
-            status = grid_search_bbox(self.cgrid, rset.rectangles, bbr)
-        if status >= 0:
-            return self.cgrid.width, self.cgrid.height
-        return self.cgrid.width, -self.cgrid.height
-
-    cdef int pack(self, RectangleSet rset, long width, long height) except -1:
-        cdef size_t i = 0
-        cdef int split_status
-        cdef Region reg
-        if self.cgrid.size + 1 < rset.length:
-            raise PackingImpossibleError(
-                (
-                    "Too many rectangles for allocated grid size "
-                    f"(grid={self.cgrid.size}, rectangles={rset.length})"
-                ),
-                [],
-            )
-        with nogil:
-            self.cgrid.width = width
-            self.cgrid.height = height
-            grid_clear(self.cgrid)
-            for i in range(rset.length):
-                r = &rset.rectangles[i]
-                grid_find_region(self.cgrid, r, &reg)
-                if reg.col_cell == NULL:
-                    r.x = NO_POSITION
-                    r.y = NO_POSITION
-                    return 1
-                r.x = start_pos(reg.col_cell_start)
-                r.y = start_pos(reg.row_cell_start)
-                split_status = grid_split(self.cgrid, &reg)
-                if split_status != 0:
-                    r.x = NO_POSITION
-                    r.y = NO_POSITION
-                    return 1
-        return 0
-
-
-def pack(sizes, long max_width, long max_height):
+def pack(sizes, long max_width, long max_height, size_t threads=1, out=None,
+         double time_limit=-1, double tolerance=0, bint count=False):
     """Pack rectangles by testing four different strategies.
 
     Strategies:
@@ -363,115 +334,456 @@ def pack(sizes, long max_width, long max_height):
 
     If ``max_width`` or ``max_height`` is too restrictive, a
     ``PackingImpossibleError`` exception might be issued.
+
+    The packing runs in C, see :c:func:`packer_pack`.  If ``threads``
+    is greater than one, the strategies are searched concurrently on
+    separate grids.  Threads beyond the first four are used for the
+    refinement probes of each strategy.  The result is the same as
+    with a single thread.
+
+    ``sizes`` may be an (n, 2) int32 or int64 buffer.  The positions
+    are then written to the (n, 2) buffer ``out``, or to a new
+    memoryview of the same integer type, which is returned.  A list of
+    sizes with ``out`` given is written to ``out`` as well.
+
+    If ``time_limit`` is not negative, the search stops after that many
+    seconds and the best packing found so far is returned.  If none
+    was found, ``TimeoutError`` is raised.  See
+    :attr:`Packer.stopped_early`.
+
+    The search stops at the first packing whose area is at most
+    ``1 + tolerance`` times a lower bound on the area.  With the
+    default tolerance 0 that is a provably optimal packing, and the
+    result is the same as that of the complete search.
+
+    If ``count`` is true, the work done is counted, see
+    :attr:`Packer.stats`.
     """
+    return Packer().pack(sizes, max_width, max_height, threads, out,
+                         time_limit, tolerance, count)
+
+
+cdef class Packer:
+    """Pack like :func:`pack`, keeping the storage between calls.
+
+    The rectangle buffer and the grids are kept after each call and
+    grown geometrically when an input doesn't fit, so repeated packing
+    of similar sized inputs allocates nothing.  A packer must not be
+    used by more than one thread at a time.
+    """
+
     cdef:
-        long area = LONG_MAX
-        long w = 0, h = 0, best_w = 0, best_h = 0
-        int case = CASE_0
-        BBoxRestrictions bbr
-
-    # Abort early
-    n = len(sizes)
-    if n == 0:
-        return list()
-
-    cdef RectangleSet rset = RectangleSet(sizes)
-
-    if max_width < 0:
-        max_width = rset.sum_width
-    elif max_width == 0:
-        raise PackingImpossibleError("max_width zero", list())
-    elif max_width < rset.max_width:
-        raise PackingImpossibleError("max_width less than widest rectangle", list())
-
-    if max_height < 0:
-        max_height = rset.sum_height
-    elif max_height == 0:
-        raise PackingImpossibleError("max_height zero", list())
-    elif max_height < rset.max_height:
-        raise PackingImpossibleError("max_height less than highest rectangle", list())
-
-    grid = Grid(rset.length + 1, 0, 0)
-    bbr = BBoxRestrictions(
-        min_width=rset.max_width,
-        max_width=max_width,
-        min_height=rset.max_height,
-        max_height=max_height,
-        max_area=area
-    )
-    best_w = max_width
-    best_h = max_height
-
-    rset.sort_by_height()
-    w, h = grid.search_bbox(rset, &bbr)
-    area = safe_bbox_area(w, h)
-    if 0 < area < bbr.max_area:
-        bbr.max_area = area
-        best_w = w
-        best_h = h
-        case = CASE_1
-
-    rset.sort_by_width()
-    w, h = grid.search_bbox(rset, &bbr)
-    area = safe_bbox_area(w, h)
-    if 0 < area < bbr.max_area:
-        bbr.max_area = area
-        best_w = w
-        best_h = h
-        case = CASE_2
-
-    # Rotated
-
-    rset.rotate_all()
-    bbr.min_width = rset.max_width
-    bbr.max_width = max_height
-    bbr.min_height = rset.max_height
-    bbr.max_height = max_width
-
-    w, h = grid.search_bbox(rset, &bbr)
-    area = safe_bbox_area(w, h)
-    if 0 < area < bbr.max_area:
-        bbr.max_area = area
-        best_w = w
-        best_h = h
-        case = CASE_3
-
-    rset.sort_by_width()
-    w, h = grid.search_bbox(rset, &bbr)
-    area = safe_bbox_area(w, h)
-    if 0 < area < bbr.max_area:
-        bbr.max_area = area
-        best_w = w
-        best_h = h
-        case = CASE_4
-
-    # Restore rset to best case
-    if case == CASE_0:
-        best_w = bbr.max_width
-        best_h = bbr.max_height
-    elif case == CASE_1:
-        rset.rotate_all()
-    elif case == CASE_2:
-        rset.rotate_all()
-        rset.sort_by_width()
-    elif case == CASE_3:
-        rset.sort_by_height()
-    elif case == CASE_4:
-        pass
-
-    grid.pack(rset, best_w, best_h)
-
-    # Restore rectangles if rotated
-    if case == CASE_0 or case == CASE_3 or case == CASE_4:
-        rset.transpose()
-
-    return rset.positions()
+        RectangleSet rset
+        CPacker packer
+        bint busy
+        # Packer with 128-bit coordinates, created by the first
+        # pack_wide, and whether it packed last
+        RpackPackerI128 *wide
+        bint last_wide
+        # Whether rset holds the packing of the last call
+        bint packed
+
+    def __cinit__(self):
+        packer_init(&self.packer)
+        self.rset = RectangleSet()
+        self.busy = False
+        self.wide = NULL
+        self.last_wide = False
+        self.packed = False
+
+    def __dealloc__(self):
+        packer_destroy(&self.packer)
+        if self.wide != NULL:
+            rpack_packer_free_i128(self.wide)
+
+    @property
+    def capacity(self):
+        """Number of rectangles that can be packed without allocating."""
+        return min(self.rset.capacity, packer_capacity(&self.packer))
+
+    @property
+    def sweep_threads(self):
+        """Threads per strategy search, see rpack.Packer."""
+        return self.packer.sweep_threads
+
+    @sweep_threads.setter
+    def sweep_threads(self, size_t threads):
+        self.packer.sweep_threads = threads if threads > 1 else 1
+
+    @property
+    def stopped_early(self):
+        """True if the last call ran out of time before it was done."""
+        if self.last_wide:
+            return bool(rpack_packer_stopped_i128(self.wide))
+        return bool(self.packer.stopped)
+
+    @property
+    def stats(self):
+        """:class:`PackStats` of the last call, None if not counted."""
+        cdef const RpackStats *stats = &self.packer.stats
+        if not self.packer.counting:
+            return None
+        if self.last_wide:
+            stats = rpack_packer_stats_i128(self.wide)
+        return PackStats(
+            stats.counters.try_packs, stats.counters.placed,
+            stats.counters.resumed, stats.counters.columns,
+            stats.counters.rows, stats.counters.jumps, stats.counters.cuts,
+            stats.counters.copied, stats.counters.coarse_steps,
+            stats.counters.refine_probes,
+            tuple(stats.strategy_seconds[i] for i in range(4)))
+
+    @property
+    def metrics(self):
+        """Bounding box size and density of the last packing.
+
+        Computed in C from the packed rectangles, whose total area is
+        already known, as ``((width, height), density)``.  None unless
+        the last call packed a non-empty input with C long coordinates.
+        """
+        cdef RectangleSet rset = self.rset
+        if not self.packed:
+            return None
+        width, height = rset.bbox_size()
+        return (width, height), rset.stats.area / (width * height)
+
+    def pack(self, sizes, long max_width, long max_height, size_t threads=1,
+             out=None, double time_limit=-1, double tolerance=0,
+             bint count=False):
+        """Same as :func:`pack`, with the storage of this packer."""
+        if self.busy:
+            raise RuntimeError("Packer is already packing")
+        # Also while the buffers of rset are read and written without
+        # the GIL
+        self.busy = True
+        try:
+            return self._pack(sizes, max_width, max_height, threads, out,
+                              time_limit, tolerance, count)
+        finally:
+            self.busy = False
+
+    cdef object _pack(self, sizes, long max_width, long max_height,
+                      size_t threads, out, double time_limit,
+                      double tolerance, bint count):
+        cdef:
+            RectangleSet rset = self.rset
+            Py_ssize_t itemsize = 0
+            int status
+        if PyObject_CheckBuffer(sizes):
+            itemsize = buffer_int_itemsize(sizes, "sizes")
+
+        # Abort early
+        self.packer.stopped = False
+        self.packer.counting = False
+        self.last_wide = False
+        self.packed = False
+        if len(sizes) == 0:
+            return list() if out is None else out
+
+        rset.fill(sizes)
+        if out is None and itemsize > 0:
+            out = new_positions_buffer(rset.length, itemsize)
+        check_status(rectangle_bounds(&rset.stats, &max_width, &max_height))
+
+        self.packer.time_limit = time_limit
+        self.packer.counting = count
+        self.packer.tolerance = tolerance if tolerance > 0 else 0
+        with nogil:
+            status = packer_pack(&self.packer, rset.rectangles, rset.length,
+                                 max_width, max_height, threads)
+        if status == RPACK_NO_MEMORY or status == RPACK_TIME_LIMIT:
+            check_status(status)
+        if out is not None:
+            out = rset.store_positions(out)
+        else:
+            out = rset.positions()
+        self.packed = True
+        return out
+
+    def pack_wide(self, sizes, max_width, max_height, size_t threads=1,
+                  double time_limit=-1, double tolerance=0,
+                  bint count=False):
+        """Same as :meth:`pack` with 128-bit coordinates, see rpack.h.
+
+        For a list of sizes whose sides, sums or areas overflow C long.
+        The positions are returned as a list.  OverflowError is raised
+        if the sizes overflow 128 bits too, or if ``HAVE_INT128`` is
+        False.
+        """
+        if not RPACK_HAVE_INT128:
+            raise OverflowError("No 128-bit integers on this platform")
+        if self.busy:
+            raise RuntimeError("Packer is already packing")
+        self.busy = True
+        try:
+            return self._pack_wide(sizes, max_width, max_height, threads,
+                                   time_limit, tolerance, count)
+        finally:
+            self.busy = False
+
+    cdef object _pack_wide(self, sizes, max_width, max_height,
+                           size_t threads, double time_limit,
+                           double tolerance, bint count):
+        cdef:
+            rpack_int128 *buf
+            rpack_int128 mw, mh
+            size_t i, length = len(sizes)
+            int status
+        self.packer.stopped = False
+        self.packer.counting = False
+        self.last_wide = False
+        self.packed = False
+        if length == 0:
+            return list()
+        if self.wide == NULL:
+            self.wide = rpack_packer_new_i128()
+            if self.wide == NULL:
+                raise MemoryError("Failed to allocate packer")
+        if length > SIZE_MAX // (4 * sizeof(rpack_int128)):
+            raise MemoryError("Size buffer allocation size overflow")
+        mw = max_width
+        mh = max_height
+        buf = <rpack_int128 *> PyMem_Malloc(
+            4 * length * sizeof(rpack_int128))
+        if not buf:
+            raise MemoryError("Failed to allocate size buffer")
+        try:
+            i = 0
+            for width, height in sizes:
+                if not isinstance(width, int):
+                    raise TypeError("Rectangle width must be an integer")
+                if not isinstance(height, int):
+                    raise TypeError("Rectangle height must be an integer")
+                buf[2 * i] = width
+                buf[2 * i + 1] = height
+                i += 1
+            rpack_packer_set_time_limit_i128(self.wide, time_limit)
+            rpack_packer_set_tolerance_i128(self.wide, tolerance)
+            rpack_packer_set_sweep_threads_i128(self.wide,
+                                                self.packer.sweep_threads)
+            rpack_packer_set_stats_i128(self.wide, count)
+            with nogil:
+                status = rpack_packer_pack_i128(
+                    self.wide, buf, length, mw, mh, threads,
+                    &buf[2 * length])
+            self.last_wide = True
+            self.packer.counting = count
+            if status != RPACK_OK and status != RPACK_IMPOSSIBLE:
+                check_status(status)
+            positions = [(buf[2 * length + 2 * i], buf[2 * length + 2 * i + 1])
+                         for i in range(length)]
+        finally:
+            PyMem_Free(buf)
+        if status == RPACK_IMPOSSIBLE:
+            raise PackingImpossibleError(
+                "Partial result",
+                [p for p in positions if p != (NO_POSITION, NO_POSITION)])
+        return positions
+
+
+cdef class Atlas:
+    """Insert rectangles one at a time into a page, see rpack.Atlas."""
+
+    cdef:
+        RpackAtlas *atlas
+        readonly long width
+        readonly long height
+        size_t length
+
+    def __cinit__(self, long width, long height):
+        self.atlas = NULL
+        if width <= 0 or height <= 0:
+            raise ValueError("width and height must be positive")
+        self.atlas = rpack_atlas_new(width, height)
+        if self.atlas == NULL:
+            raise MemoryError("Failed to allocate atlas")
+        self.width = width
+        self.height = height
+        self.length = 0
+
+    def __dealloc__(self):
+        rpack_atlas_free(self.atlas)
+
+    def __len__(self):
+        return self.length
+
+    def insert(self, long width, long height):
+        """Return the position of the inserted rectangle, None if full."""
+        cdef:
+            long x, y
+            int status
+        status = rpack_atlas_insert(self.atlas, width, height, &x, &y)
+        if status == RPACK_IMPOSSIBLE:
+            return None
+        check_status(status)
+        self.length += 1
+        return x, y
+
+    def reset(self):
+        """Remove all rectangles, keeping the storage."""
+        rpack_atlas_reset(self.atlas)
+        self.length = 0
+
+
+# Sets of `pack_many` are packed by `task_run_workers`. Each worker
+# owns one packer, which grows its grid as the sets require, so a
+# batch of small sets allocates a handful of grids in total.
+
+ctypedef struct BatchItem:
+    Rectangle *rectangles
+    size_t length
+    long max_width
+    long max_height
+    int status
+
+ctypedef struct Batch:
+    BatchItem *items
+    CPacker *packers
+
+cdef void run_batch_item(void *arg, size_t worker, size_t index) noexcept nogil:
+    cdef Batch *batch = <Batch *>arg
+    cdef BatchItem *item = &batch.items[index]
+    item.status = packer_pack(&batch.packers[worker], item.rectangles,
+                              item.length, item.max_width, item.max_height, 1)
+
+
+def pack_many(sets, long max_width, long max_height, size_t threads=1):
+    """Pack each set of rectangles in ``sets`` like :func:`pack`.
+
+    All sets are validated first and then packed without the GIL by
+    ``threads`` workers, each reusing one grid across the sets it
+    packs.  Return a list with one entry per set, in input order: the
+    positions, or the exception that :func:`pack` would have raised
+    for that set.
+    """
+    cdef:
+        list results = [None] * len(sets)
+        list rsets = [None] * len(sets)
+        list outs = [None] * len(sets)
+        list todo = []
+        RectangleSet rset
+        Batch batch
+        BatchItem *item
+        Py_ssize_t itemsize
+        size_t i, k, n_items, n_workers = 0
+        long w, h
+
+    for k, sizes in enumerate(sets):
+        try:
+            itemsize = 0
+            if PyObject_CheckBuffer(sizes):
+                itemsize = buffer_int_itemsize(sizes, "sizes")
+            if len(sizes) == 0:
+                results[k] = list()
+                continue
+            rset = RectangleSet(sizes)
+            w = max_width
+            h = max_height
+            check_status(rectangle_bounds(&rset.stats, &w, &h))
+            if itemsize > 0:
+                outs[k] = new_positions_buffer(rset.length, itemsize)
+        except Exception as error:
+            results[k] = error
+            continue
+        rsets[k] = rset
+        todo.append((k, w, h))
+
+    n_items = len(todo)
+    if n_items == 0:
+        return results
+    batch.items = NULL
+    batch.packers = NULL
+    try:
+        batch.items = <BatchItem *> PyMem_Malloc(n_items * sizeof(BatchItem))
+        if not batch.items:
+            raise MemoryError("Failed to allocate batch")
+        for i in range(n_items):
+            k, w, h = todo[i]
+            rset = rsets[k]
+            item = &batch.items[i]
+            item.rectangles = rset.rectangles
+            item.length = rset.length
+            item.max_width = w
+            item.max_height = h
+            item.status = RPACK_NO_MEMORY
+        n_workers = threads if threads > 0 else 1
+        if n_workers > n_items:
+            n_workers = n_items
+        batch.packers = <CPacker *> PyMem_Malloc(n_workers * sizeof(CPacker))
+        if not batch.packers:
+            raise MemoryError("Failed to allocate batch")
+        for i in range(n_workers):
+            packer_init(&batch.packers[i])
+        with nogil:
+            task_run_workers(run_batch_item, &batch, n_items, n_workers)
+
+        for i in range(n_items):
+            k = todo[i][0]
+            rset = rsets[k]
+            try:
+                if batch.items[i].status == RPACK_NO_MEMORY:
+                    check_status(RPACK_NO_MEMORY)
+                elif outs[k] is not None:
+                    results[k] = rset.store_positions(outs[k])
+                else:
+                    results[k] = rset.positions()
+            except (MemoryError, PackingImpossibleError) as error:
+                results[k] = error
+            except OverflowError as error:
+                # Left to pack(), see rpack.pack_many
+                results[k] = error
+    finally:
+        if batch.packers != NULL:
+            for i in range(n_workers):
+                packer_destroy(&batch.packers[i])
+        PyMem_Free(batch.packers)
+        PyMem_Free(batch.items)
+    return results
+
+
+cdef int read_pairs(pairs, long *out, Py_ssize_t length, str name) except -1:
+    """Write the first `length` (a, b) pairs of a list or buffer to `out`."""
+    cdef:
+        Py_ssize_t i
+        long a, b
+    if PyObject_CheckBuffer(pairs):
+        if buffer_int_itemsize(pairs, name) == 4:
+            return read_buffer_pairs[int32_t](pairs, out, length, name)
+        return read_buffer_pairs[int64_t](pairs, out, length, name)
+    for i in range(length):
+        a, b = pairs[i]
+        out[2 * i] = a
+        out[2 * i + 1] = b
+    return 0
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+cdef int read_buffer_pairs(const buffer_int[:, :] pairs, long *out,
+                           Py_ssize_t length, str name) except -1:
+    cdef:
+        Py_ssize_t i
+        bint overflow = False
+    if pairs.shape[0] < length:
+        raise IndexError(f"{name} buffer must have {length} rows")
+    with nogil:
+        for i in range(length):
+            if pairs[i, 0] > LONG_MAX or pairs[i, 0] < LONG_MIN \
+                    or pairs[i, 1] > LONG_MAX or pairs[i, 1] < LONG_MIN:
+                overflow = True
+                break
+            out[2 * i] = <long>pairs[i, 0]
+            out[2 * i + 1] = <long>pairs[i, 1]
+    if overflow:
+        raise OverflowError(f"{name} buffer value overflows C long")
+    return 0
 
 
 def bbox_size(sizes, positions) -> Tuple[int, int]:
     """Return bounding box size (width, height) of packed rectangles.
 
-    Useful for evaluating the result of :py:func:`rpack.pack`.
+    Useful for evaluating the result of :py:func:`rpack.pack`.  A
+    :py:class:`rpack.Packer` also tells it, see its ``metrics``.
 
     Example::
 
@@ -483,37 +795,42 @@ def bbox_size(sizes, positions) -> Tuple[int, int]:
         >>> bbox_size(sizes, positions)
         (335, 222)
 
-    :param sizes: List of rectangle sizes (width, height).
+    :param sizes: List of rectangle sizes (width, height), or an
+        (n, 2) int32 or int64 buffer.
     :type sizes: List[Tuple[int, int]]
 
-    :param positions: List of rectangle positions (x, y).
+    :param positions: List of rectangle positions (x, y), or an (n, 2)
+        int32 or int64 buffer.
     :type positions: List[Tuple[int, int]]
 
     :return: Size (width, height) of bounding box covering rectangles
              having `sizes` and `positions`.
     :rtype: Tuple[int, int]
     """
-    cdef long max_width = 0, max_height = 0, w, h, x, y, width_end, height_end
-    for i in range(len(sizes)):
-        w, h = sizes[i]
-        x, y = positions[i]
-        if long_add_overflows(w, x):
-            raise OverflowError("Rectangle x + width overflows C long")
-        if long_add_overflows(h, y):
-            raise OverflowError("Rectangle y + height overflows C long")
-        width_end = w + x
-        height_end = h + y
-        if width_end > max_width:
-            max_width = width_end
-        if height_end > max_height:
-            max_height = height_end
-    return max_width, max_height
+    cdef:
+        Py_ssize_t n = len(sizes)
+        long *buf
+        long width, height
+        int status
+    buf = <long *> PyMem_Malloc(4 * (n if n > 0 else 1) * sizeof(long))
+    if not buf:
+        raise MemoryError("Failed to allocate rectangle buffer")
+    try:
+        read_pairs(sizes, buf, n, "sizes")
+        read_pairs(positions, buf + 2 * n, n, "positions")
+        with nogil:
+            status = rpack_bbox_size(buf, buf + 2 * n, n, &width, &height)
+        check_status(status)
+    finally:
+        PyMem_Free(buf)
+    return width, height
 
 
 def packing_density(sizes, positions) -> float:
     """Return packing density of packed rectangles.
 
-    Useful for evaluating the result of :py:func:`rpack.pack`.
+    Useful for evaluating the result of :py:func:`rpack.pack`.  A
+    :py:class:`rpack.Packer` also tells it, see its ``metrics``.
 
     Example::
 
@@ -525,10 +842,12 @@ def packing_density(sizes, positions) -> float:
         >>> packing_density(sizes, positions)
         0.8279279279279279
 
-    :param sizes: List of rectangle sizes (width, height).
+    :param sizes: List of rectangle sizes (width, height), or an
+        (n, 2) int32 or int64 buffer.
     :type sizes: List[Tuple[int, int]]
 
-    :param positions: List of rectangle positions (x, y).
+    :param positions: List of rectangle positions (x, y), or an (n, 2)
+        int32 or int64 buffer.
     :type positions: List[Tuple[int, int]]
 
     :return: Packing density as a fraction in the interval [0, 1],
@@ -537,16 +856,34 @@ def packing_density(sizes, positions) -> float:
              packing.
     :rtype: float
     """
-    w, h = bbox_size(sizes, positions)
-    area_bounding_box = w*h
-    area_rectangles = sum(w*h for w, h in sizes)
-    return area_rectangles/area_bounding_box
+    cdef:
+        Py_ssize_t n = len(sizes)
+        long *buf
+        long width, height, area
+        int status
+    buf = <long *> PyMem_Malloc(4 * (n if n > 0 else 1) * sizeof(long))
+    if not buf:
+        raise MemoryError("Failed to allocate rectangle buffer")
+    try:
+        read_pairs(sizes, buf, n, "sizes")
+        read_pairs(positions, buf + 2 * n, n, "positions")
+        with nogil:
+            status = rpack_bbox_size(buf, buf + 2 * n, n, &width, &height)
+            if status == RPACK_OK:
+                status = rpack_total_area(buf, n, &area)
+        check_status(status)
+    finally:
+        PyMem_Free(buf)
+    # Python ints divide exactly rounded, width * height may overflow
+    return <object>area / (<object>width * <object>height)
 
 
 def overlapping(sizes, positions):
     """Return indices of overlapping rectangles, else ``None``.
 
-    Mainly used for test cases.
+    Rectangles that only touch do not overlap.  The pairs are not all
+    compared: a sweep line finds the first pair in O(n log n) time
+    without the GIL, or O(n log^2 n) if some rectangles overlap.
 
     Example::
 
@@ -560,44 +897,62 @@ def overlapping(sizes, positions):
         >>> overlapping(sizes, positions)
         (0, 1)
 
-    :param sizes: List of rectangle sizes (width, height).
+    :param sizes: List of rectangle sizes (width, height), or an
+        (n, 2) int32 or int64 buffer.
     :type sizes: List[Tuple[int, int]]
 
-    :param positions: List of rectangle positions (x, y).
+    :param positions: List of rectangle positions (x, y), or an (n, 2)
+        int32 or int64 buffer.
     :type positions: List[Tuple[int, int]]
 
     :return: Return indices (i, j) if i-th and j-th rectangle overlap
-             (first case found).  Return ``None`` if no rectangles
-             overlap.
+             (the first pair i < j in the order of a double loop).
+             Return ``None`` if no rectangles overlap.
     :rtype: Union[None, Tuple[int, int]]
     """
     cdef:
-        long w1, h1, x1, y1, x1_end, y1_end
-        long w2, h2, x2, y2, x2_end, y2_end
-        bint disjoint_in_x, disjoint_in_y
         Py_ssize_t n = len(sizes)
-    for i in range(n):
-        w1, h1 = sizes[i]
-        x1, y1 = positions[i]
-        if long_add_overflows(x1, w1):
-            raise OverflowError("Rectangle x + width overflows C long")
-        if long_add_overflows(y1, h1):
-            raise OverflowError("Rectangle y + height overflows C long")
-        x1_end = x1 + w1
-        y1_end = y1 + h1
-        for j in range(n):
-            if j == i:
-                continue
-            w2, h2 = sizes[j]
-            x2, y2 = positions[j]
-            if long_add_overflows(x2, w2):
-                raise OverflowError("Rectangle x + width overflows C long")
-            if long_add_overflows(y2, h2):
-                raise OverflowError("Rectangle y + height overflows C long")
-            x2_end = x2 + w2
-            y2_end = y2 + h2
-            disjoint_in_x = (x1_end <= x2 or x2_end <= x1)
-            disjoint_in_y = (y1_end <= y2 or y2_end <= y1)
-            if not (disjoint_in_x or disjoint_in_y):
-                return (i, j)
-    return None
+        long *buf
+        size_t first, second
+        int status
+    buf = <long *> PyMem_Malloc(4 * (n if n > 0 else 1) * sizeof(long))
+    if not buf:
+        raise MemoryError("Failed to allocate rectangle buffer")
+    try:
+        read_pairs(sizes, buf, n, "sizes")
+        read_pairs(positions, buf + 2 * n, n, "positions")
+        with nogil:
+            status = rpack_overlapping(buf, buf + 2 * n, n, &first, &second)
+        check_status(status)
+    finally:
+        PyMem_Free(buf)
+    if first == <size_t>n:
+        return None
+    return (first, second)
+
+
+def pack_bins(sizes, long bin_width, long bin_height):
+    """Pack into fixed-size bins, see rpack.pack_bins."""
+    cdef:
+        Py_ssize_t i, n = len(sizes)
+        long *buf
+        size_t *bins
+        size_t n_bins
+        int status
+    buf = <long *> PyMem_Malloc(4 * (n if n > 0 else 1) * sizeof(long))
+    bins = <size_t *> PyMem_Malloc((n if n > 0 else 1) * sizeof(size_t))
+    if not buf or not bins:
+        PyMem_Free(buf)
+        PyMem_Free(bins)
+        raise MemoryError("Failed to allocate rectangle buffer")
+    try:
+        read_pairs(sizes, buf, n, "sizes")
+        with nogil:
+            status = rpack_pack_bins(buf, n, bin_width, bin_height, bins,
+                                     buf + 2 * n, &n_bins)
+        check_status(status)
+        return [(bins[i], buf[2 * n + 2 * i], buf[2 * n + 2 * i + 1])
+                for i in range(n)]
+    finally:
+        PyMem_Free(buf)
+        PyMem_Free(bins)
@@ -1,6 +1,7 @@
 """rpack build script"""
 
 import re
+import sys
 from pathlib import Path
 
 from setuptools import setup, Extension, find_packages
@@ -18,8 +19,15 @@ def package_version_from_init() -> str:
 ext_modules = [
     Extension(
         "rpack._core",
-        sources=["rpack/_core.pyx", "src/rpackcore.c"],
+        sources=[
+            "rpack/_core.pyx",
+            "src/rpackcore.c",
+            "src/rpackcore_i32.c",
+            "src/rpackcore_i128.c",
+        ],
         include_dirs=["include"],
+        extra_compile_args=[] if sys.platform == "win32" else ["-pthread"],
+        extra_link_args=[] if sys.platform == "win32" else ["-pthread"],
     ),
 ]
 for e in ext_modules:
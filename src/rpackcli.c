@@ -0,0 +1,537 @@
+/* Command-line rectangle packer
+
+Packs the rectangle sizes of a file without Python. The sizes are
+either binary (width, height) pairs of native int32 or int64 integers,
+which are memory-mapped, or text with one "width height" pair per
+line. The rectangles are kept in a single array, no memory is
+allocated per rectangle.
+
+The positions are written as binary (x, y) pairs in input order, of
+the same integer type as binary input and int64 for text input. The
+bounding box, packing density and time are reported on stdout.
+
+With -t the search stops after SECONDS and the best packing found so
+far is written, which is reported as "stopped early". With -s the
+work done by the search is counted and reported as well.
+
+Usage: rpack [-f text|i32|i64] [-o OUTPUT] [-W MAX_WIDTH]
+             [-H MAX_HEIGHT] [-j THREADS] [-t SECONDS] [-s] INPUT
+
+*/
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "rpackcore.h"
+
+#define FORMAT_TEXT 0
+#define FORMAT_I32 4
+#define FORMAT_I64 8
+
+/* Rectangles written per fwrite call */
+#define WRITE_CHUNK 4096
+
+struct options {
+    const char *input;
+    const char *output;
+    int format;
+    long max_width;
+    long max_height;
+    size_t threads;
+    double time_limit;
+    int stats;
+};
+
+/* A read-only view of the input file, memory-mapped if possible */
+struct input_map {
+    const unsigned char *data;
+    size_t size;
+};
+
+static void usage(FILE * stream)
+{
+    fprintf(stream,
+            "Usage: rpack [-f text|i32|i64] [-o OUTPUT] [-W MAX_WIDTH]\n"
+            "             [-H MAX_HEIGHT] [-j THREADS] [-t SECONDS] [-s]"
+            " INPUT\n");
+}
+
+static int parse_long(const char *text, long *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtol(text, &end, 10);
+    return errno != 0 || end == text || *end != '\0';
+}
+
+static int parse_double(const char *text, double *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtod(text, &end);
+    return errno != 0 || end == text || *end != '\0';
+}
+
+static int parse_options(int argc, char **argv, struct options *opts)
+{
+    long value;
+    int i;
+
+    opts->input = NULL;
+    opts->output = NULL;
+    opts->format = FORMAT_TEXT;
+    opts->max_width = -1;
+    opts->max_height = -1;
+    opts->threads = 1;
+    opts->time_limit = -1;
+    opts->stats = 0;
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (arg[0] != '-' || arg[1] == '\0') {
+            if (opts->input != NULL) {
+                return 1;
+            }
+            opts->input = arg;
+            continue;
+        }
+        if (strcmp(arg, "-h") == 0) {
+            usage(stdout);
+            exit(EXIT_SUCCESS);
+        }
+        if (strcmp(arg, "-s") == 0) {
+            opts->stats = 1;
+            continue;
+        }
+        if (arg[2] != '\0' || i + 1 >= argc) {
+            return 1;
+        }
+        i++;
+        switch (arg[1]) {
+        case 'f':
+            if (strcmp(argv[i], "text") == 0) {
+                opts->format = FORMAT_TEXT;
+            } else if (strcmp(argv[i], "i32") == 0) {
+                opts->format = FORMAT_I32;
+            } else if (strcmp(argv[i], "i64") == 0) {
+                opts->format = FORMAT_I64;
+            } else {
+                return 1;
+            }
+            break;
+        case 'o':
+            opts->output = argv[i];
+            break;
+        case 'W':
+            if (parse_long(argv[i], &opts->max_width)) {
+                return 1;
+            }
+            break;
+        case 'H':
+            if (parse_long(argv[i], &opts->max_height)) {
+                return 1;
+            }
+            break;
+        case 'j':
+            if (parse_long(argv[i], &value) || value < 1) {
+                return 1;
+            }
+            opts->threads = (size_t) value;
+            break;
+        case 't':
+            if (parse_double(argv[i], &opts->time_limit)
+                || !(opts->time_limit >= 0)) {
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+    return opts->input == NULL;
+}
+
+static double now(void)
+{
+#if defined(_WIN32)
+    return (double) clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#endif
+}
+
+/* Input
+   =====
+*/
+
+static int map_input(const char *path, struct input_map *map)
+{
+#if !defined(_WIN32)
+    struct stat st;
+    void *data;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+    map->size = (size_t) st.st_size;
+    map->data = NULL;
+    if (map->size > 0) {
+        data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return 1;
+        }
+        map->data = data;
+    }
+    close(fd);
+    return 0;
+#else
+    FILE *file = fopen(path, "rb");
+    unsigned char *data;
+    long size;
+    if (file == NULL) {
+        return 1;
+    }
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0
+        || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return 1;
+    }
+    data = malloc(size > 0 ? (size_t) size : 1);
+    if (data == NULL
+        || fread(data, 1, (size_t) size, file) != (size_t) size) {
+        free(data);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+    map->data = data;
+    map->size = (size_t) size;
+    return 0;
+#endif
+}
+
+static void unmap_input(struct input_map *map)
+{
+#if !defined(_WIN32)
+    if (map->data != NULL) {
+        munmap((void *) map->data, map->size);
+    }
+#else
+    free((void *) map->data);
+#endif
+    map->data = NULL;
+}
+
+/* read_binary validates the (width, height) pairs of `map` into
+   `rectangles`. Return an RPACK_* status and the failing index. */
+static int
+read_binary(const struct input_map *map, int format, Rectangle * rectangles,
+            size_t length, RectangleStats * stats, size_t *failed)
+{
+    int64_t side[2];
+    int32_t side32[2];
+    size_t i;
+    int status;
+
+    for (i = 0; i < length; i++) {
+        if (format == FORMAT_I32) {
+            memcpy(side32, map->data + i * sizeof(side32), sizeof(side32));
+            side[0] = side32[0];
+            side[1] = side32[1];
+        } else {
+            memcpy(side, map->data + i * sizeof(side), sizeof(side));
+        }
+        /* Negative sides are rejected by rectangle_init, like those
+           of the text input */
+        if (side[0] > LONG_MAX || side[0] < LONG_MIN
+            || side[1] > LONG_MAX || side[1] < LONG_MIN) {
+            status = RPACK_SIDE_OVERFLOW;
+        } else {
+            status = rectangle_init(&rectangles[i], stats, i,
+                                    (long) side[0], (long) side[1]);
+        }
+        if (status != RPACK_OK) {
+            *failed = i;
+            return status;
+        }
+    }
+    return RPACK_OK;
+}
+
+/* parse_text_pair reads "width height" at `*cursor`, separated by
+   blanks or a comma. Return 0 on success and advance `*cursor` past
+   the line, 1 at the end of the input and -1 on a syntax error. */
+static int
+parse_text_pair(const char **cursor, const char *end, long *width,
+                long *height)
+{
+    const char *p = *cursor;
+    char number[32];
+    long *values[2];
+    size_t n;
+    int k;
+
+    values[0] = width;
+    values[1] = height;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'
+                       || *p == '\n')) {
+        p++;
+    }
+    if (p == end) {
+        *cursor = p;
+        return 1;
+    }
+    for (k = 0; k < 2; k++) {
+        while (p < end && (*p == ' ' || *p == '\t' || (k == 1 && *p == ','))) {
+            p++;
+        }
+        n = 0;
+        while (p < end && n + 1 < sizeof(number)
+               && (*p == '-' || *p == '+' || (*p >= '0' && *p <= '9'))) {
+            number[n++] = *p++;
+        }
+        number[n] = '\0';
+        if (n == 0 || parse_long(number, values[k])) {
+            return -1;
+        }
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    if (p < end && *p != '\n') {
+        return -1;
+    }
+    *cursor = p;
+    return 0;
+}
+
+/* read_text validates the text pairs of `map`. With `rectangles` NULL
+   the pairs are only counted into `*length`. */
+static int
+read_text(const struct input_map *map, Rectangle * rectangles,
+          size_t *length, RectangleStats * stats, size_t *failed)
+{
+    const char *cursor = (const char *) map->data;
+    const char *end = cursor + map->size;
+    long width, height;
+    size_t i = 0;
+    int status, parsed;
+
+    while ((parsed = parse_text_pair(&cursor, end, &width, &height)) == 0) {
+        if (rectangles != NULL) {
+            status = rectangle_init(&rectangles[i], stats, i, width, height);
+            if (status != RPACK_OK) {
+                *failed = i;
+                return status;
+            }
+        }
+        i++;
+    }
+    if (parsed < 0) {
+        *failed = i;
+        return -1;
+    }
+    *length = i;
+    return RPACK_OK;
+}
+
+/* Output
+   ======
+*/
+
+static int
+write_positions(const char *path, int format, Rectangle * rectangles,
+                size_t length)
+{
+    int64_t chunk64[2 * WRITE_CHUNK];
+    int32_t chunk32[2 * WRITE_CHUNK];
+    size_t i, k, n;
+    FILE *file = fopen(path, "wb");
+
+    if (file == NULL) {
+        return 1;
+    }
+    rectangle_sort_index(rectangles, length);
+    for (i = 0; i < length; i += n) {
+        n = length - i < WRITE_CHUNK ? length - i : WRITE_CHUNK;
+        for (k = 0; k < n; k++) {
+            const Rectangle *r = &rectangles[i + k];
+            if (format == FORMAT_I32) {
+                if (r->x > INT32_MAX || r->y > INT32_MAX) {
+                    fclose(file);
+                    return 2;
+                }
+                chunk32[2 * k] = (int32_t) r->x;
+                chunk32[2 * k + 1] = (int32_t) r->y;
+            } else {
+                chunk64[2 * k] = r->x;
+                chunk64[2 * k + 1] = r->y;
+            }
+        }
+        if (format == FORMAT_I32) {
+            if (fwrite(chunk32, sizeof(int32_t), 2 * n, file) != 2 * n) {
+                fclose(file);
+                return 1;
+            }
+        } else if (fwrite(chunk64, sizeof(int64_t), 2 * n, file) != 2 * n) {
+            fclose(file);
+            return 1;
+        }
+    }
+    return fclose(file) != 0;
+}
+
+static void
+report(const Rectangle * rectangles, size_t length,
+       const RectangleStats * stats, double elapsed, int stopped)
+{
+    long width, height;
+    /* A packing of the input fits long, see rectangle_bounds */
+    rectangle_bbox(rectangles, length, &width, &height);
+    printf("rectangles: %zu\n", length);
+    printf("bbox: %ld %ld\n", width, height);
+    /* 0 for an empty input, like rpack.packing_density() */
+    printf("density: %.6f\n", length == 0 ? 0.0
+           : (double) stats->area / ((double) width * (double) height));
+    printf("time: %.6f s\n", elapsed);
+    if (stopped) {
+        printf("stopped early\n");
+    }
+}
+
+static void report_stats(const RpackStats * stats)
+{
+    const RpackCounters *c = &stats->counters;
+    printf("try_packs: %llu\n", c->try_packs);
+    printf("placed: %llu\n", c->placed);
+    printf("resumed: %llu\n", c->resumed);
+    printf("columns: %llu\n", c->columns);
+    printf("rows: %llu\n", c->rows);
+    printf("jumps: %llu\n", c->jumps);
+    printf("cuts: %llu\n", c->cuts);
+    printf("copied: %llu\n", c->copied);
+    printf("coarse_steps: %llu\n", c->coarse_steps);
+    printf("refine_probes: %llu\n", c->refine_probes);
+    printf("strategy_seconds: %.6f %.6f %.6f %.6f\n",
+           stats->strategy_seconds[0], stats->strategy_seconds[1],
+           stats->strategy_seconds[2], stats->strategy_seconds[3]);
+}
+
+int main(int argc, char **argv)
+{
+    struct options opts;
+    struct input_map map;
+    RectangleStats stats;
+    Rectangle *rectangles = NULL;
+    Packer packer;
+    size_t length = 0, failed = 0;
+    double start;
+    int status, result = EXIT_FAILURE;
+
+    if (parse_options(argc, argv, &opts)) {
+        usage(stderr);
+        return 2;
+    }
+    if (map_input(opts.input, &map)) {
+        fprintf(stderr, "rpack: %s: %s\n", opts.input, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    packer_init(&packer);
+    packer.time_limit = opts.time_limit;
+    packer.counting = opts.stats;
+    rectangle_stats_init(&stats);
+
+    if (opts.format == FORMAT_TEXT) {
+        status = read_text(&map, NULL, &length, &stats, &failed);
+    } else if (map.size % (2 * (size_t) opts.format) != 0) {
+        fprintf(stderr, "rpack: %s: size is not a multiple of %d bytes\n",
+                opts.input, 2 * opts.format);
+        goto done;
+    } else {
+        length = map.size / (2 * (size_t) opts.format);
+        status = RPACK_OK;
+    }
+    if (status == RPACK_OK && length > 0) {
+        rectangles = malloc(length * sizeof(Rectangle));
+        if (rectangles == NULL) {
+            status = RPACK_NO_MEMORY;
+        } else if (opts.format == FORMAT_TEXT) {
+            status = read_text(&map, rectangles, &length, &stats, &failed);
+        } else {
+            status = read_binary(&map, opts.format, rectangles, length,
+                                 &stats, &failed);
+        }
+    }
+    if (status < 0) {
+        fprintf(stderr, "rpack: %s: pair %zu: expected width and height\n",
+                opts.input, failed + 1);
+        goto done;
+    } else if (status != RPACK_OK) {
+        fprintf(stderr, "rpack: %s: rectangle %zu: %s\n", opts.input,
+                failed + 1, rpack_strerror(status));
+        goto done;
+    }
+    unmap_input(&map);
+
+    start = now();
+    if (length > 0) {
+        status = rectangle_bounds(&stats, &opts.max_width, &opts.max_height);
+        if (status == RPACK_OK) {
+            status = packer_pack(&packer, rectangles, length,
+                                 opts.max_width, opts.max_height,
+                                 opts.threads);
+        }
+        if (status != RPACK_OK) {
+            fprintf(stderr, "rpack: %s\n", rpack_strerror(status));
+            goto done;
+        }
+    }
+    report(rectangles, length, &stats, now() - start, packer.stopped);
+    if (opts.stats) {
+        report_stats(&packer.stats);
+    }
+
+    if (opts.output != NULL) {
+        status = write_positions(opts.output,
+                                 opts.format == FORMAT_I32 ? FORMAT_I32 :
+                                 FORMAT_I64, rectangles, length);
+        if (status == 2) {
+            fprintf(stderr, "rpack: %s: position does not fit int32\n",
+                    opts.output);
+            goto done;
+        } else if (status != 0) {
+            fprintf(stderr, "rpack: %s: %s\n", opts.output,
+                    strerror(errno));
+            goto done;
+        }
+    }
+    result = EXIT_SUCCESS;
+
+  done:
+    unmap_input(&map);
+    free(rectangles);
+    packer_destroy(&packer);
+    return result;
+}
@@ -6,12 +6,30 @@ $ indent -kr --no-tabs rpackcore.c
 
 */
 
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
 #include <stdint.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* Vector scans of the occupancy bits, picked at runtime, see jump_scan */
+#if (defined(__GNUC__) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define RPACK_X86_SCAN 1
+#include <immintrin.h>
+#endif
 
 #include "rpackcore.h"
 
@@ -19,8 +37,6 @@ $ indent -kr --no-tabs rpackcore.c
    ====
 */
 
-static Cell col_full_sentinel;
-static Cell *const COL_FULL = &col_full_sentinel;
 /* Coarse-search defaults tuned from thin-rectangle pathology benchmarks.
    The small-delta triggers cut long height scans; local refinement keeps
    the final bbox close to the best dense region. */
@@ -35,7 +51,7 @@ static Cell *const COL_FULL = &col_full_sentinel;
 #define COARSE_HIGH_TRIGGER_MULTIPLIER 32ULL
 
 static unsigned long long
-coarse_trigger_for_delta(unsigned long long base_trigger, long delta)
+coarse_trigger_for_delta(unsigned long long base_trigger, Coord delta)
 {
     unsigned long long multiplier = 0;
 
@@ -60,20 +76,33 @@ coarse_trigger_for_delta(unsigned long long base_trigger, long delta)
 }
 
 static int
-long_add_overflows(long a, long b)
+coord_add_overflows(Coord a, Coord b)
 {
-    if (b > 0 && a > LONG_MAX - b) {
+    if (b > 0 && a > COORD_MAX - b) {
         return 1;
     }
-    if (b < 0 && a < LONG_MIN - b) {
+    if (b < 0 && a < COORD_MIN - b) {
         return 1;
     }
     return 0;
 }
 
+static int
+coord_mul_overflows(Coord a, Coord b)
+{
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    if (a > 0) {
+        return b > 0 ? a > COORD_MAX / b : b < COORD_MIN / a;
+    }
+    return b > 0 ? a < COORD_MIN / b : b < COORD_MAX / a;
+}
+
+#ifndef RPACK_CELL_SOA
 /* start_pos computes the starting position of a Cell by returning the
    end position of the previous cell. */
-long start_pos(const Cell * self)
+Coord start_pos(const Cell * self)
 {
     if (self == NULL) {
         return 0;
@@ -83,19 +112,210 @@ long start_pos(const Cell * self)
         return self->prev->end_pos;
     }
 }
+#endif
 
 /* CellLink
    ========
 
    The CellLink is used to handle the Grid's rows and columns. The
-   CellLink is a doubly linked list and each cell corresponds to a row
-   or column in the grid. Each cell has an end position which all
-   together define the row and column widths. Each cell has a
+   CellLink is an ordered sequence of cells and each cell corresponds
+   to a row or column in the grid. Each cell has an end position which
+   all together define the row and column widths. Each cell has a
    `jump_index`. These indecies are used when checking if a region,
    defined by a row-cell and column-cell, is occupied or not.
 
+   By default the cells form a doubly linked list. When compiled with
+   RPACK_CELL_SOA the live cells are instead kept in order in the
+   `ends` and `jumps` arrays, so walking the cells is a linear scan,
+   and `positions` maps a jump index back to the cell's position.
+   A cut then moves the cells after the victim one step, a single
+   memmove of each array.
+
+   The rest of the file only touches cells through the CellRef
+   functions below, so both storages share the grid code.
 */
 
+#ifdef RPACK_CELL_SOA
+
+static inline CellRef cell_head(const CellLink * self)
+{
+    (void) self;
+    return 0;
+}
+
+static inline CellRef cell_next(const CellLink * self, CellRef cell)
+{
+    return cell + 1 < self->jump_index ? cell + 1 : CELL_NONE;
+}
+
+static inline Coord cell_end_pos(const CellLink * self, CellRef cell)
+{
+    return self->ends[cell];
+}
+
+static inline Coord cell_start_pos(const CellLink * self, CellRef cell)
+{
+    return cell == 0 ? 0 : self->ends[cell - 1];
+}
+
+static inline size_t cell_jump_index(const CellLink * self, CellRef cell)
+{
+    return self->jumps[cell];
+}
+
+static inline CellRef cell_by_jump_index(const CellLink * self,
+                                         size_t jump_index)
+{
+    return self->positions[jump_index];
+}
+
+/* clear_cell_link restores the CellLink to the "starting state".
+   I.e. the CellLink will only have one cell which has the full
+   size. */
+static void clear_cell_link(CellLink * self)
+{
+    self->ends[0] = self->end_pos;
+    self->jumps[0] = 0;
+    self->positions[0] = 0;
+    self->jump_index = 1;
+    return;
+}
+
+/* free_cell_link frees the memory allocated by CellLink */
+static void free_cell_link(CellLink * cell_link)
+{
+    if (cell_link == NULL) {
+        return;
+    }
+    free(cell_link->ends);
+    free(cell_link->jumps);
+    free(cell_link->positions);
+    free(cell_link);
+    return;
+}
+
+/* alloc_cell_link allocates memory for a new CellLink. `size` refers
+   to the maximum number of Cells the CellLink will contain. */
+static CellLink *alloc_cell_link(size_t size, Coord end_pos)
+{
+    CellLink *cl = NULL;
+
+    if (size == 0) {
+        size = 1;
+    }
+    if (end_pos == 0) {
+        end_pos = 1;
+    }
+    if (size > SIZE_MAX / sizeof(size_t) || size > SIZE_MAX / sizeof(Coord)) {
+        return NULL;
+    }
+
+    if ((cl = malloc(sizeof(*cl))) == NULL) {
+        return NULL;
+    }
+    cl->ends = malloc(size * sizeof(*cl->ends));
+    cl->jumps = malloc(size * sizeof(*cl->jumps));
+    cl->positions = malloc(size * sizeof(*cl->positions));
+    if (cl->ends == NULL || cl->jumps == NULL || cl->positions == NULL) {
+        free_cell_link(cl);
+        return NULL;
+    }
+    cl->size = size;
+    cl->end_pos = end_pos;
+    clear_cell_link(cl);
+    return cl;
+}
+
+/* cut will 'split' an existing Cell and insert another cell after
+   it. The end positions will be adjusted accordingly.
+
+   Return 0 on success and -1 on failure. */
+static int
+cut(CellLink * self, CellRef victim, Coord end_pos, size_t *src_i,
+    size_t *dest_i)
+{
+    size_t pos, count = self->jump_index;
+    if (count >= self->size) {
+        return -1;
+    }
+    memmove(&self->ends[victim + 1], &self->ends[victim],
+            (count - victim) * sizeof(*self->ends));
+    memmove(&self->jumps[victim + 2], &self->jumps[victim + 1],
+            (count - victim - 1) * sizeof(*self->jumps));
+    for (pos = victim + 2; pos <= count; pos++) {
+        self->positions[self->jumps[pos]] = pos;
+    }
+    self->ends[victim] = end_pos;
+    self->jumps[victim + 1] = *dest_i = count;
+    self->positions[count] = victim + 1;
+    self->jump_index++;
+
+    *src_i = self->jumps[victim];
+    return 0;
+}
+
+/* uncut undoes the most recent cut by merging the newest cell back
+   into the cell before it. */
+static void uncut(CellLink * self)
+{
+    size_t pos, count = self->jump_index;
+    CellRef cell = self->positions[count - 1];
+    assert(count > 1 && cell > 0);
+    self->ends[cell - 1] = self->ends[cell];
+    memmove(&self->ends[cell], &self->ends[cell + 1],
+            (count - cell - 1) * sizeof(*self->ends));
+    memmove(&self->jumps[cell], &self->jumps[cell + 1],
+            (count - cell - 1) * sizeof(*self->jumps));
+    for (pos = cell; pos + 1 < count; pos++) {
+        self->positions[self->jumps[pos]] = pos;
+    }
+    self->jump_index--;
+}
+
+/* resize_cell_link moves the end of the last cell to `end_pos` */
+static void resize_cell_link(CellLink * self, Coord end_pos)
+{
+    self->end_pos = end_pos;
+    self->ends[self->jump_index - 1] = end_pos;
+}
+
+#else
+
+static inline CellRef cell_head(const CellLink * self)
+{
+    return self->head;
+}
+
+static inline CellRef cell_next(const CellLink * self, CellRef cell)
+{
+    (void) self;
+    return cell->next;
+}
+
+static inline Coord cell_end_pos(const CellLink * self, CellRef cell)
+{
+    (void) self;
+    return cell->end_pos;
+}
+
+static inline Coord cell_start_pos(const CellLink * self, CellRef cell)
+{
+    (void) self;
+    return start_pos(cell);
+}
+
+static inline size_t cell_jump_index(const CellLink * self, CellRef cell)
+{
+    (void) self;
+    return cell->jump_index;
+}
+
+static inline CellRef cell_by_jump_index(const CellLink * self,
+                                         size_t jump_index)
+{
+    return &self->cells[jump_index];
+}
+
 /* clear_cell_link restores the CellLink to the "starting state".
    I.e. the CellLink will only have one cell which has the full
    size. */
@@ -128,7 +348,7 @@ static void free_cell_link(CellLink * cell_link)
    to the maximum number of Cells the CellLink will contain. They are
    all allocated at this step, but only added to the linked-list when
    `cut` is called. */
-static CellLink *alloc_cell_link(size_t size, long end_pos)
+static CellLink *alloc_cell_link(size_t size, Coord end_pos)
 {
     CellLink *cl = NULL;
     Cell *cells = NULL;
@@ -163,7 +383,7 @@ static CellLink *alloc_cell_link(size_t size, long end_pos)
 
    Return 0 on success and -1 on failure. */
 static int
-cut(CellLink * self, Cell * victim, long end_pos, size_t *src_i,
+cut(CellLink * self, Cell * victim, Coord end_pos, size_t *src_i,
     size_t *dest_i)
 {
     Cell *new_cell = NULL;
@@ -187,6 +407,34 @@ cut(CellLink * self, Cell * victim, long end_pos, size_t *src_i,
     return 0;
 }
 
+/* uncut undoes the most recent cut by merging the newest cell back
+   into the cell before it. */
+static void uncut(CellLink * self)
+{
+    Cell *cell = &self->cells[self->jump_index - 1];
+    Cell *victim = cell->prev;
+    assert(self->jump_index > 1 && victim != NULL);
+    victim->end_pos = cell->end_pos;
+    victim->next = cell->next;
+    if (cell->next != NULL) {
+        cell->next->prev = victim;
+    }
+    self->jump_index--;
+}
+
+/* resize_cell_link moves the end of the last cell to `end_pos` */
+static void resize_cell_link(CellLink * self, Coord end_pos)
+{
+    Cell *cell = self->head;
+    while (cell->next != NULL) {
+        cell = cell->next;
+    }
+    self->end_pos = end_pos;
+    cell->end_pos = end_pos;
+}
+
+#endif
+
 // =================================
 
 /* JumpMatrix
@@ -194,788 +442,5822 @@ cut(CellLink * self, Cell * victim, long end_pos, size_t *src_i,
 
    The JumpMatrix works like a look-up table to check if a region
    defined by a row-cell and column-cell is free or not. If an element
-   is NULL that region is free, else occupied.
+   is JUMP_FREE that region is free, else occupied. An occupied element
+   holds the jump_index + 1 of the next row cell to test, or
+   JUMP_COL_FULL if the rest of the column is occupied.
+
+   The elements are row indices rather than Cell pointers. They are
+   stored in 16 bits when the grid is small enough and 32 bits
+   otherwise, which is a quarter or half the size of a pointer.
+
+   Small matrices are one flat row-major array. Larger ones are split
+   in JUMP_TILE x JUMP_TILE tiles which are allocated the first time
+   `copy_row` or `copy_col` writes to them. Only elements of rows and
+   columns that have been cut are ever read, so memory grows with the
+   cuts made rather than with the grid size, and a column copy walks a
+   tile at a time.
+
+   Next to the elements the matrix keeps an occupancy bit per element,
+   a bitset over the rows of each column. The free checks of
+   grid_find_region read the bit and only load the element of an
+   occupied cell to follow its jump. The bitsets are 1/16 the size of
+   the narrow elements, so the column being searched stays in cache.
+   Flat matrices allocate every column's bitset up front, tiled ones
+   when the column is reserved.
+
+   The bits of a column are kept in spatial order, top row first, so
+   the free rows below a cell are a run of zero bits. grid_find_region
+   skips such a run with one scan for the next set bit, see jump_scan,
+   64 rows per word and 128 or 256 per vector compare where the CPU
+   has SSE2 or AVX2. A row taken back by grid_resume leaves a gap, a
+   slot the scans mask out with the `live` bitset, and the next row cut
+   right above it reuses the slot. Other cuts move the slots down to
+   the next gap by one, see copy_row. An uncut so clears one bit and
+   most cuts write one bit per column.
 */
 
-/* alloc_jump_matrix allocates memory for a new JumpMatrix */
-static JumpMatrix alloc_jump_matrix(size_t size)
+#define JUMP_NARROW_MAX (UINT16_MAX - 1)
+#define JUMP_WIDE_MAX (UINT32_MAX - 1)
+#define JUMP_FLAT_MAX 2048
+#define JUMP_TILE 64
+#define JUMP_WORD_BITS 64
+
+/* bits_ctz returns the index of the lowest set bit of `word` != 0 */
+static inline unsigned bits_ctz(uint64_t word)
 {
-    size_t i, len = 0;
-    size_t row_ptr_bytes = 0;
-    size_t matrix_size = 0;
-    size_t matrix_bytes = 0;
-    Cell **ptr, ***arr;
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned) __builtin_ctzll(word);
+#else
+    static const unsigned char debruijn[64] = {
+        0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6
+    };
+    return debruijn[((word & (~word + 1)) * 0x03f79d71b4cb0a89ULL) >> 58];
+#endif
+}
 
-    if (size == 0) {
-        size = 1;
+/* bits_scan_tail finishes a scan for the first bit in [from, end)
+   set in both `bits` and `mask` from word `i`, no word before it has
+   one */
+static inline size_t
+bits_scan_tail(const uint64_t * bits, const uint64_t * mask, size_t i,
+               size_t end)
+{
+    size_t last = (end - 1) / JUMP_WORD_BITS, k;
+    for (; i <= last; i++) {
+        if ((bits[i] & mask[i]) != 0) {
+            k = i * JUMP_WORD_BITS + bits_ctz(bits[i] & mask[i]);
+            return k < end ? k : end;
+        }
     }
+    return end;
+}
 
-    if (size > SIZE_MAX / sizeof(Cell **)) {
-        return NULL;
+/* bits_scan returns the index of the first bit in [from, end) set in
+   both `bits` and `mask`, or `end` if there is none. One word at a
+   time. */
+static size_t
+bits_scan(const uint64_t * bits, const uint64_t * mask, size_t from,
+          size_t end)
+{
+    size_t i = from / JUMP_WORD_BITS;
+    uint64_t word;
+    if (from >= end) {
+        return end;
     }
-    row_ptr_bytes = sizeof(Cell **) * size;
-
-    if (size > SIZE_MAX / size) {
-        return NULL;
+    word = bits[i] & mask[i] & (~(uint64_t) 0 << (from % JUMP_WORD_BITS));
+    if (word != 0) {
+        from = i * JUMP_WORD_BITS + bits_ctz(word);
+        return from < end ? from : end;
     }
-    matrix_size = size * size;
+    return bits_scan_tail(bits, mask, i + 1, end);
+}
 
-    if (matrix_size > SIZE_MAX / sizeof(Cell *)) {
-        return NULL;
+#ifdef RPACK_X86_SCAN
+/* bits_scan_sse2 works like bits_scan, two words per compare */
+__attribute__((target("sse2")))
+static size_t
+bits_scan_sse2(const uint64_t * bits, const uint64_t * mask, size_t from,
+               size_t end)
+{
+    size_t i = from / JUMP_WORD_BITS, n_words;
+    __m128i zero = _mm_setzero_si128(), v;
+    uint64_t word;
+    if (from >= end) {
+        return end;
     }
-    matrix_bytes = sizeof(Cell *) * matrix_size;
-
-    if (row_ptr_bytes > SIZE_MAX - matrix_bytes) {
-        return NULL;
+    word = bits[i] & mask[i] & (~(uint64_t) 0 << (from % JUMP_WORD_BITS));
+    if (word != 0) {
+        from = i * JUMP_WORD_BITS + bits_ctz(word);
+        return from < end ? from : end;
     }
-    len = row_ptr_bytes + matrix_bytes;
-    if ((arr = (Cell ***) malloc(len)) == NULL) {
-        return NULL;
+    n_words = (end - 1) / JUMP_WORD_BITS + 1;
+    for (i++; i + 2 <= n_words; i += 2) {
+        v = _mm_and_si128(_mm_loadu_si128((const __m128i *) &bits[i]),
+                          _mm_loadu_si128((const __m128i *) &mask[i]));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) {
+            break;
+        }
     }
+    return bits_scan_tail(bits, mask, i, end);
+}
 
-    /* Ptr is now pointing to the first element in of 2D array  */
-    ptr = (Cell **) (arr + size);
-
-    /* For loop to point rows pointer to appropriate location in 2D array  */
-    for (i = 0; i < size; i++) {
-        arr[i] = (ptr + size * i);
+/* bits_scan_avx2 works like bits_scan, four words per compare */
+__attribute__((target("avx2")))
+static size_t
+bits_scan_avx2(const uint64_t * bits, const uint64_t * mask, size_t from,
+               size_t end)
+{
+    size_t i = from / JUMP_WORD_BITS, n_words;
+    uint64_t word;
+    if (from >= end) {
+        return end;
+    }
+    word = bits[i] & mask[i] & (~(uint64_t) 0 << (from % JUMP_WORD_BITS));
+    if (word != 0) {
+        from = i * JUMP_WORD_BITS + bits_ctz(word);
+        return from < end ? from : end;
+    }
+    n_words = (end - 1) / JUMP_WORD_BITS + 1;
+    for (i++; i + 4 <= n_words; i += 4) {
+        if (!_mm256_testz_si256
+            (_mm256_loadu_si256((const __m256i *) &bits[i]),
+             _mm256_loadu_si256((const __m256i *) &mask[i]))) {
+            break;
+        }
     }
-    arr[0][0] = NULL;
-    return arr;
+    return bits_scan_tail(bits, mask, i, end);
 }
+#endif
 
-/* copy_row copies a range of elements decided by `jump_index_col`
-   from src-row to dest-row. */
-static void
-copy_row(JumpMatrix self, size_t src_i, size_t dest_i,
-         size_t jump_index_col)
+/* bits_scan_select returns the widest scan the CPU supports */
+static BitsScanFunc bits_scan_select(void)
 {
-    size_t index = 0;
-    for (index = 0; index < jump_index_col; index++) {
-        self[dest_i][index] = self[src_i][index];
+#ifdef RPACK_X86_SCAN
+    if (__builtin_cpu_supports("avx2")) {
+        return bits_scan_avx2;
     }
+    if (__builtin_cpu_supports("sse2")) {
+        return bits_scan_sse2;
+    }
+#endif
+    return bits_scan;
 }
 
-/* copy_col copies a range of elements decided by `jump_index_row`
-   from src-col to dest-col. */
-static void
-copy_col(JumpMatrix self, size_t src_i, size_t dest_i,
-         size_t jump_index_row)
+/* bits_popcount returns the number of set bits of `word` */
+static inline unsigned bits_popcount(uint64_t word)
 {
-    size_t index = 0;
-    for (index = 0; index < jump_index_row; index++) {
-        self[index][dest_i] = self[index][src_i];
-    }
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned) __builtin_popcountll(word);
+#else
+    word -= word >> 1 & 0x5555555555555555ULL;
+    word = (word & 0x3333333333333333ULL)
+        + (word >> 2 & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (unsigned) ((word * 0x0101010101010101ULL) >> 56);
+#endif
 }
 
-/* Grid
-   ====
+/* bits_get returns bit `pos` of `bits` */
+static inline unsigned bits_get(const uint64_t * bits, size_t pos)
+{
+    return (unsigned) (bits[pos / JUMP_WORD_BITS] >> (pos % JUMP_WORD_BITS))
+        & 1;
+}
 
-   The Grid contains two CellLinks - one for rows and one for
-   columns. It also contains a JumpMatrix to keep track of which
-   regions are free or not.
-*/
+/* bits_put sets bit `pos` of `bits` to `bit` */
+static inline void bits_put(uint64_t * bits, size_t pos, unsigned bit)
+{
+    uint64_t *word = &bits[pos / JUMP_WORD_BITS];
+    uint64_t mask = (uint64_t) 1 << (pos % JUMP_WORD_BITS);
+    *word = (*word & ~mask) | ((uint64_t) bit << (pos % JUMP_WORD_BITS));
+}
 
-/* grid_alloc allocates memory for a new Grid */
-Grid *grid_alloc(size_t size, long width, long height)
+/* bits_count returns the number of set bits in [from, end) */
+static size_t bits_count(const uint64_t * bits, size_t from, size_t end)
 {
-    Grid *grid = NULL;
-    if ((grid = malloc(sizeof(*grid))) == NULL) {
-        return NULL;
+    size_t i = from / JUMP_WORD_BITS, last, n;
+    uint64_t word;
+    if (from >= end) {
+        return 0;
     }
-    if (size == 0) {
-        size = 1;
+    last = (end - 1) / JUMP_WORD_BITS;
+    word = bits[i] & (~(uint64_t) 0 << (from % JUMP_WORD_BITS));
+    for (n = 0; i < last; word = bits[++i]) {
+        n += bits_popcount(word);
     }
-    grid->size = size;
-    grid->width = width;
-    grid->height = height;
-    grid->cols = NULL;
-    grid->rows = NULL;
-    grid->jump_matrix = NULL;
+    return n + bits_popcount(word & (~(uint64_t) 0
+                                     >> (JUMP_WORD_BITS - 1
+                                         - (end - 1) % JUMP_WORD_BITS)));
+}
 
-    if ((grid->cols = alloc_cell_link(size, width)) == NULL) {
-        grid_free(grid);
-        return NULL;
+/* bits_scan_clear returns the index of the first clear bit in
+   [from, end), or `end` if there is none */
+static size_t
+bits_scan_clear(const uint64_t * bits, size_t from, size_t end)
+{
+    size_t i = from / JUMP_WORD_BITS;
+    uint64_t word;
+    if (from >= end) {
+        return end;
     }
-    if ((grid->rows = alloc_cell_link(size, height)) == NULL) {
-        grid_free(grid);
-        return NULL;
+    word = ~bits[i] & (~(uint64_t) 0 << (from % JUMP_WORD_BITS));
+    while (word == 0 && ++i <= (end - 1) / JUMP_WORD_BITS) {
+        word = ~bits[i];
     }
-    if ((grid->jump_matrix = alloc_jump_matrix(size)) == NULL) {
-        grid_free(grid);
-        return NULL;
+    if (word == 0) {
+        return end;
     }
+    from = i * JUMP_WORD_BITS + bits_ctz(word);
+    return from < end ? from : end;
+}
 
-    return grid;
+/* bits_shift moves the bits [from, to) one up to [from + 1, to],
+   bit `from` keeps its value */
+static void bits_shift(uint64_t * bits, size_t from, size_t to)
+{
+    size_t first = from / JUMP_WORD_BITS, last = to / JUMP_WORD_BITS, i;
+    uint64_t word, mask;
+    for (i = last;; i--) {
+        word = bits[i] << 1;
+        if (i > first) {
+            word |= bits[i - 1] >> (JUMP_WORD_BITS - 1);
+        }
+        mask = ~(uint64_t) 0;
+        if (i == last) {
+            mask >>= JUMP_WORD_BITS - 1 - to % JUMP_WORD_BITS;
+        }
+        if (i == first) {
+            mask &= ~(uint64_t) 0 << (from % JUMP_WORD_BITS) << 1;
+            bits[i] = (bits[i] & ~mask) | (word & mask);
+            return;
+        }
+        bits[i] = (bits[i] & ~mask) | (word & mask);
+    }
 }
 
-/* grid_free frees the memory allocated by Grid  */
-void grid_free(Grid * grid)
+/* bits_shift_cols works like bits_shift on each of the `n_cols`
+   bitsets `cols` */
+static void
+bits_shift_cols(uint64_t * const *cols, size_t n_cols, size_t from,
+                size_t to)
 {
-    if (grid == NULL) {
+    size_t i = from / JUMP_WORD_BITS, c;
+    uint64_t mask, *word;
+    if (i != to / JUMP_WORD_BITS) {
+        for (c = 0; c < n_cols; c++) {
+            bits_shift(cols[c], from, to);
+        }
         return;
     }
-    if (grid->cols != NULL) {
-        free_cell_link(grid->cols);
-    }
-    if (grid->rows != NULL) {
-        free_cell_link(grid->rows);
+    /* Within a word, as most moves are */
+    mask = ~(uint64_t) 0 >> (JUMP_WORD_BITS - 1 - to % JUMP_WORD_BITS)
+        & ~(uint64_t) 0 << (from % JUMP_WORD_BITS) << 1;
+    for (c = 0; c < n_cols; c++) {
+        word = &cols[c][i];
+        *word = (*word & ~mask) | (*word << 1 & mask);
     }
-    if (grid->jump_matrix != NULL) {
-        free(grid->jump_matrix);
+}
+
+/* jump_elem returns a pointer to the element at row `row_i` and
+   column `col_i`. The tile must have been reserved. */
+static inline char *jump_elem(const JumpMatrix * self, size_t row_i,
+                              size_t col_i)
+{
+    char *tile;
+    size_t i;
+    if (self->data != NULL) {
+        tile = self->data;
+        i = row_i * self->size + col_i;
+    } else {
+        tile = self->tiles[row_i / JUMP_TILE * self->n_tiles
+                           + col_i / JUMP_TILE];
+        i = row_i % JUMP_TILE * JUMP_TILE + col_i % JUMP_TILE;
     }
-    free(grid);
+    return tile + i * self->elem_size;
 }
 
-/* grid_clear clears the CellLinks and JumpMatrix to "start state" */
-void grid_clear(Grid * self)
+/* jump_get returns the element at row `row_i` and column `col_i` */
+static inline JumpIndex
+jump_get(const JumpMatrix * self, size_t row_i, size_t col_i)
 {
-    if (self == NULL) {
-        return;
+    const char *elem = jump_elem(self, row_i, col_i);
+    uint16_t value;
+    if (self->wide) {
+        return *(const uint32_t *) elem;
     }
-    self->cols->end_pos = self->width;
-    clear_cell_link(self->cols);
-    self->rows->end_pos = self->height;
-    clear_cell_link(self->rows);
-    self->jump_matrix[0][0] = NULL;
+    value = *(const uint16_t *) elem;
+    return value == UINT16_MAX ? JUMP_COL_FULL : value;
 }
 
-/* grid_split will split the grid by cutting a column and a row in two
-   in such a way that the region `reg` will fit the grid.
+/* jump_free_at checks if the element at slot `pos` and column
+   `col_i` is JUMP_FREE, from its occupancy bit */
+static inline int
+jump_free_at(const JumpMatrix * self, size_t pos, size_t col_i)
+{
+    return !bits_get(self->occupied[col_i], pos);
+}
 
-   Return 0 on success and -1 on failure. */
-int grid_split(Grid * self, Region * reg)
+/* jump_free checks if the element at row `row_i` and column `col_i`
+   is JUMP_FREE, from its occupancy bit */
+static inline int
+jump_free(const JumpMatrix * self, size_t row_i, size_t col_i)
 {
-    size_t src_i, dest_i;
-    Cell *r_cell = NULL;
-    Cell *c_cell = NULL;
-    Cell *jump_target = NULL;
-    assert(reg->row_end_pos <= reg->row_cell->end_pos);
-    assert(reg->col_end_pos <= reg->col_cell->end_pos);
-
-    if (reg->row_end_pos < reg->row_cell->end_pos) {
-        if (cut(self->rows, reg->row_cell, reg->row_end_pos, &src_i, &dest_i)
-            != 0) {
-            return -1;
-        }
-        copy_row(self->jump_matrix, src_i, dest_i, self->cols->jump_index);
-    }
+    return jump_free_at(self, self->row_pos[row_i], col_i);
+}
 
-    if (reg->col_end_pos < reg->col_cell->end_pos) {
-        if (cut(self->cols, reg->col_cell, reg->col_end_pos, &src_i, &dest_i)
-            != 0) {
-            return -1;
-        }
-        copy_col(self->jump_matrix, src_i, dest_i, self->rows->jump_index);
+/* jump_scan returns the first row slot at or below slot `from` whose
+   element in column `col_i` is not JUMP_FREE, or `n_slots` if there
+   is none. The bits of gaps are masked out by `live`. Most free runs
+   end within the word of `from`, only longer ones go on to the vector
+   scan. */
+static inline size_t
+jump_scan(const JumpMatrix * self, size_t col_i, size_t from)
+{
+    const uint64_t *bits = self->occupied[col_i];
+    size_t i = from / JUMP_WORD_BITS;
+    uint64_t word;
+    if (from >= self->n_slots) {
+        return self->n_slots;
+    }
+    word = (bits[i] & self->live[i]) >> (from % JUMP_WORD_BITS);
+    if (word != 0) {
+        from += bits_ctz(word);
+        return from < self->n_slots ? from : self->n_slots;
+    }
+    if ((i + 1) * JUMP_WORD_BITS >= self->n_slots) {
+        return self->n_slots;
     }
+    return self->scan(bits, self->live, (i + 1) * JUMP_WORD_BITS,
+                      self->n_slots);
+}
 
-    /* Compute jump_target */
-    if (reg->row_cell->next == NULL) {
-        assert(reg->row_cell->end_pos == self->height);
-        jump_target = COL_FULL;
+/* jump_set sets the element at row `row_i` and column `col_i` */
+static inline void
+jump_set(JumpMatrix * self, size_t row_i, size_t col_i, JumpIndex value)
+{
+    char *elem = jump_elem(self, row_i, col_i);
+    if (self->wide) {
+        *(uint32_t *) elem = value;
     } else {
-        jump_target = reg->row_cell->next;
+        *(uint16_t *) elem = (uint16_t) value;
     }
+    bits_put(self->occupied[col_i], self->row_pos[row_i],
+             value != JUMP_FREE);
+}
 
-    for (r_cell = reg->row_cell_start; r_cell != NULL;
-         r_cell = r_cell->next) {
-        assert(self->jump_matrix[r_cell->jump_index]
-               [reg->col_cell_start->jump_index] == NULL);
-        self->jump_matrix[r_cell->jump_index][reg->
-                                              col_cell_start->jump_index] =
-            jump_target;
-        if (r_cell == reg->row_cell) {
-            break;
-        }
-    }
+/* jump_reserve allocates the tile holding the element at row `row_i`
+   and column `col_i`, unless already done.
 
-    if (reg->col_cell_start == reg->col_cell) {
+   Return 0 on success and -1 on failure. */
+static int jump_reserve(JumpMatrix * self, size_t row_i, size_t col_i)
+{
+    void **tile;
+    if (self->data != NULL) {
         return 0;
     }
-
-    for (c_cell = reg->col_cell_start->next; c_cell != NULL;
-         c_cell = c_cell->next) {
-        assert(self->jump_matrix[reg->row_cell_start->jump_index]
-               [c_cell->jump_index] == NULL);
-        self->jump_matrix[reg->row_cell_start->
-                          jump_index][c_cell->jump_index] = jump_target;
-        if (c_cell == reg->col_cell) {
-            break;
-        }
+    if (self->occupied[col_i] == NULL
+        && (self->occupied[col_i] =
+            malloc(self->n_words * sizeof(uint64_t))) == NULL) {
+        return -1;
+    }
+    tile = &self->tiles[row_i / JUMP_TILE * self->n_tiles
+                        + col_i / JUMP_TILE];
+    if (*tile != NULL) {
+        return 0;
+    }
+    if ((*tile = malloc(JUMP_TILE * JUMP_TILE * self->elem_size)) == NULL) {
+        return -1;
     }
+    self->tiles_allocated++;
     return 0;
 }
 
-/* grid_find_region searches the grid for a free space that can
-   contain the region `reg`. */
-long grid_find_region(Grid * grid, const Rectangle * rectangle, Region * reg)
+/* free_jump_matrix frees the memory allocated by JumpMatrix */
+static void free_jump_matrix(JumpMatrix * self)
 {
-    long rec_col_end_pos, rec_row_end_pos;
-    long delta = rectangle->height;
-    long tmp;
-    Cell *col_cell_start = NULL;
-    Cell *col_cell = NULL;
-    Cell *row_cell_start = NULL;
-    Cell *row_cell = NULL;
+    size_t i;
+    if (self == NULL) {
+        return;
+    }
+    if (self->tiles != NULL) {
+        for (i = 0; i < self->n_tiles * self->n_tiles; i++) {
+            free(self->tiles[i]);
+        }
+        free(self->tiles);
+    }
+    if (self->occupied != NULL && self->occupied_data == NULL) {
+        for (i = 0; i < self->size; i++) {
+            free(self->occupied[i]);
+        }
+    }
+    free(self->occupied);
+    free(self->occupied_data);
+    free(self->live);
+    free(self->row_at);
+    free(self->row_pos);
+    free(self->data);
+    free(self);
+}
 
-    Cell *jump_first = NULL;
-    Cell *jump_target = NULL;
+/* alloc_jump_matrix_layout allocates memory for a new JumpMatrix with
+   32-bit elements if `wide` is set and 16-bit elements otherwise, in
+   tiles if `tiled` is set and as one array otherwise. */
+static JumpMatrix *alloc_jump_matrix_layout(size_t size, int wide,
+                                            int tiled)
+{
+    size_t n_tiles = 0, i;
+    size_t elem_size = wide ? sizeof(uint32_t) : sizeof(uint16_t);
+    JumpMatrix *jm = NULL;
 
-    /* Loop over columns */
-    rec_col_end_pos = rectangle->width;
-    col_cell_start = grid->cols->head;
-    while (col_cell_start != NULL) {
+    if (size == 0) {
+        size = 1;
+    }
+    /* Element values go up to `size` and must not reach the
+       sentinel */
+    if (size > (wide ? JUMP_WIDE_MAX : JUMP_NARROW_MAX)) {
+        return NULL;
+    }
+    if ((jm = malloc(sizeof(*jm))) == NULL) {
+        return NULL;
+    }
+    jm->size = size;
+    jm->wide = wide;
+    jm->elem_size = elem_size;
+    jm->n_tiles = 0;
+    jm->tiles_allocated = 0;
+    jm->tiles = NULL;
+    jm->data = NULL;
+    /* Room for a gap per row before copy_row compacts the slots */
+    jm->max_slots = 2 * size;
+    jm->n_words = jm->max_slots / JUMP_WORD_BITS
+        + (jm->max_slots % JUMP_WORD_BITS != 0);
+    jm->occupied = NULL;
+    jm->occupied_data = NULL;
+    jm->n_slots = 1;
+    jm->live = NULL;
+    jm->row_at = NULL;
+    jm->row_pos = NULL;
+    jm->scan = bits_scan_select();
 
-        /* Loop over rows */
-        rec_row_end_pos = rectangle->height;
-        row_cell_start = row_cell = grid->rows->head;
-        jump_first = NULL;
-        while (row_cell_start != NULL) {
+    if (size > SIZE_MAX / 2 / sizeof(size_t)
+        || (jm->occupied = calloc(size, sizeof(uint64_t *))) == NULL
+        || (jm->live = calloc(jm->n_words, sizeof(uint64_t))) == NULL
+        || (jm->row_at = malloc(jm->max_slots * sizeof(size_t))) == NULL
+        || (jm->row_pos = malloc(size * sizeof(size_t))) == NULL) {
+        free_jump_matrix(jm);
+        return NULL;
+    }
+    jm->live[0] = 1;
+    /* Rows not inserted yet keep their own index in range */
+    for (i = 0; i < size; i++) {
+        jm->row_at[i] = jm->row_pos[i] = i;
+    }
+    if (tiled) {
+        n_tiles = size / JUMP_TILE + (size % JUMP_TILE != 0);
+        if (n_tiles > SIZE_MAX / n_tiles
+            || (jm->tiles = calloc(n_tiles * n_tiles, sizeof(void *)))
+            == NULL) {
+            free_jump_matrix(jm);
+            return NULL;
+        }
+        jm->n_tiles = n_tiles;
+    } else if (size > SIZE_MAX / size || size * size > SIZE_MAX / elem_size
+               || (jm->data = malloc(size * size * elem_size)) == NULL
+               || (jm->occupied_data =
+                   malloc(size * jm->n_words * sizeof(uint64_t))) == NULL) {
+        free_jump_matrix(jm);
+        return NULL;
+    } else {
+        for (i = 0; i < size; i++) {
+            jm->occupied[i] = jm->occupied_data + i * jm->n_words;
+        }
+    }
 
-            /* Check if cell is free. The cell is free if the
-               jump_matrix element is NULL. If not NULL, it is a
-               pointer to the next row cell to test. This is an
-               optimization to prevent checking cells we already know
-               are not free.  */
-            jump_target =
-                grid->jump_matrix[row_cell->
-                                  jump_index][col_cell_start->jump_index];
+    if (jump_reserve(jm, 0, 0) != 0) {
+        free_jump_matrix(jm);
+        return NULL;
+    }
+    jump_set(jm, 0, 0, JUMP_FREE);
+    return jm;
+}
 
-            if (jump_target != NULL) {
-                if (jump_first == NULL) {
-                    jump_first = row_cell;
-                } else {
-                    /* This is an optimization to make bigger jumps */
-                    grid->jump_matrix[jump_first->jump_index]
-                        [col_cell_start->jump_index] = jump_target;
-                }
-            }
+/* alloc_jump_matrix allocates memory for a new JumpMatrix using the
+   narrowest element type that can index `size` cells. */
+static JumpMatrix *alloc_jump_matrix(size_t size)
+{
+    return alloc_jump_matrix_layout(size, size > JUMP_NARROW_MAX,
+                                    size > JUMP_FLAT_MAX);
+}
 
-            /* Column full. Abort this column. */
-            if (jump_target == COL_FULL) {
-                break;
-            }
+/* clear_jump_matrix restores the matrix to one free row and column */
+static void clear_jump_matrix(JumpMatrix * self)
+{
+    self->n_slots = 1;
+    self->live[0] = 1;
+    self->row_at[0] = 0;
+    self->row_pos[0] = 0;
+    jump_set(self, 0, 0, JUMP_FREE);
+}
 
-            /* Normal jump */
-            if (jump_target != NULL) {
-                row_cell = row_cell_start = jump_target;
-                if (long_add_overflows(row_cell->prev->end_pos,
-                                       rectangle->height)) {
-                    /* Later rows in this column only start higher, so an
-                       overflow here means this column cannot fit the
-                       rectangle in C-long coordinates. */
-                    break;
-                }
-                rec_row_end_pos =
-                    row_cell->prev->end_pos + rectangle->height;
-                continue;
-            }
+/* compact_rows moves the rows up over the gaps, in the bits of the
+   first `jump_index_col` columns */
+static void compact_rows(JumpMatrix * self, size_t jump_index_col)
+{
+    size_t col_i, k, n = 0;
+    for (k = 0; k < self->n_slots; k++) {
+        if (!bits_get(self->live, k)) {
+            continue;
+        }
+        for (col_i = 0; col_i < jump_index_col; col_i++) {
+            bits_put(self->occupied[col_i], n,
+                     bits_get(self->occupied[col_i], k));
+        }
+        bits_put(self->live, n, 1);
+        self->row_at[n] = self->row_at[k];
+        self->row_pos[self->row_at[n]] = n;
+        n++;
+    }
+    for (k = n; k < self->n_slots; k++) {
+        bits_put(self->live, k, 0);
+    }
+    self->n_slots = n;
+}
 
-            /* Free slot. Reset jump_first. */
-            jump_first = NULL;
-
-            /* Rectangle hight still doesn't fit; continue search */
-            if (row_cell->end_pos < rec_row_end_pos) {
-                row_cell = row_cell->next;
-                if (row_cell == NULL) {
-                    /* No more rows. Abort. */
-                    if ((tmp = rec_row_end_pos - grid->height) < delta) {
-                        delta = tmp;
-                    }
-                    break;
-                }
-                continue;
-            }
+/* copy_row copies a range of elements decided by `jump_index_col`
+   from src-row to dest-row, a row that is not in the matrix yet. The
+   dest-row is inserted right below the src-row, as a cut does.
 
-            /* Free row-range found. Now we need to search column-wise
-               to check if free space is available in that direction
-               as well. */
-            col_cell = col_cell_start;
-            while (col_cell != NULL) {
-                jump_target =
-                    grid->
-                    jump_matrix[row_cell_start->jump_index][col_cell->
-                                                            jump_index];
-                if (jump_target != NULL) {
-                    break;
-                }
-                if (rec_col_end_pos <= col_cell->end_pos) {
-                    /* Free region found */
-                    reg->row_cell_start = row_cell_start;
-                    reg->row_cell = row_cell;
-                    reg->row_end_pos = rec_row_end_pos;
-                    reg->col_cell_start = col_cell_start;
-                    reg->col_cell = col_cell;
-                    reg->col_end_pos = rec_col_end_pos;
-                    return delta;
-                }
-                col_cell = col_cell->next;
-            }
-            /* Todo: Consider removing this break to continue the
-               search further down the row. */
-            break;
+   Return 0 on success and -1 on failure. */
+static int
+copy_row(JumpMatrix * self, size_t src_i, size_t dest_i,
+         size_t jump_index_col)
+{
+    size_t col_i, n, pos, gap, k;
+    for (col_i = 0; col_i < jump_index_col; col_i += n) {
+        n = jump_index_col - col_i;
+        if (self->data == NULL && n > JUMP_TILE - col_i % JUMP_TILE) {
+            n = JUMP_TILE - col_i % JUMP_TILE;
         }
-
-        /* Prepare new iteration */
-        if (long_add_overflows(col_cell_start->end_pos, rectangle->width)) {
-            break;
+        if (jump_reserve(self, dest_i, col_i) != 0) {
+            return -1;
+        }
+        memcpy(jump_elem(self, dest_i, col_i), jump_elem(self, src_i, col_i),
+               n * self->elem_size);
+    }
+    for (col_i = 0; self->data == NULL && col_i < jump_index_col; col_i++) {
+        if (self->occupied[col_i] == NULL
+            && jump_reserve(self, dest_i, col_i) != 0) {
+            return -1;
         }
-        rec_col_end_pos = col_cell_start->end_pos + rectangle->width;
-        col_cell_start = col_cell_start->next;
+    }
 
-        /* Too wide to fit in any remaining columns. Abort. */
-        if (rec_col_end_pos > grid->width) {
-            break;
+    /* The new row takes the slot right below `src_i` if it is a gap.
+       Else the slots down to the next gap, or the end, move down. */
+    pos = self->row_pos[src_i] + 1;
+    if (pos < self->n_slots && !bits_get(self->live, pos)) {
+        gap = pos;
+    } else {
+        gap = bits_scan_clear(self->live, pos, self->n_slots);
+        if (gap == self->n_slots && gap == self->max_slots) {
+            compact_rows(self, jump_index_col);
+            pos = self->row_pos[src_i] + 1;
+            gap = self->n_slots;
+        }
+        if (gap == self->n_slots) {
+            self->n_slots++;
         }
     }
-    /* Failure! Couldn't find a free region. */
-    reg->col_cell = NULL;       /* Used as fail signal */
-    return delta;
+    /* Moving the bits from the src-row's slot on down copies its bits
+       to the new slot */
+    bits_shift_cols(self->occupied, jump_index_col, pos - 1, gap);
+    bits_shift(self->live, pos - 1, gap);
+    memmove(&self->row_at[pos + 1], &self->row_at[pos],
+            (gap - pos) * sizeof(size_t));
+    for (k = pos + 1; k <= gap; k++) {
+        self->row_pos[self->row_at[k]] = k;
+    }
+    self->row_at[pos] = dest_i;
+    self->row_pos[dest_i] = pos;
+    return 0;
 }
 
-static int
-grid_try_pack(Grid * grid, const Rectangle * sizes, long delta_init,
-              long *delta_out, long *grid_w_out)
+/* remove_row takes the row `row_i` out, leaving a gap. Its bits stay
+   behind, masked out by `live`. */
+static void remove_row(JumpMatrix * self, size_t row_i)
 {
-    size_t i = 0;
-    long delta = delta_init;
-    long d = 0;
-    long grid_w = 0;
-    Region reg;
+    bits_put(self->live, self->row_pos[row_i], 0);
+    while (!bits_get(self->live, self->n_slots - 1)) {
+        self->n_slots--;
+    }
+}
 
-    grid_clear(grid);
-    reg.col_cell = NULL;
-    for (i = 0; i < grid->size - 1; i++) {
-        d = grid_find_region(grid, &sizes[i], &reg);
-        if (d < delta) {
-            delta = d;
-        }
-        /* Break if failure */
-        if (reg.col_cell == NULL) {
-            break;
+/* copy_col copies a range of elements decided by `jump_index_row`
+   from src-col to dest-col.
+
+   Return 0 on success and -1 on failure. */
+static int
+copy_col(JumpMatrix * self, size_t src_i, size_t dest_i,
+         size_t jump_index_row)
+{
+    size_t row_i, k, n, stride;
+    char *src, *dest;
+    if (jump_reserve(self, 0, dest_i) != 0) {
+        return -1;
+    }
+    memcpy(self->occupied[dest_i], self->occupied[src_i],
+           ((self->n_slots - 1) / JUMP_WORD_BITS + 1) * sizeof(uint64_t));
+    stride = self->data != NULL ? self->size : JUMP_TILE;
+    for (row_i = 0; row_i < jump_index_row; row_i += n) {
+        n = jump_index_row - row_i;
+        if (self->data == NULL && n > JUMP_TILE) {
+            n = JUMP_TILE;
         }
-        /* Keep track of current grid width */
-        if (grid_w < reg.col_end_pos) {
-            grid_w = reg.col_end_pos;
+        if (jump_reserve(self, row_i, dest_i) != 0) {
+            return -1;
         }
-        assert(grid_w <= grid->width);
-        if (grid_split(grid, &reg) != 0) {
-            reg.col_cell = NULL;
-            break;
+        src = jump_elem(self, row_i, src_i);
+        dest = jump_elem(self, row_i, dest_i);
+        if (self->wide) {
+            for (k = 0; k < n; k++) {
+                ((uint32_t *) dest)[k * stride] =
+                    ((const uint32_t *) src)[k * stride];
+            }
+        } else {
+            for (k = 0; k < n; k++) {
+                ((uint16_t *) dest)[k * stride] =
+                    ((const uint16_t *) src)[k * stride];
+            }
         }
     }
+    return 0;
+}
 
-    if (delta_out != NULL) {
-        *delta_out = delta;
+/* GridJournal
+   ===========
+
+   The GridJournal lets a Grid resume a packing at a new width and
+   height instead of starting over from the first rectangle.
+   grid_try_pack records a GridMark before each rectangle: the number
+   of row and column cells and the length of an undo log holding the
+   old value of every jump matrix element written since the grid was
+   cleared. Cuts need no log of their own. New cells are only ever
+   appended, so `uncut` takes them back newest first, and copy_row and
+   copy_col only write elements of the new row or column.
+
+   Once the rectangle is placed its mark also keeps what the search
+   depended on: the largest end of a row range found free, the
+   smallest end of a row range that ran past the bottom, and the
+   rectangle's bottom and right edges. At another height the search
+   visits the same cells with the same outcome as long as
+   `row_fit_end <= height < row_reject_end`, and the rectangle touches
+   the bottom in neither grid, since that decides whether its row is
+   cut. The width only matters through the right edge in the same way.
+*/
+
+/* alloc_grid_journal allocates a journal with room for a mark per
+   rectangle of a grid of `size` */
+static GridJournal *alloc_grid_journal(size_t size)
+{
+    GridJournal *journal = NULL;
+    if (size > SIZE_MAX / sizeof(GridMark)) {
+        return NULL;
     }
-    if (grid_w_out != NULL) {
-        *grid_w_out = grid_w;
+    if ((journal = malloc(sizeof(*journal))) == NULL) {
+        return NULL;
+    }
+    if ((journal->marks = malloc(size * sizeof(GridMark))) == NULL) {
+        free(journal);
+        return NULL;
     }
-    return reg.col_cell != NULL;
+    journal->undo = NULL;
+    journal->undo_size = 0;
+    journal->recording = 0;
+    journal->placed = 0;
+    journal->undo_len = 0;
+    return journal;
 }
 
-static void
-grid_refine_neighborhood(Grid * grid, const Rectangle * sizes,
-                         const BBoxRestrictions * bbr, long *best_area,
-                         long *best_h, long *best_w,
-                         long radius)
+/* free_grid_journal frees the memory allocated by GridJournal */
+static void free_grid_journal(GridJournal * journal)
 {
-    long h_start, h_stop, h, width_limit, candidate_area;
-    long delta_unused = 0, grid_w = 0;
-    int success = 0;
-
-    if (radius <= 0) {
+    if (journal == NULL) {
         return;
     }
-    h_start = *best_h - radius;
-    if (h_start < bbr->min_height) {
-        h_start = bbr->min_height;
+    free(journal->undo);
+    free(journal->marks);
+    free(journal);
+}
+
+/* journal_forget drops everything recorded and stops recording */
+static void journal_forget(GridJournal * journal)
+{
+    journal->recording = 0;
+    journal->placed = 0;
+    journal->undo_len = 0;
+}
+
+/* journal_grow makes room for more undo entries.
+
+   Return 0 on success and -1 on failure. */
+static int journal_grow(GridJournal * journal)
+{
+    JumpUndo *undo = NULL;
+    size_t size = journal->undo_size == 0 ? 1024 : journal->undo_size;
+    if (size > SIZE_MAX / 2 / sizeof(*undo)) {
+        return -1;
     }
-    /* Use subtraction-based clamping to avoid signed overflow when
-       `best_h` is very large. */
-    if (*best_h >= bbr->max_height) {
-        h_stop = bbr->max_height;
-    } else if (radius > bbr->max_height - *best_h) {
-        h_stop = bbr->max_height;
-    } else {
-        h_stop = *best_h + radius;
+    size *= 2;
+    if ((undo = realloc(journal->undo, size * sizeof(*undo))) == NULL) {
+        return -1;
     }
+    journal->undo = undo;
+    journal->undo_size = size;
+    return 0;
+}
 
-    for (h = h_start; h <= h_stop; h++) {
-        if (h <= 0) {
-            continue;
+/* journal_log saves the current value of an element about to be
+   written. If the log cannot grow the journal is dropped, the packing
+   itself is not affected. */
+static inline void
+journal_log(GridJournal * journal, const JumpMatrix * self, size_t row,
+            size_t col)
+{
+    JumpUndo *undo = NULL;
+    if (journal->undo_len == journal->undo_size
+        && journal_grow(journal) != 0) {
+        journal_forget(journal);
+        return;
+    }
+    undo = &journal->undo[journal->undo_len++];
+    /* The jump matrix size limits the indices to JumpIndex */
+    undo->row = (JumpIndex) row;
+    undo->col = (JumpIndex) col;
+    undo->value = jump_get(self, row, col);
+}
+
+/* journal_mark_valid checks if a rectangle placed with `mark` would
+   be placed the same way in a grid of `width` and `height` */
+static int
+journal_mark_valid(const GridJournal * journal, const GridMark * mark,
+                   Coord width, Coord height)
+{
+    if (height != journal->height) {
+        if (height < mark->row_fit_end || mark->row_reject_end <= height) {
+            return 0;
         }
-        width_limit = (*best_area) / h;
-        if (width_limit > bbr->max_width) {
-            width_limit = bbr->max_width;
+        if (mark->bottom >= height || mark->bottom >= journal->height) {
+            return 0;
         }
-        if (width_limit < bbr->min_width) {
-            continue;
+    }
+    if (width != journal->width) {
+        if (mark->right >= width || mark->right >= journal->width) {
+            return 0;
         }
-        if (width_limit * h >= *best_area) {
-            width_limit -= 1;
-            if (width_limit < bbr->min_width) {
-                continue;
-            }
+    }
+    return 1;
+}
+
+/* SearchShared
+   ============
+
+   Searches running in different threads can share their best area
+   through a SearchShared. Each search publishes the area of every
+   feasible bounding box it finds and reads back the smallest one to
+   tighten its own width limit. The `slack` is added to the shared area
+   before it is used as a strict upper limit, which lets the caller
+   decide whether ties (or near ties) must still be found.
+
+   SearchShareds can be chained through `next`. An area offered to one
+   is offered to all after it too, so a search can tighten the limits
+   of the searches after it without reading theirs.
+*/
+
+/* search_shared_init resets the shared area to "nothing found yet" */
+void search_shared_init(SearchShared * self, Coord slack)
+{
+    self->area = COORD_MAX;
+    self->slack = slack < 0 ? 0 : slack;
+    self->next = NULL;
+#ifdef RPACK_COORD_I128
+    self->lock = 0;
+#endif
+}
+
+static long atomic_load_long(long *ptr)
+{
+#if defined(_MSC_VER)
+    return InterlockedCompareExchange((volatile LONG *) ptr, 0, 0);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static int atomic_cas_long(long *ptr, long expected, long desired)
+{
+#if defined(_MSC_VER)
+    return InterlockedCompareExchange((volatile LONG *) ptr, desired,
+                                      expected) == expected;
+#else
+    return __atomic_compare_exchange_n(ptr, &expected, desired, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+#ifdef RPACK_COORD_I128
+/* 16-byte atomics need libatomic, so a spin lock guards the area of
+   128-bit coordinates. Searches take it once per bounding box. */
+static void shared_lock(SearchShared * self)
+{
+    while (__atomic_test_and_set(&self->lock, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static void shared_unlock(SearchShared * self)
+{
+    __atomic_clear(&self->lock, __ATOMIC_RELEASE);
+}
+
+static Coord shared_area(SearchShared * self)
+{
+    Coord area;
+    shared_lock(self);
+    area = self->area;
+    shared_unlock(self);
+    return area;
+}
+
+static int shared_cas_area(SearchShared * self, Coord expected, Coord desired)
+{
+    int swapped = 0;
+    shared_lock(self);
+    if (self->area == expected) {
+        self->area = desired;
+        swapped = 1;
+    }
+    shared_unlock(self);
+    return swapped;
+}
+#else
+/* Coord is a long or an int32_t, both 32-bit on MSVC */
+static Coord shared_area(SearchShared * self)
+{
+#if defined(_MSC_VER)
+    return InterlockedCompareExchange((volatile LONG *) &self->area, 0, 0);
+#else
+    return __atomic_load_n(&self->area, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static int shared_cas_area(SearchShared * self, Coord expected, Coord desired)
+{
+#if defined(_MSC_VER)
+    return InterlockedCompareExchange((volatile LONG *) &self->area, desired,
+                                      expected) == expected;
+#else
+    return __atomic_compare_exchange_n(&self->area, &expected, desired, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+#endif
+
+/* search_shared_limit returns the strict upper area limit implied by
+   the best area published so far. */
+Coord search_shared_limit(SearchShared * self)
+{
+    Coord area = shared_area(self);
+    if (area > COORD_MAX - self->slack) {
+        return COORD_MAX;
+    }
+    return area + self->slack;
+}
+
+/* search_shared_offer publishes `area` to `self` and the SearchShareds
+   chained after it, in each if it is smaller than the area there. */
+void search_shared_offer(SearchShared * self, Coord area)
+{
+    Coord current;
+    for (; self != NULL; self = self->next) {
+        current = shared_area(self);
+        while (area < current && !shared_cas_area(self, current, area)) {
+            current = shared_area(self);
         }
+    }
+}
+
+/* Deadline
+   ========
+
+   A Deadline ends a search when its time budget is spent. Grids point
+   to the Deadline of the packer using them, so every search running
+   on them, in any thread, stops once one of them has seen it pass.
+   A stopped search still returns the best bounding box it found.
+*/
+
+/* deadline_now returns the time of a monotonic clock in seconds */
+double deadline_now(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double) count.QuadPart / (double) frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + 1e-9 * (double) now.tv_nsec;
+#endif
+}
+
+/* deadline_init sets the deadline `seconds` from now */
+void deadline_init(Deadline * self, double seconds)
+{
+    self->at = deadline_now() + seconds;
+    self->expired = 0;
+}
+
+/* deadline_expired returns 1 if the deadline `self` (may be NULL) has
+   passed. Once it has, the clock is no longer read. */
+int deadline_expired(Deadline * self)
+{
+    if (self == NULL) {
+        return 0;
+    }
+    if (atomic_load_long(&self->expired)) {
+        return 1;
+    }
+    if (deadline_now() < self->at) {
+        return 0;
+    }
+    atomic_cas_long(&self->expired, 0, 1);
+    return 1;
+}
+
+/* Task
+   ====
+
+   A minimal fork/join helper. `task_run` calls `func(arg, i)` for every
+   i in [0, n_tasks) using at most `n_threads` threads, the calling
+   thread included. Tasks are handed out in index order. If a thread
+   cannot be started the remaining threads (at least the calling one)
+   pick up its share, so all tasks are always run.
+
+   `task_run_workers` also passes the number of the thread running
+   the task, in [0, n_threads), so a thread can keep state such as a
+   Grid from one task to the next.
+*/
+
+struct task_pool {
+    TaskWorkerFunc func;
+    void *arg;
+    size_t n_tasks;
+    size_t next;
+    size_t n_workers;
+#if defined(_WIN32)
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+static void task_pool_lock(struct task_pool *pool)
+{
+#if defined(_WIN32)
+    EnterCriticalSection(&pool->lock);
+#else
+    pthread_mutex_lock(&pool->lock);
+#endif
+}
+
+static void task_pool_unlock(struct task_pool *pool)
+{
+#if defined(_WIN32)
+    LeaveCriticalSection(&pool->lock);
+#else
+    pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+static void task_pool_work(struct task_pool *pool)
+{
+    size_t index, worker;
+    task_pool_lock(pool);
+    worker = pool->n_workers++;
+    task_pool_unlock(pool);
+    for (;;) {
+        task_pool_lock(pool);
+        index = pool->next++;
+        task_pool_unlock(pool);
+        if (index >= pool->n_tasks) {
+            return;
+        }
+        pool->func(pool->arg, worker, index);
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI task_thread_main(LPVOID arg)
+{
+    task_pool_work((struct task_pool *) arg);
+    return 0;
+}
+#else
+static void *task_thread_main(void *arg)
+{
+    task_pool_work((struct task_pool *) arg);
+    return NULL;
+}
+#endif
+
+struct task_adapter {
+    TaskFunc func;
+    void *arg;
+};
+
+static void task_adapter_run(void *arg, size_t worker, size_t index)
+{
+    struct task_adapter *adapter = (struct task_adapter *) arg;
+    (void) worker;
+    adapter->func(adapter->arg, index);
+}
+
+void task_run(TaskFunc func, void *arg, size_t n_tasks, size_t n_threads)
+{
+    struct task_adapter adapter;
+    adapter.func = func;
+    adapter.arg = arg;
+    task_run_workers(task_adapter_run, &adapter, n_tasks, n_threads);
+}
+
+void
+task_run_workers(TaskWorkerFunc func, void *arg, size_t n_tasks,
+                 size_t n_threads)
+{
+    struct task_pool pool;
+    size_t i, started = 0;
+#if defined(_WIN32)
+    HANDLE *threads = NULL;
+#else
+    pthread_t *threads = NULL;
+#endif
+
+    if (n_threads > n_tasks) {
+        n_threads = n_tasks;
+    }
+    if (n_threads > 1 && n_threads - 1 <= SIZE_MAX / sizeof(*threads)) {
+        threads = malloc((n_threads - 1) * sizeof(*threads));
+    }
+    if (threads == NULL) {
+        for (i = 0; i < n_tasks; i++) {
+            func(arg, 0, i);
+        }
+        return;
+    }
+
+    pool.func = func;
+    pool.arg = arg;
+    pool.n_tasks = n_tasks;
+    pool.next = 0;
+    pool.n_workers = 0;
+#if defined(_WIN32)
+    InitializeCriticalSection(&pool.lock);
+    for (i = 0; i < n_threads - 1; i++) {
+        threads[started] =
+            CreateThread(NULL, 0, task_thread_main, &pool, 0, NULL);
+        if (threads[started] != NULL) {
+            started++;
+        }
+    }
+    task_pool_work(&pool);
+    for (i = 0; i < started; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    DeleteCriticalSection(&pool.lock);
+#else
+    if (pthread_mutex_init(&pool.lock, NULL) != 0) {
+        free(threads);
+        for (i = 0; i < n_tasks; i++) {
+            func(arg, 0, i);
+        }
+        return;
+    }
+    for (i = 0; i < n_threads - 1; i++) {
+        if (pthread_create(&threads[started], NULL, task_thread_main,
+                           &pool) == 0) {
+            started++;
+        }
+    }
+    task_pool_work(&pool);
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool.lock);
+#endif
+    free(threads);
+}
+
+/* Grid
+   ====
+
+   The Grid contains two CellLinks - one for rows and one for
+   columns. It also contains a JumpMatrix to keep track of which
+   regions are free or not.
+
+   If `counting` is set the work done on the grid is added to its
+   `counters`. A grid is used by one thread at a time, so no atomics
+   are needed.
+*/
+
+#define GRID_COUNT(grid, name, n)               \
+    do {                                        \
+        if ((grid)->counting) {                 \
+            (grid)->counters.name += (n);       \
+        }                                       \
+    } while (0)
+
+/* grid_alloc allocates memory for a new Grid */
+Grid *grid_alloc(size_t size, Coord width, Coord height)
+{
+    Grid *grid = NULL;
+    if ((grid = malloc(sizeof(*grid))) == NULL) {
+        return NULL;
+    }
+    if (size == 0) {
+        size = 1;
+    }
+    grid->size = size;
+    grid->capacity = size;
+    grid->width = width;
+    grid->height = height;
+    grid->cols = NULL;
+    grid->rows = NULL;
+    grid->jump_matrix = NULL;
+    grid->journal = NULL;
+    grid->deadline = NULL;
+    grid->counting = 0;
+    memset(&grid->counters, 0, sizeof(grid->counters));
+
+    if ((grid->cols = alloc_cell_link(size, width)) == NULL) {
+        grid_free(grid);
+        return NULL;
+    }
+    if ((grid->rows = alloc_cell_link(size, height)) == NULL) {
+        grid_free(grid);
+        return NULL;
+    }
+    if ((grid->jump_matrix = alloc_jump_matrix(size)) == NULL) {
+        grid_free(grid);
+        return NULL;
+    }
+    if ((grid->journal = alloc_grid_journal(size)) == NULL) {
+        grid_free(grid);
+        return NULL;
+    }
+
+    return grid;
+}
+
+/* grid_free frees the memory allocated by Grid  */
+void grid_free(Grid * grid)
+{
+    if (grid == NULL) {
+        return;
+    }
+    if (grid->cols != NULL) {
+        free_cell_link(grid->cols);
+    }
+    if (grid->rows != NULL) {
+        free_cell_link(grid->rows);
+    }
+    if (grid->jump_matrix != NULL) {
+        free_jump_matrix(grid->jump_matrix);
+    }
+    free_grid_journal(grid->journal);
+    free(grid);
+}
+
+/* grid_reserve works like realloc for a grid that packs `size - 1`
+   rectangles. `grid` (may be NULL) is reused if it has the capacity,
+   else a new grid is allocated with at least twice the capacity of
+   `grid` and `grid` is freed. On failure NULL is returned and `grid`
+   is left as it was. */
+Grid *grid_reserve(Grid * grid, size_t size)
+{
+    Grid *larger = NULL;
+    size_t capacity;
+
+    if (size == 0) {
+        size = 1;
+    }
+    if (grid != NULL && size <= grid->capacity) {
+        grid->size = size;
+        journal_forget(grid->journal);
+        return grid;
+    }
+    capacity = size;
+    if (grid != NULL && grid->capacity <= SIZE_MAX / 2
+        && 2 * grid->capacity > capacity) {
+        capacity = 2 * grid->capacity;
+    }
+    larger = grid_alloc(capacity, 0, 0);
+    if (larger == NULL && capacity > size) {
+        larger = grid_alloc(size, 0, 0);
+    }
+    if (larger == NULL) {
+        return NULL;
+    }
+    larger->size = size;
+    grid_free(grid);
+    return larger;
+}
+
+/* grid_clear clears the CellLinks and JumpMatrix to "start state" */
+void grid_clear(Grid * self)
+{
+    if (self == NULL) {
+        return;
+    }
+    self->cols->end_pos = self->width;
+    clear_cell_link(self->cols);
+    self->rows->end_pos = self->height;
+    clear_cell_link(self->rows);
+    clear_jump_matrix(self->jump_matrix);
+    journal_forget(self->journal);
+}
+
+/* grid_jump_set writes a jump matrix element and logs the old value
+   while the grid's journal is recording */
+static inline void
+grid_jump_set(Grid * self, size_t row, size_t col, JumpIndex value)
+{
+    if (self->journal->recording) {
+        journal_log(self->journal, self->jump_matrix, row, col);
+    }
+    jump_set(self->jump_matrix, row, col, value);
+}
+
+/* grid_split will split the grid by cutting a column and a row in two
+   in such a way that the region `reg` will fit the grid.
+
+   Return 0 on success and -1 on failure. */
+int grid_split(Grid * self, Region * reg)
+{
+    size_t src_i, dest_i, col_i, row_i;
+    CellLink *rows = self->rows;
+    CellLink *cols = self->cols;
+    CellRef r_cell = CELL_NONE;
+    CellRef c_cell = CELL_NONE;
+    JumpIndex jump_target = JUMP_FREE;
+    assert(reg->row_end_pos <= cell_end_pos(rows, reg->row_cell));
+    assert(reg->col_end_pos <= cell_end_pos(cols, reg->col_cell));
+
+    if (reg->row_end_pos < cell_end_pos(rows, reg->row_cell)) {
+        if (cut(rows, reg->row_cell, reg->row_end_pos, &src_i, &dest_i)
+            != 0) {
+            return -1;
+        }
+        GRID_COUNT(self, cuts, 1);
+        GRID_COUNT(self, copied, cols->jump_index);
+        if (copy_row(self->jump_matrix, src_i, dest_i,
+                     cols->jump_index) != 0) {
+            return -1;
+        }
+    }
+
+    if (reg->col_end_pos < cell_end_pos(cols, reg->col_cell)) {
+        if (cut(cols, reg->col_cell, reg->col_end_pos, &src_i, &dest_i)
+            != 0) {
+            return -1;
+        }
+        GRID_COUNT(self, cuts, 1);
+        GRID_COUNT(self, copied, rows->jump_index);
+        if (copy_col(self->jump_matrix, src_i, dest_i,
+                     rows->jump_index) != 0) {
+            return -1;
+        }
+    }
+
+    /* Compute jump_target */
+    r_cell = cell_next(rows, reg->row_cell);
+    if (r_cell == CELL_NONE) {
+        assert(cell_end_pos(rows, reg->row_cell) == self->height);
+        jump_target = JUMP_COL_FULL;
+    } else {
+        jump_target = (JumpIndex) cell_jump_index(rows, r_cell) + 1;
+    }
+
+    col_i = cell_jump_index(cols, reg->col_cell_start);
+    for (r_cell = reg->row_cell_start; r_cell != CELL_NONE;
+         r_cell = cell_next(rows, r_cell)) {
+        row_i = cell_jump_index(rows, r_cell);
+        assert(jump_get(self->jump_matrix, row_i, col_i) == JUMP_FREE);
+        grid_jump_set(self, row_i, col_i, jump_target);
+        if (r_cell == reg->row_cell) {
+            break;
+        }
+    }
+
+    if (reg->col_cell_start == reg->col_cell) {
+        return 0;
+    }
+
+    row_i = cell_jump_index(rows, reg->row_cell_start);
+    for (c_cell = cell_next(cols, reg->col_cell_start); c_cell != CELL_NONE;
+         c_cell = cell_next(cols, c_cell)) {
+        col_i = cell_jump_index(cols, c_cell);
+        assert(jump_get(self->jump_matrix, row_i, col_i) == JUMP_FREE);
+        grid_jump_set(self, row_i, col_i, jump_target);
+        if (c_cell == reg->col_cell) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/* grid_find_size searches the grid for a free space of `width` x
+   `height` and stores it in `reg`. */
+static Coord
+grid_find_size(Grid * grid, Coord width, Coord height, Region * reg)
+{
+    Coord rec_col_end_pos, rec_row_end_pos, col_start_end_pos;
+    Coord delta = height;
+    Coord tmp;
+    Coord row_fit_end = 0;
+    Coord row_reject_end = COORD_MAX;
+    const CellLink *rows = grid->rows;
+    const CellLink *cols = grid->cols;
+    CellRef col_cell_start = CELL_NONE;
+    CellRef col_cell = CELL_NONE;
+    CellRef row_cell_start = CELL_NONE;
+    CellRef row_cell = CELL_NONE;
+    const JumpMatrix *jm = grid->jump_matrix;
+    size_t col_i, row_i, pos, pos_start, end;
+    CellRef row_cell_end;
+
+    CellRef jump_first = CELL_NONE;
+    JumpIndex jump_target = JUMP_FREE;
+    /* Counted in registers, added to the grid counters on return */
+    unsigned long long n_columns = 0, n_rows = 0, n_jumps = 0;
+
+    /* Loop over columns */
+    rec_col_end_pos = width;
+    col_cell_start = cell_head(cols);
+    while (col_cell_start != CELL_NONE) {
+        col_i = cell_jump_index(cols, col_cell_start);
+        n_columns++;
+
+        /* Loop over rows */
+        rec_row_end_pos = height;
+        row_cell_start = row_cell = cell_head(rows);
+        row_i = cell_jump_index(rows, row_cell);
+        pos = pos_start = 0;
+        jump_first = CELL_NONE;
+        while (row_cell_start != CELL_NONE) {
+
+            /* Check if cell is free. The cell is free if the
+               jump_matrix element is JUMP_FREE. If not, it is the
+               index of the next row cell to test. This is an
+               optimization to prevent checking cells we already know
+               are not free. The bits are read at the slot `pos` of
+               `row_cell`, tracked along with its jump index `row_i`. */
+            n_rows++;
+            jump_target = jump_free_at(jm, pos, col_i) ? JUMP_FREE
+                : jump_get(jm, row_i, col_i);
+
+            if (jump_target != JUMP_FREE) {
+                if (jump_first == CELL_NONE) {
+                    jump_first = row_cell;
+                } else {
+                    /* This is an optimization to make bigger jumps */
+                    grid_jump_set(grid, cell_jump_index(rows, jump_first),
+                                  col_i, jump_target);
+                }
+            }
+
+            /* Column full. Abort this column. */
+            if (jump_target == JUMP_COL_FULL) {
+                break;
+            }
+
+            /* Normal jump */
+            if (jump_target != JUMP_FREE) {
+                n_jumps++;
+                row_cell = row_cell_start =
+                    cell_by_jump_index(rows, jump_target - 1);
+                row_i = jump_target - 1;
+                pos = pos_start = jm->row_pos[row_i];
+                if (coord_add_overflows(cell_start_pos(rows, row_cell),
+                                        height)) {
+                    /* Later rows in this column only start higher, so an
+                       overflow here means this column cannot fit the
+                       rectangle in Coord coordinates. */
+                    break;
+                }
+                rec_row_end_pos =
+                    cell_start_pos(rows, row_cell) + height;
+                continue;
+            }
+
+            /* Free slot. Reset jump_first. */
+            jump_first = CELL_NONE;
+
+            /* Rectangle hight still doesn't fit; continue search. The
+               free rows below end at the next occupied one, found in
+               one scan of the column's bits. If the rectangle ends
+               before that the rows down to its end are walked. */
+            if (cell_end_pos(rows, row_cell) < rec_row_end_pos) {
+                end = jump_scan(jm, col_i, pos + 1);
+                row_cell_end = CELL_NONE;
+                if (end < jm->n_slots) {
+                    row_i = jm->row_at[end];
+                    row_cell_end = cell_by_jump_index(rows, row_i);
+                }
+                if ((row_cell_end != CELL_NONE
+                     ? cell_start_pos(rows, row_cell_end) : rows->end_pos)
+                    < rec_row_end_pos) {
+                    if (grid->counting) {
+                        n_rows += bits_count(jm->live, pos + 1, end);
+                    }
+                    if (row_cell_end == CELL_NONE) {
+                        /* No more rows. Abort. */
+                        if ((tmp = rec_row_end_pos - grid->height) < delta) {
+                            delta = tmp;
+                        }
+                        if (rec_row_end_pos < row_reject_end) {
+                            row_reject_end = rec_row_end_pos;
+                        }
+                        break;
+                    }
+                    row_cell = row_cell_end;
+                    pos = end;
+                    continue;
+                }
+                do {
+                    n_rows++;
+                    row_cell = cell_next(rows, row_cell);
+                } while (cell_end_pos(rows, row_cell) < rec_row_end_pos);
+            }
+
+            /* Free row-range found. Now we need to search column-wise
+               to check if free space is available in that direction
+               as well. */
+            if (rec_row_end_pos > row_fit_end) {
+                row_fit_end = rec_row_end_pos;
+            }
+            col_cell = col_cell_start;
+            while (col_cell != CELL_NONE) {
+                n_columns++;
+                if (!jump_free_at(jm, pos_start,
+                                  cell_jump_index(cols, col_cell))) {
+                    break;
+                }
+                if (rec_col_end_pos <= cell_end_pos(cols, col_cell)) {
+                    /* Free region found */
+                    reg->row_cell_start = row_cell_start;
+                    reg->row_cell = row_cell;
+                    reg->row_start_pos = cell_start_pos(rows, row_cell_start);
+                    reg->row_end_pos = rec_row_end_pos;
+                    reg->col_cell_start = col_cell_start;
+                    reg->col_cell = col_cell;
+                    reg->col_start_pos = cell_start_pos(cols, col_cell_start);
+                    reg->col_end_pos = rec_col_end_pos;
+                    reg->found = 1;
+                    reg->row_fit_end = row_fit_end;
+                    reg->row_reject_end = row_reject_end;
+                    goto done;
+                }
+                col_cell = cell_next(cols, col_cell);
+            }
+            /* Todo: Consider removing this break to continue the
+               search further down the row. */
+            break;
+        }
+
+        /* Prepare new iteration */
+        col_start_end_pos = cell_end_pos(cols, col_cell_start);
+        if (coord_add_overflows(col_start_end_pos, width)) {
+            break;
+        }
+        rec_col_end_pos = col_start_end_pos + width;
+        col_cell_start = cell_next(cols, col_cell_start);
+
+        /* Too wide to fit in any remaining columns. Abort. */
+        if (rec_col_end_pos > grid->width) {
+            break;
+        }
+    }
+    /* Failure! Couldn't find a free region. */
+    reg->found = 0;
+    reg->row_fit_end = row_fit_end;
+    reg->row_reject_end = row_reject_end;
+  done:
+    GRID_COUNT(grid, columns, n_columns);
+    GRID_COUNT(grid, rows, n_rows);
+    GRID_COUNT(grid, jumps, n_jumps);
+    return delta;
+}
+
+/* grid_find_region searches the grid for a free space that can
+   contain `rectangle` and stores it in `reg`. */
+Coord grid_find_region(Grid * grid, const Rectangle * rectangle, Region * reg)
+{
+    return grid_find_size(grid, rectangle->width, rectangle->height, reg);
+}
+
+/* grid_resume prepares the grid for packing `sizes` at its current
+   width and height. The rectangles at the start of `sizes` that the
+   last grid_try_pack placed and that would be placed the same way
+   again are kept, see GridJournal, and the grid is rolled back to the
+   state after the last of them. Their contributions to the height
+   delta and the grid width are folded into `delta` and `grid_w`.
+
+   Return the number of rectangles kept. */
+static size_t
+grid_resume(Grid * grid, const RectangleSides * sizes, Coord *delta,
+            Coord *grid_w)
+{
+    GridJournal *journal = grid->journal;
+    const GridMark *mark = NULL;
+    const JumpUndo *undo = NULL;
+    size_t keep = 0;
+    Coord d;
+
+    if (journal->recording) {
+        for (keep = 0; keep < journal->placed; keep++) {
+            mark = &journal->marks[keep];
+            if (!journal_mark_valid(journal, mark, grid->width,
+                                    grid->height)) {
+                break;
+            }
+            d = sizes->height[sizes->order[keep]];
+            if (mark->row_reject_end - grid->height < d) {
+                d = mark->row_reject_end - grid->height;
+            }
+            if (d < *delta) {
+                *delta = d;
+            }
+            if (*grid_w < mark->right) {
+                *grid_w = mark->right;
+            }
+        }
+    }
+    if (keep == 0) {
+        grid_clear(grid);
+    } else {
+        mark = &journal->marks[keep];
+        while (journal->undo_len > mark->undo_len) {
+            undo = &journal->undo[--journal->undo_len];
+            jump_set(grid->jump_matrix, undo->row, undo->col, undo->value);
+        }
+        while (grid->rows->jump_index > mark->rows) {
+            remove_row(grid->jump_matrix, grid->rows->jump_index - 1);
+            uncut(grid->rows);
+        }
+        while (grid->cols->jump_index > mark->cols) {
+            uncut(grid->cols);
+        }
+        resize_cell_link(grid->rows, grid->height);
+        resize_cell_link(grid->cols, grid->width);
+    }
+    journal->recording = 1;
+    journal->width = grid->width;
+    journal->height = grid->height;
+    journal->placed = keep;
+    return keep;
+}
+
+/* grid_journal_mark records the state before rectangle `i` is placed */
+static void grid_journal_mark(Grid * grid, size_t i)
+{
+    GridMark *mark = &grid->journal->marks[i];
+    mark->undo_len = grid->journal->undo_len;
+    mark->rows = grid->rows->jump_index;
+    mark->cols = grid->cols->jump_index;
+}
+
+/* Number of rectangles placed between two looks at the deadline */
+#define DEADLINE_INTERVAL 32
+
+static int
+grid_try_pack(Grid * grid, const RectangleSides * sizes, Coord delta_init,
+              Coord *delta_out, Coord *grid_w_out)
+{
+    GridJournal *journal = grid->journal;
+    GridMark *mark = NULL;
+    size_t i = 0, j;
+    Coord delta = delta_init;
+    Coord d = 0;
+    Coord grid_w = 0;
+    Region reg;
+
+    i = grid_resume(grid, sizes, &delta, &grid_w);
+    GRID_COUNT(grid, try_packs, 1);
+    GRID_COUNT(grid, resumed, i);
+    /* Every rectangle kept means the packing is already complete */
+    reg.found = i > 0;
+    for (; i < grid->size - 1; i++) {
+        grid_journal_mark(grid, i);
+        /* Out of time counts as a failure to fit */
+        if (i % DEADLINE_INTERVAL == 0 && deadline_expired(grid->deadline)) {
+            reg.found = 0;
+            break;
+        }
+        j = sizes->order[i];
+        d = grid_find_size(grid, sizes->width[j], sizes->height[j], &reg);
+        if (d < delta) {
+            delta = d;
+        }
+        /* Break if failure */
+        if (!reg.found) {
+            break;
+        }
+        /* Keep track of current grid width */
+        if (grid_w < reg.col_end_pos) {
+            grid_w = reg.col_end_pos;
+        }
+        assert(grid_w <= grid->width);
+        if (grid_split(grid, &reg) != 0) {
+            journal_forget(journal);
+            reg.found = 0;
+            break;
+        }
+        GRID_COUNT(grid, placed, 1);
+        if (journal->recording) {
+            mark = &journal->marks[i];
+            mark->row_fit_end = reg.row_fit_end;
+            mark->row_reject_end = reg.row_reject_end;
+            mark->bottom = reg.row_end_pos;
+            mark->right = reg.col_end_pos;
+            journal->placed = i + 1;
+        }
+    }
+    if (reg.found) {
+        grid_journal_mark(grid, i);
+    }
+
+    if (delta_out != NULL) {
+        *delta_out = delta;
+    }
+    if (grid_w_out != NULL) {
+        *grid_w_out = grid_w;
+    }
+    return reg.found;
+}
+
+/* refine_width returns the width limit of the probe at height `h` for
+   a bounding box with an area below `limit`, or -1 if no width within
+   `bbr` is left. */
+static Coord
+refine_width(const BBoxRestrictions * bbr, Coord h, Coord limit,
+             SearchShared * shared)
+{
+    Coord width_limit;
+
+    if (h <= 0) {
+        return -1;
+    }
+    if (shared != NULL && search_shared_limit(shared) < limit) {
+        limit = search_shared_limit(shared);
+    }
+    /* A happy area found by another search must not hide one at a
+       lower height */
+    if (limit <= bbr->happy_area && bbr->happy_area < COORD_MAX) {
+        limit = bbr->happy_area + 1;
+    }
+    width_limit = limit / h;
+    if (width_limit > bbr->max_width) {
+        width_limit = bbr->max_width;
+    }
+    if (width_limit < bbr->min_width) {
+        return -1;
+    }
+    if (width_limit * h >= limit) {
+        width_limit -= 1;
+        if (width_limit < bbr->min_width) {
+            return -1;
+        }
+    }
+    return width_limit;
+}
+
+/* refine_probe packs `sizes` in a `width` x `h` grid. Return the width
+   used, or -1 if they don't fit. */
+static Coord
+refine_probe(Grid * grid, const RectangleSides * sizes,
+             const BBoxRestrictions * bbr, Coord h, Coord width)
+{
+    Coord delta_unused = 0, grid_w = 0;
+
+    grid->height = h;
+    grid->width = width;
+    GRID_COUNT(grid, refine_probes, 1);
+    if (grid_try_pack(grid, sizes, bbr->max_height, &delta_unused, &grid_w)) {
+        return grid_w;
+    }
+    return -1;
+}
+
+/* Refinement probes done ahead by one thread of grid_refine_neighborhood.
+   The thread probes every `stride`th height from `h_start` + `index`
+   and stores the width limit of each probe in `widths` and the width
+   used, or -1, in `found`, both indexed from `h_start`. */
+struct refine_task {
+    Grid *grid;
+    const RectangleSides *sizes;
+    const BBoxRestrictions *bbr;
+    Coord h_start;
+    Coord h_stop;
+    Coord stride;
+    Coord best_area;
+    Coord *widths;
+    Coord *found;
+    SearchShared *shared;
+};
+
+static void refine_task_run(void *arg, size_t index)
+{
+    struct refine_task *task = (struct refine_task *) arg + index;
+    const BBoxRestrictions *bbr = task->bbr;
+    Coord h, k, width, grid_w, best_area = task->best_area;
+
+    for (h = task->h_start + (Coord) index; h <= task->h_stop;
+         h += task->stride) {
+        if (best_area <= bbr->happy_area
+            || deadline_expired(task->grid->deadline)) {
+            break;
+        }
+        k = h - task->h_start;
+        width = refine_width(bbr, h, best_area, task->shared);
+        task->widths[k] = width;
+        task->found[k] = -1;
+        if (width >= 0) {
+            grid_w = refine_probe(task->grid, task->sizes, bbr, h, width);
+            task->found[k] = grid_w;
+            if (grid_w >= 0 && h * grid_w < best_area) {
+                best_area = h * grid_w;
+            }
+        }
+        if (task->h_stop - h < task->stride) {
+            break;
+        }
+    }
+}
+
+/* grid_refine_neighborhood probes every height within `radius` of
+   `best_h`, lowest first. Each probe must beat the smallest area so
+   far, which is kept with its height. It stops at the first height
+   with an area of at most `bbr->happy_area`.
+
+   With more than one grid the heights are first dealt out to one
+   thread per grid. A thread only knows the areas of its own heights,
+   so its probes may get a wider limit than those in order would. The
+   heights are then gone through in order on `grids[0]`, and a probe
+   done ahead is used only if it had the same width limit, otherwise
+   the height is probed again. So the result is that of the probes in
+   order, for any number of grids, and only the probes in order
+   publish their areas to `shared`. */
+static void
+grid_refine_neighborhood(Grid ** grids, size_t n_grids,
+                         const RectangleSides * sizes,
+                         const BBoxRestrictions * bbr, Coord *best_area,
+                         Coord *best_h, Coord *best_w,
+                         Coord radius, SearchShared * shared)
+{
+    struct refine_task *tasks = NULL;
+    Coord *widths = NULL, *found = NULL;
+    Coord h, h_start, h_stop, k, width, grid_w;
+    size_t i, n_heights = 0;
+
+    if (radius <= 0) {
+        return;
+    }
+    h_start = *best_h - radius;
+    if (h_start < bbr->min_height) {
+        h_start = bbr->min_height;
+    }
+    /* Use subtraction-based clamping to avoid signed overflow when
+       `best_h` is very large. */
+    if (*best_h >= bbr->max_height) {
+        h_stop = bbr->max_height;
+    } else if (radius > bbr->max_height - *best_h) {
+        h_stop = bbr->max_height;
+    } else {
+        h_stop = *best_h + radius;
+    }
+    if (h_stop < h_start) {
+        return;
+    }
+
+    if ((UCoord) (h_stop - h_start) < n_grids) {
+        n_grids = (size_t) (h_stop - h_start) + 1;
+    }
+    if (n_grids > 1) {
+        n_heights = (size_t) (h_stop - h_start) + 1;
+        tasks = malloc(n_grids * sizeof(*tasks));
+        widths = malloc(n_heights * sizeof(Coord));
+        found = malloc(n_heights * sizeof(Coord));
+    }
+    if (tasks != NULL && widths != NULL && found != NULL) {
+        /* Never the width limit of a probe */
+        for (i = 0; i < n_heights; i++) {
+            widths[i] = -2;
+        }
+        for (i = 0; i < n_grids; i++) {
+            tasks[i].grid = grids[i];
+            tasks[i].sizes = sizes;
+            tasks[i].bbr = bbr;
+            tasks[i].h_start = h_start;
+            tasks[i].h_stop = h_stop;
+            tasks[i].stride = (Coord) n_grids;
+            tasks[i].best_area = *best_area;
+            tasks[i].widths = widths;
+            tasks[i].found = found;
+            tasks[i].shared = shared;
+        }
+        task_run(refine_task_run, tasks, n_grids, n_grids);
+    } else {
+        n_heights = 0;
+    }
+
+    for (h = h_start; h <= h_stop; h++) {
+        if (*best_area <= bbr->happy_area
+            || deadline_expired(grids[0]->deadline)) {
+            break;
+        }
+        width = refine_width(bbr, h, *best_area, shared);
+        if (width >= 0) {
+            k = h - h_start;
+            if ((UCoord) k < n_heights && widths[k] == width) {
+                grid_w = found[k];
+            } else {
+                grid_w = refine_probe(grids[0], sizes, bbr, h, width);
+            }
+            if (grid_w >= 0 && h * grid_w < *best_area) {
+                *best_area = h * grid_w;
+                *best_h = h;
+                *best_w = grid_w;
+                if (shared != NULL) {
+                    search_shared_offer(shared, *best_area);
+                }
+            }
+        }
+        if (h == h_stop) {
+            break;
+        }
+    }
+    free(tasks);
+    free(widths);
+    free(found);
+}
+
+/* grid_search_bbox will search for a bbox with smallest area that can
+   contain all the rectangles, `sizes`, in the `grid`. The bounding
+   box must also satisfy the bounding box restrictions `bbr`. If the
+   deadline of the grid passes, the best bbox found so far is used. */
+Coord
+grid_search_bbox(Grid * grid, const RectangleSides * sizes,
+                 const BBoxRestrictions * bbr)
+{
+    return grid_search_bbox_shared(grid, sizes, bbr, NULL);
+}
+
+/* grid_search_bbox_shared works like grid_search_bbox but also reads
+   and publishes areas through `shared` (may be NULL). A search never
+   returns a bbox with an area at or above the shared limit seen when
+   it was found, so searches running in other threads prune each
+   other's candidate widths as soon as either finds a better box. */
+Coord
+grid_search_bbox_shared(Grid * grid, const RectangleSides * sizes,
+                        const BBoxRestrictions * bbr, SearchShared * shared)
+{
+    return grid_search_bbox_pool(&grid, 1, sizes, bbr, shared);
+}
+
+/* grid_search_bbox_pool works like grid_search_bbox_shared on
+   `grids[0]` and uses all `n_grids` grids for the refinement probes
+   after coarse stepping, one thread per grid. The result does not
+   depend on `n_grids`. */
+Coord
+grid_search_bbox_pool(Grid ** grids, size_t n_grids,
+                      const RectangleSides * sizes,
+                      const BBoxRestrictions * bbr, SearchShared * shared)
+{
+    Grid *grid = grids[0];
+    Coord start_width, start_area, area, limit, best_h, best_w, delta, grid_w;
+    Coord effective_delta, max_effective_delta;
+    unsigned long long stall_streak;
+    unsigned long long stall_trigger = 0;
+    Coord coarse_step;
+    int success, improved, used_coarse_steps;
+    Coord refine_radius = 0;
+    size_t i;
+
+    /* The grids may hold a packing of other rectangles */
+    for (i = 0; i < n_grids; i++) {
+        journal_forget(grids[i]->journal);
+    }
+
+    grid->height = bbr->min_height;
+    grid->width = bbr->max_area / grid->height;
+    if (bbr->max_width < grid->width) {
+        grid->width = bbr->max_width;
+    }
+    start_width = grid->width;
+
+    if (shared != NULL) {
+        limit = search_shared_limit(shared);
+        if ((limit - 1) / grid->height < grid->width) {
+            grid->width = (limit - 1) / grid->height;
+        }
+    }
+
+    start_area = area = bbr->max_area - 1;
+    best_w = grid->width;
+    best_h = grid->height;
+    stall_streak = 0;
+    coarse_step = 1;
+    max_effective_delta = 1;
+    used_coarse_steps = 0;
+
+    while (grid->height <= bbr->max_height
+           && bbr->min_width <= grid->width
+           && !deadline_expired(grid->deadline)) {
+        delta = bbr->max_height;
+        success = grid_try_pack(grid, sizes, delta, &delta, &grid_w);
+        improved = 0;
+        /* All rectangles successfully packed? Update area. */
+        if (success) {
+            best_h = grid->height;
+            best_w = grid_w;
+            /* bounded by construction: grid->width <= max_area / height
+               and grid_w <= grid->width. Only the first probe may reach
+               max_area, later probes stay below the best area so far. */
+            assert(best_h * best_w <= bbr->max_area);
+            area = best_h * best_w;
+            improved = 1;
+            assert(area <= bbr->max_area);
+            if (shared != NULL) {
+                search_shared_offer(shared, area);
+            }
+            if (area <= bbr->happy_area) {
+                /* We have found a solution the caller is happy
+                   with. End search. */
+                goto done;
+            }
+        }
+
+        effective_delta = delta;
+        if (effective_delta < 1) {
+            effective_delta = 1;
+        }
+
+        stall_trigger = 0;
+        if (!improved && grid->height >= COARSE_LOW_DELTA_MIN_HEIGHT) {
+            stall_trigger = coarse_trigger_for_delta(COARSE_TRIGGER, delta);
+        }
+
+        if (stall_trigger > 0) {
+            stall_streak++;
+            if (stall_streak >= stall_trigger) {
+                if (coarse_step < COARSE_STEP_MAX) {
+                    GRID_COUNT(grid, coarse_steps, 1);
+                    coarse_step *= 2;
+                    if (coarse_step > COARSE_STEP_MAX) {
+                        coarse_step = COARSE_STEP_MAX;
+                    }
+                }
+                if (effective_delta < coarse_step) {
+                    effective_delta = coarse_step;
+                    used_coarse_steps = 1;
+                }
+            }
+        } else {
+            stall_streak = 0;
+            coarse_step = 1;
+        }
+
+        if (effective_delta > max_effective_delta) {
+            max_effective_delta = effective_delta;
+        }
+        if (grid->height >= bbr->max_height) {
+            break;
+        }
+        if (effective_delta > bbr->max_height - grid->height) {
+            effective_delta = bbr->max_height - grid->height;
+            if (effective_delta <= 0) {
+                break;
+            }
+        }
+
+        /* Inc height */
+        grid->height += effective_delta;
+
+        /* Dec width limit. Another search may have found a smaller
+           area than ours in the meantime. */
+        limit = area;
+        if (shared != NULL && search_shared_limit(shared) < limit) {
+            limit = search_shared_limit(shared);
+        }
+        grid->width = limit / grid->height;
+        if (grid->width > bbr->max_width) {
+            grid->width = bbr->max_width;
+        }
+        if (grid->width * grid->height == limit) {
+            grid->width -= 1;
+        }
+        assert(grid->width * grid->height < limit);
+    }
+
+    /* If the area hasn't changed from the start it means that we
+       never found a successful packing in the while loop. We set the
+       grid maximum with/height and return a negative value to
+       indicate failure. */
+    if (start_area == area) {
+        grid->width = start_width;
+        grid->height = bbr->min_height;
+        return -1;
+    }
+    if (used_coarse_steps && !deadline_expired(grid->deadline)) {
+        refine_radius = max_effective_delta;
+        if (refine_radius > REFINE_RADIUS_MAX) {
+            refine_radius = REFINE_RADIUS_MAX;
+        }
+        grid_refine_neighborhood(grids, n_grids, sizes, bbr, &area,
+                                 &best_h, &best_w, refine_radius, shared);
+    }
+    /* Success */
+  done:grid->width = best_w;
+    grid->height = best_h;
+    return best_h;
+}
+
+struct sweep_chunk {
+    Grid *grid;
+    const RectangleSides *sizes;
+    BBoxRestrictions bbr;
+    SearchShared *shared;
+    Coord status;
+};
+
+static void sweep_chunk_run(void *arg, size_t index)
+{
+    struct sweep_chunk *chunk = (struct sweep_chunk *) arg + index;
+    chunk->status = grid_search_bbox_shared(chunk->grid, chunk->sizes,
+                                            &chunk->bbr, chunk->shared);
+}
+
+/* grid_search_bbox_sweep works like grid_search_bbox_shared but splits
+   the height range into `n_grids` chunks and searches them in one
+   thread each. `grids` must hold `n_grids` grids of the same size. The
+   result is written to `grids[0]`.
+
+   The range ends where the area of the first probe, the one the
+   single-threaded search also starts with, can no longer be beaten
+   with the narrowest allowed width. Chunks publish their areas through
+   `shared` (a local one is used if NULL), so every chunk tightens its
+   width limit as soon as any of them improves. The chunks probe other
+   heights than the single-threaded search, and which ones depends on
+   when the areas of the other chunks arrive. So the box found is not
+   the same, and may differ from run to run. */
+Coord
+grid_search_bbox_sweep(Grid ** grids, size_t n_grids,
+                       const RectangleSides * sizes,
+                       const BBoxRestrictions * bbr, SearchShared * shared)
+{
+    Grid *grid = grids[0];
+    struct sweep_chunk *chunks = NULL;
+    SearchShared local;
+    Coord start_width, h_top, span, limit, area, best_area, best_w, best_h;
+    Coord grid_w = 0, delta = 0;
+    size_t i, n_chunks;
+
+    if (n_grids <= 1) {
+        return grid_search_bbox_shared(grid, sizes, bbr, shared);
+    }
+    if (shared == NULL) {
+        search_shared_init(&local, 0);
+        shared = &local;
+    }
+    journal_forget(grid->journal);
+
+    /* First probe, same as the first iteration of the single-threaded
+       search. Its area bounds the height range worth splitting. */
+    grid->height = bbr->min_height;
+    grid->width = bbr->max_area / grid->height;
+    if (bbr->max_width < grid->width) {
+        grid->width = bbr->max_width;
+    }
+    start_width = grid->width;
+    limit = search_shared_limit(shared);
+    if ((limit - 1) / grid->height < grid->width) {
+        grid->width = (limit - 1) / grid->height;
+    }
+    best_area = bbr->max_area - 1;
+    if (limit - 1 < best_area) {
+        best_area = limit - 1;
+    }
+    best_w = start_width;
+    best_h = -1;
+    if (bbr->min_width <= grid->width && grid->height <= bbr->max_height
+        && !deadline_expired(grid->deadline)
+        && grid_try_pack(grid, sizes, bbr->max_height, &delta, &grid_w)) {
+        best_area = grid->height * grid_w;
+        best_w = grid_w;
+        best_h = grid->height;
+        search_shared_offer(shared, best_area);
+    }
+
+    h_top = best_area / bbr->min_width;
+    if (h_top > bbr->max_height) {
+        h_top = bbr->max_height;
+    }
+    if (h_top <= bbr->min_height
+        || (best_h >= 0 && best_area <= bbr->happy_area)) {
+        n_chunks = 0;
+    } else if ((UCoord) (h_top - bbr->min_height) < n_grids) {
+        n_chunks = (size_t) (h_top - bbr->min_height);
+    } else {
+        n_chunks = n_grids;
+    }
+
+    if (n_chunks > 0) {
+        chunks = malloc(n_chunks * sizeof(*chunks));
+    }
+    if (chunks != NULL) {
+        /* The first probe height is already done */
+        span = (h_top - bbr->min_height) / (Coord) n_chunks;
+        for (i = 0; i < n_chunks; i++) {
+            chunks[i].grid = grids[i];
+            chunks[i].sizes = sizes;
+            chunks[i].bbr = *bbr;
+            chunks[i].bbr.min_height =
+                bbr->min_height + 1 + span * (Coord) i;
+            if (i + 1 < n_chunks) {
+                chunks[i].bbr.max_height =
+                    chunks[i].bbr.min_height + span - 1;
+            } else {
+                chunks[i].bbr.max_height = h_top;
+            }
+            chunks[i].shared = shared;
+        }
+        task_run(sweep_chunk_run, chunks, n_chunks, n_chunks);
+        for (i = 0; i < n_chunks; i++) {
+            if (chunks[i].status < 0) {
+                continue;
+            }
+            area = chunks[i].grid->width * chunks[i].grid->height;
+            if (best_h < 0 || area < best_area) {
+                best_area = area;
+                best_w = chunks[i].grid->width;
+                best_h = chunks[i].grid->height;
+            }
+        }
+        free(chunks);
+    } else if (n_chunks > 0) {
+        /* Out of memory, search the rest in this thread */
+        BBoxRestrictions rest = *bbr;
+        rest.min_height = bbr->min_height + 1;
+        rest.max_height = h_top;
+        if (grid_search_bbox_shared(grid, sizes, &rest, shared) >= 0) {
+            area = grid->width * grid->height;
+            if (best_h < 0 || area < best_area) {
+                best_w = grid->width;
+                best_h = grid->height;
+            }
+        }
+    }
+
+    if (best_h < 0) {
+        grid->width = start_width;
+        grid->height = bbr->min_height;
+        return -1;
+    }
+    grid->width = best_w;
+    grid->height = best_h;
+    return best_h;
+}
+
+// =================================
+
+/* Rectangle
+   =========
+
+   Input validation and the orders of the packing strategies.
+
+   The strategies take the rectangles by decreasing height or width and
+   then decreasing area. rectangle_order computes such an order once,
+   as a permutation, with a stable LSD radix sort over the 8-bit digits
+   of the area and then the side. A digit that is the same for every
+   rectangle takes no pass, so small sides sort in a few passes. Equal
+   rectangles keep their input order.
+*/
+
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_DIGITS (sizeof(UCoord) * CHAR_BIT / RADIX_BITS)
+
+void rectangle_stats_init(RectangleStats * self)
+{
+    self->sum_width = 0;
+    self->sum_height = 0;
+    self->min_width = COORD_MAX;
+    self->min_height = COORD_MAX;
+    self->max_width = 0;
+    self->max_height = 0;
+    self->area = 0;
+}
+
+/* rectangle_init validates a `width` x `height` rectangle, stores it
+   in `self` and adds it to `stats`. Return an RPACK_* status. */
+int rectangle_init(Rectangle * self, RectangleStats * stats, size_t index,
+                   Coord width, Coord height)
+{
+    Coord area;
+    if (width <= 0) {
+        return RPACK_WIDTH_NOT_POSITIVE;
+    } else if (height <= 0) {
+        return RPACK_HEIGHT_NOT_POSITIVE;
+    }
+
+    if (stats->sum_width > COORD_MAX - width) {
+        return RPACK_SUM_WIDTH_OVERFLOW;
+    }
+    if (stats->sum_height > COORD_MAX - height) {
+        return RPACK_SUM_HEIGHT_OVERFLOW;
+    }
+    stats->sum_width += width;
+    stats->sum_height += height;
+
+    if (stats->max_width < width) {
+        stats->max_width = width;
+    }
+    if (stats->max_height < height) {
+        stats->max_height = height;
+    }
+    if (width < stats->min_width) {
+        stats->min_width = width;
+    }
+    if (height < stats->min_height) {
+        stats->min_height = height;
+    }
+
+    if (width > COORD_MAX / height) {
+        return RPACK_AREA_OVERFLOW;
+    }
+    area = width * height;
+    if (stats->area > COORD_MAX - area) {
+        return RPACK_SUM_AREA_OVERFLOW;
+    }
+    stats->area += area;
+
+    self->width = width;
+    self->height = height;
+    self->x = -1;
+    self->y = -1;
+    self->index = index;
+    self->area = area;
+    self->wide = width >= height;
+    self->rotated = 0;
+    return RPACK_OK;
+}
+
+/* rectangle_bounds resolves a negative `max_width` or `max_height` to
+   the sum of the rectangle sides and checks that the bounds can hold
+   the largest rectangle. Return an RPACK_* status. */
+int rectangle_bounds(const RectangleStats * stats, Coord *max_width,
+                     Coord *max_height)
+{
+    if (*max_width < 0) {
+        *max_width = stats->sum_width;
+    } else if (*max_width == 0) {
+        return RPACK_MAX_WIDTH_ZERO;
+    } else if (*max_width < stats->max_width) {
+        return RPACK_MAX_WIDTH_TOO_SMALL;
+    }
+
+    if (*max_height < 0) {
+        *max_height = stats->sum_height;
+    } else if (*max_height == 0) {
+        return RPACK_MAX_HEIGHT_ZERO;
+    } else if (*max_height < stats->max_height) {
+        return RPACK_MAX_HEIGHT_TOO_SMALL;
+    }
+    return RPACK_OK;
+}
+
+/* rectangle_bbox sets `*width` and `*height` to the size of the box at
+   the origin that encloses the placed rectangles, whose sides are
+   swapped if they are rotated. Return RPACK_OK or
+   RPACK_POSITION_OVERFLOW. */
+int rectangle_bbox(const Rectangle * rectangles, size_t length,
+                   Coord *width, Coord *height)
+{
+    const Rectangle *r;
+    Coord w, h;
+    size_t i;
+
+    *width = 0;
+    *height = 0;
+    for (i = 0; i < length; i++) {
+        r = &rectangles[i];
+        w = r->rotated ? r->height : r->width;
+        h = r->rotated ? r->width : r->height;
+        if (coord_add_overflows(r->x, w) || coord_add_overflows(r->y, h)) {
+            return RPACK_POSITION_OVERFLOW;
+        }
+        if (r->x + w > *width) {
+            *width = r->x + w;
+        }
+        if (r->y + h > *height) {
+            *height = r->y + h;
+        }
+    }
+    return RPACK_OK;
+}
+
+/* radix_key returns the area (`k` 0) or the side (`k` 1) of `r` as a
+   key that increases as the value decreases */
+static inline UCoord
+radix_key(const Rectangle * r, int by_width, int k)
+{
+    Coord value = k == 0 ? r->area : by_width ? r->width : r->height;
+    return ~(UCoord) value;
+}
+
+/* rectangle_order stores in `order` the indices into `rectangles`
+   sorted by decreasing width if `by_width` is set, else height, and
+   then by decreasing area. `tmp` must hold `length` indices too. */
+void rectangle_order(const Rectangle * rectangles, size_t length,
+                     int by_width, size_t *order, size_t *tmp)
+{
+    size_t counts[2][RADIX_DIGITS][RADIX_SIZE];
+    size_t *src = order, *dest = tmp, *swap, *count;
+    size_t i, d, n, sum;
+    UCoord key;
+    unsigned shift;
+    int k;
+
+    if (length == 0) {
+        return;
+    }
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < length; i++) {
+        order[i] = i;
+        for (k = 0; k < 2; k++) {
+            key = radix_key(&rectangles[i], by_width, k);
+            for (d = 0; d < RADIX_DIGITS; d++) {
+                counts[k][d][key >> d * RADIX_BITS & (RADIX_SIZE - 1)]++;
+            }
+        }
+    }
+    for (k = 0; k < 2; k++) {
+        for (d = 0; d < RADIX_DIGITS; d++) {
+            count = counts[k][d];
+            shift = (unsigned) (d * RADIX_BITS);
+            key = radix_key(&rectangles[0], by_width, k);
+            if (count[key >> shift & (RADIX_SIZE - 1)] == length) {
+                continue;
+            }
+            for (i = 0, sum = 0; i < RADIX_SIZE; i++) {
+                n = count[i];
+                count[i] = sum;
+                sum += n;
+            }
+            for (i = 0; i < length; i++) {
+                key = radix_key(&rectangles[src[i]], by_width, k);
+                dest[count[key >> shift & (RADIX_SIZE - 1)]++] = src[i];
+            }
+            swap = src;
+            src = dest;
+            dest = swap;
+        }
+    }
+    if (src != order) {
+        memcpy(order, src, length * sizeof(size_t));
+    }
+}
+
+/* rectangle_sort_index puts the rectangles of a complete packing back
+   in input order, following the permutation cycles of their indices */
+void rectangle_sort_index(Rectangle * rectangles, size_t length)
+{
+    Rectangle tmp;
+    size_t i, j;
+    for (i = 0; i < length; i++) {
+        while ((j = rectangles[i].index) != i) {
+            assert(j < length);
+            tmp = rectangles[j];
+            rectangles[j] = rectangles[i];
+            rectangles[i] = tmp;
+        }
+    }
+}
+
+/* rectangle_sides_fill copies the sides of `rectangles` to `sides`,
+   which must hold 4 * `length` coordinates, and points `self` at them,
+   read in the given `order`. The positions start at -1. */
+void rectangle_sides_fill(RectangleSides * self, Coord *sides,
+                          const size_t *order, const Rectangle * rectangles,
+                          size_t length)
+{
+    Coord *width = sides, *height = sides + length;
+    Coord *x = sides + 2 * length, *y = sides + 3 * length;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        width[i] = rectangles[i].width;
+        height[i] = rectangles[i].height;
+        x[i] = -1;
+        y[i] = -1;
+    }
+    self->width = width;
+    self->height = height;
+    self->x = x;
+    self->y = y;
+    self->order = order;
+    self->length = length;
+}
+
+int rectangle_index_cmp(const void *a, const void *b)
+{
+    size_t index_a = ((const Rectangle *) a)->index;
+    size_t index_b = ((const Rectangle *) b)->index;
+    return (index_a > index_b) - (index_a < index_b);
+}
+
+int rectangle_area_cmp(const void *a, const void *b)
+{
+    Coord area_a = ((const Rectangle *) a)->area;
+    Coord area_b = ((const Rectangle *) b)->area;
+    return (area_a < area_b) - (area_a > area_b);
+}
+
+int rectangle_width_cmp(const void *a, const void *b)
+{
+    Coord width_a = ((const Rectangle *) a)->width;
+    Coord width_b = ((const Rectangle *) b)->width;
+    if (width_a == width_b) {
+        return rectangle_area_cmp(a, b);
+    }
+    return width_a < width_b ? 1 : -1;
+}
+
+int rectangle_height_cmp(const void *a, const void *b)
+{
+    Coord height_a = ((const Rectangle *) a)->height;
+    Coord height_b = ((const Rectangle *) b)->height;
+    if (height_a == height_b) {
+        return rectangle_area_cmp(a, b);
+    }
+    return height_a < height_b ? 1 : -1;
+}
+
+// =================================
+
+/* Packer
+   ======
+
+   The Packer runs the complete packing of a set of rectangles. Four
+   strategies are tried and the one with the smallest bounding box
+   wins:
+
+   1. Sort by height.
+   2. Sort by width.
+   3. Rotate and sort by height.
+   4. Rotate and sort by width.
+
+   The height and width orders are computed once, see rectangle_order,
+   and the sides of the input are copied once to separate arrays, see
+   RectangleSides. Each strategy reads the sides through its order,
+   with the arrays swapped for strategies 3 and 4, so no rectangle is
+   copied or rotated.
+
+   A Packer keeps its grids and scratch buffers between calls and only
+   grows them, geometrically, when an input does not fit.
+
+   With a `time_limit` the strategies left when it runs out are
+   skipped and the best packing found so far is used.
+
+   The search stops as soon as the area is within `tolerance` of a
+   lower bound, see area_lower_bound, and the strategies left are
+   skipped too. With tolerance 0 only a provably optimal area stops
+   the search, which gives the same result as a complete search.
+
+   The time spent on each strategy is kept in `stats`. If `counting`
+   is set, the counters of all grids are added up there as well.
+*/
+
+#define CASE_0 0
+#define CASE_1 1
+#define CASE_2 2
+#define CASE_3 3
+#define CASE_4 4
+
+static Coord safe_bbox_area(Coord width, Coord height)
+{
+    if (width <= 0 || height <= 0) {
+        return -1;
+    }
+    if (width > COORD_MAX / height) {
+        return COORD_MAX;
+    }
+    return width * height;
+}
+
+/* area_lower_bound returns an area that no bounding box of
+   `rectangles` within `bbr` can be smaller than. The box holds the
+   total area and is at least as wide as the widest rectangle and as
+   the rectangles taller than half of `max_height` side by side, since
+   no two of them fit on top of each other. The same goes for the
+   height, and the total area spread over `max_height` or `max_width`
+   gives a minimal width or height as well. */
+static Coord
+area_lower_bound(const Rectangle * rectangles, size_t length,
+                 const BBoxRestrictions * bbr)
+{
+    Coord area = 0, width = bbr->min_width, height = bbr->min_height;
+    Coord side_by_side = 0, stacked = 0;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        area += rectangles[i].area;
+        if (rectangles[i].height > bbr->max_height / 2) {
+            side_by_side += rectangles[i].width;
+        }
+        if (rectangles[i].width > bbr->max_width / 2) {
+            stacked += rectangles[i].height;
+        }
+    }
+    if (width < side_by_side) {
+        width = side_by_side;
+    }
+    if (width < (area - 1) / bbr->max_height + 1) {
+        width = (area - 1) / bbr->max_height + 1;
+    }
+    if (height < stacked) {
+        height = stacked;
+    }
+    if (height < (area - 1) / bbr->max_width + 1) {
+        height = (area - 1) / bbr->max_width + 1;
+    }
+    if (width > COORD_MAX / height) {
+        return COORD_MAX;
+    }
+    return width * height > area ? width * height : area;
+}
+
+/* happy_area returns the largest area within `tolerance` of `bound` */
+static Coord happy_area(Coord bound, double tolerance)
+{
+    double extra = (double) bound * tolerance;
+    if (extra >= (double) (COORD_MAX - bound)) {
+        return COORD_MAX;
+    }
+    return bound + (Coord) extra;
+}
+
+void packer_init(Packer * self)
+{
+    self->grids = NULL;
+    self->n_grids = 0;
+    self->sides = NULL;
+    self->sides_size = 0;
+    self->orders = NULL;
+    self->orders_size = 0;
+    self->rectangles = NULL;
+    self->rectangles_size = 0;
+    self->time_limit = -1;
+    self->tolerance = 0;
+    self->sweep_threads = 1;
+    self->stopped = 0;
+    self->deadline.at = 0;
+    self->deadline.expired = 0;
+    self->counting = 0;
+    memset(&self->stats, 0, sizeof(self->stats));
+#ifndef RPACK_NAME
+    self->narrow = NULL;
+    self->narrow_rectangles = NULL;
+    self->narrow_size = 0;
+#endif
+}
+
+void packer_destroy(Packer * self)
+{
+    size_t i;
+    for (i = 0; i < self->n_grids; i++) {
+        grid_free(self->grids[i]);
+    }
+    free(self->grids);
+    free(self->sides);
+    free(self->orders);
+    free(self->rectangles);
+#ifndef RPACK_NAME
+    rpack_packer_free_i32(self->narrow);
+    free(self->narrow_rectangles);
+#endif
+    packer_init(self);
+}
+
+/* packer_capacity returns the number of rectangles the packer can
+   pack with a single thread without allocating */
+size_t packer_capacity(const Packer * self)
+{
+    size_t capacity = 0;
+    if (self->n_grids > 0) {
+        capacity = self->grids[0]->capacity - 1;
+    }
+#ifndef RPACK_NAME
+    /* Most inputs are packed by the int32 variant alone */
+    if (self->narrow != NULL) {
+        size_t narrow = packer_capacity_i32(self->narrow);
+        if (self->narrow_size < narrow) {
+            narrow = self->narrow_size;
+        }
+        if (narrow > capacity) {
+            capacity = narrow;
+        }
+    }
+#endif
+    return capacity;
+}
+
+/* reserve_rectangles makes `*buffer` hold at least `length`
+   rectangles, growing it geometrically. Return 0 on success. */
+static int
+reserve_rectangles(Rectangle ** buffer, size_t *size, size_t length)
+{
+    Rectangle *larger;
+    size_t new_size = length;
+
+    if (length <= *size) {
+        return 0;
+    }
+    if (length > SIZE_MAX / sizeof(Rectangle)) {
+        return 1;
+    }
+    if (*size <= SIZE_MAX / sizeof(Rectangle) / 2 && 2 * *size > new_size) {
+        new_size = 2 * *size;
+    }
+    larger = realloc(*buffer, new_size * sizeof(Rectangle));
+    if (larger == NULL && new_size > length) {
+        new_size = length;
+        larger = realloc(*buffer, new_size * sizeof(Rectangle));
+    }
+    if (larger == NULL) {
+        return 1;
+    }
+    *buffer = larger;
+    *size = new_size;
+    return 0;
+}
+
+/* reserve_orders makes the packer hold the strategy orders of `length`
+   rectangles and room to sort them. Return 0 on success. */
+static int reserve_orders(Packer * self, size_t length)
+{
+    size_t *larger;
+    size_t size;
+    if (length > SIZE_MAX / 3 / sizeof(size_t)) {
+        return 1;
+    }
+    size = 3 * length;
+    if (size <= self->orders_size) {
+        return 0;
+    }
+    if (self->orders_size <= SIZE_MAX / sizeof(size_t) / 2
+        && 2 * self->orders_size > size) {
+        size = 2 * self->orders_size;
+    }
+    larger = realloc(self->orders, size * sizeof(size_t));
+    if (larger == NULL && size > 3 * length) {
+        size = 3 * length;
+        larger = realloc(self->orders, size * sizeof(size_t));
+    }
+    if (larger == NULL) {
+        return 1;
+    }
+    self->orders = larger;
+    self->orders_size = size;
+    return 0;
+}
+
+/* reserve_sides makes the packer hold the sides and positions of
+   `length` rectangles, see rectangle_sides_fill. Return 0 on success. */
+static int reserve_sides(Packer * self, size_t length)
+{
+    Coord *larger;
+    size_t size;
+    if (length > SIZE_MAX / 4 / sizeof(Coord)) {
+        return 1;
+    }
+    size = 4 * length;
+    if (size <= self->sides_size) {
+        return 0;
+    }
+    if (self->sides_size <= SIZE_MAX / sizeof(Coord) / 2
+        && 2 * self->sides_size > size) {
+        size = 2 * self->sides_size;
+    }
+    larger = realloc(self->sides, size * sizeof(Coord));
+    if (larger == NULL && size > 4 * length) {
+        size = 4 * length;
+        larger = realloc(self->sides, size * sizeof(Coord));
+    }
+    if (larger == NULL) {
+        return 1;
+    }
+    self->sides = larger;
+    self->sides_size = size;
+    return 0;
+}
+
+/* packer_reserve_grids makes the packer hold `n_grids` grids for
+   `length` rectangles, all bound to the deadline of the packer if it
+   has a time limit and counting if the packer is. Return 0 on
+   success. */
+static int
+packer_reserve_grids(Packer * self, size_t n_grids, size_t length)
+{
+    Grid **grids;
+    Grid *grid;
+    size_t i;
+
+    if (n_grids > self->n_grids) {
+        grids = realloc(self->grids, n_grids * sizeof(Grid *));
+        if (grids == NULL) {
+            return 1;
+        }
+        self->grids = grids;
+    }
+    for (i = 0; i < n_grids; i++) {
+        grid = grid_reserve(i < self->n_grids ? self->grids[i] : NULL,
+                            length + 1);
+        if (grid == NULL) {
+            return 1;
+        }
+        grid->deadline = self->time_limit < 0 ? NULL : &self->deadline;
+        grid->counting = self->counting;
+        self->grids[i] = grid;
+        if (i >= self->n_grids) {
+            self->n_grids = i + 1;
+        }
+    }
+    return 0;
+}
+
+/* The sides of the rectangles in input order and the two orders of
+   the strategies, see rectangle_order */
+struct strategy_orders {
+    RectangleSides input;
+    const size_t *by_height;
+    const size_t *by_width;
+};
+
+/* strategy_sides points `sides` at the input read in the order of
+   `strategy_case`, rotated for CASE_3 and CASE_4. CASE_0, no strategy
+   found, packs like CASE_4. */
+static void
+strategy_sides(RectangleSides * sides, const struct strategy_orders *orders,
+               int strategy_case)
+{
+    *sides = orders->input;
+    sides->order = strategy_case == CASE_2 || strategy_case == CASE_3
+        ? orders->by_width : orders->by_height;
+    if (strategy_case != CASE_1 && strategy_case != CASE_2) {
+        sides->width = orders->input.height;
+        sides->height = orders->input.width;
+        sides->x = orders->input.y;
+        sides->y = orders->input.x;
+    }
+}
+
+/* place_rectangles places the rectangles in order in a `width` x
+   `height` grid. Return 0 on success, or 1 if a rectangle did not fit.
+   It and the rectangles after it are left at (-1, -1). */
+static int
+place_rectangles(Grid * grid, const RectangleSides * sides, Coord width,
+                 Coord height)
+{
+    size_t i, j;
+    Region reg;
+
+    grid->width = width;
+    grid->height = height;
+    grid_clear(grid);
+    for (i = 0; i < sides->length; i++) {
+        j = sides->order[i];
+        grid_find_size(grid, sides->width[j], sides->height[j], &reg);
+        if (!reg.found || grid_split(grid, &reg) != 0) {
+            break;
+        }
+        sides->x[j] = reg.col_start_pos;
+        sides->y[j] = reg.row_start_pos;
+    }
+    if (i == sides->length) {
+        return 0;
+    }
+    for (; i < sides->length; i++) {
+        j = sides->order[i];
+        sides->x[j] = -1;
+        sides->y[j] = -1;
+    }
+    return 1;
+}
+
+static void
+search_strategy(Grid ** grids, size_t n_grids, const RectangleSides * sides,
+                BBoxRestrictions * bbr, int strategy_case, int *best_case,
+                Coord *best_w, Coord *best_h, double *seconds)
+{
+    Grid *grid = grids[0];
+    Coord status, area, height;
+    double start;
+    /* Out of time, or already happy with the best strategy so far */
+    if (deadline_expired(grid->deadline)
+        || (*best_case != CASE_0 && bbr->max_area <= bbr->happy_area)) {
+        return;
+    }
+    start = deadline_now();
+    status = grid_search_bbox_sweep(grids, n_grids, sides, bbr, NULL);
+    seconds[strategy_case - CASE_1] = deadline_now() - start;
+    height = status >= 0 ? grid->height : -grid->height;
+    area = safe_bbox_area(grid->width, height);
+    if (0 < area && area < bbr->max_area) {
+        bbr->max_area = area;
+        *best_w = grid->width;
+        *best_h = height;
+        *best_case = strategy_case;
+    }
+}
+
+/* search_strategies searches the four strategies one after another.
+   With more than one of the `n_grids`
+   grids, each search sweeps the heights in chunks, see
+   grid_search_bbox_sweep. Return the CASE_* of the best strategy, or
+   CASE_0 if none succeeded. `bbr` is left rotated, the state
+   `finish_strategy` expects. The time spent on each strategy is
+   stored in `seconds`. */
+static int
+search_strategies(Grid ** grids, size_t n_grids,
+                  const struct strategy_orders *orders,
+                  BBoxRestrictions * bbr, Coord max_width, Coord max_height,
+                  Coord *best_w, Coord *best_h, double *seconds)
+{
+    RectangleSides sides;
+    int best_case = CASE_0;
+    Coord min_width;
+
+    strategy_sides(&sides, orders, CASE_1);
+    search_strategy(grids, n_grids, &sides, bbr, CASE_1, &best_case,
+                    best_w, best_h, seconds);
+
+    strategy_sides(&sides, orders, CASE_2);
+    search_strategy(grids, n_grids, &sides, bbr, CASE_2, &best_case,
+                    best_w, best_h, seconds);
+
+    /* Rotated */
+    strategy_sides(&sides, orders, CASE_3);
+    min_width = bbr->min_width;
+    bbr->min_width = bbr->min_height;
+    bbr->min_height = min_width;
+    bbr->max_width = max_height;
+    bbr->max_height = max_width;
+    search_strategy(grids, n_grids, &sides, bbr, CASE_3, &best_case,
+                    best_w, best_h, seconds);
+
+    strategy_sides(&sides, orders, CASE_4);
+    search_strategy(grids, n_grids, &sides, bbr, CASE_4, &best_case,
+                    best_w, best_h, seconds);
+    return best_case;
+}
+
+/* Strategies are searched concurrently through task_run. Each task
+   reads the shared sides in its own order and owns a pool of grids. The pool
+   is used for the refinement probes, see grid_search_bbox_pool. */
+struct strategy_task {
+    RectangleSides sides;
+    BBoxRestrictions bbr;
+    Grid **grids;
+    size_t n_grids;
+    SearchShared *shared;
+    Coord width;
+    Coord height;
+    int skip;
+    double seconds;
+};
+
+static void run_strategy(void *arg, size_t index)
+{
+    struct strategy_task *task = &((struct strategy_task *) arg)[index];
+    Coord status;
+    double start;
+    if (task->skip) {
+        return;
+    }
+    start = deadline_now();
+    status = grid_search_bbox_pool(task->grids, task->n_grids,
+                                   &task->sides, &task->bbr,
+                                   task->shared);
+    task->seconds += deadline_now() - start;
+    /* Out of time, keep what an earlier round found */
+    if (status < 0 && deadline_expired(task->grids[0]->deadline)) {
+        return;
+    }
+    task->width = task->grids[0]->width;
+    task->height = status >= 0 ? task->grids[0]->height : -1;
+}
+
+/* accept_bound returns the area bound after the sequential path has
+   seen `task`. A strategy's search only succeeds below `max_area - 1`,
+   so a later strategy must be at least two units of area better to
+   win. */
+static Coord accept_bound(const struct strategy_task *task, Coord max_area)
+{
+    Coord area;
+    if (task->height < 0) {
+        return max_area;
+    }
+    area = safe_bbox_area(task->width, task->height);
+    if (0 < area && area < max_area - 1) {
+        return area;
+    }
+    return max_area;
+}
+
+/* search_strategies_parallel searches the four strategies with
+   `threads` threads and finds the packing search_strategies would.
+
+   The search of a strategy depends on the area bound it starts from,
+   which in the sequential path is the best area of the strategies
+   before it. So the first strategy is searched alone, with all grids
+   for its refinement probes. The other three are then searched
+   concurrently, all from the bound the first one leaves, which is
+   right unless one of them improves on the strategies before it.
+
+   Such an improvement is shared at once: each strategy of a round
+   offers its areas to the SearchShared of every strategy after it,
+   which tightens their width limits as soon as any strategy before
+   them finds a better box. The slack of 2 keeps areas that are no
+   improvement, see accept_bound, from changing their search. So a
+   search is only narrowed if its bound was wrong, and it is searched
+   again anyway, in less time than it would have taken unnarrowed.
+
+   The bounds are checked in strategy order, and the strategies after
+   the first wrong one are searched again, concurrently, from the bound
+   before them, until all bounds are right. Ties go to the earlier
+   strategy. A strategy that the sequential path would skip, because
+   the area before it is happy, see packer_pack, is not searched. No
+   round is started once the deadline has passed.
+
+   Return the CASE_* of the best strategy, or -1 if out of memory.
+   `bbr` is left in the same state as after search_strategies. */
+static int
+search_strategies_parallel(Packer * self,
+                           const struct strategy_orders *orders,
+                           BBoxRestrictions * bbr, Coord max_width,
+                           Coord max_height, size_t threads, Coord *best_w,
+                           Coord *best_h)
+{
+    struct strategy_task tasks[4];
+    SearchShared shared[4];
+    Coord guesses[4];
+    size_t k, start, length = orders->input.length;
+    size_t pool_size = threads >= 8 ? threads / 4 : 1;
+    Coord max_area, min_width;
+    int best_case = CASE_0;
+
+    if (packer_reserve_grids(self, 4 * pool_size, length)) {
+        return -1;
+    }
+    for (k = 0; k < 4; k++) {
+        strategy_sides(&tasks[k].sides, orders, CASE_1 + (int) k);
+        tasks[k].grids = &self->grids[k * pool_size];
+        tasks[k].n_grids = pool_size;
+        tasks[k].shared = NULL;
+        tasks[k].bbr = *bbr;
+        tasks[k].height = -1;
+        tasks[k].skip = 0;
+        tasks[k].seconds = 0;
+        if (k >= 2) {
+            tasks[k].bbr.min_width = bbr->min_height;
+            tasks[k].bbr.max_width = max_height;
+            tasks[k].bbr.min_height = bbr->min_width;
+            tasks[k].bbr.max_height = max_width;
+        }
+    }
+
+    /* The first strategy runs alone, so all grids are free */
+    tasks[0].n_grids = threads < 4 * pool_size ? threads : 4 * pool_size;
+    run_strategy(tasks, 0);
+
+    start = 1;
+    max_area = accept_bound(&tasks[0], bbr->max_area);
+    while (start < 4 && !deadline_expired(tasks[0].grids[0]->deadline)) {
+        for (k = start; k < 4; k++) {
+            guesses[k] = max_area;
+            tasks[k].bbr.max_area = max_area;
+            tasks[k].skip = max_area != bbr->max_area
+                && max_area <= bbr->happy_area;
+            if (tasks[k].skip) {
+                tasks[k].height = -1;
+            }
+            search_shared_init(&shared[k], 2);
+            shared[k].next = k + 1 < 4 ? &shared[k + 1] : NULL;
+            tasks[k].shared = &shared[k];
+        }
+        task_run(run_strategy, &tasks[start], 4 - start, threads);
+        /* The first strategy of the round had the right bound */
+        for (k = start; k < 4 && guesses[k] == max_area; k++) {
+            max_area = accept_bound(&tasks[k], max_area);
+        }
+        start = k;
+    }
+
+    for (k = 0; k < 4; k++) {
+        self->stats.strategy_seconds[k] = tasks[k].seconds;
+        max_area = accept_bound(&tasks[k], bbr->max_area);
+        if (max_area != bbr->max_area) {
+            bbr->max_area = max_area;
+            *best_w = tasks[k].width;
+            *best_h = tasks[k].height;
+            best_case = CASE_1 + (int) k;
+        }
+    }
+
+    min_width = bbr->min_width;
+    bbr->min_width = bbr->min_height;
+    bbr->max_width = max_height;
+    bbr->min_height = min_width;
+    bbr->max_height = max_width;
+    return best_case;
+}
+
+/* finish_strategy packs the rectangles with the winning strategy and
+   stores their positions, in unrotated coordinates, in `rectangles`.
+   `bbr` must be in the state left by the strategy search. Return the
+   status of place_rectangles. */
+static int
+finish_strategy(Grid * grid, Rectangle * rectangles,
+                const struct strategy_orders *orders,
+                const BBoxRestrictions * bbr, int best_case, Coord best_w,
+                Coord best_h)
+{
+    RectangleSides sides;
+    size_t i;
+    int status;
+
+    if (best_case == CASE_0) {
+        best_w = bbr->max_width;
+        best_h = bbr->max_height;
+    }
+    strategy_sides(&sides, orders, best_case);
+    status = place_rectangles(grid, &sides, best_w, best_h);
+    for (i = 0; i < orders->input.length; i++) {
+        rectangles[i].x = orders->input.x[i];
+        rectangles[i].y = orders->input.y[i];
+    }
+    return status;
+}
+
+/* packer_count_grids adds up the counters of the grids in `stats` */
+static void packer_count_grids(Packer * self)
+{
+    RpackCounters *sum = &self->stats.counters;
+    GridCounters *c;
+    size_t i;
+
+    for (i = 0; i < self->n_grids; i++) {
+        c = &self->grids[i]->counters;
+        sum->try_packs += c->try_packs;
+        sum->placed += c->placed;
+        sum->resumed += c->resumed;
+        sum->columns += c->columns;
+        sum->rows += c->rows;
+        sum->jumps += c->jumps;
+        sum->cuts += c->cuts;
+        sum->copied += c->copied;
+        sum->coarse_steps += c->coarse_steps;
+        sum->refine_probes += c->refine_probes;
+    }
+}
+
+#ifndef RPACK_NAME
+/* Inputs that fit int32
+   =====================
+
+   Most inputs have sides, sums and areas far below INT32_MAX. They are
+   packed by the int32 variant of this file, see rpackcore_i32.c, whose
+   cells and rectangles take less memory. It searches the same bounding
+   boxes in the same order and thus gives the same packing, provided
+   that no value it computes reaches INT32_MAX where a long would not.
+*/
+
+/* NARROW_MAX bounds the bounding box areas and sums of inputs packed
+   by the int32 variant. The margin keeps the limits and slack added
+   to an area, see SearchShared, below INT32_MAX. */
+#define NARROW_MAX (INT32_MAX / 2)
+
+/* fits_narrow returns 1 if the int32 variant gives the same packing of
+   `rectangles` within `bbr` as this one */
+static int
+fits_narrow(const Rectangle * rectangles, size_t length,
+            const BBoxRestrictions * bbr)
+{
+    Coord sum_width = 0, sum_height = 0, area = 0;
+    size_t i;
+
+    if (bbr->max_width > NARROW_MAX / bbr->max_height) {
+        return 0;
+    }
+    /* A happy area of COORD_MAX means none, in both variants */
+    if (bbr->happy_area > NARROW_MAX && bbr->happy_area != COORD_MAX) {
+        return 0;
+    }
+    for (i = 0; i < length; i++) {
+        sum_width += rectangles[i].width;
+        sum_height += rectangles[i].height;
+        area += rectangles[i].area;
+        if (sum_width > NARROW_MAX || sum_height > NARROW_MAX
+            || area > NARROW_MAX) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* packer_pack_narrow packs like packer_pack, with the int32 variant */
+static int
+packer_pack_narrow(Packer * self, Rectangle * rectangles, size_t length,
+                   Coord max_width, Coord max_height, size_t threads)
+{
+    struct rectangle_i32 *narrow;
+    Rectangle *r;
+    size_t i, size = length;
+    int status;
+
+    if (self->narrow == NULL
+        && (self->narrow = rpack_packer_new_i32()) == NULL) {
+        return RPACK_NO_MEMORY;
+    }
+    if (length > self->narrow_size) {
+        if (length > SIZE_MAX / sizeof(*narrow) / 2) {
+            return RPACK_NO_MEMORY;
+        }
+        if (2 * self->narrow_size > size) {
+            size = 2 * self->narrow_size;
+        }
+        narrow = realloc(self->narrow_rectangles, size * sizeof(*narrow));
+        if (narrow == NULL) {
+            return RPACK_NO_MEMORY;
+        }
+        self->narrow_rectangles = narrow;
+        self->narrow_size = size;
+    }
+    narrow = self->narrow_rectangles;
+    for (i = 0; i < length; i++) {
+        r = &rectangles[i];
+        narrow[i].width = (int32_t) r->width;
+        narrow[i].height = (int32_t) r->height;
+        narrow[i].x = (int32_t) r->x;
+        narrow[i].y = (int32_t) r->y;
+        narrow[i].index = r->index;
+        narrow[i].area = (int32_t) r->area;
+        narrow[i].wide = r->wide;
+        narrow[i].rotated = r->rotated;
+    }
+    rpack_packer_set_time_limit_i32(self->narrow, self->time_limit);
+    rpack_packer_set_tolerance_i32(self->narrow, self->tolerance);
+    rpack_packer_set_sweep_threads_i32(self->narrow, self->sweep_threads);
+    rpack_packer_set_stats_i32(self->narrow, self->counting);
+    status = packer_pack_i32(self->narrow, narrow, length,
+                             (int32_t) max_width, (int32_t) max_height,
+                             threads);
+    for (i = 0; i < length; i++) {
+        r = &rectangles[i];
+        r->width = narrow[i].width;
+        r->height = narrow[i].height;
+        r->x = narrow[i].x;
+        r->y = narrow[i].y;
+        r->index = narrow[i].index;
+        r->area = narrow[i].area;
+        r->wide = narrow[i].wide;
+        r->rotated = narrow[i].rotated;
+    }
+    self->stopped = rpack_packer_stopped_i32(self->narrow);
+    self->stats = *rpack_packer_stats_i32(self->narrow);
+    return status;
+}
+#endif
+
+/* packer_pack packs `length` validated rectangles, see rectangle_init,
+   within bounds resolved by rectangle_bounds. The positions are stored
+   in the rectangles, which are otherwise left as they are. Return an
+   RPACK_* status.
+
+   With `sweep_threads` above 1 the strategies are searched one after
+   another, each with that many threads, see grid_search_bbox_sweep,
+   and `threads` is not used. */
+int packer_pack(Packer * self, Rectangle * rectangles, size_t length,
+                Coord max_width, Coord max_height, size_t threads)
+{
+    BBoxRestrictions bbr;
+    struct strategy_orders orders;
+    Coord best_w = max_width, best_h = max_height;
+    size_t i, sweep = self->sweep_threads > 1 ? self->sweep_threads : 1;
+    int best_case, status;
+
+    self->stopped = 0;
+    memset(&self->stats, 0, sizeof(self->stats));
+    for (i = 0; i < self->n_grids; i++) {
+        memset(&self->grids[i]->counters, 0, sizeof(GridCounters));
+    }
+    if (length == 0) {
+        return RPACK_OK;
+    }
+    if (self->time_limit >= 0) {
+        deadline_init(&self->deadline, self->time_limit);
+    }
+    bbr.min_width = 0;
+    bbr.min_height = 0;
+    for (i = 0; i < length; i++) {
+        if (rectangles[i].width > bbr.min_width) {
+            bbr.min_width = rectangles[i].width;
+        }
+        if (rectangles[i].height > bbr.min_height) {
+            bbr.min_height = rectangles[i].height;
+        }
+    }
+    bbr.max_width = max_width;
+    bbr.max_height = max_height;
+    bbr.max_area = COORD_MAX;
+    bbr.happy_area = happy_area(area_lower_bound(rectangles, length, &bbr),
+                                self->tolerance);
+#ifndef RPACK_NAME
+    if (fits_narrow(rectangles, length, &bbr)) {
+        return packer_pack_narrow(self, rectangles, length, max_width,
+                                  max_height, threads);
+    }
+#endif
+
+    /* All strategies, also those searched in parallel, share the sides
+       and read them in their own order */
+    if (sweep > 1) {
+        threads = 1;
+    }
+    if (reserve_orders(self, length) || reserve_sides(self, length)
+        || packer_reserve_grids(self, sweep, length)) {
+        return RPACK_NO_MEMORY;
+    }
+    rectangle_order(rectangles, length, 0, self->orders,
+                    &self->orders[2 * length]);
+    rectangle_order(rectangles, length, 1, &self->orders[length],
+                    &self->orders[2 * length]);
+    rectangle_sides_fill(&orders.input, self->sides, NULL, rectangles,
+                         length);
+    orders.by_height = self->orders;
+    orders.by_width = &self->orders[length];
+
+    if (threads > 1) {
+        best_case = search_strategies_parallel(self, &orders, &bbr,
+                                               max_width, max_height,
+                                               threads, &best_w, &best_h);
+        if (best_case < 0) {
+            return RPACK_NO_MEMORY;
+        }
+    } else {
+        best_case = search_strategies(self->grids, sweep, &orders, &bbr,
+                                      max_width, max_height, &best_w, &best_h,
+                                      self->stats.strategy_seconds);
+    }
+    self->stopped = self->time_limit >= 0 && self->deadline.expired;
+    status = finish_strategy(self->grids[0], rectangles, &orders, &bbr,
+                             best_case, best_w, best_h);
+    if (self->counting) {
+        packer_count_grids(self);
+    }
+    if (status != 0) {
+        /* Without a packing found in time the bounds are unproven */
+        return self->stopped ? RPACK_TIME_LIMIT : RPACK_IMPOSSIBLE;
+    }
+    return RPACK_OK;
+}
+
+// =================================
+
+/* Atlas
+   =====
+
+   An Atlas places rectangles one at a time into a page of fixed size,
+   first fit, on a Grid kept between inserts. An insert is one region
+   search and one split, nothing is moved once placed.
+
+   A grid has room for a fixed number of cuts. When it runs out, a grid
+   with twice the room is taken and the rectangles placed so far are
+   inserted into it again. The search is deterministic, so they land
+   where they were, and the replays cost O(1) inserts per insert.
+*/
+
+/* Room for the first grid of an atlas, in cells */
+#define ATLAS_MIN_CELLS 64
+
+void atlas_init(Atlas * self, Coord width, Coord height)
+{
+    self->grid = NULL;
+    self->width = width;
+    self->height = height;
+    self->placed = NULL;
+    self->length = 0;
+    self->size = 0;
+    self->stale = 0;
+}
+
+void atlas_destroy(Atlas * self)
+{
+    grid_free(self->grid);
+    free(self->placed);
+    self->grid = NULL;
+    self->placed = NULL;
+    self->length = 0;
+    self->size = 0;
+}
+
+/* atlas_reset empties the page, keeping the storage */
+void atlas_reset(Atlas * self)
+{
+    self->length = 0;
+    if (self->grid != NULL) {
+        grid_clear(self->grid);
+    }
+    self->stale = 0;
+}
+
+/* atlas_resize empties the page and makes it `width` x `height` */
+void atlas_resize(Atlas * self, Coord width, Coord height)
+{
+    self->width = width;
+    self->height = height;
+    if (self->grid != NULL) {
+        self->grid->width = width;
+        self->grid->height = height;
+    }
+    atlas_reset(self);
+}
+
+/* atlas_rebuild places the rectangles again on a grid of at least
+   `size` cells, clearing the grid first */
+static int atlas_rebuild(Atlas * self, size_t size)
+{
+    Grid *grid;
+    Rectangle *r;
+    Region reg;
+    size_t i;
+
+    if ((grid = grid_reserve(self->grid, size)) == NULL) {
+        return RPACK_NO_MEMORY;
+    }
+    self->grid = grid;
+    self->stale = 1;
+    grid->width = self->width;
+    grid->height = self->height;
+    grid_clear(grid);
+    for (i = 0; i < self->length; i++) {
+        r = &self->placed[i];
+        grid_find_region(grid, r, &reg);
+        assert(reg.found && reg.col_start_pos == r->x
+               && reg.row_start_pos == r->y);
+        if (!reg.found || grid_split(grid, &reg) != 0) {
+            return RPACK_NO_MEMORY;
+        }
+    }
+    self->stale = 0;
+    return RPACK_OK;
+}
+
+/* atlas_insert places a `width` x `height` rectangle at the first free
+   region and sets `*x` and `*y` to its position.
+
+   Return RPACK_IMPOSSIBLE if no free region can contain it. */
+int atlas_insert(Atlas * self, Coord width, Coord height, Coord *x,
+                 Coord *y)
+{
+    Grid *grid = self->grid;
+    Rectangle *r;
+    Region reg;
+    int status;
+
+    if (width <= 0) {
+        return RPACK_WIDTH_NOT_POSITIVE;
+    }
+    if (height <= 0) {
+        return RPACK_HEIGHT_NOT_POSITIVE;
+    }
+    if (width > self->width || height > self->height) {
+        return RPACK_IMPOSSIBLE;
+    }
+    if (reserve_rectangles(&self->placed, &self->size, self->length + 1)) {
+        return RPACK_NO_MEMORY;
+    }
+    /* A split cuts at most one row and one column */
+    if (grid == NULL) {
+        status = atlas_rebuild(self, ATLAS_MIN_CELLS);
+    } else if (grid->rows->jump_index >= grid->capacity
+               || grid->cols->jump_index >= grid->capacity) {
+        status = atlas_rebuild(self, grid->capacity + 1);
+    } else if (self->stale) {
+        status = atlas_rebuild(self, grid->capacity);
+    } else {
+        status = RPACK_OK;
+    }
+    if (status != RPACK_OK) {
+        return status;
+    }
+    grid = self->grid;
+
+    r = &self->placed[self->length];
+    r->width = width;
+    r->height = height;
+    r->index = self->length;
+    r->area = 0;
+    r->wide = 0;
+    r->rotated = 0;
+    grid_find_region(grid, r, &reg);
+    if (!reg.found) {
+        return RPACK_IMPOSSIBLE;
+    }
+    if (grid_split(grid, &reg) != 0) {
+        /* Half split, placed again by the next insert */
+        self->stale = 1;
+        return RPACK_NO_MEMORY;
+    }
+    r->x = reg.col_start_pos;
+    r->y = reg.row_start_pos;
+    self->length++;
+    *x = r->x;
+    *y = r->y;
+    return RPACK_OK;
+}
+
+// =================================
+
+/* Bins
+   ====
+
+   bins_pack places rectangles into as few `width` x `height` bins as
+   it can, first fit decreasing: in order of decreasing height, each
+   rectangle goes to the first bin with room for it, else to a new bin.
+   Each bin is an Atlas, kept between passes and calls.
+
+   A bin is not searched if its free area is too small, or if a
+   rectangle no smaller in either side did not fit it before, since a
+   region that can contain a rectangle can contain any smaller one.
+
+   Unless the bins are as few as a lower bound, the total area in bins
+   or the rectangles wider and higher than half a bin, the rectangles
+   are placed once more in order of decreasing width and the pass with
+   fewer bins is kept.
+*/
+
+void bins_init(Bins * self)
+{
+    self->bins = NULL;
+    self->size = 0;
+    self->rectangles = NULL;
+    self->rectangles_size = 0;
+    self->orders = NULL;
+    self->positions = NULL;
+    self->indices = NULL;
+    self->scratch_size = 0;
+}
+
+void bins_destroy(Bins * self)
+{
+    size_t i;
+    for (i = 0; i < self->size; i++) {
+        atlas_destroy(&self->bins[i].atlas);
+    }
+    free(self->bins);
+    free(self->rectangles);
+    free(self->orders);
+    free(self->positions);
+    free(self->indices);
+    bins_init(self);
+}
+
+/* bins_reserve makes room for `length` rectangles. Return 0 on
+   success. */
+static int bins_reserve(Bins * self, size_t length)
+{
+    size_t *orders, *indices;
+    Coord *positions;
+
+    if (reserve_rectangles(&self->rectangles, &self->rectangles_size,
+                           length)) {
+        return 1;
+    }
+    if (length <= self->scratch_size) {
+        return 0;
+    }
+    if (length > SIZE_MAX / 2 / sizeof(size_t)
+        || length > SIZE_MAX / 2 / sizeof(Coord)) {
+        return 1;
+    }
+    if ((orders = realloc(self->orders, 2 * length * sizeof(size_t)))
+        == NULL) {
+        return 1;
+    }
+    self->orders = orders;
+    if ((positions = realloc(self->positions, 2 * length * sizeof(Coord)))
+        == NULL) {
+        return 1;
+    }
+    self->positions = positions;
+    if ((indices = realloc(self->indices, length * sizeof(size_t)))
+        == NULL) {
+        return 1;
+    }
+    self->indices = indices;
+    self->scratch_size = length;
+    return 0;
+}
+
+/* bins_open empties bin `i`, allocating it if it is new. Return 0 on
+   success. */
+static int
+bins_open(Bins * self, size_t i, Coord width, Coord height, Coord area)
+{
+    Bin *larger;
+    size_t size;
+    Bin *bin;
+
+    if (i == self->size) {
+        size = self->size < 4 ? 4 : self->size;
+        if (size > SIZE_MAX / sizeof(Bin) / 2) {
+            return 1;
+        }
+        if ((larger = realloc(self->bins, 2 * size * sizeof(Bin))) == NULL) {
+            return 1;
+        }
+        self->bins = larger;
+        for (; self->size < 2 * size; self->size++) {
+            atlas_init(&self->bins[self->size].atlas, width, height);
+        }
+    }
+    bin = &self->bins[i];
+    atlas_resize(&bin->atlas, width, height);
+    bin->free_area = area;
+    bin->failed = 0;
+    return 0;
+}
+
+/* bins_place places the rectangles in `order` into bins, storing the
+   bin and position of each by input index. */
+static int
+bins_place(Bins * self, const size_t *order, size_t length, Coord width,
+           Coord height, Coord area, size_t *bins, Coord *positions,
+           size_t *n_bins)
+{
+    Rectangle *r;
+    Bin *bin;
+    Coord x, y;
+    size_t i, k, used = 0;
+    int status;
+
+    for (k = 0; k < length; k++) {
+        r = &self->rectangles[order[k]];
+        for (i = 0; i < used; i++) {
+            bin = &self->bins[i];
+            if (bin->free_area >= 0 && r->area > bin->free_area) {
+                continue;
+            }
+            if (bin->failed && r->width >= bin->fail_width
+                && r->height >= bin->fail_height) {
+                continue;
+            }
+            status = atlas_insert(&bin->atlas, r->width, r->height, &x, &y);
+            if (status == RPACK_OK) {
+                break;
+            }
+            if (status != RPACK_IMPOSSIBLE) {
+                return status;
+            }
+            bin->failed = 1;
+            bin->fail_width = r->width;
+            bin->fail_height = r->height;
+        }
+        if (i == used) {
+            if (bins_open(self, used, width, height, area)) {
+                return RPACK_NO_MEMORY;
+            }
+            bin = &self->bins[used++];
+            /* Fits an empty bin, see rectangle_bounds */
+            status = atlas_insert(&bin->atlas, r->width, r->height, &x, &y);
+            if (status != RPACK_OK) {
+                return status;
+            }
+        }
+        if (bin->free_area >= 0) {
+            bin->free_area -= r->area;
+        }
+        bins[r->index] = i;
+        positions[2 * r->index] = x;
+        positions[2 * r->index + 1] = y;
+    }
+    *n_bins = used;
+    return RPACK_OK;
+}
+
+/* bins_pack sets `bins[i]` to the bin of rectangle `i` and its
+   position in the bin, and `*n_bins` to the number of bins used. */
+int bins_pack(Bins * self, const Coord *sizes, size_t length, Coord width,
+              Coord height, size_t *bins, Coord *positions, size_t *n_bins)
+{
+    RectangleStats stats;
+    Rectangle *r;
+    Coord area = -1, need;
+    size_t i, lower = 0, n_wide;
+    int status;
+
+    *n_bins = 0;
+    if (width <= 0) {
+        return RPACK_MAX_WIDTH_ZERO;
+    }
+    if (height <= 0) {
+        return RPACK_MAX_HEIGHT_ZERO;
+    }
+    if (length == 0) {
+        return RPACK_OK;
+    }
+    if (bins_reserve(self, length)) {
+        return RPACK_NO_MEMORY;
+    }
+    rectangle_stats_init(&stats);
+    for (i = 0; i < length; i++) {
+        r = &self->rectangles[i];
+        status = rectangle_init(r, &stats, i, sizes[2 * i],
+                                sizes[2 * i + 1]);
+        if (status != RPACK_OK) {
+            return status;
+        }
+        /* No two of these fit one bin */
+        if (r->width > width - r->width && r->height > height - r->height) {
+            lower++;
+        }
+    }
+    status = rectangle_bounds(&stats, &width, &height);
+    if (status != RPACK_OK) {
+        return status;
+    }
+    if (!coord_mul_overflows(width, height)) {
+        area = width * height;
+        need = stats.area / area + (stats.area % area != 0);
+        if ((size_t) need > lower) {
+            lower = (size_t) need;
+        }
+    }
+
+    rectangle_order(self->rectangles, length, 0, self->orders,
+                    self->orders + length);
+    status = bins_place(self, self->orders, length, width, height, area,
+                        bins, positions, n_bins);
+    if (status != RPACK_OK || *n_bins <= lower) {
+        return status;
+    }
+    rectangle_order(self->rectangles, length, 1, self->orders,
+                    self->orders + length);
+    status = bins_place(self, self->orders, length, width, height, area,
+                        self->indices, self->positions, &n_wide);
+    if (status != RPACK_OK) {
+        return status;
+    }
+    if (n_wide < *n_bins) {
+        memcpy(bins, self->indices, length * sizeof(size_t));
+        memcpy(positions, self->positions, 2 * length * sizeof(Coord));
+        *n_bins = n_wide;
+    }
+    return RPACK_OK;
+}
+
+// =================================
+
+/* Overlap
+   =======
+
+   Two rectangles overlap if their interiors intersect, rectangles that
+   only touch do not. rpack_overlapping() returns the first overlapping
+   pair (i, j), i < j, in the order of a double loop over all pairs,
+   but without comparing all pairs.
+
+   A vertical line sweeps the rectangles from left to right, ending
+   rectangles before starting new ones at the same x. The rectangles
+   the line crosses are active. A starting rectangle overlaps an active
+   one whose bottom is below its top and whose top is above its bottom.
+   The tops of the active rectangles are kept in a max tree whose
+   leaves are ordered by bottom, so this is a prefix maximum, and a
+   sweep takes O(n log n) time.
+
+   Whether any of the first k + 1 rectangles overlaps another is
+   monotone in k. If the rectangles overlap at all, a binary search
+   over k with one sweep per step finds i, and comparing i to the
+   others finds j. Rectangles with a side that is not positive are not
+   intervals the sweep can handle, then all pairs are compared.
+*/
+
+typedef struct {
+    Coord key;
+    size_t index;
+} OverlapKey;
+
+typedef struct {
+    size_t length;
+    size_t leaves;
+    Coord *x0, *y0, *x1, *y1;
+    /* Prefix max trees of the active tops, all rectangles and the
+       first k + 1 of them */
+    Coord *all, *first;
+    /* Leaf of every rectangle and the number of rectangles with a
+       bottom below its top */
+    size_t *leaf, *below;
+    OverlapKey *starts, *ends;
+} Overlap;
+
+static int overlap_key_cmp(const void *a, const void *b)
+{
+    const OverlapKey *p = a, *q = b;
+    if (p->key != q->key) {
+        return p->key < q->key ? -1 : 1;
+    }
+    return (p->index > q->index) - (p->index < q->index);
+}
+
+static int rectangles_overlap(const Overlap * self, size_t i, size_t j)
+{
+    return self->x0[i] < self->x1[j] && self->x0[j] < self->x1[i]
+        && self->y0[i] < self->y1[j] && self->y0[j] < self->y1[i];
+}
+
+static void overlap_destroy(Overlap * self)
+{
+    free(self->x0);
+    free(self->leaf);
+    free(self->starts);
+}
+
+/* overlap_init reads `length` rectangles. Return an RPACK_* status,
+   RPACK_OK also if some side is not positive, see overlap_sweepable(). */
+static int
+overlap_init(Overlap * self, const Coord *sizes, const Coord *positions,
+             size_t length)
+{
+    size_t i, lo, hi, mid, leaves = 1;
+
+    while (leaves < length) {
+        leaves *= 2;
+    }
+    self->length = length;
+    self->leaves = leaves;
+    self->leaf = NULL;
+    self->starts = NULL;
+    if (length > SIZE_MAX / sizeof(OverlapKey) / 16) {
+        self->x0 = NULL;
+        return RPACK_NO_MEMORY;
+    }
+    self->x0 = malloc((4 * length + 4 * leaves) * sizeof(Coord));
+    self->leaf = malloc(2 * length * sizeof(size_t));
+    self->starts = malloc(2 * length * sizeof(OverlapKey));
+    if (self->x0 == NULL || self->leaf == NULL || self->starts == NULL) {
+        overlap_destroy(self);
+        return RPACK_NO_MEMORY;
+    }
+    self->y0 = self->x0 + length;
+    self->x1 = self->y0 + length;
+    self->y1 = self->x1 + length;
+    self->all = self->y1 + length;
+    self->first = self->all + 2 * leaves;
+    self->below = self->leaf + length;
+    self->ends = self->starts + length;
+
+    for (i = 0; i < length; i++) {
+        if (coord_add_overflows(positions[2 * i], sizes[2 * i])
+            || coord_add_overflows(positions[2 * i + 1], sizes[2 * i + 1])) {
+            overlap_destroy(self);
+            return RPACK_POSITION_OVERFLOW;
+        }
+        self->x0[i] = positions[2 * i];
+        self->y0[i] = positions[2 * i + 1];
+        self->x1[i] = positions[2 * i] + sizes[2 * i];
+        self->y1[i] = positions[2 * i + 1] + sizes[2 * i + 1];
+    }
+
+    /* Leaves ordered by bottom, with the bottoms kept in `ends` for the
+       binary searches */
+    for (i = 0; i < length; i++) {
+        self->starts[i].key = self->y0[i];
+        self->starts[i].index = i;
+    }
+    qsort(self->starts, length, sizeof(OverlapKey), overlap_key_cmp);
+    for (i = 0; i < length; i++) {
+        self->leaf[self->starts[i].index] = i;
+        self->ends[i].key = self->starts[i].key;
+    }
+    for (i = 0; i < length; i++) {
+        lo = 0;
+        hi = length;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (self->ends[mid].key < self->y1[i]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        self->below[i] = lo;
+    }
+
+    for (i = 0; i < length; i++) {
+        self->starts[i].key = self->x0[i];
+        self->starts[i].index = i;
+        self->ends[i].key = self->x1[i];
+        self->ends[i].index = i;
+    }
+    qsort(self->starts, length, sizeof(OverlapKey), overlap_key_cmp);
+    qsort(self->ends, length, sizeof(OverlapKey), overlap_key_cmp);
+    return RPACK_OK;
+}
+
+/* overlap_sweepable returns 1 if all sides are positive */
+static int overlap_sweepable(const Overlap * self)
+{
+    size_t i;
+    for (i = 0; i < self->length; i++) {
+        if (self->x1[i] <= self->x0[i] || self->y1[i] <= self->y0[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void
+overlap_tree_set(Coord * tree, size_t leaves, size_t leaf, Coord top)
+{
+    size_t i = leaves + leaf;
+    tree[i] = top;
+    for (i /= 2; i > 0; i /= 2) {
+        tree[i] = tree[2 * i] > tree[2 * i + 1] ? tree[2 * i]
+            : tree[2 * i + 1];
+    }
+}
+
+/* overlap_tree_max returns the largest top of the leaves before `end` */
+static Coord
+overlap_tree_max(const Coord * tree, size_t leaves, size_t end)
+{
+    Coord max = COORD_MIN;
+    size_t lo = leaves, hi = leaves + end;
+    while (lo < hi) {
+        if (lo & 1) {
+            max = tree[lo] > max ? tree[lo] : max;
+            lo++;
+        }
+        if (hi & 1) {
+            hi--;
+            max = tree[hi] > max ? tree[hi] : max;
+        }
+        lo /= 2;
+        hi /= 2;
+    }
+    return max;
+}
+
+/* overlap_sweep returns 1 if one of the rectangles 0, ..., k overlaps
+   another rectangle. */
+static int overlap_sweep(Overlap * self, size_t k)
+{
+    size_t s = 0, e = 0, i, n = self->length, leaves = self->leaves;
+
+    for (i = 0; i < 2 * leaves; i++) {
+        self->all[i] = COORD_MIN;
+        self->first[i] = COORD_MIN;
+    }
+    while (s < n) {
+        if (self->ends[e].key <= self->starts[s].key) {
+            /* Ends before the next start, so it has started */
+            i = self->ends[e++].index;
+            overlap_tree_set(self->all, leaves, self->leaf[i], COORD_MIN);
+            if (i <= k) {
+                overlap_tree_set(self->first, leaves, self->leaf[i],
+                                 COORD_MIN);
+            }
+            continue;
+        }
+        i = self->starts[s++].index;
+        if (overlap_tree_max(i <= k ? self->all : self->first, leaves,
+                             self->below[i]) > self->y0[i]) {
+            return 1;
+        }
+        overlap_tree_set(self->all, leaves, self->leaf[i], self->y1[i]);
+        if (i <= k) {
+            overlap_tree_set(self->first, leaves, self->leaf[i],
+                             self->y1[i]);
+        }
+    }
+    return 0;
+}
+
+/* overlap_first sets (*first, *second) to the first overlapping pair
+   or to (length, length). */
+static void overlap_first(Overlap * self, size_t *first, size_t *second)
+{
+    size_t i, j, lo, hi, mid, n = self->length;
+
+    *first = n;
+    *second = n;
+    if (!overlap_sweepable(self)) {
+        for (i = 0; i < n; i++) {
+            for (j = i + 1; j < n; j++) {
+                if (rectangles_overlap(self, i, j)) {
+                    *first = i;
+                    *second = j;
+                    return;
+                }
+            }
+        }
+        return;
+    }
+    if (n < 2 || !overlap_sweep(self, n - 1)) {
+        return;
+    }
+    lo = 0;
+    hi = n - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (overlap_sweep(self, mid)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    /* No rectangle before lo overlaps any other */
+    for (j = lo + 1; j < n; j++) {
+        if (rectangles_overlap(self, lo, j)) {
+            *first = lo;
+            *second = j;
+            return;
+        }
+    }
+}
+
+/* Public API
+   ==========
+
+   See rpack.h.
+*/
+
+RpackPacker *rpack_packer_new(void)
+{
+    Packer *packer = malloc(sizeof(Packer));
+    if (packer != NULL) {
+        packer_init(packer);
+    }
+    return packer;
+}
+
+void rpack_packer_free(RpackPacker * packer)
+{
+    if (packer == NULL) {
+        return;
+    }
+    packer_destroy(packer);
+    free(packer);
+}
+
+int rpack_packer_pack(RpackPacker * packer, const Coord *sizes,
+                      size_t length, Coord max_width, Coord max_height,
+                      size_t threads, Coord *positions)
+{
+    RectangleStats stats;
+    Rectangle *r;
+    size_t i;
+    int status;
+
+    if (length == 0) {
+        return RPACK_OK;
+    }
+    if (reserve_rectangles(&packer->rectangles, &packer->rectangles_size,
+                           length)) {
+        return RPACK_NO_MEMORY;
+    }
+    rectangle_stats_init(&stats);
+    for (i = 0; i < length; i++) {
+        status = rectangle_init(&packer->rectangles[i], &stats, i,
+                                sizes[2 * i], sizes[2 * i + 1]);
+        if (status != RPACK_OK) {
+            return status;
+        }
+    }
+    status = rectangle_bounds(&stats, &max_width, &max_height);
+    if (status != RPACK_OK) {
+        return status;
+    }
+    status = packer_pack(packer, packer->rectangles, length, max_width,
+                         max_height, threads);
+    if (status == RPACK_NO_MEMORY) {
+        return status;
+    }
+    for (i = 0; i < length; i++) {
+        r = &packer->rectangles[i];
+        positions[2 * r->index] = r->x;
+        positions[2 * r->index + 1] = r->y;
+    }
+    return status;
+}
+
+void rpack_packer_set_time_limit(RpackPacker * packer, double seconds)
+{
+    packer->time_limit = seconds < 0 ? -1 : seconds;
+}
+
+void rpack_packer_set_tolerance(RpackPacker * packer, double tolerance)
+{
+    packer->tolerance = tolerance > 0 ? tolerance : 0;
+}
+
+void rpack_packer_set_sweep_threads(RpackPacker * packer, size_t threads)
+{
+    packer->sweep_threads = threads > 1 ? threads : 1;
+}
+
+void rpack_packer_set_stats(RpackPacker * packer, int enable)
+{
+    packer->counting = enable != 0;
+}
+
+const RpackStats *rpack_packer_stats(const RpackPacker * packer)
+{
+    return &packer->stats;
+}
+
+int rpack_packer_stopped(const RpackPacker * packer)
+{
+    return packer->stopped;
+}
+
+int rpack_pack(const Coord *sizes, size_t length, Coord max_width,
+               Coord max_height, size_t threads, Coord *positions)
+{
+    Packer packer;
+    int status;
+    packer_init(&packer);
+    status = rpack_packer_pack(&packer, sizes, length, max_width,
+                               max_height, threads, positions);
+    packer_destroy(&packer);
+    return status;
+}
+
+int rpack_overlapping(const Coord *sizes, const Coord *positions,
+                      size_t length, size_t *first, size_t *second)
+{
+    Overlap overlap;
+    int status;
+
+    *first = length;
+    *second = length;
+    if (length == 0) {
+        return RPACK_OK;
+    }
+    status = overlap_init(&overlap, sizes, positions, length);
+    if (status != RPACK_OK) {
+        return status;
+    }
+    overlap_first(&overlap, first, second);
+    overlap_destroy(&overlap);
+    return RPACK_OK;
+}
+
+int rpack_bbox_size(const Coord *sizes, const Coord *positions,
+                    size_t length, Coord *width, Coord *height)
+{
+    size_t i;
+
+    *width = 0;
+    *height = 0;
+    for (i = 0; i < length; i++) {
+        if (coord_add_overflows(positions[2 * i], sizes[2 * i])
+            || coord_add_overflows(positions[2 * i + 1], sizes[2 * i + 1])) {
+            return RPACK_POSITION_OVERFLOW;
+        }
+        if (positions[2 * i] + sizes[2 * i] > *width) {
+            *width = positions[2 * i] + sizes[2 * i];
+        }
+        if (positions[2 * i + 1] + sizes[2 * i + 1] > *height) {
+            *height = positions[2 * i + 1] + sizes[2 * i + 1];
+        }
+    }
+    return RPACK_OK;
+}
+
+int rpack_total_area(const Coord *sizes, size_t length, Coord *area)
+{
+    Coord a;
+    size_t i;
+
+    *area = 0;
+    for (i = 0; i < length; i++) {
+        if (coord_mul_overflows(sizes[2 * i], sizes[2 * i + 1])) {
+            return RPACK_AREA_OVERFLOW;
+        }
+        a = sizes[2 * i] * sizes[2 * i + 1];
+        if (coord_add_overflows(*area, a)) {
+            return RPACK_SUM_AREA_OVERFLOW;
+        }
+        *area += a;
+    }
+    return RPACK_OK;
+}
+
+RpackAtlas *rpack_atlas_new(Coord width, Coord height)
+{
+    Atlas *atlas;
+    if (width <= 0 || height <= 0) {
+        return NULL;
+    }
+    if ((atlas = malloc(sizeof(Atlas))) != NULL) {
+        atlas_init(atlas, width, height);
+    }
+    return atlas;
+}
+
+void rpack_atlas_free(RpackAtlas * atlas)
+{
+    if (atlas == NULL) {
+        return;
+    }
+    atlas_destroy(atlas);
+    free(atlas);
+}
+
+int rpack_atlas_insert(RpackAtlas * atlas, Coord width, Coord height,
+                       Coord *x, Coord *y)
+{
+    return atlas_insert(atlas, width, height, x, y);
+}
+
+void rpack_atlas_reset(RpackAtlas * atlas)
+{
+    atlas_reset(atlas);
+}
+
+int rpack_pack_bins(const Coord *sizes, size_t length, Coord bin_width,
+                    Coord bin_height, size_t *bins, Coord *positions,
+                    size_t *n_bins)
+{
+    Bins packer;
+    int status;
+    bins_init(&packer);
+    status = bins_pack(&packer, sizes, length, bin_width, bin_height, bins,
+                       positions, n_bins);
+    bins_destroy(&packer);
+    return status;
+}
+
+#ifndef RPACK_NAME
+const char *rpack_strerror(int status)
+{
+    switch (status) {
+    case RPACK_OK:
+        return "Success";
+    case RPACK_WIDTH_NOT_POSITIVE:
+        return "Rectangle width must be positive integer";
+    case RPACK_HEIGHT_NOT_POSITIVE:
+        return "Rectangle height must be positive integer";
+    case RPACK_SUM_WIDTH_OVERFLOW:
+        return "Total rectangle width too large";
+    case RPACK_SUM_HEIGHT_OVERFLOW:
+        return "Total rectangle height too large";
+    case RPACK_AREA_OVERFLOW:
+        return "Rectangle area too large";
+    case RPACK_SUM_AREA_OVERFLOW:
+        return "Total rectangle area too large";
+    case RPACK_SIDE_OVERFLOW:
+        return "Rectangle side too large to convert to C long";
+    case RPACK_MAX_WIDTH_ZERO:
+        return "max_width zero";
+    case RPACK_MAX_WIDTH_TOO_SMALL:
+        return "max_width less than widest rectangle";
+    case RPACK_MAX_HEIGHT_ZERO:
+        return "max_height zero";
+    case RPACK_MAX_HEIGHT_TOO_SMALL:
+        return "max_height less than highest rectangle";
+    case RPACK_IMPOSSIBLE:
+        return "Partial result";
+    case RPACK_NO_MEMORY:
+        return "Out of memory";
+    case RPACK_TIME_LIMIT:
+        return "Time limit reached before any packing was found";
+    case RPACK_POSITION_OVERFLOW:
+        return "Rectangle position plus side too large";
+    default:
+        return "Unknown error";
+    }
+}
+#endif
+
+/* ==========
+ * TEST CASES
+ * ==========
+ */
+#if !defined(NDEBUG) && !defined(RPACK_NAME)
+
+static void test_cell_link(void)
+{
+    CellLink *cl = NULL;
+    cl = alloc_cell_link(100, 1234);
+    assert(cl != NULL);
+
+    assert(cl->size == 100);
+    assert(cl->end_pos == 1234);
+    assert(cl->jump_index == 1);
+    assert(cell_jump_index(cl, cell_head(cl)) == 0);
+    assert(cell_by_jump_index(cl, 0) == cell_head(cl));
+    assert(cell_next(cl, cell_head(cl)) == CELL_NONE);
+    assert(cell_start_pos(cl, cell_head(cl)) == 0);
+    assert(cell_end_pos(cl, cell_head(cl)) == cl->end_pos);
+
+    free_cell_link(cl);
+}
+
+static void test_cell_link_cut(void)
+{
+    CellLink *cl = NULL;
+    CellRef head, cell;
+    cl = alloc_cell_link(100, 1000);
+    assert(cl != NULL);
+    head = cell_head(cl);
+
+    size_t src_i, dest_i;
+    assert(cut(cl, head, 111, &src_i, &dest_i) == 0);
+
+    assert(cl->size == 100);
+    assert(cl->end_pos == 1000);
+    assert(cl->jump_index == 2);
+    assert(cell_head(cl) == head);
+    assert(cell_end_pos(cl, head) == 111);
+
+    assert(src_i == 0);
+    assert(dest_i == 1);
+
+    cell = cell_next(cl, head);
+    assert(cell == cell_by_jump_index(cl, 1));
+    assert(cell_start_pos(cl, cell) == 111);
+    assert(cell_end_pos(cl, cell) == 1000);
+    assert(cell_next(cl, cell) == CELL_NONE);
+
+    assert(cut(cl, head, 11, &src_i, &dest_i) == 0);
+
+    assert(src_i == 0);
+    assert(dest_i == 2);
+    assert(cell_end_pos(cl, head) == 11);
+    cell = cell_next(cl, head);
+    assert(cell_jump_index(cl, cell) == 2);
+    assert(cell == cell_by_jump_index(cl, 2));
+    assert(cell_start_pos(cl, cell) == 11);
+    assert(cell_end_pos(cl, cell) == 111);
+    cell = cell_next(cl, cell);
+    assert(cell_jump_index(cl, cell) == 1);
+    assert(cell == cell_by_jump_index(cl, 1));
+    assert(cell_start_pos(cl, cell) == 111);
+
+    clear_cell_link(cl);
+    assert(cl->jump_index == 1);
+    assert(cell_next(cl, cell_head(cl)) == CELL_NONE);
+
+    free_cell_link(cl);
+}
+
+static void test_cell_link_uncut(void)
+{
+    CellLink *cl = NULL;
+    CellRef head, cell;
+    size_t src_i, dest_i;
+    cl = alloc_cell_link(100, 1000);
+    assert(cl != NULL);
+    head = cell_head(cl);
+
+    assert(cut(cl, head, 500, &src_i, &dest_i) == 0);
+    assert(cut(cl, head, 100, &src_i, &dest_i) == 0);
+    cell = cell_by_jump_index(cl, 1);
+    assert(cut(cl, cell, 700, &src_i, &dest_i) == 0);
+    assert(cl->jump_index == 4);
+
+    uncut(cl);
+    assert(cl->jump_index == 3);
+    cell = cell_by_jump_index(cl, 1);
+    assert(cell_start_pos(cl, cell) == 500);
+    assert(cell_end_pos(cl, cell) == 1000);
+    assert(cell_next(cl, cell) == CELL_NONE);
+
+    resize_cell_link(cl, 2000);
+    assert(cl->end_pos == 2000);
+    assert(cell_end_pos(cl, cell) == 2000);
+
+    uncut(cl);
+    assert(cl->jump_index == 2);
+    assert(cell_end_pos(cl, head) == 500);
+    assert(cell_next(cl, head) == cell_by_jump_index(cl, 1));
+    uncut(cl);
+    assert(cl->jump_index == 1);
+    assert(cell_end_pos(cl, head) == 2000);
+    assert(cell_next(cl, head) == CELL_NONE);
+
+    free_cell_link(cl);
+}
+
+static void test_cell_link_cut_overflow(void)
+{
+    CellLink *cl = NULL;
+    size_t src_i = 0;
+    size_t dest_i = 0;
+    cl = alloc_cell_link(1, 1000);
+    assert(cl != NULL);
+    assert(cl->jump_index == 1);
+    assert(cut(cl, cell_head(cl), 111, &src_i, &dest_i) == -1);
+    assert(cl->jump_index == 1);
+    free_cell_link(cl);
+}
+
+static void test_jump_matrix(void)
+{
+    JumpMatrix *jm = NULL;
+    size_t i, j, size;
+    int tiled;
+
+    size = 100;
+    jm = alloc_jump_matrix(size);
+    assert(jm != NULL);
+    assert(!jm->wide);
+    assert(jm->data != NULL);
+    free_jump_matrix(jm);
+
+    for (tiled = 0; tiled <= 1; tiled++) {
+        jm = alloc_jump_matrix_layout(size, 0, tiled);
+        assert(jm != NULL);
+        assert(jump_get(jm, 0, 0) == JUMP_FREE);
+
+        for (i = 0; i < size; i++) {
+            for (j = 0; j < size; j++) {
+                assert(jump_reserve(jm, i, j) == 0);
+                jump_set(jm, i, j, (JumpIndex) (i + 1));
+            }
+        }
+        assert(jm->tiles_allocated == jm->n_tiles * jm->n_tiles);
+        for (i = 0; i < size; i++) {
+            for (j = 0; j < size; j++) {
+                assert(jump_get(jm, i, j) == i + 1);
+            }
+        }
+        jump_set(jm, 3, 4, JUMP_COL_FULL);
+        assert(jump_get(jm, 3, 4) == JUMP_COL_FULL);
+
+        free_jump_matrix(jm);
+    }
+}
+
+static void test_jump_matrix_wide(void)
+{
+    JumpMatrix *jm = NULL;
+    size_t size = 10;
+
+    jm = alloc_jump_matrix_layout(size, 1, 0);
+    assert(jm != NULL);
+    assert(jm->wide);
+    assert(jump_reserve(jm, 9, 9) == 0);
+    jump_set(jm, 9, 9, (JumpIndex) JUMP_NARROW_MAX + 1);
+    assert(jump_get(jm, 9, 9) == JUMP_NARROW_MAX + 1);
+    jump_set(jm, 9, 0, JUMP_COL_FULL);
+    assert(jump_get(jm, 9, 0) == JUMP_COL_FULL);
+    free_jump_matrix(jm);
+
+    /* Too large for 16-bit indices */
+    assert(alloc_jump_matrix_layout(JUMP_NARROW_MAX + 1, 0, 0) == NULL);
+}
+
+static void test_jump_matrix_copy(void)
+{
+    JumpMatrix *jm = NULL;
+    size_t i, j, size;
+
+    size = 3;
+    jm = alloc_jump_matrix(size);
+    assert(jm != NULL);
+    assert(jump_get(jm, 0, 0) == JUMP_FREE);
+
+    assert(copy_row(jm, 0, 1, 1) == 0);
+    assert(copy_col(jm, 0, 1, 2) == 0);
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+            assert(jump_get(jm, i, j) == JUMP_FREE);
+        }
+    }
+
+    /* Row 2 goes between rows 0 and 1 */
+    jump_set(jm, 0, 0, JUMP_COL_FULL);
+    assert(!jump_free(jm, 0, 0));
+    assert(copy_row(jm, 0, 2, 2) == 0);
+    assert(jm->n_slots == 3);
+    assert(jm->row_at[0] == 0 && jm->row_at[1] == 2 && jm->row_at[2] == 1);
+    assert(jump_get(jm, 2, 0) == JUMP_COL_FULL);
+    assert(!jump_free(jm, 2, 0));
+    assert(jump_free(jm, 1, 0));
+    assert(jump_free(jm, 2, 1));
+    assert(jump_scan(jm, 0, 1) == 1);
+    assert(jump_scan(jm, 0, 2) == 3);
+    assert(copy_col(jm, 0, 2, 3) == 0);
+    assert(jump_get(jm, 0, 2) == JUMP_COL_FULL);
+    assert(jump_get(jm, 2, 2) == JUMP_COL_FULL);
+    assert(jump_free(jm, 1, 2));
+    jump_set(jm, 2, 2, JUMP_FREE);
+    assert(jump_free(jm, 2, 2));
+    assert(!jump_free(jm, 0, 2));
+
+    /* And out again, leaving a gap that the next cut of row 0 takes */
+    remove_row(jm, 2);
+    assert(jm->n_slots == 3);
+    assert(!jump_free(jm, 0, 0));
+    assert(jump_free(jm, 1, 0));
+    assert(jump_scan(jm, 0, 1) == 3);
+    assert(copy_row(jm, 0, 2, 3) == 0);
+    assert(jm->n_slots == 3 && jm->row_at[1] == 2);
+    assert(jump_scan(jm, 0, 1) == 1);
+
+    /* Gaps pile up until the slots run out and are compacted */
+    remove_row(jm, 2);
+    assert(copy_row(jm, 1, 2, 3) == 0);
+    assert(jm->n_slots == 4 && jm->row_at[3] == 2);
+    remove_row(jm, 1);
+    assert(copy_row(jm, 2, 1, 3) == 0);
+    remove_row(jm, 2);
+    assert(copy_row(jm, 1, 2, 3) == 0);
+    assert(jm->n_slots == jm->max_slots);
+    remove_row(jm, 1);
+    jump_set(jm, 2, 1, JUMP_COL_FULL);
+    assert(copy_row(jm, 2, 1, 3) == 0);
+    assert(jm->n_slots == 3);
+    assert(jm->row_at[0] == 0 && jm->row_at[1] == 2 && jm->row_at[2] == 1);
+    assert(!jump_free(jm, 2, 1) && !jump_free(jm, 1, 1));
+    assert(jump_scan(jm, 1, 1) == 1);
+    assert(!jump_free(jm, 0, 0));
+
+    /* The last row goes without a gap */
+    remove_row(jm, 1);
+    assert(jm->n_slots == 2);
+
+    free_jump_matrix(jm);
+}
+
+static void test_bits_scan(void)
+{
+    uint64_t bits[9], ones[9];
+    size_t i, k, from, end;
+    BitsScanFunc scan = bits_scan_select();
+
+    memset(ones, 0xff, sizeof(ones));
+
+    /* Every single set bit, seen from before and after it */
+    for (k = 0; k < 9 * JUMP_WORD_BITS; k++) {
+        memset(bits, 0, sizeof(bits));
+        bits[k / JUMP_WORD_BITS] = (uint64_t) 1 << (k % JUMP_WORD_BITS);
+        for (from = 0; from < 9 * JUMP_WORD_BITS; from += 37) {
+            end = from <= k ? k : 9 * JUMP_WORD_BITS;
+            assert(bits_scan(bits, ones, from, 9 * JUMP_WORD_BITS) == end);
+            assert(scan(bits, ones, from, 9 * JUMP_WORD_BITS) == end);
+        }
+        assert(scan(bits, ones, 0, k) == k);
+        assert(scan(ones, bits, 0, 9 * JUMP_WORD_BITS) == k);
+    }
+
+    /* Shifting moves the bits up and keeps the first */
+    memset(bits, 0, sizeof(bits));
+    bits[1] = 1;
+    bits_shift(bits, 3, 7 * JUMP_WORD_BITS);
+    assert(bits[1] == 2 && bits[0] == 0);
+    for (i = 0; i < 2 * JUMP_WORD_BITS; i++) {
+        bits_shift(bits, 0, 9 * JUMP_WORD_BITS - 1);
+    }
+    assert(bits[3] == 2 && bits[1] == 0);
+    bits_shift(bits, 3 * JUMP_WORD_BITS + 1, 3 * JUMP_WORD_BITS + 3);
+    assert(bits[3] == 6);
+    bits_shift(bits, 3 * JUMP_WORD_BITS - 1, 4 * JUMP_WORD_BITS);
+    assert(bits[3] == 12 && bits[4] == 0);
+
+    /* Counting */
+    assert(bits_count(bits, 0, 9 * JUMP_WORD_BITS) == 2);
+    assert(bits_count(bits, 3 * JUMP_WORD_BITS + 3,
+                      3 * JUMP_WORD_BITS + 4) == 1);
+    assert(bits_count(bits, 3 * JUMP_WORD_BITS + 4,
+                      9 * JUMP_WORD_BITS) == 0);
+    assert(bits_count(bits, 5, 5) == 0);
+
+    /* Scanning for a clear bit */
+    memset(bits, 0xff, sizeof(bits));
+    bits[4] = ~((uint64_t) 1 << 5);
+    k = 4 * JUMP_WORD_BITS + 5;
+    assert(bits_scan_clear(bits, 0, 9 * JUMP_WORD_BITS) == k);
+    assert(bits_scan_clear(bits, k, k + 1) == k);
+    assert(bits_scan_clear(bits, 0, k) == k);
+    assert(bits_scan_clear(bits, k + 1, 9 * JUMP_WORD_BITS)
+           == 9 * JUMP_WORD_BITS);
+}
+
+static void test_jump_matrix_lazy(void)
+{
+    JumpMatrix *jm = NULL;
+    size_t i, size = 10 * JUMP_TILE;
+
+    jm = alloc_jump_matrix(JUMP_FLAT_MAX + 1);
+    assert(jm != NULL);
+    assert(jm->tiles != NULL);
+    free_jump_matrix(jm);
+
+    jm = alloc_jump_matrix_layout(size, 0, 1);
+    assert(jm != NULL);
+    assert(jm->n_tiles == 10);
+    assert(jm->tiles_allocated == 1);
+
+    /* Cut rows down to the third tile row */
+    jump_set(jm, 0, 0, 7);
+    for (i = 1; i <= 2 * JUMP_TILE; i++) {
+        assert(copy_row(jm, 0, i, 1) == 0);
+    }
+    assert(jm->tiles_allocated == 3);
+
+    /* Column copies only allocate tiles in the destination column */
+    assert(copy_col(jm, 0, 3 * JUMP_TILE, 2 * JUMP_TILE + 1) == 0);
+    assert(jm->tiles_allocated == 6);
+    for (i = 0; i <= 2 * JUMP_TILE; i++) {
+        assert(jump_get(jm, i, 3 * JUMP_TILE) == 7);
+    }
+
+    /* Row copy spanning two tiles */
+    assert(copy_col(jm, 0, JUMP_TILE, 1) == 0);
+    assert(jm->tiles_allocated == 7);
+    assert(copy_row(jm, 0, 5 * JUMP_TILE, JUMP_TILE + 1) == 0);
+    assert(jm->tiles_allocated == 9);
+    assert(jump_get(jm, 5 * JUMP_TILE, 0) == 7);
+    assert(jump_get(jm, 5 * JUMP_TILE, JUMP_TILE) == 7);
+
+    free_jump_matrix(jm);
+}
+
+static void test_jump_matrix_size_overflow(void)
+{
+    JumpMatrix *jm = NULL;
+    jm = alloc_jump_matrix(SIZE_MAX);
+    assert(jm == NULL);
+}
+
+static void test_grid(void)
+{
+    Grid *grid = NULL;
+    grid = grid_alloc(100, 120, 50);
+    assert(grid != NULL);
+    assert(grid->size == 100);
+    assert(grid->width == 120);
+    assert(grid->height == 50);
+    assert(grid->cols != NULL);
+    assert(grid->rows != NULL);
+    assert(grid->jump_matrix != NULL);
+    grid_free(grid);
+}
+
+static void test_grid_split(void)
+{
+    Grid *grid = NULL;
+    CellLink *rows, *cols;
+    Region reg;
+    grid = grid_alloc(100, 120, 50);
+    assert(grid != NULL);
+    rows = grid->rows;
+    cols = grid->cols;
+
+    reg.row_cell_start = reg.row_cell = cell_head(rows);
+    reg.row_end_pos = 30;
+    reg.col_cell_start = reg.col_cell = cell_head(cols);
+    reg.col_end_pos = 30;
+    assert(grid_split(grid, &reg) == 0);
+
+    assert(cell_end_pos(rows, cell_head(rows)) == 30);
+    assert(cell_end_pos(cols, cell_head(cols)) == 30);
+    assert(cell_end_pos(rows, cell_next(rows, cell_head(rows))) == 50);
+    assert(cell_end_pos(cols, cell_next(cols, cell_head(cols))) == 120);
+
+    jump_set(grid->jump_matrix, 0, 0, JUMP_COL_FULL);
+
+    reg.row_cell_start = reg.row_cell = cell_next(rows, cell_head(rows));
+    reg.row_end_pos = 40;
+    reg.col_cell_start = reg.col_cell = cell_head(cols);
+    reg.col_end_pos = 10;
+    assert(grid_split(grid, &reg) == 0);
+
+    assert(jump_get(grid->jump_matrix, 0, 0) == JUMP_COL_FULL);
+    assert(jump_get(grid->jump_matrix, 0, 1) == JUMP_FREE);
+    assert(jump_get(grid->jump_matrix, 0, 2) == JUMP_COL_FULL);
+
+    assert(jump_get(grid->jump_matrix, 1, 0)
+           == cell_jump_index(rows, cell_next(rows, reg.row_cell)) + 1);
+    assert(jump_get(grid->jump_matrix, 1, 1) == JUMP_FREE);
+    assert(jump_get(grid->jump_matrix, 1, 2) == JUMP_FREE);
+
+    assert(jump_get(grid->jump_matrix, 2, 0) == JUMP_FREE);
+    assert(jump_get(grid->jump_matrix, 2, 1) == JUMP_FREE);
+    assert(jump_get(grid->jump_matrix, 2, 2) == JUMP_FREE);
+
+    grid_free(grid);
+}
+
+static void test_grid_split_overflow(void)
+{
+    Grid *grid = NULL;
+    Region reg;
+    grid = grid_alloc(1, 120, 50);
+    assert(grid != NULL);
+
+    reg.row_cell_start = reg.row_cell = cell_head(grid->rows);
+    reg.row_end_pos = 30;
+    reg.col_cell_start = reg.col_cell = cell_head(grid->cols);
+    reg.col_end_pos = 30;
+    assert(grid_split(grid, &reg) == -1);
+
+    grid_free(grid);
+}
+
+static void test_grid_reserve(void)
+{
+    Grid *grid = NULL;
+    Grid *same = NULL;
+
+    grid = grid_reserve(NULL, 10);
+    assert(grid != NULL);
+    assert(grid->size == 10);
+    assert(grid->capacity == 10);
+
+    same = grid_reserve(grid, 4);
+    assert(same == grid);
+    assert(grid->size == 4);
+    assert(grid->capacity == 10);
+
+    /* Grows at least geometrically */
+    grid = grid_reserve(grid, 11);
+    assert(grid != NULL);
+    assert(grid->size == 11);
+    assert(grid->capacity == 20);
+    grid = grid_reserve(grid, 100);
+    assert(grid != NULL);
+    assert(grid->size == 100);
+    assert(grid->capacity == 100);
+
+    /* Failure leaves the grid as it was */
+    assert(grid_reserve(grid, SIZE_MAX) == NULL);
+    assert(grid->size == 100);
+
+    grid_free(grid);
+}
+
+/* assert_occupied checks the occupancy bits of the grid's live cells
+   against the jump matrix elements */
+static void assert_occupied(const Grid * grid)
+{
+    size_t r, c;
+    for (r = 0; r < grid->rows->jump_index; r++) {
+        for (c = 0; c < grid->cols->jump_index; c++) {
+            assert(jump_free(grid->jump_matrix, r, c)
+                   == (jump_get(grid->jump_matrix, r, c) == JUMP_FREE));
+        }
+    }
+}
+
+/* test_sides points `sides` at the `length` rectangles `sizes`, in
+   array order */
+static void
+test_sides(RectangleSides * sides, long *buffer, size_t *order,
+           const Rectangle * sizes, size_t length)
+{
+    size_t i;
+    for (i = 0; i < length; i++) {
+        order[i] = i;
+    }
+    rectangle_sides_fill(sides, buffer, order, sizes, length);
+}
+
+static void test_grid_tiled(void)
+{
+    Grid *grid = NULL;
+    BBoxRestrictions bbr;
+    Rectangle sizes[150];
+    RectangleSides sides;
+    long buffer[4 * 150];
+    size_t order[150];
+    unsigned long seed = 1;
+    size_t i;
+    long h, width, height;
+
+    /* Rectangles sorted by decreasing height */
+    bbr.min_width = bbr.max_width = bbr.max_height = 0;
+    for (i = 0; i < 150; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        sizes[i].width = 1 + (long) (seed >> 16) % 40;
+        sizes[i].height = 150 - (long) i;
+        sizes[i].area = sizes[i].width * sizes[i].height;
+        if (bbr.min_width < sizes[i].width) {
+            bbr.min_width = sizes[i].width;
+        }
+        bbr.max_width += sizes[i].width;
+        bbr.max_height += sizes[i].height;
+    }
+    bbr.min_height = sizes[0].height;
+    bbr.max_area = LONG_MAX;
+    bbr.happy_area = 0;
+    test_sides(&sides, buffer, order, sizes, 150);
+
+    grid = grid_alloc(151, 0, 0);
+    assert(grid != NULL);
+    assert(grid->jump_matrix->data != NULL);
+    h = grid_search_bbox(grid, &sides, &bbr);
+    assert(h > 0);
+    assert_occupied(grid);
+    width = grid->width;
+    height = grid->height;
+
+    free_jump_matrix(grid->jump_matrix);
+    grid->jump_matrix = alloc_jump_matrix_layout(151, 0, 1);
+    assert(grid->jump_matrix != NULL);
+    h = grid_search_bbox(grid, &sides, &bbr);
+    assert(h > 0);
+    assert(grid->width == width);
+    assert(grid->height == height);
+    assert(grid->jump_matrix->tiles_allocated > 1);
+    assert_occupied(grid);
+
+    grid_free(grid);
+}
+
+static void test_search_shared(void)
+{
+    SearchShared shared, next;
+    search_shared_init(&shared, 2);
+    assert(search_shared_limit(&shared) == LONG_MAX);
+    search_shared_offer(&shared, 100);
+    assert(search_shared_limit(&shared) == 102);
+    search_shared_offer(&shared, 200);
+    assert(search_shared_limit(&shared) == 102);
+    search_shared_offer(&shared, 50);
+    assert(search_shared_limit(&shared) == 52);
+
+    /* Offers go down the chain, not up */
+    search_shared_init(&next, 0);
+    shared.next = &next;
+    search_shared_offer(&next, 40);
+    assert(search_shared_limit(&shared) == 52);
+    assert(search_shared_limit(&next) == 40);
+    search_shared_offer(&shared, 30);
+    assert(search_shared_limit(&shared) == 32);
+    assert(search_shared_limit(&next) == 30);
+}
+
+static void test_task_func(void *arg, size_t index)
+{
+    size_t *counts = arg;
+    counts[index]++;
+}
+
+static void test_task_run(void)
+{
+    size_t counts[64];
+    size_t i, n_threads;
+    for (n_threads = 0; n_threads <= 8; n_threads++) {
+        memset(counts, 0, sizeof(counts));
+        task_run(test_task_func, counts, 64, n_threads);
+        for (i = 0; i < 64; i++) {
+            assert(counts[i] == 1);
+        }
+    }
+}
+
+static void test_task_worker_func(void *arg, size_t worker, size_t index)
+{
+    size_t *workers = arg;
+    /* Each worker is used by one thread at a time */
+    workers[index] = worker + 1;
+}
+
+static void test_task_run_workers(void)
+{
+    size_t workers[64];
+    size_t i, n_threads;
+    for (n_threads = 0; n_threads <= 8; n_threads++) {
+        memset(workers, 0, sizeof(workers));
+        task_run_workers(test_task_worker_func, workers, 64, n_threads);
+        for (i = 0; i < 64; i++) {
+            assert(workers[i] >= 1);
+            assert(workers[i] <= (n_threads > 1 ? n_threads : 1));
+        }
+    }
+}
+
+static void test_grid_search_bbox_shared(void)
+{
+    Grid *grid = NULL;
+    SearchShared shared;
+    BBoxRestrictions bbr;
+    Rectangle sizes[4];
+    RectangleSides sides;
+    long buffer[4 * 4];
+    size_t i, order[4];
+    long h;
+
+    for (i = 0; i < 4; i++) {
+        sizes[i].width = 2;
+        sizes[i].height = 2;
+        sizes[i].area = 4;
+    }
+    test_sides(&sides, buffer, order, sizes, 4);
+    bbr.min_width = 2;
+    bbr.max_width = 8;
+    bbr.min_height = 2;
+    bbr.max_height = 8;
+    bbr.max_area = LONG_MAX;
+    bbr.happy_area = 0;
+    grid = grid_alloc(5, 0, 0);
+    assert(grid != NULL);
+
+    search_shared_init(&shared, 0);
+    h = grid_search_bbox_shared(grid, &sides, &bbr, &shared);
+    assert(h > 0);
+    assert(grid->width * grid->height == 16);
+    assert(search_shared_limit(&shared) == 16);
+
+    /* Nothing below the published area exists, so a second search
+       sharing the same bound must fail. */
+    h = grid_search_bbox_shared(grid, &sides, &bbr, &shared);
+    assert(h < 0);
+
+    grid_free(grid);
+}
+
+static int test_rectangle_height_cmp(const void *a, const void *b)
+{
+    const Rectangle *ra = a, *rb = b;
+    return (rb->height > ra->height) - (rb->height < ra->height);
+}
+
+static int test_grid_equal(const Grid * a, const Grid * b)
+{
+    CellRef ca, cb;
+    size_t r, c;
+    if (a->rows->jump_index != b->rows->jump_index
+        || a->cols->jump_index != b->cols->jump_index) {
+        return 0;
+    }
+    for (ca = cell_head(a->rows), cb = cell_head(b->rows);
+         ca != CELL_NONE && cb != CELL_NONE;
+         ca = cell_next(a->rows, ca), cb = cell_next(b->rows, cb)) {
+        if (cell_end_pos(a->rows, ca) != cell_end_pos(b->rows, cb)
+            || cell_jump_index(a->rows, ca) != cell_jump_index(b->rows, cb)) {
+            return 0;
+        }
+    }
+    for (ca = cell_head(a->cols), cb = cell_head(b->cols);
+         ca != CELL_NONE && cb != CELL_NONE;
+         ca = cell_next(a->cols, ca), cb = cell_next(b->cols, cb)) {
+        if (cell_end_pos(a->cols, ca) != cell_end_pos(b->cols, cb)
+            || cell_jump_index(a->cols, ca) != cell_jump_index(b->cols, cb)) {
+            return 0;
+        }
+    }
+    for (r = 0; r < a->rows->jump_index; r++) {
+        for (c = 0; c < a->cols->jump_index; c++) {
+            if (jump_get(a->jump_matrix, r, c)
+                != jump_get(b->jump_matrix, r, c)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void test_grid_try_pack_resume(void)
+{
+    Grid *grid = NULL;
+    Grid *fresh = NULL;
+    Rectangle sizes[40];
+    RectangleSides sides;
+    long buffer[4 * 40];
+    size_t i, order[80];
+    unsigned long seed = 12345;
+    long height = 30, width;
+    long delta_1, delta_2, grid_w_1, grid_w_2;
+    int success_1, success_2, k, resumed = 0;
+
+    for (i = 0; i < 40; i++) {
+        seed = seed * 1103515245 + 12345;
+        sizes[i].width = 1 + (long) (seed >> 16) % 20;
+        seed = seed * 1103515245 + 12345;
+        sizes[i].height = 1 + (long) (seed >> 16) % 20;
+        sizes[i].area = sizes[i].width * sizes[i].height;
+    }
+    /* Read through the height order, not in array order */
+    rectangle_order(sizes, 40, 0, order, &order[40]);
+    rectangle_sides_fill(&sides, buffer, order, sizes, 40);
+    grid = grid_alloc(41, 0, 0);
+    fresh = grid_alloc(41, 0, 0);
+    assert(grid != NULL && fresh != NULL);
+
+    /* Walk the height up and down while the width shrinks and grows,
+       every probe must match a packing from scratch */
+    for (k = 0; k < 300; k++) {
+        seed = seed * 1103515245 + 12345;
+        height += (long) (seed >> 16) % 7 - 3;
+        if (height < 20) {
+            height = 20;
+        }
+        width = 5000 / height + (long) (seed >> 20) % 5 - 2;
+        grid->height = fresh->height = height;
+        grid->width = fresh->width = width;
+
+        /* Resuming twice keeps the same rectangles */
+        delta_1 = 1000;
+        grid_w_1 = 0;
+        if (grid_resume(grid, &sides, &delta_1, &grid_w_1) > 0) {
+            resumed++;
+        }
+        success_1 = grid_try_pack(grid, &sides, 1000, &delta_1, &grid_w_1);
+        grid_clear(fresh);
+        success_2 = grid_try_pack(fresh, &sides, 1000, &delta_2, &grid_w_2);
+        assert(success_1 == success_2);
+        assert(delta_1 == delta_2);
+        assert(grid_w_1 == grid_w_2);
+        assert(test_grid_equal(grid, fresh));
+    }
+    assert(resumed > 0);
+
+    grid_free(grid);
+    grid_free(fresh);
+}
+
+static void test_grid_search_bbox_pool(void)
+{
+#if LONG_MAX > 2147483647L
+    /* Thin-rectangle fixture, exercises coarse stepping and refinement */
+    static const long fixture[10][2] = {
+        {936469, 1}, {956023, 480880}, {762663, 456585},
+        {522456, 924841}, {193372, 365467}, {505745, 921750},
+        {127245, 805540}, {234482, 384004}, {986956, 278825},
+        {787627, 59839}
+    };
+    Grid *grids[4];
+    BBoxRestrictions bbr;
+    Rectangle sizes[10];
+    RectangleSides sides;
+    long buffer[4 * 10];
+    size_t i, order[10], n_grids;
+    long h, width, height;
+
+    bbr.min_width = bbr.min_height = 0;
+    bbr.max_width = bbr.max_height = 0;
+    for (i = 0; i < 10; i++) {
+        sizes[i].width = fixture[i][0];
+        sizes[i].height = fixture[i][1];
+        sizes[i].area = sizes[i].width * sizes[i].height;
+        if (bbr.min_width < sizes[i].width) {
+            bbr.min_width = sizes[i].width;
+        }
+        if (bbr.min_height < sizes[i].height) {
+            bbr.min_height = sizes[i].height;
+        }
+        bbr.max_width += sizes[i].width;
+        bbr.max_height += sizes[i].height;
+    }
+    bbr.max_area = LONG_MAX;
+    bbr.happy_area = 0;
+    qsort(sizes, 10, sizeof(Rectangle), test_rectangle_height_cmp);
+    test_sides(&sides, buffer, order, sizes, 10);
+    for (i = 0; i < 4; i++) {
+        grids[i] = grid_alloc(11, 0, 0);
+        assert(grids[i] != NULL);
+    }
+
+    h = grid_search_bbox(grids[0], &sides, &bbr);
+    assert(h > 0);
+    width = grids[0]->width;
+    height = grids[0]->height;
+    for (n_grids = 1; n_grids <= 4; n_grids++) {
+        h = grid_search_bbox_pool(grids, n_grids, &sides, &bbr, NULL);
+        assert(h > 0);
+        assert(grids[0]->width == width);
+        assert(grids[0]->height == height);
+    }
 
-        grid->height = h;
-        grid->width = width_limit;
-        success =
-            grid_try_pack(grid, sizes, bbr->max_height, &delta_unused, &grid_w);
-        if (!success) {
-            continue;
-        }
-        candidate_area = h * grid_w;
-        if (candidate_area < *best_area) {
-            *best_area = candidate_area;
-            *best_h = h;
-            *best_w = grid_w;
-        }
+    for (i = 0; i < 4; i++) {
+        grid_free(grids[i]);
     }
+#endif
 }
 
-/* grid_search_bbox will search for a bbox with smallest area that can
-   contain all the rectangles, `sizes`, in the `grid`. The bounding
-   box must also satisfy the bounding box restrictions `bbr`. */
-long
-grid_search_bbox(Grid * grid, const Rectangle * sizes,
-                 const BBoxRestrictions * bbr)
+static void test_grid_search_bbox_sweep(void)
 {
-    long happy_area = 1;        /* Todo */
-    long start_width, start_area, area, best_h, best_w, delta, grid_w;
-    long effective_delta, max_effective_delta;
-    unsigned long long stall_streak;
-    unsigned long long stall_trigger = 0;
-    long coarse_step;
-    int success, improved, used_coarse_steps;
-    long refine_radius = 0;
+    Grid *grids[4];
+    BBoxRestrictions bbr;
+    Rectangle sizes[20];
+    RectangleSides sides;
+    long buffer[4 * 20];
+    size_t i, order[20], n_grids;
+    long h, area;
 
-    grid->height = bbr->min_height;
-    grid->width = bbr->max_area / grid->height;
-    if (bbr->max_width < grid->width) {
-        grid->width = bbr->max_width;
+    /* Squares sorted by decreasing height */
+    for (i = 0; i < 20; i++) {
+        sizes[i].width = sizes[i].height = 21 - (long) i;
+        sizes[i].area = sizes[i].width * sizes[i].height;
+    }
+    test_sides(&sides, buffer, order, sizes, 20);
+    bbr.min_width = 21;
+    bbr.max_width = 230;
+    bbr.min_height = 21;
+    bbr.max_height = 230;
+    bbr.max_area = LONG_MAX;
+    bbr.happy_area = 0;
+    for (i = 0; i < 4; i++) {
+        grids[i] = grid_alloc(21, 0, 0);
+        assert(grids[i] != NULL);
     }
-    start_width = grid->width;
 
-    start_area = area = bbr->max_area - 1;
-    best_w = grid->width;
-    best_h = grid->height;
-    stall_streak = 0;
-    coarse_step = 1;
-    max_effective_delta = 1;
-    used_coarse_steps = 0;
+    h = grid_search_bbox(grids[0], &sides, &bbr);
+    assert(h > 0);
+    area = grids[0]->width * grids[0]->height;
+    for (n_grids = 1; n_grids <= 4; n_grids++) {
+        h = grid_search_bbox_sweep(grids, n_grids, &sides, &bbr, NULL);
+        assert(h > 0);
+        assert(grids[0]->height == h);
+        assert(grids[0]->width * grids[0]->height <= area);
+    }
 
-    while (grid->height <= bbr->max_height
-           && bbr->min_width <= grid->width) {
-        delta = bbr->max_height;
-        success = grid_try_pack(grid, sizes, delta, &delta, &grid_w);
-        improved = 0;
-        /* All rectangles successfully packed? Update area. */
-        if (success) {
-            best_h = grid->height;
-            best_w = grid_w;
-            /* bounded by construction: grid->width = area / grid->height and
-               grid_w <= grid->width, so best_h * best_w <= area <= LONG_MAX */
-            assert(best_h * best_w < area);
-            area = best_h * best_w;
-            improved = 1;
-            assert(area <= bbr->max_area);
-            if (area <= happy_area) {
-                /* We have found a solution the caller is happy
-                   with. End search. */
-                goto done;
-            }
-        }
+    /* Nothing fits below the area limit */
+    bbr.max_area = 21 * 21;
+    h = grid_search_bbox_sweep(grids, 4, &sides, &bbr, NULL);
+    assert(h < 0);
+    assert(grids[0]->height == bbr.min_height);
 
-        effective_delta = delta;
-        if (effective_delta < 1) {
-            effective_delta = 1;
-        }
+    for (i = 0; i < 4; i++) {
+        grid_free(grids[i]);
+    }
+}
 
-        stall_trigger = 0;
-        if (!improved && grid->height >= COARSE_LOW_DELTA_MIN_HEIGHT) {
-            stall_trigger = coarse_trigger_for_delta(COARSE_TRIGGER, delta);
-        }
+static void test_rectangle_init(void)
+{
+    RectangleStats stats;
+    Rectangle r;
+    long max_width = -1, max_height = 7;
 
-        if (stall_trigger > 0) {
-            stall_streak++;
-            if (stall_streak >= stall_trigger) {
-                if (coarse_step < COARSE_STEP_MAX) {
-                    coarse_step *= 2;
-                    if (coarse_step > COARSE_STEP_MAX) {
-                        coarse_step = COARSE_STEP_MAX;
-                    }
-                }
-                if (effective_delta < coarse_step) {
-                    effective_delta = coarse_step;
-                    used_coarse_steps = 1;
-                }
-            }
-        } else {
-            stall_streak = 0;
-            coarse_step = 1;
-        }
+    rectangle_stats_init(&stats);
+    assert(rectangle_init(&r, &stats, 3, 4, 2) == RPACK_OK);
+    assert(r.index == 3 && r.area == 8 && r.wide && r.x == -1);
+    assert(rectangle_init(&r, &stats, 4, 1, 5) == RPACK_OK);
+    assert(stats.sum_width == 5 && stats.sum_height == 7);
+    assert(stats.max_width == 4 && stats.min_height == 2);
+    assert(stats.area == 13);
+    assert(rectangle_init(&r, &stats, 5, 0, 5) == RPACK_WIDTH_NOT_POSITIVE);
+    assert(rectangle_init(&r, &stats, 5, 1, -1)
+           == RPACK_HEIGHT_NOT_POSITIVE);
+    assert(rectangle_init(&r, &stats, 5, LONG_MAX, 1)
+           == RPACK_SUM_WIDTH_OVERFLOW);
 
-        if (effective_delta > max_effective_delta) {
-            max_effective_delta = effective_delta;
-        }
-        if (grid->height >= bbr->max_height) {
-            break;
-        }
-        if (effective_delta > bbr->max_height - grid->height) {
-            effective_delta = bbr->max_height - grid->height;
-            if (effective_delta <= 0) {
-                break;
-            }
-        }
+    assert(rectangle_bounds(&stats, &max_width, &max_height) == RPACK_OK);
+    assert(max_width == 5 && max_height == 7);
+    max_width = 3;
+    assert(rectangle_bounds(&stats, &max_width, &max_height)
+           == RPACK_MAX_WIDTH_TOO_SMALL);
+    max_width = 4;
+    max_height = 0;
+    assert(rectangle_bounds(&stats, &max_width, &max_height)
+           == RPACK_MAX_HEIGHT_ZERO);
+}
 
-        /* Inc height */
-        grid->height += effective_delta;
+static void test_rectangle_order(void)
+{
+    RectangleStats stats;
+    Rectangle r[200];
+    size_t order[200], tmp[200];
+    unsigned long seed = 7;
+    size_t i;
+    long side;
+    int by_width;
 
-        /* Dec width limit */
-        grid->width = area / grid->height;
-        if (grid->width > bbr->max_width) {
-            grid->width = bbr->max_width;
-        }
-        if (grid->width * grid->height == area) {
-            grid->width -= 1;
+    /* Few distinct sizes for many ties, and a side past 2^16 */
+    rectangle_stats_init(&stats);
+    for (i = 0; i < 200; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        side = i == 17 ? 70000 : 1 + (long) (seed >> 16) % 5;
+        assert(rectangle_init(&r[i], &stats, i, side,
+                              1 + (long) (seed >> 8) % 4) == RPACK_OK);
+    }
+    for (by_width = 0; by_width <= 1; by_width++) {
+        rectangle_order(r, 200, by_width, order, tmp);
+        assert(order[0] == 17 || by_width == 0);
+        for (i = 1; i < 200; i++) {
+            const Rectangle *a = &r[order[i - 1]];
+            const Rectangle *b = &r[order[i]];
+            int cmp = by_width ? rectangle_width_cmp(a, b)
+                : rectangle_height_cmp(a, b);
+            /* Sorted, and stable */
+            assert(cmp < 0 || (cmp == 0 && order[i - 1] < order[i]));
         }
-        assert(grid->width * grid->height < area);
     }
 
-    /* If the area hasn't changed from the start it means that we
-       never found a successful packing in the while loop. We set the
-       grid maximum with/height and return a negative value to
-       indicate failure. */
-    if (start_area == area) {
-        grid->width = start_width;
-        grid->height = bbr->min_height;
-        return -1;
+    /* Back to input order from any permutation */
+    for (i = 0; i < 200; i++) {
+        r[i].index = order[i];
     }
-    if (used_coarse_steps) {
-        refine_radius = max_effective_delta;
-        if (refine_radius > REFINE_RADIUS_MAX) {
-            refine_radius = REFINE_RADIUS_MAX;
-        }
-        grid_refine_neighborhood(grid, sizes, bbr, &area, &best_h, &best_w,
-                                 refine_radius);
+    rectangle_sort_index(r, 200);
+    for (i = 0; i < 200; i++) {
+        assert(r[i].index == i);
     }
-    /* Success */
-  done:grid->width = best_w;
-    grid->height = best_h;
-    return best_h;
 }
 
-/* ==========
- * TEST CASES
- * ==========
- */
-#ifndef NDEBUG
+static void test_area_lower_bound(void)
+{
+    RectangleStats stats;
+    Rectangle r[3];
+    BBoxRestrictions bbr;
 
-static void test_cell_link(void)
+    /* aaaa   Both wider than half of max_width 6, so stacked
+       bbb    even though the total area is only 7 */
+    rectangle_stats_init(&stats);
+    assert(rectangle_init(&r[0], &stats, 0, 4, 1) == RPACK_OK);
+    assert(rectangle_init(&r[1], &stats, 1, 3, 1) == RPACK_OK);
+    bbr.min_width = 4;
+    bbr.min_height = 1;
+    bbr.max_width = 6;
+    bbr.max_height = 2;
+    bbr.max_area = LONG_MAX;
+    assert(area_lower_bound(r, 2, &bbr) == 8);
+    bbr.max_width = 7;
+    assert(area_lower_bound(r, 2, &bbr) == 7);
+
+    /* The area spread over max_height 2 is at least 5 wide */
+    assert(rectangle_init(&r[2], &stats, 2, 1, 2) == RPACK_OK);
+    bbr.min_height = 2;
+    assert(area_lower_bound(r, 3, &bbr) == 10);
+
+    assert(happy_area(100, 0) == 100);
+    assert(happy_area(100, 0.02) == 102);
+    assert(happy_area(LONG_MAX - 1, 1) == LONG_MAX);
+}
+
+static void test_rpack_pack(void)
 {
-    CellLink *cl = NULL;
-    cl = alloc_cell_link(100, 1234);
-    assert(cl != NULL);
+    /* aaa  bb  cc  -->  aaabb
+       aaa  bb           aaabb
+       aaa               aaacc */
+    static const long perfect[6] = { 3, 3, 2, 2, 2, 1 };
+    static const long expected[6] = { 0, 0, 3, 0, 3, 2 };
+    static const size_t lengths[4] = { 40, 27, 14, 1 };
+    long sizes[2 * 40];
+    long positions[2 * 40];
+    long threaded[2 * 40];
+    long bad[2] = { 3, 0 };
+    long four[8] = { 2, 2, 2, 2, 2, 2, 2, 2 };
+    RpackPacker *packer;
+    size_t i, k, n;
 
-    assert(cl->size == 100);
-    assert(cl->end_pos == 1234);
-    assert(cl->jump_index == 1);
-    assert(cl->head == &cl->cells[0]);
-    assert(cl->head->prev == NULL);
-    assert(cl->head->next == NULL);
-    assert(cl->head->end_pos == cl->end_pos);
+    assert(rpack_pack(perfect, 3, -1, -1, 1, positions) == RPACK_OK);
+    assert(memcmp(positions, expected, sizeof(expected)) == 0);
+    assert(rpack_pack(bad, 1, -1, -1, 1, positions)
+           == RPACK_HEIGHT_NOT_POSITIVE);
+    assert(rpack_pack(perfect, 3, 2, -1, 1, positions)
+           == RPACK_MAX_WIDTH_TOO_SMALL);
+    assert(rpack_pack(four, 4, 3, 3, 1, positions) == RPACK_IMPOSSIBLE);
+    assert(positions[0] == 0 && positions[1] == 0);
+    assert(positions[2] == -1 && positions[7] == -1);
 
-    free_cell_link(cl);
+    /* A packer gives the same result when reused and with threads */
+    packer = rpack_packer_new();
+    assert(packer != NULL);
+    srand(3);
+    for (k = 0; k < 4; k++) {
+        n = lengths[k];
+        for (i = 0; i < 2 * n; i++) {
+            sizes[i] = 1 + rand() % 50;
+        }
+        assert(rpack_pack(sizes, n, -1, -1, 1, positions) == RPACK_OK);
+        assert(rpack_packer_pack(packer, sizes, n, -1, -1, 1, threaded)
+               == RPACK_OK);
+        assert(memcmp(positions, threaded, 2 * n * sizeof(long)) == 0);
+        assert(rpack_packer_pack(packer, sizes, n, -1, -1, 8, threaded)
+               == RPACK_OK);
+        assert(memcmp(positions, threaded, 2 * n * sizeof(long)) == 0);
+    }
+    assert(packer_capacity(packer) == 40);
+    rpack_packer_free(packer);
 }
 
-static void test_cell_link_cut(void)
+static void test_packer_refine_threads(void)
 {
-    CellLink *cl = NULL;
-    cl = alloc_cell_link(100, 1000);
-    assert(cl != NULL);
+#if LONG_MAX > 2147483647L
+    /* Thin rectangles, whose search refines after coarse stepping. The
+       refinement probes of the first strategy run on 1, 2, 4 and 8
+       threads, see search_strategies_parallel. */
+    static const size_t threads[4] = { 1, 2, 4, 8 };
+    long sizes[2 * 10];
+    long positions[2 * 10];
+    long threaded[2 * 10];
+    RpackPacker *packer;
+    unsigned long long refine_probes = 0;
+    size_t i, k, seed;
 
-    size_t src_i, dest_i;
-    assert(cut(cl, cl->head, 111, &src_i, &dest_i) == 0);
+    packer = rpack_packer_new();
+    assert(packer != NULL);
+    rpack_packer_set_stats(packer, 1);
+    srand(11);
+    for (seed = 0; seed < 12; seed++) {
+        for (i = 0; i < 10; i++) {
+            sizes[2 * i] = 1 + rand() % 1000000;
+            sizes[2 * i + 1] = i % 3 == 0 ? 1 + rand() % 100
+                : 1 + rand() % 1000000;
+        }
+        assert(rpack_packer_pack(packer, sizes, 10, -1, -1, 1, positions)
+               == RPACK_OK);
+        refine_probes += rpack_packer_stats(packer)->counters.refine_probes;
+        for (k = 1; k < 4; k++) {
+            assert(rpack_packer_pack(packer, sizes, 10, -1, -1, threads[k],
+                                     threaded) == RPACK_OK);
+            assert(memcmp(positions, threaded, sizeof(positions)) == 0);
+        }
+    }
+    assert(refine_probes > 0);
+    rpack_packer_free(packer);
+#endif
+}
 
-    assert(cl->size == 100);
-    assert(cl->end_pos == 1000);
-    assert(cl->jump_index == 2);
-    assert(cl->head == &cl->cells[0]);
-    assert(cl->head->prev == NULL);
-    assert(cl->head->next == &cl->cells[1]);
-    assert(cl->head->end_pos == 111);
+static int test_overlapping(const long *sizes, const long *pos, size_t n)
+{
+    size_t i, k, d;
+    int overlap;
+    for (i = 0; i < n; i++) {
+        for (k = i + 1; k < n; k++) {
+            overlap = 1;
+            for (d = 0; d < 2; d++) {
+                if (pos[2 * i + d] >= pos[2 * k + d] + sizes[2 * k + d]
+                    || pos[2 * k + d] >= pos[2 * i + d] + sizes[2 * i + d]) {
+                    overlap = 0;
+                }
+            }
+            if (overlap) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
 
-    assert(src_i == 0);
-    assert(dest_i == 1);
+static void test_packer_time_limit(void)
+{
+    long four[8] = { 2, 2, 2, 2, 2, 2, 2, 2 };
+    long sizes[2 * 40];
+    long positions[2 * 40];
+    long limited[2 * 40];
+    RpackPacker *packer;
+    size_t i;
 
-    assert(cl->cells[1].prev == cl->head);
-    assert(cl->cells[1].end_pos == 1000);
+    srand(5);
+    for (i = 0; i < 2 * 40; i++) {
+        sizes[i] = 1 + rand() % 50;
+    }
+    assert(rpack_pack(sizes, 40, -1, -1, 1, positions) == RPACK_OK);
+    packer = rpack_packer_new();
+    assert(packer != NULL);
 
-    assert(cut(cl, cl->head, 11, &src_i, &dest_i) == 0);
+    /* A generous limit changes nothing */
+    rpack_packer_set_time_limit(packer, 60);
+    assert(rpack_packer_pack(packer, sizes, 40, -1, -1, 1, limited)
+           == RPACK_OK);
+    assert(!rpack_packer_stopped(packer));
+    assert(memcmp(positions, limited, sizeof(positions)) == 0);
 
-    assert(src_i == 0);
-    assert(dest_i == 2);
-    assert(cl->head->end_pos == 11);
-    assert(cl->head->next->jump_index == 2);
-    assert(start_pos(cl->head->next) == 11);
+    /* Out of time from the start, still a valid packing */
+    rpack_packer_set_time_limit(packer, 0);
+    assert(rpack_packer_pack(packer, sizes, 40, -1, -1, 1, limited)
+           == RPACK_OK);
+    assert(rpack_packer_stopped(packer));
+    assert(!test_overlapping(sizes, limited, 40));
+    assert(rpack_packer_pack(packer, sizes, 40, -1, -1, 8, limited)
+           == RPACK_OK);
+    assert(rpack_packer_stopped(packer));
+    assert(!test_overlapping(sizes, limited, 40));
 
-    clear_cell_link(cl);
-    assert(cl->jump_index == 1);
+    /* No packing found in time is not proof of an impossible one */
+    assert(rpack_packer_pack(packer, four, 4, 3, 3, 1, limited)
+           == RPACK_TIME_LIMIT);
 
-    free_cell_link(cl);
+    rpack_packer_set_time_limit(packer, -1);
+    assert(rpack_packer_pack(packer, sizes, 40, -1, -1, 1, limited)
+           == RPACK_OK);
+    assert(!rpack_packer_stopped(packer));
+    assert(memcmp(positions, limited, sizeof(positions)) == 0);
+    rpack_packer_free(packer);
 }
 
-static void test_cell_link_cut_overflow(void)
+static void test_packer_sweep(void)
 {
-    CellLink *cl = NULL;
-    size_t src_i = 0;
-    size_t dest_i = 0;
-    cl = alloc_cell_link(1, 1000);
-    assert(cl != NULL);
-    assert(cl->jump_index == 1);
-    assert(cut(cl, cl->head, 111, &src_i, &dest_i) == -1);
-    assert(cl->jump_index == 1);
-    free_cell_link(cl);
+#if LONG_MAX > 2147483647L
+    /* Sides up to 50 are packed by the int32 variant, the others by
+       this one */
+    static const long sides[2] = { 50, 100000000 };
+    long sizes[2 * 40];
+    long positions[2 * 40];
+    long swept[2 * 40];
+    RpackPacker *packer;
+    long width, height, area;
+    size_t i, k, seed;
+
+    packer = rpack_packer_new();
+    assert(packer != NULL);
+    srand(13);
+    for (seed = 0; seed < 8; seed++) {
+        for (i = 0; i < 2 * 40; i++) {
+            sizes[i] = 1 + rand() % sides[seed % 2];
+        }
+        rpack_packer_set_sweep_threads(packer, 1);
+        assert(rpack_packer_pack(packer, sizes, 40, -1, -1, 1, positions)
+               == RPACK_OK);
+        assert(rpack_bbox_size(sizes, positions, 40, &width, &height)
+               == RPACK_OK);
+        area = width * height;
+        /* The area of the sweep is no larger for these inputs */
+        for (k = 2; k <= 4; k += 2) {
+            rpack_packer_set_sweep_threads(packer, k);
+            assert(rpack_packer_pack(packer, sizes, 40, -1, -1, 8, swept)
+                   == RPACK_OK);
+            assert(!test_overlapping(sizes, swept, 40));
+            assert(rpack_bbox_size(sizes, swept, 40, &width, &height)
+                   == RPACK_OK);
+            assert(width * height <= area);
+        }
+    }
+    rpack_packer_free(packer);
+#endif
 }
 
-static void test_jump_matrix(void)
+static void test_packer_stats(void)
 {
-    Cell *cell = NULL;
-    JumpMatrix jm = NULL;
-    size_t i, j, size;
+    long sizes[2 * 40];
+    long positions[2 * 40];
+    long counted[2 * 40];
+    const RpackStats *stats;
+    RpackPacker *packer;
+    size_t i, threads;
 
-    size = 100;
-    jm = alloc_jump_matrix(size);
-    assert(jm != NULL);
-    assert(jm[0][0] == NULL);
+    srand(7);
+    for (i = 0; i < 2 * 40; i++) {
+        sizes[i] = 1 + rand() % 50;
+    }
+    assert(rpack_pack(sizes, 40, -1, -1, 1, positions) == RPACK_OK);
+    packer = rpack_packer_new();
+    assert(packer != NULL);
+    stats = rpack_packer_stats(packer);
 
-    for (i = 0; i < size; i++) {
-        for (j = 0; j < size; j++) {
-            jm[i][j] = cell;
+    rpack_packer_set_stats(packer, 1);
+    for (threads = 1; threads <= 8; threads *= 8) {
+        assert(rpack_packer_pack(packer, sizes, 40, -1, -1, threads, counted)
+               == RPACK_OK);
+        assert(memcmp(positions, counted, sizeof(positions)) == 0);
+        assert(stats->counters.try_packs > 0);
+        assert(stats->counters.placed > 0);
+        assert(stats->counters.columns >= stats->counters.try_packs);
+        assert(stats->counters.rows > 0);
+        assert(stats->counters.cuts > 0);
+        assert(stats->counters.copied >= stats->counters.cuts);
+        for (i = 0; i < 4; i++) {
+            assert(stats->strategy_seconds[i] >= 0);
         }
     }
 
-    free(jm);
+    rpack_packer_set_stats(packer, 0);
+    assert(rpack_packer_pack(packer, sizes, 40, -1, -1, 1, counted)
+           == RPACK_OK);
+    assert(stats->counters.try_packs == 0 && stats->counters.rows == 0);
+    rpack_packer_free(packer);
 }
 
-static void test_jump_matrix_copy(void)
+/* test_overlapping_pairs compares all pairs like a double loop */
+static void
+test_overlapping_pairs(const long *sizes, const long *positions,
+                       size_t length, size_t *first, size_t *second)
 {
-    JumpMatrix jm = NULL;
-    size_t i, j, size;
+    size_t i, j;
+    for (i = 0; i < length; i++) {
+        for (j = i + 1; j < length; j++) {
+            if (positions[2 * i] < positions[2 * j] + sizes[2 * j]
+                && positions[2 * j] < positions[2 * i] + sizes[2 * i]
+                && positions[2 * i + 1] < positions[2 * j + 1]
+                + sizes[2 * j + 1]
+                && positions[2 * j + 1] < positions[2 * i + 1]
+                + sizes[2 * i + 1]) {
+                *first = i;
+                *second = j;
+                return;
+            }
+        }
+    }
+    *first = length;
+    *second = length;
+}
 
-    size = 2;
-    jm = alloc_jump_matrix(size);
-    assert(jm != NULL);
-    assert(jm[0][0] == NULL);
+static void test_rpack_overlapping(void)
+{
+    long sizes[2 * 400], positions[2 * 400];
+    long touching[4] = { 0, 0, 10, 0 }, squares[4] = { 10, 10, 10, 10 };
+    long huge[2] = { LONG_MAX, 1 }, one[2] = { 1, 0 };
+    size_t i, k, n, first, second, want_first, want_second;
 
-    copy_row(jm, 0, 1, 1);
-    copy_col(jm, 0, 1, 2);
+    assert(rpack_overlapping(squares, touching, 2, &first, &second)
+           == RPACK_OK);
+    assert(first == 2 && second == 2);
+    touching[2] = 9;
+    assert(rpack_overlapping(squares, touching, 2, &first, &second)
+           == RPACK_OK);
+    assert(first == 0 && second == 1);
+    assert(rpack_overlapping(huge, one, 1, &first, &second)
+           == RPACK_POSITION_OVERFLOW);
+    assert(rpack_overlapping(NULL, NULL, 0, &first, &second) == RPACK_OK);
+    assert(first == 0 && second == 0);
 
-    for (i = 0; i < size; i++) {
-        for (j = 0; j < size; j++) {
-            assert(jm[i][j] == NULL);
+    /* Dense random placements, some with sides that are not positive */
+    srand(13);
+    for (k = 0; k < 400; k++) {
+        n = 1 + (size_t) rand() % 40;
+        for (i = 0; i < n; i++) {
+            sizes[2 * i] = 1 + rand() % 6;
+            sizes[2 * i + 1] = 1 + rand() % 6;
+            positions[2 * i] = rand() % (k < 200 ? 60 : 20);
+            positions[2 * i + 1] = rand() % (k < 200 ? 60 : 20);
+        }
+        if (k % 10 == 9) {
+            sizes[rand() % (2 * n)] -= 6;
         }
+        test_overlapping_pairs(sizes, positions, n, &want_first,
+                               &want_second);
+        assert(rpack_overlapping(sizes, positions, n, &first, &second)
+               == RPACK_OK);
+        assert(first == want_first && second == want_second);
     }
 
-    free(jm);
+    /* Packings do not overlap until a rectangle is moved */
+    for (i = 0; i < 400; i++) {
+        sizes[2 * i] = 1 + rand() % 50;
+        sizes[2 * i + 1] = 1 + rand() % 50;
+    }
+    assert(rpack_pack(sizes, 400, -1, -1, 1, positions) == RPACK_OK);
+    assert(rpack_overlapping(sizes, positions, 400, &first, &second)
+           == RPACK_OK);
+    assert(first == 400 && second == 400);
+    positions[2 * 321] = positions[2 * 123];
+    positions[2 * 321 + 1] = positions[2 * 123 + 1];
+    test_overlapping_pairs(sizes, positions, 400, &want_first,
+                           &want_second);
+    assert(rpack_overlapping(sizes, positions, 400, &first, &second)
+           == RPACK_OK);
+    assert(first == want_first && second == want_second);
+    assert(first <= 123 && second >= 123);
 }
 
-static void test_jump_matrix_size_overflow(void)
+static void test_rpack_bbox_size(void)
 {
-    JumpMatrix jm = NULL;
-    jm = alloc_jump_matrix(SIZE_MAX);
-    assert(jm == NULL);
-}
+    long sizes[] = { 58, 206, 231, 176, 35, 113, 46, 109 };
+    long positions[8], huge[2] = { LONG_MAX, 2 }, at[2] = { 1, 0 };
+    long negative[4] = { -5, 3, 4, -2 }, origin[4] = { 2, 0, -10, 0 };
+    long width, height, area;
+    Rectangle rectangles[4];
+    RectangleStats stats;
+    size_t i;
 
-static void test_grid(void)
-{
-    Grid *grid = NULL;
-    grid = grid_alloc(100, 120, 50);
-    assert(grid != NULL);
-    assert(grid->size == 100);
-    assert(grid->width == 120);
-    assert(grid->height == 50);
-    assert(grid->cols != NULL);
-    assert(grid->rows != NULL);
-    assert(grid->jump_matrix != NULL);
-    grid_free(grid);
+    assert(rpack_pack(sizes, 4, -1, -1, 1, positions) == RPACK_OK);
+    assert(rpack_bbox_size(sizes, positions, 4, &width, &height)
+           == RPACK_OK);
+    assert(width == 335 && height == 222);
+    assert(rpack_total_area(sizes, 4, &area) == RPACK_OK);
+    assert(area == 61573);
+
+    rectangle_stats_init(&stats);
+    for (i = 0; i < 4; i++) {
+        assert(rectangle_init(&rectangles[i], &stats, i, sizes[2 * i],
+                              sizes[2 * i + 1]) == RPACK_OK);
+        rectangles[i].x = positions[2 * i];
+        rectangles[i].y = positions[2 * i + 1];
+    }
+    assert(rectangle_bbox(rectangles, 4, &width, &height) == RPACK_OK);
+    assert(width == 335 && height == 222 && stats.area == area);
+    rectangles[1].width = 176;
+    rectangles[1].height = 231;
+    rectangles[1].rotated = 1;
+    assert(rectangle_bbox(rectangles, 4, &width, &height) == RPACK_OK);
+    assert(width == 335 && height == 222);
+
+    /* The box starts at the origin, sides may be negative */
+    assert(rpack_bbox_size(negative, origin, 2, &width, &height)
+           == RPACK_OK);
+    assert(width == 0 && height == 3);
+    assert(rpack_total_area(negative, 2, &area) == RPACK_OK);
+    assert(area == -23);
+    assert(rpack_bbox_size(NULL, NULL, 0, &width, &height) == RPACK_OK);
+    assert(width == 0 && height == 0);
+
+    assert(rpack_bbox_size(huge, at, 1, &width, &height)
+           == RPACK_POSITION_OVERFLOW);
+    assert(rpack_total_area(huge, 1, &area) == RPACK_AREA_OVERFLOW);
+    huge[1] = 1;
+    assert(rpack_total_area(huge, 1, &area) == RPACK_OK);
+    assert(area == LONG_MAX);
+    sizes[0] = LONG_MAX;
+    sizes[1] = 1;
+    assert(rpack_total_area(sizes, 2, &area) == RPACK_SUM_AREA_OVERFLOW);
 }
 
-static void test_grid_split(void)
+static void test_rpack_atlas(void)
 {
-    Grid *grid = NULL;
+    RpackAtlas *atlas;
+    Grid *grid;
+    Rectangle r;
+    RectangleStats stats;
     Region reg;
-    grid = grid_alloc(100, 120, 50);
-    assert(grid != NULL);
+    long sizes[2 * 400], positions[2 * 400], x, y;
+    size_t i, n = 0, first, second;
+    int status;
 
-    reg.row_cell_start = reg.row_cell = grid->rows->head;
-    reg.row_end_pos = 30;
-    reg.col_cell_start = reg.col_cell = grid->cols->head;
-    reg.col_end_pos = 30;
-    assert(grid_split(grid, &reg) == 0);
+    assert(rpack_atlas_new(0, 10) == NULL);
+    assert(rpack_atlas_new(10, -1) == NULL);
+    atlas = rpack_atlas_new(100, 100);
+    assert(atlas != NULL);
+    assert(rpack_atlas_insert(atlas, 0, 5, &x, &y)
+           == RPACK_WIDTH_NOT_POSITIVE);
+    assert(rpack_atlas_insert(atlas, 5, -5, &x, &y)
+           == RPACK_HEIGHT_NOT_POSITIVE);
+    assert(rpack_atlas_insert(atlas, 101, 5, &x, &y) == RPACK_IMPOSSIBLE);
+    for (i = 0; i < 100; i++) {
+        assert(rpack_atlas_insert(atlas, 10, 10, &x, &y) == RPACK_OK);
+        assert(x % 10 == 0 && y % 10 == 0 && x < 100 && y < 100);
+    }
+    assert(rpack_atlas_insert(atlas, 1, 1, &x, &y) == RPACK_IMPOSSIBLE);
+    rpack_atlas_reset(atlas);
+    assert(rpack_atlas_insert(atlas, 100, 100, &x, &y) == RPACK_OK);
+    assert(x == 0 && y == 0);
+    rpack_atlas_free(atlas);
+
+    /* Places like one search and split per rectangle on a grid large
+       enough from the start, also across grid growth */
+    atlas = rpack_atlas_new(1000, 800);
+    grid = grid_alloc(2 * 400 + 1, 1000, 800);
+    assert(atlas != NULL && grid != NULL);
+    grid_clear(grid);
+    rectangle_stats_init(&stats);
+    srand(7);
+    for (i = 0; i < 400; i++) {
+        sizes[2 * n] = 1 + rand() % 90;
+        sizes[2 * n + 1] = 1 + rand() % 90;
+        status = rpack_atlas_insert(atlas, sizes[2 * n], sizes[2 * n + 1],
+                                    &x, &y);
+        assert(rectangle_init(&r, &stats, n, sizes[2 * n], sizes[2 * n + 1])
+               == RPACK_OK);
+        grid_find_region(grid, &r, &reg);
+        assert((status == RPACK_OK) == reg.found);
+        if (status != RPACK_OK) {
+            assert(status == RPACK_IMPOSSIBLE);
+            continue;
+        }
+        assert(x == reg.col_start_pos && y == reg.row_start_pos);
+        assert(grid_split(grid, &reg) == 0);
+        positions[2 * n] = x;
+        positions[2 * n + 1] = y;
+        n++;
+    }
+    assert(n > 64 && n < 400);
+    assert(rpack_overlapping(sizes, positions, n, &first, &second)
+           == RPACK_OK);
+    assert(first == n && second == n);
+    grid_free(grid);
+    rpack_atlas_free(atlas);
+}
 
-    assert(grid->rows->head->end_pos == 30);
-    assert(grid->cols->head->end_pos == 30);
-    assert(grid->rows->head->next->end_pos == 50);
-    assert(grid->cols->head->next->end_pos == 120);
+static void test_rpack_pack_bins(void)
+{
+    long squares[20], sizes[2 * 200], positions[2 * 200], again[2 * 200];
+    long bin_sizes[2 * 200], bin_positions[2 * 200];
+    size_t bins[200], bins_again[200], n_bins, n, i, b, first, second;
+    long area = 0;
+    Bins packer;
 
-    Cell _cell;
-    Cell *test_cell = &_cell;
-    grid->jump_matrix[0][0] = test_cell;
+    for (i = 0; i < 20; i++) {
+        squares[i] = 50;
+    }
+    assert(rpack_pack_bins(squares, 10, 100, 100, bins, positions, &n_bins)
+           == RPACK_OK);
+    assert(n_bins == 3);
+    assert(rpack_pack_bins(squares, 0, 100, 100, bins, positions, &n_bins)
+           == RPACK_OK);
+    assert(n_bins == 0);
+    assert(rpack_pack_bins(squares, 10, 49, 100, bins, positions, &n_bins)
+           == RPACK_MAX_WIDTH_TOO_SMALL);
+    assert(rpack_pack_bins(squares, 10, 100, 0, bins, positions, &n_bins)
+           == RPACK_MAX_HEIGHT_ZERO);
 
-    reg.row_cell_start = reg.row_cell = grid->rows->head->next;
-    reg.row_end_pos = 40;
-    reg.col_cell_start = reg.col_cell = grid->cols->head;
-    reg.col_end_pos = 10;
-    assert(grid_split(grid, &reg) == 0);
+    srand(11);
+    for (i = 0; i < 200; i++) {
+        sizes[2 * i] = 1 + rand() % 120;
+        sizes[2 * i + 1] = 1 + rand() % 90;
+        area += sizes[2 * i] * sizes[2 * i + 1];
+    }
+    assert(rpack_pack_bins(sizes, 200, 300, 200, bins, positions, &n_bins)
+           == RPACK_OK);
+    assert(n_bins >= (size_t) ((area + 300 * 200 - 1) / (300 * 200)));
+    for (b = 0; b < n_bins; b++) {
+        for (i = 0, n = 0; i < 200; i++) {
+            assert(bins[i] < n_bins);
+            assert(positions[2 * i] >= 0 && positions[2 * i + 1] >= 0);
+            assert(positions[2 * i] + sizes[2 * i] <= 300);
+            assert(positions[2 * i + 1] + sizes[2 * i + 1] <= 200);
+            if (bins[i] == b) {
+                bin_sizes[2 * n] = sizes[2 * i];
+                bin_sizes[2 * n + 1] = sizes[2 * i + 1];
+                bin_positions[2 * n] = positions[2 * i];
+                bin_positions[2 * n + 1] = positions[2 * i + 1];
+                n++;
+            }
+        }
+        assert(n > 0);
+        assert(rpack_overlapping(bin_sizes, bin_positions, n, &first,
+                                 &second) == RPACK_OK);
+        assert(first == n && second == n);
+    }
 
-    assert(grid->jump_matrix[0][0] == test_cell);
-    assert(grid->jump_matrix[0][1] == NULL);
-    assert(grid->jump_matrix[0][2] == test_cell);
+    /* Bins kept from a call with other sizes give the same result */
+    bins_init(&packer);
+    assert(bins_pack(&packer, sizes, 200, 150, 400, bins_again, again,
+                     &n) == RPACK_OK);
+    assert(bins_pack(&packer, sizes, 200, 300, 200, bins_again, again,
+                     &n) == RPACK_OK);
+    assert(n == n_bins);
+    for (i = 0; i < 200; i++) {
+        assert(bins_again[i] == bins[i]);
+        assert(again[2 * i] == positions[2 * i]);
+        assert(again[2 * i + 1] == positions[2 * i + 1]);
+    }
+    bins_destroy(&packer);
+}
 
-    assert(grid->jump_matrix[1][0] == grid->rows->head->next->next);
-    assert(grid->jump_matrix[1][1] == NULL);
-    assert(grid->jump_matrix[1][2] == NULL);
+#ifdef RPACK_HAVE_INT128
+static void test_rpack_pack_i128(void)
+{
+    /* The perfect packing of test_rpack_pack, 2^61 times as wide */
+    static const long perfect[6] = { 3, 3, 2, 2, 2, 1 };
+    static const long expected[6] = { 0, 0, 3, 0, 3, 2 };
+    const rpack_int128 unit = (rpack_int128) 1 << 61;
+    rpack_int128 wide[6], wide_positions[6];
+    rpack_int128 sizes[2 * 40], positions[2 * 40];
+    long narrow[2 * 40], narrow_positions[2 * 40];
+    long overflow[6];
+    RpackPackerI128 *packer;
+    size_t i;
 
-    assert(grid->jump_matrix[2][0] == NULL);
-    assert(grid->jump_matrix[2][1] == NULL);
-    assert(grid->jump_matrix[2][2] == NULL);
+    for (i = 0; i < 6; i++) {
+        wide[i] = i % 2 == 0 ? perfect[i] * unit : perfect[i];
+        overflow[i] = i % 2 == 0 ? (long) (perfect[i] * unit) : perfect[i];
+    }
+    assert(rpack_pack(overflow, 3, -1, -1, 1, narrow_positions)
+           == RPACK_AREA_OVERFLOW);
+    assert(rpack_pack_i128(wide, 3, -1, -1, 1, wide_positions) == RPACK_OK);
+    for (i = 0; i < 6; i++) {
+        assert(wide_positions[i] ==
+               (i % 2 == 0 ? expected[i] * unit : expected[i]));
+    }
+    assert(rpack_pack_i128(wide, 3, 4 * unit, -1, 1, wide_positions)
+           == RPACK_OK);
+    assert(rpack_pack_i128(wide, 3, 2 * unit, -1, 1, wide_positions)
+           == RPACK_MAX_WIDTH_TOO_SMALL);
 
-    grid_free(grid);
+    /* Inputs that fit long are packed the same as with long */
+    packer = rpack_packer_new_i128();
+    assert(packer != NULL);
+    srand(5);
+    for (i = 0; i < 2 * 40; i++) {
+        narrow[i] = 1 + rand() % 50;
+        sizes[i] = narrow[i];
+    }
+    assert(rpack_pack(narrow, 40, -1, -1, 1, narrow_positions) == RPACK_OK);
+    assert(rpack_packer_pack_i128(packer, sizes, 40, -1, -1, 1, positions)
+           == RPACK_OK);
+    for (i = 0; i < 2 * 40; i++) {
+        assert(positions[i] == narrow_positions[i]);
+    }
+    assert(rpack_packer_pack_i128(packer, sizes, 40, -1, -1, 8, positions)
+           == RPACK_OK);
+    for (i = 0; i < 2 * 40; i++) {
+        assert(positions[i] == narrow_positions[i]);
+    }
+    rpack_packer_free_i128(packer);
 }
 
-static void test_grid_split_overflow(void)
+/* The int32 variant packs like the others, the 128-bit one never hands
+   inputs on to it */
+static void test_packer_narrow(void)
 {
-    Grid *grid = NULL;
-    Region reg;
-    grid = grid_alloc(1, 120, 50);
-    assert(grid != NULL);
+    static const size_t lengths[4] = { 60, 33, 7, 1 };
+    long sizes[2 * 60], positions[2 * 60];
+    long huge[2] = { 50000, 50000 };
+    rpack_int128 wide_sizes[2 * 60], wide_positions[2 * 60];
+    RpackPacker *packer;
+    RpackPackerI128 *wide;
+    size_t i, k, n, threads;
+    double tolerance;
+    long max_width;
 
-    reg.row_cell_start = reg.row_cell = grid->rows->head;
-    reg.row_end_pos = 30;
-    reg.col_cell_start = reg.col_cell = grid->cols->head;
-    reg.col_end_pos = 30;
-    assert(grid_split(grid, &reg) == -1);
+    packer = rpack_packer_new();
+    wide = rpack_packer_new_i128();
+    assert(packer != NULL && wide != NULL);
+    assert(rpack_packer_pack(packer, huge, 1, -1, -1, 1, positions)
+           == RPACK_OK);
+    assert(packer->narrow == NULL);
 
-    grid_free(grid);
+    srand(11);
+    for (k = 0; k < 16; k++) {
+        n = lengths[k % 4];
+        for (i = 0; i < 2 * n; i++) {
+            sizes[i] = 1 + rand() % (k < 8 ? 30 : 3000);
+            wide_sizes[i] = sizes[i];
+        }
+        max_width = k % 3 == 0 ? 3000 + rand() % 3000 : -1;
+        threads = k % 2 == 0 ? 1 : 4;
+        tolerance = k % 5 == 4 ? 0.05 : 0;
+        rpack_packer_set_tolerance(packer, tolerance);
+        rpack_packer_set_tolerance_i128(wide, tolerance);
+        assert(rpack_packer_pack(packer, sizes, n, max_width, -1, threads,
+                                 positions) == RPACK_OK);
+        assert(packer->narrow != NULL);
+        assert(rpack_packer_pack_i128(wide, wide_sizes, n, max_width, -1,
+                                      threads, wide_positions) == RPACK_OK);
+        for (i = 0; i < 2 * n; i++) {
+            assert(positions[i] == wide_positions[i]);
+        }
+    }
+    assert(packer_capacity(packer) >= 60);
+    rpack_packer_free_i128(wide);
+    rpack_packer_free(packer);
 }
+#endif
 
 int main(void)
 {
     test_cell_link();
     test_cell_link_cut();
+    test_cell_link_uncut();
     test_cell_link_cut_overflow();
     printf("CELL LINK: PASSED\n");
     test_jump_matrix();
+    test_jump_matrix_wide();
+    test_jump_matrix_lazy();
     test_jump_matrix_copy();
+    test_bits_scan();
     test_jump_matrix_size_overflow();
     printf("JUMP MATRIX: PASSED\n");
     test_grid();
     test_grid_split();
     test_grid_split_overflow();
+    test_grid_reserve();
+    test_grid_tiled();
+    test_grid_try_pack_resume();
     printf("GRID: PASSED\n");
+    test_search_shared();
+    test_task_run();
+    test_task_run_workers();
+    test_grid_search_bbox_shared();
+    test_grid_search_bbox_pool();
+    test_grid_search_bbox_sweep();
+    printf("SEARCH SHARED: PASSED\n");
+    test_rectangle_init();
+    test_rectangle_order();
+    test_area_lower_bound();
+    test_rpack_pack();
+    test_packer_refine_threads();
+    test_packer_time_limit();
+    test_packer_sweep();
+    test_packer_stats();
+    test_rpack_overlapping();
+    test_rpack_bbox_size();
+    test_rpack_atlas();
+    test_rpack_pack_bins();
+#ifdef RPACK_HAVE_INT128
+    test_rpack_pack_i128();
+    test_packer_narrow();
+#endif
+    printf("PACKER: PASSED\n");
     return 0;
 }
 #endif
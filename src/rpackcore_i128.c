@@ -0,0 +1,16 @@
+/* Core functions and data structures with 128-bit coordinates
+
+The core of rpackcore.c compiled once more with Coord being __int128
+and the suffix _i128 on every external name, see rpackcore.h. Inputs
+that overflow long are packed by it natively, instead of being
+reduced or scaled to fit.
+
+*/
+
+#if defined(__SIZEOF_INT128__)
+#define RPACK_COORD_I128
+#include "rpackcore.c"
+#else
+/* No 128-bit integers, the translation unit must not be empty */
+typedef int rpackcore_i128_unavailable;
+#endif
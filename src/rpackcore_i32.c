@@ -0,0 +1,11 @@
+/* Core functions and data structures with 32-bit coordinates
+
+The core of rpackcore.c compiled once more with Coord being int32_t
+and the suffix _i32 on every external name, see rpackcore.h. The long
+core hands it the inputs whose sides, sums and areas fit, which then
+take half the memory in the cells and rectangles.
+
+*/
+
+#define RPACK_COORD_I32
+#include "rpackcore.c"
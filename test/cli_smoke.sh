@@ -0,0 +1,65 @@
+#!/bin/sh
+# Smoke test of the command-line packer, see the test target of the
+# Makefile. The same sizes are packed from text, int32 and int64 input
+# and the positions written must be those of the rpack.pack example.
+#
+# Usage: sh test/cli_smoke.sh [RPACK]
+
+set -e
+
+RPACK=${1:-bin/rpack}
+SIZES="58 206 231 176 35 113 46 109"
+EXPECTED="0 0 58 0 289 0 289 113"
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+if [ "$(printf '\001\000' | od -An -t d2 | tr -d ' ')" = 1 ]; then
+    little_endian=1
+else
+    little_endian=0
+fi
+
+# binary writes SIZES as native integers of $1 bytes, all below 256
+binary() {
+    for value in $SIZES; do
+        byte="\\$(printf '%03o' "$value")"
+        zeros=""
+        i=1
+        while [ "$i" -lt "$1" ]; do
+            zeros="$zeros\\000"
+            i=$((i + 1))
+        done
+        if [ "$little_endian" = 1 ]; then
+            printf "$byte$zeros"
+        else
+            printf "$zeros$byte"
+        fi
+    done
+}
+
+# check runs RPACK with the arguments after $1 and $2 and compares the
+# positions, integers of $2 bytes, with EXPECTED
+check() {
+    name=$1
+    size=$2
+    shift 2
+    "$RPACK" -o "$tmp/positions" "$@" >/dev/null
+    positions=$(od -An -v -t "d$size" "$tmp/positions" | tr -s ' \n' '  ' \
+                | sed 's/^ *//; s/ *$//')
+    if [ "$positions" != "$EXPECTED" ]; then
+        echo "CLI: $name: got '$positions', expected '$EXPECTED'" >&2
+        exit 1
+    fi
+}
+
+printf '%s %s\n' $SIZES >"$tmp/sizes.txt"
+check text 8 "$tmp/sizes.txt"
+
+binary 4 >"$tmp/sizes.i32"
+check i32 4 -f i32 "$tmp/sizes.i32"
+
+binary 8 >"$tmp/sizes.i64"
+check i64 8 -f i64 -j 4 "$tmp/sizes.i64"
+
+echo "CLI: PASSED"
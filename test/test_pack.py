@@ -1,10 +1,13 @@
 """Test rpack._core module"""
 
 # Built-in
+import array
 import ctypes
+import os
 import random
 import subprocess
 import sys
+import tempfile
 import unittest
 
 # Local
@@ -36,6 +39,12 @@ def _overlapping_py(sizes, positions):
     return None
 
 
+def _int_buffer(rows, typecode):
+    """Return rows as an (n, 2) memoryview of `typecode` integers"""
+    flat = array.array(typecode, [v for row in rows for v in row])
+    return memoryview(flat).cast("B").cast(typecode, (len(rows), 2))
+
+
 # TEST CORE UTILS
 # ===============
 
@@ -68,6 +77,21 @@ class TestPackingDensity(unittest.TestCase):
         positions = [(0, 0), (width, 0)]
         self.assertEqual(rpack.packing_density(sizes, positions), 1.0)
 
+    def test_density_buffers(self):
+        sizes = [(58, 206), (231, 176), (35, 113), (46, 109)]
+        pos = [(0, 0), (58, 0), (289, 0), (289, 113)]
+        expected = sum(w * h for w, h in sizes) / (335 * 222)
+        for typecode in ("i", "q"):
+            with self.subTest(typecode=typecode):
+                self.assertEqual(
+                    rpack._core.packing_density(
+                        _int_buffer(sizes, typecode), _int_buffer(pos, typecode)
+                    ),
+                    expected,
+                )
+        with self.assertRaises(ZeroDivisionError):
+            rpack._core.packing_density([], [])
+
     def test_core_packing_density_raises_on_sum_wraparound(self):
         long_bits = ctypes.sizeof(ctypes.c_long) * 8
         long_max = (1 << (long_bits - 1)) - 1
@@ -113,6 +137,63 @@ class TestOverlapping(unittest.TestCase):
         with self.assertRaises(OverflowError):
             rpack._core.overlapping([(width, 1)], [(width, 0)])
 
+    def test_overlapping_first_pair(self):
+        rng = random.Random(17)
+        for k in range(300):
+            n = rng.randint(1, 30)
+            span = 40 if k < 150 else 12
+            sizes = [(rng.randint(1, 6), rng.randint(1, 6)) for _ in range(n)]
+            pos = [(rng.randrange(span), rng.randrange(span)) for _ in range(n)]
+            if k % 10 == 9:
+                w, h = sizes[0]
+                sizes[0] = (w - 6, h)
+            with self.subTest(k=k):
+                self.assertEqual(
+                    rpack._core.overlapping(sizes, pos),
+                    _overlapping_py(sizes, pos),
+                )
+
+    def test_overlapping_buffers(self):
+        sizes = [(10, 10), (10, 10), (4, 4)]
+        pos = [(0, 0), (10, 10), (12, 8)]
+        for typecode in ("i", "q"):
+            with self.subTest(typecode=typecode):
+                self.assertEqual(
+                    rpack._core.overlapping(
+                        _int_buffer(sizes, typecode), _int_buffer(pos, typecode)
+                    ),
+                    (1, 2),
+                )
+                self.assertEqual(
+                    rpack._core.overlapping(sizes, _int_buffer(pos, typecode)),
+                    (1, 2),
+                )
+        with self.assertRaises(IndexError):
+            rpack._core.overlapping(sizes, _int_buffer(pos[:2], "q"))
+
+    def test_overlapping_packing(self):
+        rng = random.Random(5)
+        sizes = [(rng.randint(1, 100), rng.randint(1, 100)) for _ in range(100)]
+        pos = rpack.pack(sizes)
+        self.assertIsNone(rpack.overlapping(sizes, pos))
+        pos[90] = pos[40]
+        self.assertEqual(rpack.overlapping(sizes, pos), _overlapping_py(sizes, pos))
+
+    def test_bigint_overlapping_matches_pairwise(self):
+        rng = random.Random(23)
+        scale = 1 << 200
+        for k in range(50):
+            n = rng.randint(2, 20)
+            sizes = [
+                (rng.randint(1, 6) * scale, rng.randint(1, 6) * scale + k)
+                for _ in range(n)
+            ]
+            pos = [(rng.randrange(30) * scale, rng.randrange(30) * scale) for _ in range(n)]
+            with self.subTest(k=k):
+                self.assertEqual(
+                    rpack.overlapping(sizes, pos), _overlapping_py(sizes, pos)
+                )
+
 
 class TestBboxSize(unittest.TestCase):
     def test_enclosing_size(self):
@@ -156,6 +237,22 @@ class TestBboxSize(unittest.TestCase):
         positions = [(0, 0), (width, 0)]
         self.assertEqual(rpack.enclosing_size(sizes, positions), (2 * width, 1))
 
+    def test_bbox_size_buffers(self):
+        sizes = [(3, 5), (1, 1), (1, 1), (-4, 2)]
+        pos = [(0, 0), (3, 0), (0, 5), (1, -9)]
+        for typecode in ("i", "q"):
+            with self.subTest(typecode=typecode):
+                self.assertEqual(
+                    rpack._core.bbox_size(
+                        _int_buffer(sizes, typecode), _int_buffer(pos, typecode)
+                    ),
+                    (4, 6),
+                )
+                self.assertEqual(
+                    rpack._core.bbox_size(sizes, _int_buffer(pos, typecode)), (4, 6)
+                )
+        self.assertEqual(rpack._core.bbox_size([], []), (0, 0))
+
     def test_core_bbox_size_raises_on_sum_wraparound(self):
         long_bits = ctypes.sizeof(ctypes.c_long) * 8
         long_max = (1 << (long_bits - 1)) - 1
@@ -175,6 +272,7 @@ class TestPackInput(unittest.TestCase):
 
     _LONG_BITS = ctypes.sizeof(ctypes.c_long) * 8
     _LONG_MAX = (1 << (_LONG_BITS - 1)) - 1
+    _INT128_MAX = (1 << 127) - 1
 
     def test_empty(self):
         """Empty input should give empty output"""
@@ -215,6 +313,35 @@ class TestPackInput(unittest.TestCase):
         with self.assertRaises(TypeError):
             rpack.pack([[1.99, 1.99]])
 
+    def test_threads_bad(self):
+        with self.assertRaisesRegex(ValueError, "threads"):
+            rpack.pack([(2, 2)], threads=0)
+        with self.assertRaisesRegex(TypeError, "threads"):
+            rpack.pack([(2, 2)], threads=2.0)
+
+    def test_time_limit_bad(self):
+        with self.assertRaisesRegex(ValueError, "time_limit"):
+            rpack.pack([(2, 2)], time_limit=-1)
+        with self.assertRaisesRegex(TypeError, "time_limit"):
+            rpack.pack([(2, 2)], time_limit="1")
+
+    def test_tolerance_bad(self):
+        with self.assertRaisesRegex(ValueError, "tolerance"):
+            rpack.pack([(2, 2)], tolerance=-0.5)
+        with self.assertRaisesRegex(TypeError, "tolerance"):
+            rpack.pack([(2, 2)], tolerance=None)
+
+    def test_buffer_bad(self):
+        floats = memoryview(array.array("d", [1.0, 2.0])).cast("B")
+        with self.assertRaisesRegex(TypeError, "int32 or int64"):
+            rpack.pack(floats.cast("d", (1, 2)))
+        with self.assertRaisesRegex(ValueError, "shape"):
+            rpack.pack(memoryview(array.array("q", [1, 2, 3])))
+        with self.assertRaises(ValueError):
+            rpack.pack(_int_buffer([(3, 0)], "q"))
+        with self.assertRaisesRegex(ValueError, "rows"):
+            rpack.pack([(1, 1), (2, 2)], out=_int_buffer([(0, 0)], "q"))
+
     def test_area_overflow_fallback(self):
         too_wide = self._LONG_MAX // 2 + 1
         self.assertEqual(rpack.pack([(too_wide, 2)]), [(0, 0)])
@@ -267,8 +394,8 @@ class TestPackInput(unittest.TestCase):
 
     def test_bigint_fallback_remaps_zero_bound_artifact(self):
         sizes = [
-            (1, self._LONG_MAX + 1),
-            (1, self._LONG_MAX + 2),
+            (1, self._INT128_MAX + 1),
+            (1, self._INT128_MAX + 2),
         ]
         with self.assertRaises(rpack.PackingImpossibleError) as error:
             rpack.pack(sizes, max_width=1)
@@ -278,7 +405,7 @@ class TestPackInput(unittest.TestCase):
         )
 
     def test_bigint_fallback_preserves_positive_bound_after_gcd_reduction(self):
-        side = self._LONG_MAX + 2
+        side = self._INT128_MAX + 2
         sizes = [(side, 1), (side, 1)]
         with self.assertRaises(rpack.PackingImpossibleError) as error:
             rpack.pack(sizes, max_width=1)
@@ -289,8 +416,8 @@ class TestPackInput(unittest.TestCase):
 
     def test_bigint_fallback_remaps_zero_height_artifact(self):
         sizes = [
-            (self._LONG_MAX + 1, 1),
-            (self._LONG_MAX + 2, 1),
+            (self._INT128_MAX + 1, 1),
+            (self._INT128_MAX + 2, 1),
         ]
         with self.assertRaises(rpack.PackingImpossibleError) as error:
             rpack.pack(sizes, max_height=1)
@@ -415,6 +542,34 @@ class TestPackInput(unittest.TestCase):
             rpack.pack([(1, side)], max_height=0)
 
 
+    @unittest.skipUnless(rpack._core.HAVE_INT128, "No 128-bit integers")
+    def test_wide_coordinates_are_exact(self):
+        """Sizes beyond C long pack natively, like their narrow versions"""
+        scale = 1 << 70
+        for seed in range(20):
+            rng = random.Random(seed)
+            sizes = [(rng.randint(1, 100), rng.randint(1, 100)) for _ in range(25)]
+            wide = [(w * scale, h) for w, h in sizes]
+            expected = [(x * scale, y) for x, y in rpack.pack(sizes)]
+            self.assertEqual(rpack.pack(wide), expected)
+            self.assertEqual(rpack.pack(wide, threads=3), expected)
+
+    @unittest.skipUnless(rpack._core.HAVE_INT128, "No 128-bit integers")
+    def test_wide_coordinates_options(self):
+        side = self._LONG_MAX // 2 + 1
+        sizes = [(side, 1), (side, 1)]
+        packer = rpack.Packer()
+        pos = packer.pack(sizes, time_limit=10, stats=True)
+        self.assertEqual(pos, [(0, 0), (side, 0)])
+        self.assertFalse(packer.stopped_early)
+        self.assertGreater(packer.stats.try_packs, 0)
+        self.assertEqual(packer.pack(sizes, max_height=2), pos)
+        self.assertEqual(packer.pack(sizes, max_width=side), [(0, 0), (0, 1)])
+        self.assertEqual(packer.pack([(2, 2)]), [(0, 0)])
+        out = rpack.pack(_int_buffer(sizes, "q"))
+        self.assertEqual(out.tolist(), [[0, 0], [side, 0]])
+
+
 class TestPackInputBoundingBoxRestrictions(unittest.TestCase):
     """Test how rpack.pack handles bad input"""
 
@@ -637,6 +792,243 @@ class TestPackOutput(unittest.TestCase):
                 pos = rpack.pack(sizes)
                 self.assertFalse(rpack._core.overlapping(sizes, pos))
 
+    def test_buffer_same_result(self):
+        """Buffer input and output should give the list packing"""
+        random.seed(5)
+        sizes = [(random.randint(1, 100), random.randint(1, 100)) for _ in range(50)]
+        expected = [list(p) for p in rpack.pack(sizes)]
+        for typecode in ("i", "q"):
+            with self.subTest(typecode=typecode):
+                positions = rpack.pack(_int_buffer(sizes, typecode))
+                self.assertEqual(positions.format, typecode)
+                self.assertEqual(positions.shape, (50, 2))
+                self.assertEqual(positions.tolist(), expected)
+                out = _int_buffer([(0, 0)] * 50, typecode)
+                self.assertIs(rpack.pack(sizes, out=out), out)
+                self.assertEqual(out.tolist(), expected)
+        with self.assertRaises(rpack.PackingImpossibleError) as error:
+            rpack.pack(_int_buffer([(2, 2)] * 4, "q"), max_width=3, max_height=3)
+        self.assertEqual(error.exception.args[1], [(0, 0)])
+
+    def test_buffer_position_overflow(self):
+        """Positions beyond an int32 out buffer should raise OverflowError"""
+        half = 1 << 31
+        out = _int_buffer([(0, 0)] * 2, "i")
+        with self.assertRaisesRegex(OverflowError, "int32 out buffer"):
+            rpack.pack([(half, 1), (half, 1)], max_height=1, out=out)
+        big = 1 << (ctypes.sizeof(ctypes.c_long) * 8)
+        with self.assertRaisesRegex(OverflowError, "int32 out buffer"):
+            rpack.pack([(big, 1), (big, 1)], max_height=1, out=out)
+
+    def test_threads_same_result(self):
+        """Concurrent strategy search should not change the packing"""
+        for i in range(10):
+            with self.subTest(seed=i):
+                random.seed(i)
+                m = random.choice([10, 1000, 100000])
+                sizes = [
+                    (random.randint(1, m), random.randint(1, m)) for _ in range(40)
+                ]
+                self.assertEqual(rpack.pack(sizes, threads=4), rpack.pack(sizes))
+        sizes = [(2, 2)] * 4
+        self.assertEqual(
+            rpack.pack(sizes, max_width=3, threads=4), rpack.pack(sizes, max_width=3)
+        )
+        sizes = list(self._THIN_PATHOLOGY_BASE)
+        self.assertEqual(rpack.pack(sizes, threads=8), rpack.pack(sizes))
+
+    def test_pack_many_same_result(self):
+        """pack_many should give the pack() result of each set"""
+        random.seed(7)
+        sets = [
+            [(random.randint(1, 50), random.randint(1, 50)) for _ in range(n)]
+            for n in (1, 30, 5, 60, 2, 12)
+        ]
+        expected = [rpack.pack(sizes, max_width=200) for sizes in sets]
+        for threads in (1, 4):
+            with self.subTest(threads=threads):
+                self.assertEqual(
+                    rpack.pack_many(sets, max_width=200, threads=threads), expected
+                )
+        positions = rpack.pack_many([_int_buffer(sets[1], "i")])[0]
+        self.assertEqual(positions.format, "i")
+        self.assertEqual(positions.tolist(), [list(p) for p in expected[1]])
+
+    def test_pack_many_errors_in_place(self):
+        """pack_many should return errors in place of the failed sets"""
+        long_bits = ctypes.sizeof(ctypes.c_long) * 8
+        big = 1 << long_bits
+        sets = [[(2, 2)] * 4, [(0, 1)], [], [(4, 4)]]
+        results = rpack.pack_many(sets, max_width=3, threads=2)
+        self.assertEqual(len(results), len(sets))
+        self.assertEqual(results[0], rpack.pack([(2, 2)] * 4, max_width=3))
+        self.assertIsInstance(results[1], ValueError)
+        self.assertEqual(results[2], [])
+        self.assertIsInstance(results[3], rpack.PackingImpossibleError)
+        sizes = [(big, 1), (1, 1)]
+        self.assertEqual(rpack.pack_many([sizes])[0], rpack.pack(sizes))
+        impossible = rpack.pack_many([[(2, 2)] * 4], max_width=3, max_height=3)[0]
+        self.assertIsInstance(impossible, rpack.PackingImpossibleError)
+        self.assertEqual(impossible.args[1], [(0, 0)])
+        # An overflow is returned for its set only
+        side = (1 << 31) - 1
+        sets = [[(2, 1)], _int_buffer([(side, 1)] * 3, "i")]
+        results = rpack._core.pack_many(sets, -1, 1, 1)
+        self.assertEqual(results[0], [(0, 0)])
+        self.assertIsInstance(results[1], OverflowError)
+        self.assertIsInstance(rpack.pack_many(sets, max_height=1)[1], OverflowError)
+
+    def test_packer_same_result(self):
+        """Packer should give the pack() result while reusing storage"""
+        packer = rpack.Packer()
+        self.assertEqual(packer.capacity, 0)
+        random.seed(11)
+        for n, threads in ((20, 1), (5, 1), (30, 4), (21, 1), (60, 8), (3, 1)):
+            with self.subTest(n=n, threads=threads):
+                sizes = [
+                    (random.randint(1, 50), random.randint(1, 50)) for _ in range(n)
+                ]
+                self.assertEqual(
+                    packer.pack(sizes, threads=threads), rpack.pack(sizes)
+                )
+        # 20 -> 40 -> 80, then reused for the smaller inputs
+        self.assertEqual(packer.capacity, 80)
+        with self.assertRaises(ValueError):
+            packer.pack([(1, 1), (0, 1)])
+        with self.assertRaises(rpack.PackingImpossibleError):
+            packer.pack([(2, 2)] * 4, max_width=3, max_height=3)
+        sizes = [(3, 3), (2, 2), (2, 1)]
+        self.assertEqual(packer.pack(sizes), [(0, 0), (3, 0), (3, 2)])
+        out = _int_buffer([(0, 0)] * 3, "q")
+        self.assertIs(packer.pack(_int_buffer(sizes, "i"), out=out), out)
+        self.assertEqual(out.tolist(), [[0, 0], [3, 0], [3, 2]])
+
+    def test_packer_busy(self):
+        """A packer should refuse to pack while it still reads the sizes"""
+        packer = rpack._core.Packer()
+        errors = []
+
+        class Sizes(list):
+            def __iter__(self):
+                try:
+                    packer.pack([(1, 1)], -1, -1)
+                except RuntimeError as error:
+                    errors.append(error)
+                return super().__iter__()
+
+        sizes = [(3, 3), (2, 2), (2, 1)]
+        self.assertEqual(
+            packer.pack(Sizes(sizes), -1, -1), [(0, 0), (3, 0), (3, 2)]
+        )
+        self.assertEqual(len(errors), 1)
+        self.assertEqual(packer.pack(sizes, -1, -1), [(0, 0), (3, 0), (3, 2)])
+
+    def test_tolerance(self):
+        """A tolerance should stop at a packing close to the lower bound"""
+        random.seed(17)
+        sizes = [(random.randint(1, 50), random.randint(1, 50)) for _ in range(60)]
+        positions = rpack.pack(sizes)
+        self.assertEqual(rpack.pack(sizes, tolerance=0), positions)
+        for tolerance in (0.05, 0.5):
+            with self.subTest(tolerance=tolerance):
+                pos = rpack.pack(sizes, tolerance=tolerance)
+                self.assertFalse(rpack.overlapping(sizes, pos))
+                threaded = rpack.pack(sizes, threads=8, tolerance=tolerance)
+                self.assertEqual(pos, threaded)
+                density = rpack.packing_density(sizes, pos)
+                self.assertGreaterEqual(density, 1 / (1 + tolerance))
+
+    def test_sweep_threads(self):
+        """The height sweep should find an area no larger than pack()"""
+        random.seed(23)
+        sizes = [(random.randint(1, 50), random.randint(1, 50)) for _ in range(40)]
+        width, height = rpack.bbox_size(sizes, rpack.pack(sizes))
+        for sweep_threads in (2, 4):
+            with self.subTest(sweep_threads=sweep_threads):
+                packer = rpack.Packer(sweep_threads=sweep_threads)
+                pos = packer.pack(sizes, threads=8)
+                self.assertFalse(rpack.overlapping(sizes, pos))
+                w, h = rpack.bbox_size(sizes, pos)
+                self.assertLessEqual(w * h, width * height)
+                with self.assertRaises(ValueError):
+                    packer.pack(sizes, cache=rpack.PackCache())
+        with self.assertRaises(ValueError):
+            rpack.Packer(sweep_threads=0)
+
+    def test_stats(self):
+        """Counting should not change the result"""
+        random.seed(19)
+        sizes = [(random.randint(1, 50), random.randint(1, 50)) for _ in range(40)]
+        positions = rpack.pack(sizes)
+        packer = rpack.Packer()
+        for threads in (1, 8):
+            with self.subTest(threads=threads):
+                pos = packer.pack(sizes, threads=threads, stats=True)
+                self.assertEqual(pos, positions)
+                stats = packer.stats
+                self.assertIsInstance(stats, rpack.PackStats)
+                self.assertGreater(stats.try_packs, 0)
+                self.assertGreater(stats.placed, 0)
+                self.assertGreater(stats.rows, 0)
+                self.assertGreaterEqual(stats.copied, stats.cuts)
+                self.assertEqual(len(stats.strategy_seconds), 4)
+        pos = packer.pack(sizes, time_limit=60, stats=True)
+        self.assertEqual((pos, packer.stopped_early), (positions, False))
+        self.assertGreater(packer.stats.try_packs, 0)
+        packer.pack(sizes)
+        self.assertIsNone(packer.stats)
+        self.assertEqual(packer.pack([], stats=True), [])
+        self.assertIsNone(packer.stats)
+
+    def test_metrics(self):
+        random.seed(17)
+        sizes = [(random.randint(1, 50), random.randint(1, 50)) for _ in range(40)]
+        positions = rpack.pack(sizes)
+        bbox = rpack.bbox_size(sizes, positions)
+        density = rpack.packing_density(sizes, positions)
+        packer = rpack.Packer()
+        self.assertIsNone(packer.metrics)
+        self.assertEqual(packer.pack(iter(sizes), time_limit=60), positions)
+        self.assertEqual(packer.metrics, (bbox, density))
+        out = packer.pack(_int_buffer(sizes, "i"))
+        self.assertEqual(out.tolist(), [list(p) for p in positions])
+        self.assertEqual(packer.metrics, (bbox, density))
+        self.assertEqual(packer.pack([]), [])
+        self.assertEqual(packer.metrics, ((0, 0), 0.0))
+        with self.assertRaises(ValueError):
+            packer.pack([(0, 1)])
+        self.assertIsNone(packer.metrics)
+
+    def test_metrics_wide(self):
+        """Metrics of packings beyond C long are computed exactly"""
+        scale = 1 << 70
+        sizes = [(58 * scale, 206), (231 * scale, 176), (35 * scale, 113)]
+        packer = rpack.Packer()
+        pos = packer.pack(sizes)
+        bbox, density = packer.metrics
+        self.assertEqual(bbox, rpack.bbox_size(sizes, pos))
+        self.assertEqual(density, rpack.packing_density(sizes, pos))
+        self.assertEqual(bbox[0] % scale, 0)
+
+    def test_time_limit(self):
+        """Out of time should still give a valid packing"""
+        random.seed(13)
+        sizes = [(random.randint(1, 50), random.randint(1, 50)) for _ in range(40)]
+        positions = rpack.pack(sizes)
+        self.assertEqual(rpack.pack(sizes, time_limit=60), positions)
+        packer = rpack.Packer()
+        for threads in (1, 8):
+            with self.subTest(threads=threads):
+                pos = packer.pack(sizes, threads=threads, time_limit=0)
+                self.assertTrue(packer.stopped_early)
+                self.assertEqual(len(pos), len(sizes))
+                self.assertFalse(rpack.overlapping(sizes, pos))
+        self.assertEqual(packer.pack(sizes), positions)
+        self.assertFalse(packer.stopped_early)
+        # No packing found in time proves nothing about the bounds
+        with self.assertRaises(TimeoutError):
+            rpack.pack([(2, 2)] * 4, max_width=3, max_height=3, time_limit=0)
+
     @unittest.skipIf(
         ctypes.sizeof(ctypes.c_long) < 8,
         "thin-pathology fixture exceeds 32-bit C long area limits",
@@ -697,3 +1089,356 @@ class TestPackOutput(unittest.TestCase):
         small_pos = rpack.pack(small_sizes)
         big_pos = rpack.pack(big_sizes)
         self.assertEqual(big_pos, [(x * scale, y * scale) for x, y in small_pos])
+
+
+# TEST CACHE
+# ==========
+
+
+class TestPackCache(unittest.TestCase):
+    def test_hit_in_any_order(self):
+        rng = random.Random(29)
+        cache = rpack.PackCache()
+        for k in range(20):
+            sizes = [(rng.randint(1, 9), rng.randint(1, 9)) for _ in range(15)]
+            max_width = None if k % 2 else 30
+            expected = rpack.pack(sizes, max_width=max_width, cache=cache)
+            shuffled = list(range(len(sizes)))
+            rng.shuffle(shuffled)
+            sizes = [sizes[i] for i in shuffled]
+            with self.subTest(k=k):
+                self.assertEqual(
+                    rpack.pack(sizes, max_width=max_width, cache=cache),
+                    rpack.pack(sizes, max_width=max_width),
+                )
+                self.assertEqual(
+                    sorted(rpack.pack(sizes, max_width=max_width, cache=cache)),
+                    sorted(expected),
+                )
+        self.assertEqual(cache.stats, rpack.CacheStats(40, 20, 0, 20, 0))
+
+    def test_arguments_are_keys(self):
+        cache = rpack.PackCache()
+        sizes = [(3, 4), (3, 4), (4, 3), (3, 4), (3, 4)]
+        rpack.pack(sizes, cache=cache)
+        rpack.pack(sizes, max_width=9, cache=cache)
+        rpack.pack(sizes, max_height=9, cache=cache)
+        rpack.pack(sizes, tolerance=0.5, cache=cache)
+        rpack.pack(sizes, max_width=-1, cache=cache)
+        self.assertEqual(cache.stats.misses, 4)
+        self.assertEqual(cache.stats.hits, 1)
+
+    def test_eviction(self):
+        cache = rpack.PackCache(maxsize=2)
+        for sizes in ([(1, 1)], [(2, 2)], [(1, 1)], [(3, 3)], [(2, 2)]):
+            rpack.pack(sizes, cache=cache)
+        self.assertEqual(cache.stats, rpack.CacheStats(1, 4, 2, 2, 0))
+        cache.clear()
+        self.assertEqual(cache.stats, rpack.CacheStats(0, 0, 0, 0, 0))
+        with self.assertRaises(ValueError):
+            rpack.PackCache(maxsize=-1)
+
+    def test_results(self):
+        cache = rpack.PackCache()
+        sizes = [(58, 206), (231, 176), (35, 113), (46, 109)]
+        positions = rpack.pack(sizes)
+        bbox = rpack.bbox_size(sizes, positions)
+        density = rpack.packing_density(sizes, positions)
+        rpack.pack(sizes, cache=cache)
+        packer = rpack.Packer()
+        pos = packer.pack(sizes, time_limit=10, stats=True, cache=cache)
+        self.assertEqual(pos, positions)
+        self.assertEqual((packer.stopped_early, packer.stats), (False, None))
+        self.assertEqual(packer.metrics, (bbox, density))
+        out = rpack.pack(_int_buffer(sizes, "i"), cache=cache)
+        self.assertEqual(out.format, "i")
+        self.assertEqual(out.tolist(), [list(p) for p in positions])
+        out = _int_buffer([(0, 0)] * 4, "q")
+        self.assertIs(rpack.Packer().pack(sizes, out=out, cache=cache), out)
+        self.assertEqual(out.tolist(), [list(p) for p in positions])
+
+    def test_invalid_input(self):
+        cache = rpack.PackCache()
+        with self.assertRaises(ValueError):
+            rpack.pack([(0, 1)], cache=cache)
+        with self.assertRaises(TypeError):
+            rpack.pack([(1, 1), (None, 1)], cache=cache)
+        with self.assertRaises(TypeError):
+            rpack.pack([(1, 1)], cache={})
+        with self.assertRaises(rpack.PackingImpossibleError):
+            rpack.pack([(3, 3), (3, 3)], max_width=3, max_height=3, cache=cache)
+        self.assertEqual(cache.stats.size, 0)
+
+    def test_file(self):
+        sizes = [(3, 5), (4, 2), (2, 2)]
+        huge = [(1 << 70, 1), (1 << 70, 1)]
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "cache")
+            with rpack.PackCache(path=path) as cache:
+                positions = rpack.pack(sizes, cache=cache)
+                huge_positions = rpack.pack(huge, cache=cache)
+                self.assertEqual(cache.stats.disk_entries, 1)
+            with rpack.PackCache(maxsize=0, path=path) as cache:
+                self.assertEqual(rpack.pack(sizes[::-1], cache=cache), positions[::-1])
+                self.assertEqual(rpack.pack(huge, cache=cache), huge_positions)
+                self.assertEqual(cache.stats, rpack.CacheStats(1, 1, 0, 0, 1))
+            # Records of other processes are read, torn ones ignored
+            with rpack.PackCache(path=path) as reader:
+                with rpack.PackCache(path=path) as writer:
+                    rpack.pack([(1, 1)], cache=writer)
+                rpack.pack([(1, 1)], cache=reader)
+                self.assertEqual(reader.stats.hits, 1)
+            with open(path, "ab") as fh:
+                fh.write(b"RPCK" + bytes(20))
+            with rpack.PackCache(path=path) as cache:
+                self.assertEqual(cache.stats.disk_entries, 2)
+                rpack.pack([(7, 7)], cache=cache)
+                self.assertEqual(cache.stats.disk_entries, 3)
+            with rpack.PackCache(path=path) as cache:
+                self.assertEqual(rpack.pack([(7, 7)], cache=cache), [(0, 0)])
+                self.assertEqual(cache.stats.hits, 1)
+            # A record still being written is scanned again, the ones
+            # before it are not
+            size = os.path.getsize(path)
+            with open(path, "ab") as fh:
+                fh.write(b"RPCK" + bytes(16) + (5).to_bytes(8, "little") + bytes(8))
+            with rpack.PackCache(path=path) as cache:
+                self.assertEqual(cache._file._scanned, size)
+                rpack.pack([(8, 8)], cache=cache)
+                self.assertEqual(cache.stats.disk_entries, 4)
+            other = os.path.join(tmp, "other")
+            with open(other, "wb") as fh:
+                fh.write(b"not a cache")
+            with self.assertRaises(ValueError):
+                rpack.PackCache(path=other)
+
+
+# TEST ATLAS
+# ==========
+
+
+class TestAtlas(unittest.TestCase):
+    def test_insert_until_full(self):
+        atlas = rpack.Atlas(100, 60)
+        sizes, positions = [], []
+        for _ in range(200):
+            position = atlas.insert(10, 6)
+            if position is None:
+                break
+            sizes.append((10, 6))
+            positions.append(position)
+        self.assertEqual(len(positions), 100)
+        self.assertEqual(len(atlas), 100)
+        self.assertIsNone(rpack.overlapping(sizes, positions))
+        self.assertEqual(rpack.bbox_size(sizes, positions), (100, 60))
+        self.assertIsNone(atlas.insert(1, 1))
+
+    def test_positions_are_kept(self):
+        """Earlier rectangles should not move, also as the page grows"""
+        rng = random.Random(31)
+        atlas = rpack.Atlas(800, 600)
+        sizes, positions = [], []
+        for _ in range(300):
+            size = (rng.randint(1, 80), rng.randint(1, 80))
+            position = atlas.insert(*size)
+            if position is not None:
+                sizes.append(size)
+                positions.append(position)
+                x, y = position
+                self.assertLessEqual(x + size[0], 800)
+                self.assertLessEqual(y + size[1], 600)
+        self.assertGreater(len(positions), 64)
+        self.assertEqual(len(atlas), len(positions))
+        self.assertIsNone(rpack.overlapping(sizes, positions))
+
+    def test_reset(self):
+        atlas = rpack.Atlas(10, 10)
+        self.assertEqual(atlas.insert(10, 10), (0, 0))
+        self.assertIsNone(atlas.insert(1, 1))
+        atlas.reset()
+        self.assertEqual(len(atlas), 0)
+        self.assertEqual(atlas.insert(4, 4), (0, 0))
+        self.assertEqual(atlas.insert(4, 4), (0, 4))
+
+    def test_too_large(self):
+        atlas = rpack.Atlas(10, 20)
+        self.assertEqual((atlas.width, atlas.height), (10, 20))
+        self.assertIsNone(atlas.insert(11, 1))
+        self.assertIsNone(atlas.insert(1, 2**200))
+        self.assertEqual(len(atlas), 0)
+
+    def test_invalid(self):
+        for width, height, error in (
+            (0, 10, ValueError),
+            (10, -1, ValueError),
+            (1.5, 10, TypeError),
+        ):
+            with self.subTest(width=width, height=height):
+                with self.assertRaises(error):
+                    rpack.Atlas(width, height)
+        atlas = rpack.Atlas(10, 10)
+        with self.assertRaises(ValueError):
+            atlas.insert(0, 1)
+        with self.assertRaises(ValueError):
+            atlas.insert(1, -1)
+        with self.assertRaises(TypeError):
+            atlas.insert(1, 2.0)
+
+
+# TEST BINS
+# =========
+
+
+class TestPackBins(unittest.TestCase):
+    def assert_valid(self, sizes, result, bin_width, bin_height):
+        self.assertEqual(len(result), len(sizes))
+        n_bins = max(b for b, _, _ in result) + 1
+        for b in range(n_bins):
+            in_bin = [i for i, (k, _, _) in enumerate(result) if k == b]
+            self.assertTrue(in_bin, f"bin {b} is empty")
+            bin_sizes = [sizes[i] for i in in_bin]
+            positions = [result[i][1:] for i in in_bin]
+            self.assertIsNone(rpack.overlapping(bin_sizes, positions))
+            width, height = rpack.bbox_size(bin_sizes, positions)
+            self.assertLessEqual(width, bin_width)
+            self.assertLessEqual(height, bin_height)
+        return n_bins
+
+    def test_random(self):
+        rng = random.Random(37)
+        for k in range(10):
+            sizes = [(rng.randint(1, 40), rng.randint(1, 40)) for _ in range(100)]
+            bin_width, bin_height = rng.randint(40, 120), rng.randint(40, 120)
+            with self.subTest(k=k):
+                result = rpack.pack_bins(sizes, bin_width, bin_height)
+                n_bins = self.assert_valid(sizes, result, bin_width, bin_height)
+                area = sum(w * h for w, h in sizes)
+                self.assertGreaterEqual(n_bins * bin_width * bin_height, area)
+
+    def test_squares(self):
+        result = rpack.pack_bins([(50, 50)] * 10, 100, 100)
+        self.assertEqual(self.assert_valid([(50, 50)] * 10, result, 100, 100), 3)
+
+    def test_fits_one_bin(self):
+        sizes = [(58, 206), (231, 176), (35, 113), (46, 109)]
+        result = rpack.pack_bins(sizes, 1000, 1000)
+        self.assertEqual({b for b, _, _ in result}, {0})
+        self.assert_valid(sizes, result, 1000, 1000)
+
+    def test_buffer(self):
+        sizes = [(3, 5), (7, 2), (4, 4), (6, 6)]
+        for typecode in ("i", "q"):
+            with self.subTest(typecode=typecode):
+                self.assertEqual(
+                    rpack.pack_bins(_int_buffer(sizes, typecode), 8, 8),
+                    rpack.pack_bins(sizes, 8, 8),
+                )
+
+    def test_empty(self):
+        self.assertEqual(rpack.pack_bins([], 10, 10), [])
+
+    def test_invalid(self):
+        with self.assertRaises(rpack.PackingImpossibleError):
+            rpack.pack_bins([(5, 5), (11, 1)], 10, 10)
+        with self.assertRaises(rpack.PackingImpossibleError):
+            rpack.pack_bins([(5, 11)], 10, 10)
+        with self.assertRaises(ValueError):
+            rpack.pack_bins([(0, 5)], 10, 10)
+        with self.assertRaises(ValueError):
+            rpack.pack_bins([(5, 5)], 0, 10)
+        with self.assertRaises(TypeError):
+            rpack.pack_bins([(5, 5)], 10, 10.0)
+
+
+# TEST COMMAND LINE
+# =================
+
+_CLI = os.path.join(os.path.dirname(__file__), os.pardir, "bin", "rpack")
+
+
+@unittest.skipUnless(os.path.exists(_CLI), "bin/rpack not built, see Makefile")
+class TestCommandLine(unittest.TestCase):
+    """Test the native command-line packer"""
+
+    def run_cli(self, data, *args):
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "sizes")
+            output = os.path.join(tmp, "positions")
+            with open(path, "wb") as fh:
+                fh.write(data)
+            completed = subprocess.run(
+                [_CLI, "-o", output, *args, path],
+                capture_output=True,
+                text=True,
+                timeout=30.0,
+            )
+            positions = None
+            if completed.returncode == 0:
+                with open(output, "rb") as fh:
+                    positions = fh.read()
+        return completed, positions
+
+    def test_same_result(self):
+        """Binary and text input should give the pack() result"""
+        random.seed(3)
+        sizes = [(random.randint(1, 40), random.randint(1, 40)) for _ in range(30)]
+        expected = rpack.pack(sizes)
+        flat = [v for p in expected for v in p]
+        values = [v for size in sizes for v in size]
+        text = "".join(f"{w} {h}\n" for w, h in sizes).encode()
+        for data, typecode, args in (
+            (array.array("i", values).tobytes(), "i", ["-f", "i32"]),
+            (array.array("q", values).tobytes(), "q", ["-f", "i64", "-j", "4"]),
+            (text, "q", []),
+        ):
+            with self.subTest(args=args):
+                completed, positions = self.run_cli(data, *args)
+                self.assertEqual(completed.returncode, 0, completed.stderr)
+                self.assertEqual(array.array(typecode, positions).tolist(), flat)
+                width, height = rpack.bbox_size(sizes, expected)
+                self.assertIn(f"bbox: {width} {height}\n", completed.stdout)
+
+    def test_empty(self):
+        """An empty input should give an empty packing"""
+        completed, positions = self.run_cli(b"")
+        self.assertEqual(completed.returncode, 0, completed.stderr)
+        self.assertEqual(positions, b"")
+        self.assertIn("bbox: 0 0\n", completed.stdout)
+        self.assertIn("density: 0.000000\n", completed.stdout)
+
+    def test_time_limit(self):
+        """Out of time should still write a packing"""
+        completed, positions = self.run_cli(b"3 3\n2 2\n2 1\n", "-t", "0")
+        self.assertEqual(completed.returncode, 0, completed.stderr)
+        self.assertIn("stopped early\n", completed.stdout)
+        self.assertEqual(len(positions), 3 * 2 * 8)
+
+    def test_stats(self):
+        """Counters should be printed on request"""
+        completed, _ = self.run_cli(b"3 3\n2 2\n2 1\n", "-s")
+        self.assertEqual(completed.returncode, 0, completed.stderr)
+        self.assertIn("try_packs: ", completed.stdout)
+        self.assertIn("placed: ", completed.stdout)
+
+    def test_errors(self):
+        """Bad input should fail with a message"""
+        for data, args, message in (
+            (b"3 3\n0 2\n", [], "rectangle 2: Rectangle width must be positive"),
+            (b"3 3\n2\n", [], "pair 2: expected width and height"),
+            (b"3 3\n", ["-W", "2"], "max_width less than widest rectangle"),
+            (b"\x01\x00\x00", ["-f", "i32"], "not a multiple of 8 bytes"),
+            (
+                array.array("i", [3, 3, -5, 2]).tobytes(),
+                ["-f", "i32"],
+                "rectangle 2: Rectangle width must be positive",
+            ),
+            (
+                array.array("q", [3, -1]).tobytes(),
+                ["-f", "i64"],
+                "rectangle 1: Rectangle height must be positive",
+            ),
+        ):
+            with self.subTest(message=message):
+                completed, _ = self.run_cli(data, *args)
+                self.assertEqual(completed.returncode, 1)
+                self.assertIn(message, completed.stderr)